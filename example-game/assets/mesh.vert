@@ -3,20 +3,28 @@
 #extension GL_GOOGLE_include_directive : enable
 #include "scene.glsl"
 
+#ifdef SKINNED
 layout(set=2, binding=0) uniform PerSkinnedObject
 {
 	mat4 u_bone_matrices[64];
 };
+#else
+layout(set=2, binding=0) uniform PerObject
+{
+	mat4 u_model_matrix;
+};
+#endif
 
+// Packed vertex layout, see vertex_packing in mesh-ops.h
 layout(location = 0) in vec3 v_position;
 layout(location = 1) in vec3 v_color;
-layout(location = 2) in vec3 v_normal;
+layout(location = 2) in vec2 v_normal;     // Octahedral encoded
 layout(location = 3) in vec2 v_texcoord;
-layout(location = 4) in vec3 v_tangent;
-layout(location = 5) in vec3 v_bitangent;
-
+layout(location = 4) in vec4 v_tangent;    // Octahedral encoded in xy, sign of bitangent in w
+#ifdef SKINNED
 layout(location = 6) in uvec4 v_bone_indices;
 layout(location = 7) in vec4 v_bone_weights;
+#endif
 
 layout(location = 0) out vec3 position;
 layout(location = 1) out vec3 color;
@@ -26,17 +34,29 @@ layout(location = 4) out vec3 tangent;
 layout(location = 5) out vec3 bitangent;
 out gl_PerVertex { vec4 gl_Position; };
 
+vec3 decode_octahedral(vec2 e)
+{
+    vec3 v = vec3(e, 1 - abs(e.x) - abs(e.y));
+    if(v.z < 0) v.xy = (1 - abs(v.yx)) * vec2(v.x < 0 ? -1 : 1, v.y < 0 ? -1 : 1);
+    return normalize(v);
+}
+
 void main()
 {
+#ifdef SKINNED
     mat4 model_matrix = u_bone_matrices[v_bone_indices.x] * v_bone_weights.x
 		        	  + u_bone_matrices[v_bone_indices.y] * v_bone_weights.y
 					  + u_bone_matrices[v_bone_indices.z] * v_bone_weights.z
 					  + u_bone_matrices[v_bone_indices.w] * v_bone_weights.w;
+#else
+	mat4 model_matrix = u_model_matrix;
+#endif
 	position = (model_matrix * vec4(v_position, 1)).xyz;
 	color = v_color;
-	normal = normalize((model_matrix * vec4(v_normal, 0)).xyz);
+    vec3 v_normal_vec = decode_octahedral(v_normal), v_tangent_vec = decode_octahedral(v_tangent.xy);
+	normal = normalize((model_matrix * vec4(v_normal_vec, 0)).xyz);
     texcoord = v_texcoord;
-	tangent = normalize((model_matrix * vec4(v_tangent, 0)).xyz);
-    bitangent = normalize((model_matrix * vec4(v_bitangent, 0)).xyz);
+	tangent = normalize((model_matrix * vec4(v_tangent_vec, 0)).xyz);
+    bitangent = normalize((model_matrix * vec4(cross(v_normal_vec, v_tangent_vec) * v_tangent.w, 0)).xyz);
     gl_Position = u_view_proj_matrix * vec4(position, 1);	
 }
\ No newline at end of file
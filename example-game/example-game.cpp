@@ -1,5 +1,6 @@
 #include "renderer.h"
 #include "load.h"
+#include "asset-loader.h"
 #include "fbx.h"
 #include <iostream>
 #include <chrono>
@@ -61,26 +62,48 @@ int main() try
     constexpr coord_system vk_coords {coord_axis::right, coord_axis::down, coord_axis::forward};
     constexpr coord_system cubemap_coords {coord_axis::right, coord_axis::up, coord_axis::back};
 
-    renderer r {[](const char * message) { std::cerr << "validation layer: " << message << std::endl; }};
+    renderer r {[](const char * message) { std::cerr << "validation layer: " << message << std::endl; }, "shader-cache", true, "pipeline-cache.bin"};
+
+    // Begin decoding our images and meshes in the background, with images decoded straight into staging memory
+    asset_loader loader {r.get_shader_compiler()};
+    auto load_staged_image = [&](const char * filename) { return loader.submit(0, [&r, filename]() { return r.load_staged_image(filename, true); }); };
+    auto helmet_albedo_img = load_staged_image("assets/helmet-albedo.jpg");
+    auto helmet_normal_img = load_staged_image("assets/helmet-normal.jpg");
+    auto helmet_metallic_img = load_staged_image("assets/helmet-metallic.jpg");
+    auto mutant_albedo_img = load_staged_image("assets/mutant-albedo.jpg");
+    auto mutant_normal_img = load_staged_image("assets/mutant-normal.jpg");
+    auto akai_albedo_img = load_staged_image("assets/akai-albedo.jpg");
+    auto akai_normal_img = load_staged_image("assets/akai-normal.jpg");
+    auto map_2_island_img = load_staged_image("assets/map_2_island.jpg");
+    auto map_2_objects_img = load_staged_image("assets/map_2_objects.jpg");
+    auto map_2_terrain_img = load_staged_image("assets/map_2_terrain.jpg");
+    asset_handle<staged_image> env_imgs[] {
+        load_staged_image("assets/posx.jpg"), load_staged_image("assets/negx.jpg"), 
+        load_staged_image("assets/posy.jpg"), load_staged_image("assets/negy.jpg"),
+        load_staged_image("assets/posz.jpg"), load_staged_image("assets/negz.jpg")};
+    auto helmet_fbx = loader.load_meshes_from_fbx(game_coords, "assets/helmet-mesh.fbx");
+    auto mutant_fbx = loader.load_meshes_from_fbx(game_coords, "assets/mutant-mesh.fbx");
+    auto box_fbx = loader.load_meshes_from_fbx(game_coords, "assets/cube-mesh.fbx");
+    auto sands_obj = loader.load_mesh_from_obj(game_coords, "assets/sands location.obj");
 
     // Create our textures
     auto black_tex = r.create_texture_2d(generate_single_color_image({0,0,0,255}));
     auto gray_tex = r.create_texture_2d(generate_single_color_image({128,128,128,255}));
     auto flat_tex = r.create_texture_2d(generate_single_color_image({128,128,255,255}));
-    auto helmet_albedo = r.create_texture_2d(load_image("assets/helmet-albedo.jpg", true));
-    auto helmet_normal = r.create_texture_2d(load_image("assets/helmet-normal.jpg", true));
-    auto helmet_metallic = r.create_texture_2d(load_image("assets/helmet-metallic.jpg", true));
-    auto mutant_albedo = r.create_texture_2d(load_image("assets/mutant-albedo.jpg", true));
-    auto mutant_normal = r.create_texture_2d(load_image("assets/mutant-normal.jpg", true));
-    auto akai_albedo = r.create_texture_2d(load_image("assets/akai-albedo.jpg", true));
-    auto akai_normal = r.create_texture_2d(load_image("assets/akai-normal.jpg", true));
-    auto map_2_island = r.create_texture_2d(load_image("assets/map_2_island.jpg", true));
-    auto map_2_objects = r.create_texture_2d(load_image("assets/map_2_objects.jpg", true));
-    auto map_2_terrain = r.create_texture_2d(load_image("assets/map_2_terrain.jpg", true));
+    auto helmet_albedo = r.create_texture_2d(helmet_albedo_img.get());
+    auto helmet_normal = r.create_texture_2d(helmet_normal_img.get());
+    auto helmet_metallic = r.create_texture_2d(helmet_metallic_img.get());
+    auto mutant_albedo = r.create_texture_2d(mutant_albedo_img.get());
+    auto mutant_normal = r.create_texture_2d(mutant_normal_img.get());
+    auto akai_albedo = r.create_texture_2d(akai_albedo_img.get());
+    auto akai_normal = r.create_texture_2d(akai_normal_img.get());
+    auto map_2_island = r.create_texture_2d(map_2_island_img.get());
+    auto map_2_objects = r.create_texture_2d(map_2_objects_img.get());
+    auto map_2_terrain = r.create_texture_2d(map_2_terrain_img.get());
     auto env_tex = r.create_texture_cube(
-        load_image("assets/posx.jpg", true), load_image("assets/negx.jpg", true), 
-        load_image("assets/posy.jpg", true), load_image("assets/negy.jpg", true),
-        load_image("assets/posz.jpg", true), load_image("assets/negz.jpg", true));
+        env_imgs[0].get(), env_imgs[1].get(), 
+        env_imgs[2].get(), env_imgs[3].get(),
+        env_imgs[4].get(), env_imgs[5].get());
 
     // Create our sampler
     VkSamplerCreateInfo sampler_info = {VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
@@ -92,11 +115,12 @@ int main() try
     sampler sampler {r.ctx, sampler_info};
 
     // Create our meshes
-    gfx_mesh helmet_mesh {r.ctx, load_meshes_from_fbx(game_coords, "assets/helmet-mesh.fbx")[0]};
-    gfx_mesh mutant_mesh {r.ctx, load_meshes_from_fbx(game_coords, "assets/mutant-mesh.fbx")[0]};
-    gfx_mesh skybox_mesh {r.ctx, invert_faces(generate_box_mesh({-10,-10,-10}, {10,10,10}))};
-    gfx_mesh box_mesh {r.ctx, load_meshes_from_fbx(game_coords, "assets/cube-mesh.fbx")[0]};
-    gfx_mesh sands_mesh {r.ctx, load_mesh_from_obj(game_coords, "assets/sands location.obj")};
+    const vertex_packing static_packing {true, false, false}, skinned_packing {true, true, false};
+    gfx_mesh helmet_mesh {r.ctx, helmet_fbx.get()[0], static_packing};
+    gfx_mesh mutant_mesh {r.ctx, mutant_fbx.get()[0], skinned_packing};
+    gfx_mesh skybox_mesh {r.ctx, invert_faces(generate_box_mesh({-10,-10,-10}, {10,10,10})), static_packing};
+    gfx_mesh box_mesh {r.ctx, box_fbx.get()[0], static_packing};
+    gfx_mesh sands_mesh {r.ctx, sands_obj.get(), static_packing, {true, 0}};
 
     // Set up scene contract
     auto render_pass = r.create_render_pass(
@@ -112,28 +136,22 @@ int main() try
     }});
     
     // Set up our shader pipeline
-    auto static_vert_shader = r.create_shader(VK_SHADER_STAGE_VERTEX_BIT, "assets/static.vert");
-    auto skinned_vert_shader = r.create_shader(VK_SHADER_STAGE_VERTEX_BIT, "assets/skinned.vert");
-    auto frag_shader = r.create_shader(VK_SHADER_STAGE_FRAGMENT_BIT, "assets/shader.frag");
-    auto metal_shader = r.create_shader(VK_SHADER_STAGE_FRAGMENT_BIT, "assets/metal.frag");
-    auto skybox_vert_shader = r.create_shader(VK_SHADER_STAGE_VERTEX_BIT, "assets/skybox.vert");
-    auto skybox_frag_shader = r.create_shader(VK_SHADER_STAGE_FRAGMENT_BIT, "assets/skybox.frag");
-
-    auto mesh_vertex_format = r.create_vertex_format({{0, sizeof(mesh::vertex), VK_VERTEX_INPUT_RATE_VERTEX}}, {
-        {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(mesh::vertex, position)}, 
-        {1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(mesh::vertex, color)},
-        {2, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(mesh::vertex, normal)},
-        {3, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(mesh::vertex, texcoord)},
-        {4, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(mesh::vertex, tangent)},
-        {5, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(mesh::vertex, bitangent)},
-        {6, 0, VK_FORMAT_R32G32B32A32_UINT, offsetof(mesh::vertex, bone_indices)},
-        {7, 0, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(mesh::vertex, bone_weights)}
+    auto mesh_vert_shaders = r.create_shader_permutations(VK_SHADER_STAGE_VERTEX_BIT, "assets/mesh.vert", {{"", "SKINNED"}});
+    auto mesh_frag_shaders = r.create_shader_permutations(VK_SHADER_STAGE_FRAGMENT_BIT, "assets/mesh.frag", {{"", "METAL"}});
+    auto shaders = r.create_shaders({
+        {VK_SHADER_STAGE_VERTEX_BIT, "assets/skybox.vert"},
+        {VK_SHADER_STAGE_FRAGMENT_BIT, "assets/skybox.frag"}
     });
+    auto static_vert_shader = mesh_vert_shaders.get({}), skinned_vert_shader = mesh_vert_shaders.get({"SKINNED"});
+    auto frag_shader = mesh_frag_shaders.get({}), metal_shader = mesh_frag_shaders.get({"METAL"});
+    auto skybox_vert_shader = shaders[0], skybox_frag_shader = shaders[1];
 
-    auto helmet_pipeline  = r.create_material(contract, mesh_vertex_format, {static_vert_shader, metal_shader}, true, true, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO);
-    auto static_pipeline  = r.create_material(contract, mesh_vertex_format, {static_vert_shader, frag_shader}, true, true, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO);
-    auto skinned_pipeline = r.create_material(contract, mesh_vertex_format, {skinned_vert_shader, frag_shader}, true, true, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO);
-    auto skybox_pipeline  = r.create_material(contract, mesh_vertex_format, {skybox_vert_shader, skybox_frag_shader}, false, false, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO);
+    auto static_vertex_format = r.create_vertex_format(static_packing), skinned_vertex_format = r.create_vertex_format(skinned_packing);
+
+    auto helmet_pipeline  = r.create_material(contract, static_vertex_format, {static_vert_shader, metal_shader}, true, true, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO);
+    auto static_pipeline  = r.create_material(contract, static_vertex_format, {static_vert_shader, frag_shader}, true, true, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO);
+    auto skinned_pipeline = r.create_material(contract, skinned_vertex_format, {skinned_vert_shader, frag_shader}, true, true, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO);
+    auto skybox_pipeline  = r.create_material(contract, static_vertex_format, {skybox_vert_shader, skybox_frag_shader}, false, false, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO);
 
     // Set up a window with swapchain framebuffers
     window win {r.ctx, {1280, 720}, "Example Game"};
@@ -191,6 +209,7 @@ int main() try
         
         // Determine matrices
         const auto proj_matrix = linalg::perspective_matrix(1.0f, win.get_aspect(), 1.0f, 1000.0f, linalg::pos_z, linalg::zero_to_one) * make_transform_4x4(game_coords, vk_coords);        
+        const auto view_proj_matrix = proj_matrix * camera.get_view_matrix(game_coords);
 
         // Render a frame
         auto & pool = pools[frame_index];
@@ -238,17 +257,18 @@ int main() try
             box.write_combined_image_sampler(3, 0, sampler, *black_tex);
             list.draw(box, box_mesh);
         
+            const float4x4 sands_matrix = translation_matrix(float3{0,27,-64}) * scaling_matrix(float3{10,10,10});
             for(size_t i=0; i<sands_mesh.m.materials.size(); ++i)
             {
                 auto sands = list.descriptor_set(*static_pipeline);
-                sands.write_uniform_buffer(0, 0, pool.write_data(per_static_object{translation_matrix(float3{0,27,-64}) * scaling_matrix(float3{10,10,10})}));
+                sands.write_uniform_buffer(0, 0, pool.write_data(per_static_object{sands_matrix}));
                 if(sands_mesh.m.materials[i].name == "map_2_island1") sands.write_combined_image_sampler(1, 0, sampler, *map_2_island);
                 else if(sands_mesh.m.materials[i].name == "map_2_object1") sands.write_combined_image_sampler(1, 0, sampler, *map_2_objects);
                 else if(sands_mesh.m.materials[i].name == "map_2_terrain1") sands.write_combined_image_sampler(1, 0, sampler, *map_2_terrain);
                 else sands.write_combined_image_sampler(1, 0, sampler, *gray_tex);
                 sands.write_combined_image_sampler(2, 0, sampler, *flat_tex);
                 sands.write_combined_image_sampler(3, 0, sampler, *black_tex);
-                list.draw(sands, sands_mesh, {i});
+                list.draw(sands, sands_mesh, {i}, view_proj_matrix, sands_matrix, camera.position);
             }
         }
 
@@ -260,7 +280,7 @@ int main() try
         ps.light_color = {0.8f,0.7f,0.5f};
 
         per_view_uniforms pv;
-        pv.view_proj_matrix = proj_matrix * camera.get_view_matrix(game_coords);
+        pv.view_proj_matrix = view_proj_matrix;
         pv.rotation_only_view_proj_matrix = proj_matrix * inverse(pose_matrix(camera.get_orientation(game_coords), float3{0,0,0}));
         pv.eye_position = camera.position;
 
@@ -154,6 +154,7 @@ GLuint load_gl_texture(const char * filename)
 }
 
 #include "load.h"
+#include "mesh-ops.h"
 
 int main() try
 {
@@ -214,7 +215,9 @@ int main() try
     int env_index = 0;
 
     constexpr coord_system coords {coord_axis::right, coord_axis::down, coord_axis::forward};
-    const auto helmet_fbx = load_meshes_from_fbx(coords, "../example-game/assets/helmet-mesh.fbx");
+    std::vector<mesh_optimization_stats> helmet_stats;
+    const auto helmet_fbx = load_meshes_from_fbx(coords, "../example-game/assets/helmet-mesh.fbx", &helmet_stats);
+    for(auto & s : helmet_stats) std::cout << "Optimized helmet-mesh.fbx: ACMR " << s.before.acmr << " -> " << s.after.acmr << ", ATVR " << s.before.atvr << " -> " << s.after.atvr << std::endl;
     GLuint tex_albedo = load_gl_texture("../example-game/assets/helmet-albedo.jpg");
     GLuint tex_normal = load_gl_texture("../example-game/assets/helmet-normal.jpg");
     GLuint tex_metallic = load_gl_texture("../example-game/assets/helmet-metallic.jpg");
@@ -44,7 +44,7 @@ int main() try
     const font_face font {sprites, "C:/windows/fonts/arial.ttf", 32.0f};
     sprites.prepare_sheet();
 
-    renderer r {[](const char * message) { std::cerr << "validation layer: " << message << std::endl; }}; 
+    renderer r {[](const char * message) { std::cerr << "validation layer: " << message << std::endl; }, "shader-cache", true, "pipeline-cache.bin"}; 
     sprites.texture = r.create_texture_2d(sprites.sheet);
 
     // Create our sampler
@@ -97,13 +97,16 @@ int main() try
     std::vector<uint3> quad_tris {{0,1,2},{0,2,3}};
     gfx_mesh quad_mesh {r.ctx, quad_verts, quad_tris};
 
-    auto image_vert_shader = r.create_shader(VK_SHADER_STAGE_VERTEX_BIT, "assets/image.vert");
-    auto image_frag_shader = r.create_shader(VK_SHADER_STAGE_FRAGMENT_BIT, "assets/image.frag");
-    auto hipass_frag_shader = r.create_shader(VK_SHADER_STAGE_FRAGMENT_BIT, "assets/hipass.frag");
-    auto hgauss_frag_shader = r.create_shader(VK_SHADER_STAGE_FRAGMENT_BIT, "assets/hgauss.frag");
-    auto vgauss_frag_shader = r.create_shader(VK_SHADER_STAGE_FRAGMENT_BIT, "assets/vgauss.frag");
-    auto add_frag_shader = r.create_shader(VK_SHADER_STAGE_FRAGMENT_BIT, "assets/add.frag");
-    auto sample_frag_shader = r.create_shader(VK_SHADER_STAGE_FRAGMENT_BIT, "assets/sample.frag");
+    auto shaders = r.create_shaders({
+        {VK_SHADER_STAGE_VERTEX_BIT, "assets/image.vert"},
+        {VK_SHADER_STAGE_FRAGMENT_BIT, "assets/image.frag"},
+        {VK_SHADER_STAGE_FRAGMENT_BIT, "assets/hipass.frag"},
+        {VK_SHADER_STAGE_FRAGMENT_BIT, "assets/hgauss.frag"},
+        {VK_SHADER_STAGE_FRAGMENT_BIT, "assets/vgauss.frag"},
+        {VK_SHADER_STAGE_FRAGMENT_BIT, "assets/add.frag"},
+        {VK_SHADER_STAGE_FRAGMENT_BIT, "assets/sample.frag"}
+    });
+    auto image_vert_shader = shaders[0], image_frag_shader = shaders[1], hipass_frag_shader = shaders[2], hgauss_frag_shader = shaders[3], vgauss_frag_shader = shaders[4], add_frag_shader = shaders[5], sample_frag_shader = shaders[6];
     
     auto image_mtl = r.create_material(post_contract, image_vertex_format, {image_vert_shader, image_frag_shader}, false, false, VK_BLEND_FACTOR_SRC_ALPHA, VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA);
     auto hipass_mtl = r.create_material(post_contract, image_vertex_format, {image_vert_shader, hipass_frag_shader}, false, false, VK_BLEND_FACTOR_ONE, VK_BLEND_FACTOR_ZERO);
@@ -208,8 +211,14 @@ int main() try
         ps.ambient_light = {0.01f,0.01f,0.01f};
         ps.light_direction = normalize(float3{1,-2,5});
         ps.light_color = {0.9f,0.9f,0.9f};
+        game::per_view_uniforms pv;
+        pv.view_proj_matrix = proj_matrix * camera.get_view_matrix(game::coords);
+        pv.eye_position = camera.position;
+        pv.eye_x_axis = qrot(camera.get_orientation(game::coords), game::coords.get_right());
+        pv.eye_y_axis = qrot(camera.get_orientation(game::coords), game::coords.get_down());
+
         draw_list list {pool, *contract};
-        game::draw(list, ps, res, g);
+        game::draw(list, ps, pv, res, g);
 
         draw_list gui_list {pool, *post_contract};
         gui_context gui {gs, gui_list, win.get_dims()};
@@ -224,12 +233,6 @@ int main() try
         gui.end_frame(*image_mtl, image_sampler);
 
         // Set up per-scene and per-view descriptor sets
-        game::per_view_uniforms pv;
-        pv.view_proj_matrix = proj_matrix * camera.get_view_matrix(game::coords);
-        pv.eye_position = camera.position;
-        pv.eye_x_axis = qrot(camera.get_orientation(game::coords), game::coords.get_right());
-        pv.eye_y_axis = qrot(camera.get_orientation(game::coords), game::coords.get_down());
-
         auto per_scene = list.shared_descriptor_set(0);
         per_scene.write_uniform_buffer(0, 0, list.upload_uniforms(ps));      
         per_scene.write_combined_image_sampler(1, 0, shadow_sampler, shadowmap.get_image_view(), VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
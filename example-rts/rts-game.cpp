@@ -179,6 +179,7 @@ std::ostream & operator << (std::ostream & out, shader_info::scalar_type s)
     case shader_info::uint_: return out << "uint";
     case shader_info::float_: return out << "float";
     case shader_info::double_: return out << "double";
+    case shader_info::bool_: return out << "bool";
     default: return out << "???";
     }
 }
@@ -233,8 +234,8 @@ game::resources::resources(renderer & r, std::shared_ptr<scene_contract> contrac
 {
     // Load meshes
     terrain_mesh = std::make_shared<gfx_mesh>(r.ctx, generate_box_mesh({0,0,-20}, {64,64,0}));
-    unit0_mesh = std::make_shared<gfx_mesh>(r.ctx, transform(scaling_matrix(float3{0.1f}), load_mesh_from_obj(game::coords, "assets/f44a.obj")));
-    unit1_mesh = std::make_shared<gfx_mesh>(r.ctx, transform(scaling_matrix(float3{0.1f}), load_mesh_from_obj(game::coords, "assets/cf105.obj")));
+    unit0_mesh = std::make_shared<gfx_mesh>(r.ctx, transform(scaling_matrix(float3{0.1f}), load_mesh_from_obj(game::coords, "assets/f44a.obj")), gfx_mesh_options{false, 3});
+    unit1_mesh = std::make_shared<gfx_mesh>(r.ctx, transform(scaling_matrix(float3{0.1f}), load_mesh_from_obj(game::coords, "assets/cf105.obj")), gfx_mesh_options{false, 3});
     bullet_mesh = std::make_shared<gfx_mesh>(r.ctx, apply_vertex_color(generate_box_mesh({-0.05f,-0.1f,-0.05f},{+0.05f,+0.1f,0.05f}), {2,2,2}));
     const particle_vertex particle_vertices[] {{{-0.5f,-0.5f}, {0,0}}, {{-0.5f,+0.5f}, {0,1}}, {{+0.5f,+0.5f}, {1,1}}, {{+0.5f,-0.5f}, {1,0}}};
     const uint32_t particle_indices[] {0, 1, 2, 0, 2, 3};
@@ -297,7 +298,7 @@ game::resources::resources(renderer & r, std::shared_ptr<scene_contract> contrac
 // game::draw(...) //
 /////////////////////
 
-void game::draw(draw_list & list, per_scene_uniforms & ps, const resources & r, const state & s)
+void game::draw(draw_list & list, per_scene_uniforms & ps, const per_view_uniforms & pv, const resources & r, const state & s)
 {
     {
         auto descriptors = list.descriptor_set(*r.standard_mtl);
@@ -316,7 +317,7 @@ void game::draw(draw_list & list, per_scene_uniforms & ps, const resources & r,
         auto descriptors = list.descriptor_set(*r.standard_mtl);
         descriptors.write_uniform_buffer(0, 0, list.upload_uniforms(per_static_object{u.get_model_matrix(), game::team_colors[u.owner]*std::max(u.cooldown*4-1.5f,0.0f)}));
         descriptors.write_combined_image_sampler(1, 0, *r.linear_sampler, u.owner ? *r.unit1_tex : *r.unit0_tex);
-        list.draw(descriptors, u.owner ? *r.unit1_mesh : *r.unit0_mesh);
+        list.draw(descriptors, u.owner ? *r.unit1_mesh : *r.unit0_mesh, pv.view_proj_matrix, u.get_model_matrix());
     }
 
     for(auto & b : s.bullets)
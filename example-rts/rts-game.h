@@ -117,7 +117,8 @@ namespace game
         alignas(16) float3 emissive_mtl;
     };
 
-    void draw(draw_list & list, per_scene_uniforms & ps, const resources & r, const state & s);
+    // Units are drawn at the level of detail needed by the given view, but are not culled, so that the same list can be drawn into the shadow map
+    void draw(draw_list & list, per_scene_uniforms & ps, const per_view_uniforms & pv, const resources & r, const state & s);
 }
 
 #endif
\ No newline at end of file
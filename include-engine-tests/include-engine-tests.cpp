@@ -1,6 +1,23 @@
 #include "linalg.h"
 using namespace linalg::aliases;
 
+#include "image-ops.h"
+#include "mesh-ops.h"
+#include "load.h"
+#include "fbx.h"
+#include "package.h"
+#include "texture-cooker.h"
+#include "asset-loader.h"
+#include <random>
+#include <array>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <filesystem>
+#include <sstream>
+#include <cstring>
+
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
 
@@ -76,4 +93,1692 @@ TEST_CASE("transform functions", "[transform]")
     test_transform(float4x4{{0,1,0,0},{0,0,1,0},{1,0,0,0},{0,0,0,1}}, true, true); // rotation
     test_transform(float4x4{{-1,0,0,0},{0,1,0,0},{0,0,1,0},{0,0,0,1}}, true, true); // mirror
 }
-*/
\ No newline at end of file
+*/
+
+///////////////
+// image-ops //
+///////////////
+
+const VkFormat image_op_formats[]
+{
+    VK_FORMAT_R8_UNORM, VK_FORMAT_R8G8_SRGB, VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_B8G8R8_SRGB, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_B8G8R8A8_UNORM, 
+    VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT
+};
+
+// Produces an image of the given format whose channels hold uniformly distributed values in [0,1]
+image make_random_image(int2 dims, VkFormat format, std::mt19937 & engine)
+{
+    image im {dims, VK_FORMAT_R32G32B32A32_SFLOAT};
+    std::uniform_real_distribution<float> dist {0, 1};
+    for(size_t i=0, n=product(dims)*4; i<n; ++i) reinterpret_cast<float *>(im.get_pixels())[i] = dist(engine);
+    return reference::convert_image(im, format);
+}
+
+// Compares two images in linear space, allowing for one step of 8 bit quantization (about 0.01 for sRGB channels near one) or for the precision of half floats
+void require_images_match(const image & a, const image & b)
+{
+    REQUIRE(a.get_format() == b.get_format());
+    REQUIRE(a.get_width() == b.get_width());
+    REQUIRE(a.get_height() == b.get_height());
+
+    const VkFormat format = a.get_format();
+    const bool is_srgb = format == VK_FORMAT_R8_SRGB || format == VK_FORMAT_R8G8_SRGB || format == VK_FORMAT_R8G8B8_SRGB || format == VK_FORMAT_B8G8R8_SRGB || format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_B8G8R8A8_SRGB;
+    const float margin = is_srgb ? 0.01f : format < VK_FORMAT_R16_SFLOAT ? 1.01f/255 : format < VK_FORMAT_R32_SFLOAT ? 2e-3f : 1e-4f;
+    const image fa = reference::convert_image(a, VK_FORMAT_R32G32B32A32_SFLOAT), fb = reference::convert_image(b, VK_FORMAT_R32G32B32A32_SFLOAT);
+    for(size_t i=0, n=size_t(a.get_width())*a.get_height()*4; i<n; ++i) REQUIRE(reinterpret_cast<const float *>(fa.get_pixels())[i] == Approx(reinterpret_cast<const float *>(fb.get_pixels())[i]).margin(margin));
+}
+
+TEST_CASE("convert_image matches its reference implementation", "[image-ops]")
+{
+    std::mt19937 engine;
+    for(auto src : image_op_formats)
+    {
+        const image im = make_random_image({37,5}, src, engine);
+        for(auto dst : image_op_formats) require_images_match(convert_image(im, dst), reference::convert_image(im, dst));
+    }
+}
+
+TEST_CASE("convert_image round trips 8 bit sRGB values exactly", "[image-ops]")
+{
+    image im {{256,1}, VK_FORMAT_R8G8B8A8_SRGB};
+    for(int i=0; i<256*4; ++i) reinterpret_cast<uint8_t *>(im.get_pixels())[i] = static_cast<uint8_t>(i/4);
+    for(auto linear_format : {VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT})
+    {
+        const image round_trip = convert_image(convert_image(im, linear_format), VK_FORMAT_R8G8B8A8_SRGB);
+        REQUIRE(memcmp(round_trip.get_pixels(), im.get_pixels(), 256*4) == 0);
+    }
+}
+
+TEST_CASE("downsample_image matches its reference implementation", "[image-ops]")
+{
+    std::mt19937 engine;
+    for(auto format : image_op_formats)
+    {
+        for(int2 dims : {int2{16,16}, int2{37,20}, int2{5,1}, int2{1,1}})
+        {
+            const image im = make_random_image(dims, format, engine);
+            for(auto filter : {downsample_filter::box, downsample_filter::kaiser}) require_images_match(downsample_image(im, filter), reference::downsample_image(im, filter));
+        }
+    }
+}
+
+TEST_CASE("downsample_image preserves solid colors", "[image-ops]")
+{
+    image im {{9,6}, VK_FORMAT_R8G8B8A8_SRGB};
+    for(int i=0; i<9*6; ++i) memcpy(im.get_pixels() + i*4, "\x20\x80\xC0\xFF", 4);
+    for(auto filter : {downsample_filter::box, downsample_filter::kaiser})
+    {
+        const image result = downsample_image(im, filter);
+        REQUIRE(result.get_width() == 4);
+        REQUIRE(result.get_height() == 3);
+        for(int i=0; i<4*3; ++i) REQUIRE(memcmp(result.get_pixels() + i*4, "\x20\x80\xC0\xFF", 4) == 0);
+    }
+}
+
+TEST_CASE("premultiply_alpha matches its reference implementation", "[image-ops]")
+{
+    std::mt19937 engine;
+    for(auto format : image_op_formats)
+    {
+        const image im = make_random_image({37,5}, format, engine);
+        require_images_match(premultiply_alpha(im), reference::premultiply_alpha(im));
+    }
+}
+
+TEST_CASE("swizzle_image matches its reference implementation", "[image-ops]")
+{
+    const VkComponentMapping mappings[]
+    {
+        {VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY},
+        {VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_A},
+        {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE},
+        {VK_COMPONENT_SWIZZLE_A, VK_COMPONENT_SWIZZLE_ZERO, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_R},
+    };
+    std::mt19937 engine;
+    for(auto format : image_op_formats)
+    {
+        const image im = make_random_image({37,5}, format, engine);
+        for(auto & mapping : mappings) require_images_match(swizzle_image(im, mapping), reference::swizzle_image(im, mapping));
+    }
+}
+
+TEST_CASE("renormalize_normal_map matches its reference implementation", "[image-ops]")
+{
+    std::mt19937 engine;
+    for(auto format : {VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT})
+    {
+        const image im = make_random_image({37,5}, format, engine);
+        require_images_match(renormalize_normal_map(im), reference::renormalize_normal_map(im));
+    }
+
+    // Float normals should come out with unit length
+    const image normals = renormalize_normal_map(make_random_image({16,16}, VK_FORMAT_R32G32B32_SFLOAT, engine));
+    for(int i=0; i<16*16; ++i) REQUIRE(length(reinterpret_cast<const float3 *>(normals.get_pixels())[i]) == Approx(1.0f));
+}
+
+//////////////
+// mesh-ops //
+//////////////
+
+// Produces a flat grid of n by n quads in the XY plane, with the triangles of the left and right halves assigned to separate materials
+mesh make_grid_mesh(int n)
+{
+    mesh m;
+    for(int y=0; y<=n; ++y) for(int x=0; x<=n; ++x) m.vertices.push_back({{float(x), float(y), 0}, {1,1,1}, {0,0,1}, {float(x)/n, float(y)/n}});
+    for(auto half : {0, 1})
+    {
+        m.materials.push_back({"", m.triangles.size(), 0});
+        for(int y=0; y<n; ++y) for(int x=half*n/2; x<(half+1)*n/2; ++x)
+        {
+            const uint32_t i = y*(n+1)+x;
+            m.triangles.push_back({i, i+1, i+n+2});
+            m.triangles.push_back({i, i+n+2, i+n+1});
+        }
+        m.materials.back().num_triangles = m.triangles.size() - m.materials.back().first_triangle;
+    }
+    return m;
+}
+
+// Gives every corner of every triangle its own vertex, as the FBX loader does
+mesh unweld_vertices(mesh m)
+{
+    std::vector<mesh::vertex> vertices;
+    for(auto & t : m.triangles) for(auto & i : t) { vertices.push_back(m.vertices[i]); i = narrow(vertices.size()-1); }
+    m.vertices.swap(vertices);
+    return m;
+}
+
+void require_same_triangles(const mesh & a, const mesh & b)
+{
+    REQUIRE(a.triangles.size() == b.triangles.size());
+    for(size_t i=0; i<a.triangles.size(); ++i) for(int j=0; j<3; ++j) REQUIRE(a.vertices[a.triangles[i][j]].position == b.vertices[b.triangles[i][j]].position);
+}
+
+TEST_CASE("weld_vertices merges identical vertices", "[mesh-ops]")
+{
+    const mesh grid = make_grid_mesh(8), welded = weld_vertices(unweld_vertices(grid));
+    REQUIRE(welded.vertices.size() == grid.vertices.size());
+    require_same_triangles(welded, grid);
+    REQUIRE(welded.materials.size() == 2);
+    REQUIRE(welded.materials[1].first_triangle == 64);
+    REQUIRE(welded.materials[1].num_triangles == 64);
+
+    // Vertices which differ in any attribute are kept apart
+    mesh recolored = unweld_vertices(grid);
+    recolored.vertices[0].color.x = 0.5f;
+    REQUIRE(weld_vertices(recolored).vertices.size() == grid.vertices.size()+1);
+}
+
+TEST_CASE("weld_vertices merges nearby vertices within epsilon", "[mesh-ops]")
+{
+    // Texcoords are multiples of 1/8, so an epsilon of 1/64 keeps every attribute well away from a rounding boundary
+    const mesh grid = make_grid_mesh(8);
+    mesh perturbed = unweld_vertices(grid);
+    std::mt19937 engine;
+    std::uniform_real_distribution<float> noise {-1e-4f, 1e-4f};
+    for(auto & v : perturbed.vertices) v.position += float3{noise(engine), noise(engine), noise(engine)};
+    REQUIRE(weld_vertices(perturbed).vertices.size() == perturbed.vertices.size());
+    const mesh welded = weld_vertices(perturbed, 1.0f/64);
+    REQUIRE(welded.vertices.size() == grid.vertices.size());
+    REQUIRE(welded.triangles.size() == grid.triangles.size());
+
+    // Collapsing a column of vertices onto its neighbour removes the triangles between them, and shrinks the first material accordingly
+    mesh collapsed = unweld_vertices(grid);
+    for(auto & v : collapsed.vertices) if(v.position.x == 1) { v.position.x = 1e-3f; v.texcoord.x = 0; }
+    const mesh narrowed = weld_vertices(collapsed, 1.0f/64);
+    REQUIRE(narrowed.vertices.size() == 9*8);
+    REQUIRE(narrowed.triangles.size() == 128-16);
+    REQUIRE(narrowed.materials[0].first_triangle == 0);
+    REQUIRE(narrowed.materials[0].num_triangles == 64-16);
+    REQUIRE(narrowed.materials[1].first_triangle == 64-16);
+    REQUIRE(narrowed.materials[1].num_triangles == 64);
+}
+
+// Sorts the corners of every triangle of a material by position, so that triangle sets can be compared regardless of vertex and triangle order
+std::vector<std::array<float,9>> get_sorted_triangles(const mesh & m, const mesh::material & mat)
+{
+    std::vector<std::array<float,9>> triangles;
+    for(size_t i=mat.first_triangle; i<mat.first_triangle+mat.num_triangles; ++i)
+    {
+        std::array<float,9> t;
+        for(int j=0; j<3; ++j) for(int k=0; k<3; ++k) t[j*3+k] = m.vertices[m.triangles[i][j]].position[k];
+        triangles.push_back(t);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+TEST_CASE("optimize_mesh reduces vertex transforms without changing the triangles of any material", "[mesh-ops]")
+{
+    // Shuffle the triangles of each half of a large grid, which defeats the vertex cache
+    mesh shuffled = make_grid_mesh(64);
+    std::mt19937 engine;
+    for(auto & mat : shuffled.materials) std::shuffle(shuffled.triangles.begin() + mat.first_triangle, shuffled.triangles.begin() + mat.first_triangle + mat.num_triangles, engine);
+    const auto before = analyze_vertex_cache(shuffled);
+    REQUIRE(before.acmr > 2.0f);
+
+    mesh_optimization_stats stats;
+    const mesh optimized = optimize_mesh(shuffled, 16, &stats);
+    const auto after = analyze_vertex_cache(optimized);
+    REQUIRE(after.acmr < 1.0f);
+    REQUIRE(after.atvr < 1.5f);
+    REQUIRE(stats.before.acmr == before.acmr);
+    REQUIRE(stats.before.atvr == before.atvr);
+    REQUIRE(stats.after.acmr == after.acmr);
+    REQUIRE(stats.after.atvr == after.atvr);
+    REQUIRE(optimized.vertices.size() == shuffled.vertices.size());
+    REQUIRE(optimized.materials.size() == 2);
+    for(int i=0; i<2; ++i)
+    {
+        REQUIRE(optimized.materials[i].first_triangle == shuffled.materials[i].first_triangle);
+        REQUIRE(optimized.materials[i].num_triangles == shuffled.materials[i].num_triangles);
+        REQUIRE(get_sorted_triangles(optimized, optimized.materials[i]) == get_sorted_triangles(shuffled, shuffled.materials[i]));
+    }
+
+    // Vertices should be fetched in order of first use
+    uint32_t next_vertex = 0;
+    for(auto & t : optimized.triangles) for(auto v : t) { REQUIRE(v <= next_vertex); if(v == next_vertex) ++next_vertex; }
+}
+
+float half_to_float(uint16_t h)
+{
+    const int exponent = h >> 10 & 0x1F, mantissa = h & 0x3FF;
+    return (h & 0x8000 ? -1 : 1) * (exponent ? std::ldexp(1024 + mantissa, exponent - 25) : std::ldexp(mantissa, -24));
+}
+
+float3 decode_octahedral(float x, float y)
+{
+    float3 v {x, y, 1 - std::abs(x) - std::abs(y)};
+    if(v.z < 0) v = {(1 - std::abs(y)) * (x < 0 ? -1 : 1), (1 - std::abs(x)) * (y < 0 ? -1 : 1), v.z};
+    return normalize(v);
+}
+
+TEST_CASE("pack_vertices matches the layout described by get_packed_vertex_attributes", "[mesh-ops]")
+{
+    std::mt19937 engine;
+    std::uniform_real_distribution<float> dist {-1, 1};
+    std::vector<mesh::vertex> vertices(1000);
+    for(auto & v : vertices)
+    {
+        v.position = {dist(engine)*100, dist(engine)*100, dist(engine)*100};
+        v.color = {dist(engine)*0.5f+0.5f, dist(engine)*0.5f+0.5f, dist(engine)*0.5f+0.5f};
+        v.normal = normalize(float3{dist(engine), dist(engine), dist(engine)});
+        v.texcoord = {dist(engine)*0.5f+0.5f, dist(engine)*0.5f+0.5f};
+        v.tangent = normalize(cross(v.normal, float3{dist(engine), dist(engine), dist(engine)}));
+        v.bitangent = cross(v.normal, v.tangent) * (dist(engine) < 0 ? -1.0f : 1.0f);
+        v.bone_indices = {uint32_t(dist(engine)*127+128), 1, 2, 255};
+        v.bone_weights = {dist(engine)+1, dist(engine)+1, dist(engine)+1, 0};
+    }
+
+    for(bool color : {false, true}) for(bool skinning : {false, true}) for(bool unorm_texcoords : {false, true})
+    {
+        const vertex_packing packing {color, skinning, unorm_texcoords};
+        const uint32_t size = get_packed_vertex_size(packing);
+        REQUIRE(size == (skinning ? 32 : 24) + (color ? 4 : 0));
+        const auto attributes = get_packed_vertex_attributes(packing);
+        REQUIRE(attributes.back().offset + 4 == size);
+
+        const auto data = pack_vertices(vertices, packing);
+        REQUIRE(data.size() == vertices.size() * size);
+        for(size_t i=0; i<vertices.size(); ++i)
+        {
+            auto & v = vertices[i];
+            for(auto & a : attributes)
+            {
+                const uint8_t * p = data.data() + i*size + a.offset;
+                short2 s; byte4 b; linalg::vec<int8_t,4> c; ushort2 u; float3 f;
+                switch(a.location)
+                {
+                case 0: memcpy(&f, p, sizeof(f)); REQUIRE(f == v.position); break;
+                case 1: memcpy(&b, p, sizeof(b)); for(int j=0; j<3; ++j) REQUIRE(b[j]/255.0f == Approx(v.color[j]).margin(0.5f/255)); REQUIRE(b.w == 255); break;
+                case 2: memcpy(&s, p, sizeof(s)); REQUIRE(dot(decode_octahedral(s.x/32767.0f, s.y/32767.0f), v.normal) > 0.99999f); break;
+                case 3: 
+                    memcpy(&u, p, sizeof(u));
+                    if(a.format == VK_FORMAT_R16G16_UNORM) for(int j=0; j<2; ++j) REQUIRE(u[j]/65535.0f == Approx(v.texcoord[j]).margin(0.5f/65535));
+                    else for(int j=0; j<2; ++j) REQUIRE(half_to_float(u[j]) == Approx(v.texcoord[j]).margin(1.0f/4096));
+                    break;
+                case 4: 
+                    memcpy(&c, p, sizeof(c));
+                    REQUIRE(dot(decode_octahedral(c.x/127.0f, c.y/127.0f), v.tangent) > 0.999f);
+                    REQUIRE(dot(cross(v.normal, v.tangent) * (c.w/127.0f), v.bitangent) == Approx(1.0f));
+                    break;
+                case 6: memcpy(&b, p, sizeof(b)); REQUIRE(uint4{b} == v.bone_indices); break;
+                case 7: 
+                    memcpy(&b, p, sizeof(b));
+                    REQUIRE(b.x + b.y + b.z + b.w == 255);
+                    for(int j=0; j<4; ++j) REQUIRE(b[j]/255.0f == Approx(v.bone_weights[j] / sum(v.bone_weights)).margin(2.0f/255));
+                    break;
+                default: FAIL();
+                }
+            }
+        }
+    }
+
+    // Bone indices which do not fit in eight bits are rejected
+    vertices[0].bone_indices.x = 256;
+    REQUIRE_NOTHROW(pack_vertices(vertices, {false, false, false}));
+    REQUIRE_THROWS(pack_vertices(vertices, {false, true, false}));
+}
+
+TEST_CASE("build_meshlets splits every material into bounded meshlets", "[mesh-ops]")
+{
+    // Displace the grid into a bumpy surface, so that the normal cones have some width
+    mesh grid = make_grid_mesh(32);
+    for(auto & v : grid.vertices) v.position.z = std::sin(v.position.x * 0.5f) * std::cos(v.position.y * 0.5f);
+    const mesh original = grid;
+    const auto meshlets = build_meshlets(grid, 64, 124);
+    for(int i=0; i<2; ++i) REQUIRE(get_sorted_triangles(grid, grid.materials[i]) == get_sorted_triangles(original, original.materials[i]));
+
+    size_t next_triangle = 0;
+    for(auto & ml : meshlets)
+    {
+        REQUIRE(ml.first_triangle == next_triangle);
+        REQUIRE(ml.num_triangles > 0);
+        REQUIRE(ml.num_triangles <= 124);
+        next_triangle += ml.num_triangles;
+        auto & mat = grid.materials[ml.material];
+        REQUIRE(ml.first_triangle >= mat.first_triangle);
+        REQUIRE(ml.first_triangle + ml.num_triangles <= mat.first_triangle + mat.num_triangles);
+
+        std::vector<uint32_t> vertices;
+        for(size_t i=ml.first_triangle; i<ml.first_triangle+ml.num_triangles; ++i)
+        {
+            auto & t = grid.triangles[i];
+            for(auto v : t)
+            {
+                vertices.push_back(v);
+                REQUIRE(distance(grid.vertices[v].position, ml.center) <= ml.radius * 1.0001f);
+            }
+            const float3 n = normalize(cross(grid.vertices[t.y].position - grid.vertices[t.x].position, grid.vertices[t.z].position - grid.vertices[t.x].position));
+            REQUIRE(std::sqrt(std::max(0.0f, 1 - dot(n, ml.cone_axis)*dot(n, ml.cone_axis))) <= ml.cone_cutoff + 1e-4f);
+        }
+        std::sort(vertices.begin(), vertices.end());
+        REQUIRE(std::unique(vertices.begin(), vertices.end()) - vertices.begin() <= 64);
+    }
+    REQUIRE(next_triangle == grid.triangles.size());
+    REQUIRE(meshlets.size() <= 2048/64 * 2);
+}
+
+TEST_CASE("is_meshlet_culled rejects meshlets outside the frustum or facing away", "[mesh-ops]")
+{
+    mesh grid = make_grid_mesh(8);
+    const auto meshlets = build_meshlets(grid, 16, 16);
+    const float4x4 proj_matrix = linalg::perspective_matrix(1.0f, 1.0f, 0.1f, 100.0f, linalg::neg_z, linalg::zero_to_one);
+
+    // Looking down at the front face of the grid from above, every meshlet is visible
+    const float4x4 view_matrix = inverse(translation_matrix(float3{4,4,10}));
+    for(auto & ml : meshlets) REQUIRE_FALSE(is_meshlet_culled(ml, proj_matrix * view_matrix, {4,4,10}));
+
+    // From below, every triangle faces away
+    const float4x4 below_matrix = inverse(translation_matrix(float3{4,4,-10}) * rotation_matrix(rotation_quat(float3{1,0,0}, 3.14159265f)));
+    for(auto & ml : meshlets) REQUIRE(is_meshlet_culled(ml, proj_matrix * below_matrix, {4,4,-10}));
+
+    // Looking away from the grid, every meshlet is outside the frustum
+    const float4x4 away_matrix = inverse(translation_matrix(float3{4,4,10}) * rotation_matrix(rotation_quat(float3{1,0,0}, 3.14159265f)));
+    for(auto & ml : meshlets) REQUIRE(is_meshlet_culled(ml, proj_matrix * away_matrix, {4,4,10}));
+
+    // Looking at one corner of the grid, the meshlets at the opposite corner are outside the frustum
+    const float4x4 corner_matrix = inverse(translation_matrix(float3{0,0,1}));
+    REQUIRE_FALSE(is_meshlet_culled(meshlets.front(), proj_matrix * corner_matrix, {0,0,1}));
+    size_t culled = 0;
+    for(auto & ml : meshlets) if(is_meshlet_culled(ml, proj_matrix * corner_matrix, {0,0,1})) ++culled;
+    REQUIRE(culled > 0);
+}
+
+TEST_CASE("generate_lods simplifies every material without crossing seams or material boundaries", "[mesh-ops]")
+{
+    // Cut a UV seam along x=8 by giving the triangles to its left their own copies of its vertices, in a separate chart of texture space
+    mesh grid = make_grid_mesh(32);
+    for(auto & v : grid.vertices) v.position.z = std::sin(v.position.x * 0.2f) * std::cos(v.position.y * 0.2f);
+    for(auto & t : grid.triangles)
+    {
+        if(std::max({grid.vertices[t.x].position.x, grid.vertices[t.y].position.x, grid.vertices[t.z].position.x}) > 8) continue;
+        for(auto & i : t)
+        {
+            if(grid.vertices[i].position.x != 8) continue;
+            auto v = grid.vertices[i];
+            v.texcoord.x += 10;
+            grid.vertices.push_back(v);
+            i = narrow(grid.vertices.size()-1);
+        }
+    }
+    for(auto & v : grid.vertices) if(v.position.x < 8) v.texcoord.x += 10;
+    grid = weld_vertices(grid);
+
+    const mesh original = grid;
+    const auto lods = generate_lods(grid, 3);
+    REQUIRE(lods.size() == 3);
+    REQUIRE(grid.vertices.size() == original.vertices.size());
+    REQUIRE(std::equal(original.triangles.begin(), original.triangles.end(), grid.triangles.begin()));
+
+    size_t prev_count = original.triangles.size();
+    float prev_error = 0;
+    for(auto & lod : lods)
+    {
+        REQUIRE(lod.error >= prev_error);
+        prev_error = lod.error;
+
+        size_t count = 0;
+        std::vector<bool> used(grid.vertices.size());
+        for(auto & mat : lod.materials)
+        {
+            REQUIRE(mat.first_triangle >= original.triangles.size());
+            REQUIRE(mat.first_triangle + mat.num_triangles <= grid.triangles.size());
+            count += mat.num_triangles;
+            for(size_t i=mat.first_triangle; i<mat.first_triangle+mat.num_triangles; ++i)
+            {
+                auto & t = grid.triangles[i];
+                for(auto v : t) REQUIRE(v < grid.vertices.size());
+                for(auto v : t) used[v] = true;
+                const bool chart = grid.vertices[t.x].texcoord.x >= 5;
+                REQUIRE((grid.vertices[t.y].texcoord.x >= 5) == chart);
+                REQUIRE((grid.vertices[t.z].texcoord.x >= 5) == chart);
+            }
+        }
+        REQUIRE(count < prev_count * 3/4);
+        prev_count = count;
+
+        // The vertices along the boundary between the two materials never move
+        for(size_t i=0; i<grid.vertices.size(); ++i) if(grid.vertices[i].position.x == 16) REQUIRE(used[i]);
+    }
+}
+
+TEST_CASE("build_meshlets and generate_lods keep their ranges apart on a mesh without materials", "[mesh-ops]")
+{
+    mesh grid = make_grid_mesh(32);
+    for(auto & v : grid.vertices) v.position.z = std::sin(v.position.x * 0.2f) * std::cos(v.position.y * 0.2f);
+    grid.materials.clear();
+    const size_t base_count = grid.triangles.size();
+
+    const auto meshlets = build_meshlets(grid);
+    for(auto & ml : meshlets) REQUIRE(ml.first_triangle + ml.num_triangles <= base_count);
+    const auto lods = generate_lods(grid, 2);
+    REQUIRE(lods.size() == 2);
+    REQUIRE(grid.materials.size() == 1);
+    REQUIRE(grid.materials[0].first_triangle == 0);
+    REQUIRE(grid.materials[0].num_triangles == base_count);
+    for(auto & lod : lods)
+    {
+        REQUIRE(lod.materials.size() == 1);
+        REQUIRE(lod.materials[0].first_triangle >= base_count);
+    }
+
+    // Later passes only reorder the full detail triangles
+    const mesh original = grid;
+    build_meshlets(grid);
+    REQUIRE(std::equal(original.triangles.begin() + base_count, original.triangles.end(), grid.triangles.begin() + base_count, grid.triangles.end()));
+}
+
+TEST_CASE("parallel_for visits every index once, including from nested and concurrent calls", "[utility]")
+{
+    std::vector<std::atomic<int>> visits(64*64);
+    std::vector<std::thread> callers;
+    for(int c=0; c<4; ++c) callers.emplace_back([&visits, c]() 
+    {
+        parallel_for(16, [&visits, c](size_t i) { parallel_for(64, [&visits, c, i](size_t j) { visits[(c*16+i)*64+j]++; }); });
+    });
+    for(auto & t : callers) t.join();
+    for(auto & v : visits) REQUIRE(v == 1);
+
+    std::atomic<int> calls {0};
+    REQUIRE_THROWS_AS(parallel_for(1000, [&calls](size_t i) { ++calls; if(i == 10) throw std::runtime_error("failed"); }), std::runtime_error);
+    REQUIRE(calls <= 1000);
+}
+
+TEST_CASE("mesh_cache round trips every part of a mesh", "[load]")
+{
+    mesh m = make_grid_mesh(4);
+    m.bones.push_back({"root", std::nullopt, {{1,2,3}, {0,0,0,1}, {1,1,1}}, translation_matrix(float3{-1,-2,-3})});
+    m.bones.push_back({"child", 0, {{0,1,0}, {0,0,0,1}, {2,2,2}}, linalg::identity});
+    m.animations.push_back({"wave", {{0, {m.bones[0].initial_pose, m.bones[1].initial_pose}}, {10, {m.bones[1].initial_pose, m.bones[0].initial_pose}}}});
+    save_mesh_cache("test-mesh-cache.bin", {&m, 1});
+
+    {
+        const mesh_cache cache {"test-mesh-cache.bin"};
+        REQUIRE(cache.get_mesh_count() == 1);
+        const mesh loaded = cache.get_mesh(0);
+        REQUIRE(loaded.vertices.size() == m.vertices.size());
+        for(size_t i=0; i<m.vertices.size(); ++i) REQUIRE(memcmp(&loaded.vertices[i], &m.vertices[i], sizeof(mesh::vertex)) == 0);
+        REQUIRE(loaded.triangles == m.triangles);
+        REQUIRE(loaded.materials.size() == 2);
+        for(size_t i=0; i<2; ++i)
+        {
+            REQUIRE(loaded.materials[i].name == m.materials[i].name);
+            REQUIRE(loaded.materials[i].first_triangle == m.materials[i].first_triangle);
+            REQUIRE(loaded.materials[i].num_triangles == m.materials[i].num_triangles);
+        }
+        REQUIRE(loaded.bones.size() == 2);
+        REQUIRE(loaded.bones[1].name == "child");
+        REQUIRE(loaded.bones[0].parent_index == std::nullopt);
+        REQUIRE(loaded.bones[1].parent_index == size_t(0));
+        REQUIRE(loaded.bones[0].model_to_bone_matrix == m.bones[0].model_to_bone_matrix);
+        REQUIRE(loaded.animations.size() == 1);
+        REQUIRE(loaded.animations[0].keyframes.size() == 2);
+        REQUIRE(loaded.animations[0].keyframes[1].key == 10);
+        REQUIRE(loaded.animations[0].keyframes[1].local_transforms[0].scaling == float3(2,2,2));
+    }
+    std::remove("test-mesh-cache.bin");
+}
+
+TEST_CASE("mesh_cache rejects corrupt files", "[load]")
+{
+    const auto require_rejected = [](const mesh & m)
+    {
+        save_mesh_cache("test-mesh-cache.bin", {&m, 1});
+        REQUIRE_THROWS_AS(mesh_cache{"test-mesh-cache.bin"}, std::runtime_error);
+    };
+
+    // Materials which reach past the last triangle, and triangles which refer past the last vertex
+    mesh m = make_grid_mesh(4);
+    m.materials.back().num_triangles += 1;
+    require_rejected(m);
+    m = make_grid_mesh(4);
+    m.materials.back().first_triangle = ~size_t(0);
+    require_rejected(m);
+    m = make_grid_mesh(4);
+    m.triangles.back().z = static_cast<uint32_t>(m.vertices.size());
+    require_rejected(m);
+
+    // A truncated file
+    m = make_grid_mesh(4);
+    save_mesh_cache("test-mesh-cache.bin", {&m, 1});
+    std::vector<char> contents;
+    {
+        std::ifstream in {"test-mesh-cache.bin", std::ios::binary};
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    std::ofstream{"test-mesh-cache.bin", std::ios::binary}.write(contents.data(), contents.size() - 64);
+    REQUIRE_THROWS_AS(mesh_cache{"test-mesh-cache.bin"}, std::runtime_error);
+    std::remove("test-mesh-cache.bin");
+}
+
+// Wraps bytes in a zlib stream made of stored blocks, as an FBX exporter would compress an array, without depending on zlib itself
+std::vector<uint8_t> make_zlib_stream(const std::vector<uint8_t> & bytes)
+{
+    std::vector<uint8_t> stream {0x78, 0x01};
+    size_t offset = 0;
+    do
+    {
+        const uint16_t length = static_cast<uint16_t>(std::min<size_t>(bytes.size() - offset, 65535));
+        stream.push_back(offset + length == bytes.size() ? 1 : 0);
+        for(uint16_t n : {length, uint16_t(~length)}) { stream.push_back(n & 0xFF); stream.push_back(n >> 8); }
+        stream.insert(stream.end(), bytes.begin() + offset, bytes.begin() + offset + length);
+        offset += length;
+    } while(offset < bytes.size());
+
+    uint32_t a = 1, b = 0;
+    for(auto byte : bytes) { a = (a + byte) % 65521; b = (b + a) % 65521; }
+    for(int shift : {24, 16, 8, 0}) stream.push_back(static_cast<uint8_t>(((b << 16) | a) >> shift));
+    return stream;
+}
+
+// A node of a binary FBX document, with its properties already encoded
+struct fbx_binary_node
+{
+    std::string name;
+    std::vector<uint8_t> properties;
+    uint32_t property_count = 0;
+    std::vector<fbx_binary_node> children;
+
+    template<class T> void append(const T & value) { auto p = reinterpret_cast<const uint8_t *>(&value); properties.insert(properties.end(), p, p+sizeof(T)); }
+    template<class T> fbx_binary_node & scalar(char type, T value) { properties.push_back(type); append(value); ++property_count; return *this; }
+    fbx_binary_node & string(std::string_view s)
+    { 
+        properties.push_back('S'); 
+        append(static_cast<uint32_t>(s.size())); 
+        properties.insert(properties.end(), s.begin(), s.end()); 
+        ++property_count; 
+        return *this; 
+    }
+    fbx_binary_node & array(char type, uint32_t count, uint32_t encoding, const std::vector<uint8_t> & bytes)
+    {
+        properties.push_back(type);
+        for(uint32_t n : {count, encoding, static_cast<uint32_t>(bytes.size())}) append(n);
+        properties.insert(properties.end(), bytes.begin(), bytes.end());
+        ++property_count;
+        return *this;
+    }
+    template<class T> fbx_binary_node & array(char type, const std::vector<T> & elements, bool compressed)
+    {
+        std::vector<uint8_t> bytes(reinterpret_cast<const uint8_t *>(elements.data()), reinterpret_cast<const uint8_t *>(elements.data() + elements.size()));
+        return array(type, static_cast<uint32_t>(elements.size()), compressed, compressed ? make_zlib_stream(bytes) : bytes);
+    }
+};
+
+// Encodes nodes in the layout used by FBX 7.4 and earlier, with 32-bit offsets
+void write_fbx_node(std::vector<uint8_t> & out, const fbx_binary_node & n)
+{
+    const size_t start = out.size();
+    out.resize(start + 13);
+    const uint32_t header[] {0, n.property_count, static_cast<uint32_t>(n.properties.size())};
+    memcpy(out.data() + start + 4, header + 1, 8);
+    out[start + 12] = static_cast<uint8_t>(n.name.size());
+    out.insert(out.end(), n.name.begin(), n.name.end());
+    out.insert(out.end(), n.properties.begin(), n.properties.end());
+    if(!n.children.empty())
+    {
+        for(auto & child : n.children) write_fbx_node(out, child);
+        out.resize(out.size() + 13);
+    }
+    const uint32_t end_offset = static_cast<uint32_t>(out.size());
+    memcpy(out.data() + start, &end_offset, 4);
+}
+std::vector<uint8_t> write_fbx_binary(const std::vector<fbx_binary_node> & nodes)
+{
+    const char magic[] = "Kaydara FBX Binary  ";
+    std::vector<uint8_t> out(magic, magic + sizeof(magic));
+    for(uint8_t b : {0x1A, 0x00, 0xE8, 0x1C, 0x00, 0x00}) out.push_back(b); // Followed by version 7400
+    for(auto & n : nodes) write_fbx_node(out, n);
+    out.resize(out.size() + 13);
+    return out;
+}
+
+fbx::ast::document load_fbx_text(std::string_view text) { return fbx::ast::load(array_view<uint8_t>{reinterpret_cast<const uint8_t *>(text.data()), text.size()}); }
+
+TEST_CASE("fbx::ast::load reads binary and ASCII documents into the same tree", "[fbx]")
+{
+    fbx_binary_node child {"Child"};
+    child.array('l', std::vector<int64_t>{1, 2, 3}, false);
+    fbx_binary_node header {"Header"};
+    header.scalar('I', int32_t(7)).scalar('D', 2.5).string("abc").children.push_back(child);
+    const auto binary = write_fbx_binary({header, fbx_binary_node{"Empty"}});
+    const std::string ascii = "; A comment\nHeader: 7, 2.5, \"abc\" {\n    Child: *3 {\n        a: 1,2,3\n    }\n}\nEmpty:  {\n}\n";
+
+    const auto check = [](const fbx::ast::document & doc)
+    {
+        REQUIRE(doc.nodes.size == 2);
+        auto & n = doc.nodes[0];
+        REQUIRE(n.name == "Header");
+        REQUIRE(n.properties.size == 3);
+        REQUIRE(n.properties[0].get<int>() == 7);
+        REQUIRE(n.properties[1].get<double>() == 2.5);
+        REQUIRE(n.properties[2].get_string() == "abc");
+        REQUIRE(n.children.size == 1);
+        REQUIRE(n.children[0].name == "Child");
+        REQUIRE((n.children[0].properties[0].get_elements<int64_t>() == std::vector<int64_t>{1, 2, 3}));
+        REQUIRE(doc.nodes[1].name == "Empty");
+        REQUIRE(doc.nodes[1].properties.size == 0);
+        REQUIRE(doc.nodes[1].children.size == 0);
+    };
+    const auto binary_doc = fbx::ast::load(array_view<uint8_t>{binary});
+    REQUIRE(binary_doc.version == 7400);
+    check(binary_doc);
+    check(load_fbx_text(ascii));
+    std::istringstream in {std::string{binary.begin(), binary.end()}};
+    check(fbx::ast::load(in));
+
+    // Truncated and malformed documents are rejected
+    REQUIRE_THROWS_AS(fbx::ast::load(array_view<uint8_t>{binary.data(), binary.size() - 20}), std::runtime_error);
+    REQUIRE_THROWS_AS(load_fbx_text("Header: 7, 2.5 {\n    Child: 1\n"), std::runtime_error);
+    REQUIRE_THROWS_AS(load_fbx_text("Header: \"abc"), std::runtime_error);
+}
+
+TEST_CASE("compressed fbx arrays are inflated on demand, and corrupt ones fail on every access", "[fbx]")
+{
+    std::vector<double> positions(300);
+    for(size_t i=0; i<positions.size(); ++i) positions[i] = i * 0.5;
+    std::vector<int32_t> indices(600);
+    for(size_t i=0; i<indices.size(); ++i) indices[i] = static_cast<int32_t>(i);
+
+    fbx_binary_node vertices {"Vertices"}, polygons {"PolygonVertexIndex"};
+    vertices.array('d', positions, true);
+    polygons.array('i', indices, true);
+    const auto binary = write_fbx_binary({vertices, polygons});
+    const auto doc = fbx::ast::load(array_view<uint8_t>{binary});
+    REQUIRE(doc.deferred_arrays.size() == 2);
+    REQUIRE(doc.deferred_arrays[0].node_name == "Vertices");
+
+    // One array is inflated ahead of time, the other on first access
+    const std::string_view names[] {"Vertices"};
+    fbx::ast::inflate_arrays(doc, names);
+    REQUIRE(doc.nodes[0].properties[0].get_elements<double>() == positions);
+    REQUIRE(doc.nodes[1].properties[0].get<int32_t>(599) == 599);
+    REQUIRE(doc.nodes[1].properties[0].get_elements<int32_t>() == indices);
+
+    // Corrupt data, and streams which end before filling the array, are reported rather than leaving the array partially filled
+    auto corrupt_stream = make_zlib_stream(std::vector<uint8_t>(80));
+    corrupt_stream[2] = 0x07; // A final block of the reserved type
+    fbx_binary_node corrupt_node {"Vertices"}, truncated_node {"Vertices"};
+    corrupt_node.array('d', 10, 1, corrupt_stream);
+    truncated_node.array('d', 10, 1, make_zlib_stream(std::vector<uint8_t>(40)));
+    const auto corrupt = write_fbx_binary({corrupt_node}), truncated = write_fbx_binary({truncated_node});
+
+    for(auto & contents : {corrupt, truncated})
+    {
+        const auto bad_doc = fbx::ast::load(array_view<uint8_t>{contents});
+        REQUIRE(bad_doc.deferred_arrays.size() >= 1);
+        REQUIRE_THROWS_AS(bad_doc.nodes[0].properties[0].get<double>(), std::runtime_error);
+        REQUIRE_THROWS_AS(bad_doc.nodes[0].properties[0].get<double>(), std::runtime_error);
+        REQUIRE_THROWS_AS(fbx::ast::inflate_arrays(bad_doc, names), std::runtime_error);
+    }
+}
+
+TEST_CASE("fbx::ast::property::get_elements converts whole arrays between element types", "[fbx]")
+{
+    std::vector<double> reals(13);
+    for(size_t i=0; i<reals.size(); ++i) reals[i] = i * 0.25 - 1;
+    fbx_binary_node n {"Arrays"};
+    n.array('d', reals, false).array('b', std::vector<uint8_t>{0, 1, 1, 0}, false).array('l', std::vector<int64_t>{-5, 7}, false).scalar('F', 4.5f);
+    const auto binary = write_fbx_binary({n});
+    const auto doc = fbx::ast::load(array_view<uint8_t>{binary});
+    auto & props = doc.nodes[0].properties;
+
+    const auto floats = props[0].get_elements<float>();
+    REQUIRE(floats.size() == reals.size());
+    for(size_t i=0; i<reals.size(); ++i) REQUIRE(floats[i] == static_cast<float>(reals[i]));
+    REQUIRE((props[1].get_elements<int>() == std::vector<int>{0, 1, 1, 0}));
+    REQUIRE((props[2].get_elements<int32_t>() == std::vector<int32_t>{-5, 7}));
+    REQUIRE((props[2].get_elements<double>() == std::vector<double>{-5, 7}));
+    REQUIRE((props[3].get_elements<double>() == std::vector<double>{4.5}));
+
+    // The caller's storage must match the size of the property
+    float storage[4];
+    REQUIRE_THROWS_AS(props[0].get_elements(storage, 4), std::runtime_error);
+    props[1].get_elements(storage, 4);
+    REQUIRE(storage[2] == 1.0f);
+}
+
+// A quad and a triangle, each attached to a model, in the ASCII FBX format
+const char * const test_fbx_scene = R"(
+Objects:  {
+    Geometry: 100, "Geometry::quad", "Mesh" {
+        Vertices: *12 {
+            a: 0,0,0,1,0,0,1,1,0,0,1,0
+        }
+        PolygonVertexIndex: *4 {
+            a: 0,1,2,-4
+        }
+    }
+    Model: 200, "Model::quad", "Mesh" {
+        Properties70:  {
+            P: "Lcl Translation", "Lcl Translation", "", "A",1,2,3
+        }
+    }
+    Geometry: 300, "Geometry::triangle", "Mesh" {
+        Vertices: *9 {
+            a: 0,0,0,0.5,0,0,0,0.5,0
+        }
+        PolygonVertexIndex: *3 {
+            a: 0,1,-3
+        }
+    }
+    Model: 400, "Model::triangle", "Mesh" {
+        Properties70:  {
+            P: "Lcl Scaling", "Lcl Scaling", "", "A",2,2,2
+        }
+    }
+}
+Connections:  {
+    C: "OO",100,200
+    C: "OO",100,999
+    C: "OO",300,400
+    C: "OO",400,0
+}
+)";
+
+TEST_CASE("fbx::load_meshes follows connections between objects by id", "[fbx]")
+{
+    const auto meshes = fbx::load_meshes(load_fbx_text(test_fbx_scene));
+    REQUIRE(meshes.size() == 2);
+
+    // Each geometry takes the transform of the model it is connected to, and connections to unknown ids are ignored
+    REQUIRE(meshes[0].bones.size() == 1);
+    REQUIRE(meshes[0].bones[0].name == "Model::quad");
+    REQUIRE(meshes[0].bones[0].initial_pose.translation == float3(1,2,3));
+    REQUIRE(meshes[1].bones.size() == 1);
+    REQUIRE(meshes[1].bones[0].name == "Model::triangle");
+    REQUIRE(meshes[1].bones[0].initial_pose.scaling == float3(2,2,2));
+}
+
+// Describes the stored type of an FBX array property, as printed by operator <<
+template<class T> std::string describe_fbx_array(size_t size) { std::ostringstream ss; ss << typeid(T).name() << '[' << size << ']'; return ss.str(); }
+std::string describe(const fbx::ast::property & p) { std::ostringstream ss; ss << p; return ss.str(); }
+
+TEST_CASE("ASCII fbx arrays are stored in the narrowest type the binary format would use", "[fbx]")
+{
+    const auto doc = load_fbx_text(R"(
+Small: *3 { a: 1,2,-3 }
+Limits: *2 { a: -2147483648,2147483647 }
+Large: *2 { a: 1,5000000000 }
+Mixed: *4 { a: 1,2.5,3,1e3 }
+Empty: *0 { a: }
+Scalars: 7, -2.5e-1, T
+)");
+    REQUIRE(doc.nodes.size == 6);
+    REQUIRE(describe(doc.nodes[0].properties[0]) == describe_fbx_array<int32_t>(3));
+    REQUIRE((doc.nodes[0].properties[0].get_elements<int32_t>() == std::vector<int32_t>{1, 2, -3}));
+    REQUIRE(describe(doc.nodes[1].properties[0]) == describe_fbx_array<int32_t>(2));
+    REQUIRE(doc.nodes[1].properties[0].get<int64_t>(0) == INT32_MIN);
+    REQUIRE(describe(doc.nodes[2].properties[0]) == describe_fbx_array<int64_t>(2));
+    REQUIRE(doc.nodes[2].properties[0].get<int64_t>(1) == 5000000000);
+    REQUIRE(describe(doc.nodes[3].properties[0]) == describe_fbx_array<double>(4));
+    REQUIRE((doc.nodes[3].properties[0].get_elements<double>() == std::vector<double>{1, 2.5, 3, 1000}));
+    REQUIRE(doc.nodes[4].properties[0].size() == 0);
+    REQUIRE(doc.nodes[5].properties.size == 3);
+    REQUIRE(doc.nodes[5].properties[0].get<int64_t>() == 7);
+    REQUIRE(doc.nodes[5].properties[1].get<double>() == -0.25);
+    REQUIRE(doc.nodes[5].properties[2].get<int>() == 1);
+
+    REQUIRE_THROWS_AS(load_fbx_text("Short: *3 { a: 1,2 }"), std::runtime_error);
+    REQUIRE_THROWS_AS(load_fbx_text("Bad: *1 { a: x }"), std::runtime_error);
+}
+
+TEST_CASE("fbx::load_meshes returns every geometry in document order, and reports failures from any of them", "[fbx]")
+{
+    // Geometry i is a fan of i+1 triangles
+    std::ostringstream ss;
+    ss << "Objects:  {\n";
+    for(int i=0; i<32; ++i)
+    {
+        ss << "    Geometry: " << i+1 << ", \"Geometry::" << i << "\", \"Mesh\" {\n        Vertices: *" << (i+3)*3 << " { a: ";
+        for(int j=0; j<i+3; ++j) ss << (j ? "," : "") << j << ",0," << i;
+        ss << " }\n        PolygonVertexIndex: *" << i+3 << " { a: ";
+        for(int j=0; j<i+3; ++j) ss << (j ? "," : "") << (j == i+2 ? ~j : j);
+        ss << " }\n    }\n";
+    }
+    ss << "}\nConnections:  {\n}\n";
+    const auto meshes = fbx::load_meshes(load_fbx_text(ss.str()));
+    REQUIRE(meshes.size() == 32);
+    for(size_t i=0; i<meshes.size(); ++i)
+    {
+        REQUIRE(meshes[i].triangles.size() == i+1);
+        REQUIRE(meshes[i].vertices.front().position.z == i);
+    }
+
+    std::string broken = ss.str();
+    broken.replace(broken.find("PolygonVertexIndex", broken.size()/2), 18, "PolygonVertexIndeX");
+    REQUIRE_THROWS_AS(fbx::load_meshes(load_fbx_text(broken)), std::runtime_error);
+}
+
+static mesh load_obj_text(const char * text, mesh_optimization_stats * stats = nullptr)
+{
+    { std::ofstream out("test-mesh.obj", std::ofstream::binary); out << text; }
+    struct remover { ~remover() { std::remove("test-mesh.obj"); } } remove_on_exit;
+    return load_mesh_from_obj({coord_axis::right, coord_axis::up, coord_axis::back}, "test-mesh.obj", stats);
+}
+
+TEST_CASE("load_mesh_from_obj shares corners with identical indices, and rejects faces which index out of range", "[obj]")
+{
+    const char * header = "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nvt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\nvt 0.5 0.5\nvn 0 0 1\n";
+
+    // Two quads over the same corners, fanned into four triangles which reuse four vertices
+    mesh_optimization_stats stats {};
+    auto m = load_obj_text((std::string(header) + "usemtl a\nf 1/1/1 2/2/1 3/3/1 4/4/1\nusemtl b\nf 1/1/1 2/2/1 3/3/1 4/4/1\n").c_str(), &stats);
+    REQUIRE(stats.before.acmr == 1.0f);
+    REQUIRE(stats.after.acmr == 1.0f);
+    REQUIRE(m.vertices.size() == 4);
+    REQUIRE(m.triangles.size() == 4);
+    REQUIRE(m.materials.size() == 2);
+    REQUIRE(m.materials[0].name == "a");
+    REQUIRE(m.materials[0].num_triangles == 2);
+    REQUIRE(m.materials[1].first_triangle == 2);
+
+    // The same position with a different texcoord, or without a normal, is a distinct vertex
+    m = load_obj_text((std::string(header) + "f 1/1/1 2/2/1 3/3/1\nf 1/5/1 3/3/1 4/4\n").c_str());
+    REQUIRE(m.vertices.size() == 5);
+    REQUIRE(m.triangles.size() == 2);
+
+    REQUIRE_THROWS_AS(load_obj_text((std::string(header) + "f 1 2 9\n").c_str()), std::runtime_error);
+    REQUIRE_THROWS_AS(load_obj_text((std::string(header) + "f 0 1 2\n").c_str()), std::runtime_error);
+    REQUIRE_THROWS_AS(load_obj_text((std::string(header) + "f 1/6 2 3\n").c_str()), std::runtime_error);
+    REQUIRE_THROWS_AS(load_obj_text((std::string(header) + "f 1//2 2 3\n").c_str()), std::runtime_error);
+}
+
+TEST_CASE("load_image decodes into caller provided memory with the same result as allocating its own", "[image]")
+{
+    // A 3x2 binary PPM, which has no alpha channel, so the decoder must expand it to RGBA on the way out
+    const uint8_t rgb[] {255,0,0, 0,255,0, 0,0,255, 10,20,30, 40,50,60, 70,80,90};
+    { std::ofstream out("test-image.ppm", std::ofstream::binary); out << "P6\n3 2\n255\n"; out.write(reinterpret_cast<const char *>(rgb), sizeof(rgb)); }
+
+    const image expected = load_image("test-image.ppm", false);
+    std::vector<uint8_t> pixels;
+    int2 dims; VkFormat format {};
+    load_image("test-image.ppm", false, [&](int2 d, VkFormat f, size_t capacity) -> void *
+    {
+        dims = d;
+        format = f;
+        pixels.resize(capacity, 0xCD);
+        return pixels.data();
+    });
+    REQUIRE(dims == int2(3,2));
+    REQUIRE(format == expected.get_format());
+    REQUIRE(pixels.size() >= 3*2*4);
+    REQUIRE(memcmp(pixels.data(), expected.get_pixels(), 3*2*4) == 0);
+    for(size_t i=0; i<6; ++i) REQUIRE(pixels[i*4+3] == 255);
+
+    // Failures are reported before the caller is asked for memory when the header cannot be read
+    { std::ofstream out("test-image.ppm", std::ofstream::binary); out << "not an image"; }
+    bool allocated = false;
+    REQUIRE_THROWS_AS(load_image("test-image.ppm", false, [&](int2, VkFormat, size_t) -> void * { allocated = true; return nullptr; }), std::runtime_error);
+    REQUIRE(!allocated);
+    std::remove("test-image.ppm");
+    REQUIRE_THROWS_AS(load_image("test-image.ppm", false, [&](int2, VkFormat, size_t) -> void * { allocated = true; return nullptr; }), std::runtime_error);
+    REQUIRE(!allocated);
+}
+
+static void write_test_file(const char * filename, const char * text) { std::ofstream{filename, std::ofstream::binary} << text; }
+
+TEST_CASE("load_shader_info_from_spirv reflects the descriptors of a compiled shader", "[shader]")
+{
+    write_test_file("test-reflect.frag", R"(#version 450
+layout(set=1, binding=2) uniform sampler2D u_albedo;
+layout(set=0, binding=0) uniform PerScene { mat4 view_proj; vec3 eye; float ambient[4]; } u_scene;
+layout(set=1, binding=0) uniform samplerCube u_env;
+layout(location=0) in vec3 v_normal;
+layout(location=0) out vec4 f_color;
+void main() { f_color = texture(u_albedo, v_normal.xy) * texture(u_env, v_normal) * u_scene.ambient[2] + u_scene.view_proj * vec4(u_scene.eye, 1); }
+)");
+    shader_compiler compiler;
+    const auto spirv = compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-reflect.frag");
+    std::remove("test-reflect.frag");
+    const auto info = load_shader_info_from_spirv(spirv);
+    REQUIRE(info.stage == VK_SHADER_STAGE_FRAGMENT_BIT);
+    REQUIRE(info.name == "main");
+
+    // Descriptors are sorted by set and binding, regardless of the order they were declared in
+    REQUIRE(info.descriptors.size() == 3);
+    REQUIRE(info.descriptors[0].set == 0);
+    REQUIRE(info.descriptors[0].binding == 0);
+    REQUIRE(info.descriptors[0].name == "u_scene");
+    REQUIRE(info.descriptors[1].set == 1);
+    REQUIRE(info.descriptors[1].binding == 0);
+    REQUIRE(info.descriptors[1].name == "u_env");
+    REQUIRE(info.descriptors[2].binding == 2);
+    REQUIRE(info.descriptors[2].name == "u_albedo");
+
+    auto & env = std::get<shader_info::sampler>(info.descriptors[1].type.contents);
+    REQUIRE(env.view_type == VK_IMAGE_VIEW_TYPE_CUBE);
+    REQUIRE(env.channel == shader_info::float_);
+    REQUIRE(std::get<shader_info::sampler>(info.descriptors[2].type.contents).view_type == VK_IMAGE_VIEW_TYPE_2D);
+
+    // Uniform blocks keep their member names, shapes and std140 offsets
+    auto & block = std::get<shader_info::structure>(info.descriptors[0].type.contents);
+    REQUIRE(block.name == "PerScene");
+    REQUIRE(block.members.size() == 3);
+    REQUIRE(block.members[0].name == "view_proj");
+    REQUIRE(block.members[0].offset == 0u);
+    auto & view_proj = std::get<shader_info::numeric>(block.members[0].type->contents);
+    REQUIRE(view_proj.row_count == 4);
+    REQUIRE(view_proj.column_count == 4);
+    REQUIRE(view_proj.matrix_layout);
+    REQUIRE(view_proj.matrix_layout->stride == 16);
+    REQUIRE(block.members[1].name == "eye");
+    REQUIRE(block.members[1].offset == 64u);
+    REQUIRE(std::get<shader_info::numeric>(block.members[1].type->contents).row_count == 3);
+    REQUIRE(block.members[2].offset == 80u);
+    auto & ambient = std::get<shader_info::array>(block.members[2].type->contents);
+    REQUIRE(ambient.length == 4);
+    REQUIRE(ambient.stride == 16u);
+
+    // Modules which are truncated or refer to ids beyond their bound are rejected rather than read out of range
+    REQUIRE_THROWS_AS(load_shader_info_from_spirv({spirv.data(), 4}), std::runtime_error);
+    auto bad_length = spirv;
+    bad_length[5] |= 0xFFFF0000;
+    REQUIRE_THROWS_AS(load_shader_info_from_spirv(bad_length), std::runtime_error);
+    auto bad_bound = spirv;
+    bad_bound[3] = 8;
+    REQUIRE_THROWS_AS(load_shader_info_from_spirv(bad_bound), std::runtime_error);
+    bad_bound[3] = 0xFFFFFFFF;
+    REQUIRE_THROWS_AS(load_shader_info_from_spirv(bad_bound), std::runtime_error);
+    REQUIRE_THROWS_AS(load_shader_info_from_spirv({bad_bound.data(), 5}), std::runtime_error);
+    bad_bound[3] = narrow(spirv.size() + 0x20000);
+    REQUIRE_THROWS_AS(load_shader_info_from_spirv(bad_bound), std::runtime_error);
+}
+
+TEST_CASE("shader_compiler reuses cached SPIR-V until the shader or anything it includes changes", "[shader]")
+{
+    std::filesystem::remove_all("test-shader-cache");
+    write_test_file("test-cache.glsl", "const float gain = 2.0;\n");
+    write_test_file("test-cache.frag", "#version 450\n#extension GL_GOOGLE_include_directive : require\n#include \"test-cache.glsl\"\nlayout(location=0) out vec4 f_color;\nvoid main() { f_color = vec4(gain); }\n");
+
+    std::vector<uint32_t> spirv;
+    {
+        shader_compiler compiler {"test-shader-cache"};
+        spirv = compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-cache.frag");
+        REQUIRE(compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-cache.frag") == spirv);
+        const auto stats = compiler.get_cache_stats();
+        REQUIRE(stats.misses == 1);
+        REQUIRE(stats.hits == 1);
+        REQUIRE(stats.stale == 0);
+        REQUIRE(stats.stores == 1);
+    }
+    {
+        // A new compiler finds the entry on disk, but not for another stage or another set of defines
+        shader_compiler compiler {"test-shader-cache"};
+        REQUIRE(compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-cache.frag") == spirv);
+        const shader_compile_request request {VK_SHADER_STAGE_FRAGMENT_BIT, "test-cache.frag", {"UNUSED"}};
+        REQUIRE(compiler.compile_glsl({&request, 1})[0].spirv == spirv);
+        const auto stats = compiler.get_cache_stats();
+        REQUIRE(stats.hits == 1);
+        REQUIRE(stats.misses == 1);
+        REQUIRE(stats.stale == 0);
+    }
+
+    // Editing an included file invalidates the entry, which is replaced once the shader is compiled again
+    write_test_file("test-cache.glsl", "const float gain = 3.0;\n");
+    {
+        shader_compiler compiler {"test-shader-cache"};
+        REQUIRE(compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-cache.frag") != spirv);
+        const auto stats = compiler.get_cache_stats();
+        REQUIRE(stats.hits == 0);
+        REQUIRE(stats.misses == 1);
+        REQUIRE(stats.stale == 1);
+        REQUIRE(stats.stores == 1);
+    }
+    {
+        shader_compiler compiler {"test-shader-cache"};
+        compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-cache.frag");
+        REQUIRE(compiler.get_cache_stats().hits == 1);
+    }
+
+    // Truncated entries are treated as stale rather than trusted
+    for(auto & entry : std::filesystem::directory_iterator("test-shader-cache")) std::filesystem::resize_file(entry.path(), 40);
+    {
+        shader_compiler compiler {"test-shader-cache"};
+        compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-cache.frag");
+        REQUIRE(compiler.get_cache_stats().stale == 1);
+    }
+
+    std::filesystem::remove_all("test-shader-cache");
+    std::remove("test-cache.frag");
+    std::remove("test-cache.glsl");
+}
+
+TEST_CASE("shader_compiler compiles batches concurrently and reports failures per shader", "[shader]")
+{
+    write_test_file("test-batch.frag", "#version 450\nlayout(set=0, binding=BINDING) uniform sampler2D u_tex;\nlayout(location=0) out vec4 f_color;\n#ifdef BROKEN\nvoid main() { f_color = undeclared; }\n#else\nvoid main() { f_color = texture(u_tex, vec2(0)); }\n#endif\n");
+
+    // Each request binds its sampler at a different index, so that results can be matched to requests
+    std::vector<shader_compile_request> requests;
+    for(int i=0; i<24; ++i) requests.push_back({VK_SHADER_STAGE_FRAGMENT_BIT, "test-batch.frag", {"BINDING=" + std::to_string(i)}});
+    requests[5].defines.push_back("BROKEN");
+    requests[17].filename = "test-batch-missing.frag";
+
+    shader_compiler compiler;
+    const auto results = compiler.compile_glsl(requests);
+    REQUIRE(results.size() == requests.size());
+    for(size_t i=0; i<results.size(); ++i)
+    {
+        if(i == 5 || i == 17)
+        {
+            REQUIRE(results[i].spirv.empty());
+            REQUIRE(!results[i].diagnostics.empty());
+            continue;
+        }
+        REQUIRE(!results[i].spirv.empty());
+        REQUIRE(results[i].info.descriptors.size() == 1);
+        REQUIRE(results[i].info.descriptors[0].binding == i);
+        REQUIRE(load_shader_info_from_spirv(results[i].spirv).descriptors[0].binding == i);
+    }
+    REQUIRE(results[5].diagnostics.find("undeclared") != std::string::npos);
+
+    // Compiling a single shader throws its diagnostics instead
+    REQUIRE_THROWS_AS(compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-batch-missing.frag"), std::runtime_error);
+    std::remove("test-batch.frag");
+}
+
+TEST_CASE("shader permutations are identified by their distinct keywords, and share identical modules", "[shader]")
+{
+    const std::vector<std::vector<std::string>> axes {{"", "SKINNED"}, {"LOW", "HIGH"}};
+    const auto permutations = enumerate_shader_permutations(axes);
+    REQUIRE((permutations == std::vector<std::vector<std::string>>{{"LOW"}, {"HIGH"}, {"SKINNED", "LOW"}, {"SKINNED", "HIGH"}}));
+    const std::vector<std::vector<std::string>> empty_axis {{"A"}, {}};
+    REQUIRE_THROWS_AS(enumerate_shader_permutations(empty_axis), std::logic_error);
+
+    const std::vector<std::string> keywords {"SKINNED", "", "HIGH", "SKINNED"};
+    REQUIRE(get_shader_permutation_key(keywords) == "HIGH SKINNED");
+    REQUIRE(get_shader_permutation_key({}) == "");
+
+    // SKINNED does not affect the code, so only the choice between LOW and HIGH produces distinct modules
+    write_test_file("test-permutations.frag", "#version 450\nlayout(location=0) out vec4 f_color;\n#ifdef BROKEN\n#error broken\n#endif\n#ifdef HIGH\nvoid main() { f_color = vec4(2); }\n#else\nvoid main() { f_color = vec4(1); }\n#endif\n");
+    auto requested = permutations;
+    requested.push_back({"HIGH", "SKINNED"});
+    requested.push_back({"LOW", "", "LOW"});
+    shader_compiler compiler;
+    const auto set = compiler.compile_glsl_permutations(VK_SHADER_STAGE_FRAGMENT_BIT, "test-permutations.frag", requested);
+    REQUIRE((set.keys == std::vector<std::string>{"LOW", "HIGH", "LOW SKINNED", "HIGH SKINNED"}));
+    REQUIRE(set.infos.size() == 4);
+    REQUIRE(set.modules.size() == 2);
+    REQUIRE((set.module_indices == std::vector<size_t>{0, 1, 0, 1}));
+    REQUIRE(set.find(keywords) == size_t(3));
+    REQUIRE(set.find(std::vector<std::string>{"LOW", "SKINNED"}) == size_t(2));
+    REQUIRE(!set.find(std::vector<std::string>{"MEDIUM"}));
+
+    // Every permutation which fails is reported together
+    requested.push_back({"BROKEN"});
+    requested.push_back({"BROKEN", "HIGH"});
+    try
+    {
+        compiler.compile_glsl_permutations(VK_SHADER_STAGE_FRAGMENT_BIT, "test-permutations.frag", requested);
+        FAIL("expected an exception");
+    }
+    catch(const std::runtime_error & e)
+    {
+        const std::string what = e.what();
+        REQUIRE(what.find("[BROKEN]") != std::string::npos);
+        REQUIRE(what.find("[BROKEN HIGH]") != std::string::npos);
+        REQUIRE(what.find("[LOW]") == std::string::npos);
+    }
+    std::remove("test-permutations.frag");
+}
+
+TEST_CASE("load_shader_info_from_spirv reflects scalar specialization constants with their defaults", "[shader]")
+{
+    write_test_file("test-specialization.frag", R"(#version 450
+layout(constant_id=7) const float gain = 2.5;
+layout(constant_id=2) const int count = -3;
+layout(constant_id=4) const uint mask = 10u;
+layout(constant_id=0) const bool enabled = true;
+layout(constant_id=1) const bool disabled = false;
+const int twice = count * 2;
+layout(location=0) out vec4 f_color;
+void main() { f_color = enabled && !disabled ? vec4(gain * float(twice + int(mask))) : vec4(0); }
+)");
+    shader_compiler compiler;
+    const auto spirv = compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-specialization.frag");
+    const auto info = load_shader_info_from_spirv(spirv);
+
+    // Sorted by id, with constants derived from others left out, as they cannot be specialized directly
+    auto & constants = info.specialization_constants;
+    REQUIRE(constants.size() == 5);
+    REQUIRE(constants[0].id == 0);
+    REQUIRE(constants[0].name == "enabled");
+    REQUIRE(constants[0].type == shader_info::bool_);
+    REQUIRE(constants[0].default_value == 1);
+    REQUIRE(constants[1].id == 1);
+    REQUIRE(constants[1].default_value == 0);
+    REQUIRE(constants[2].id == 2);
+    REQUIRE(constants[2].name == "count");
+    REQUIRE(constants[2].type == shader_info::int_);
+    REQUIRE(constants[2].default_value == uint32_t(-3));
+    REQUIRE(constants[3].id == 4);
+    REQUIRE(constants[3].type == shader_info::uint_);
+    REQUIRE(constants[3].default_value == 10);
+    REQUIRE(constants[4].id == 7);
+    REQUIRE(constants[4].name == "gain");
+    REQUIRE(constants[4].type == shader_info::float_);
+    float gain;
+    const auto bits = static_cast<uint32_t>(constants[4].default_value);
+    memcpy(&gain, &bits, sizeof(gain));
+    REQUIRE(gain == 2.5f);
+
+    // Remapping strips the names from the module, but the result is reflected beforehand
+    shader_compiler remapping_compiler {nullptr, true};
+    const shader_compile_request request {VK_SHADER_STAGE_FRAGMENT_BIT, "test-specialization.frag"};
+    const auto results = remapping_compiler.compile_glsl({&request, 1});
+    auto & result = results[0];
+    REQUIRE(result.info.specialization_constants.size() == 5);
+    REQUIRE(result.info.specialization_constants[4].name == "gain");
+    REQUIRE(load_shader_info_from_spirv(result.spirv).specialization_constants[4].name.empty());
+    std::remove("test-specialization.frag");
+}
+
+TEST_CASE("remapped SPIR-V is identical for shaders which differ only in names", "[shader]")
+{
+    write_test_file("test-remap-a.frag", "#version 450\nlayout(set=0, binding=0) uniform PerScene { vec4 tint; } u_scene;\nlayout(set=0, binding=1) uniform sampler2D u_tex;\nlayout(location=0) in vec2 texcoord;\nlayout(location=0) out vec4 f_color;\nvoid main() { vec4 c = texture(u_tex, texcoord); f_color = c * u_scene.tint; }\n");
+    write_test_file("test-remap-b.frag", "#version 450\nlayout(set=0, binding=0) uniform Scene { vec4 color; } scene;\nlayout(set=0, binding=1) uniform sampler2D albedo;\nlayout(location=0) in vec2 uv;\nlayout(location=0) out vec4 result;\nvoid main() { vec4 sample_color = texture(albedo, uv); result = sample_color * scene.color; }\n");
+
+    shader_compiler compiler, remapping_compiler {nullptr, true};
+    REQUIRE(compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-remap-a.frag") != compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-remap-b.frag"));
+    const auto a = remapping_compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-remap-a.frag");
+    REQUIRE(a == remapping_compiler.compile_glsl(VK_SHADER_STAGE_FRAGMENT_BIT, "test-remap-b.frag"));
+
+    // The remapped module is still valid SPIR-V, with the same interface, but no names
+    const auto info = load_shader_info_from_spirv(a);
+    REQUIRE(info.descriptors.size() == 2);
+    REQUIRE(info.descriptors[1].binding == 1);
+    REQUIRE(info.descriptors[1].name.empty());
+    std::remove("test-remap-a.frag");
+    std::remove("test-remap-b.frag");
+}
+
+TEST_CASE("pipeline cache data is only unwrapped for the device and driver which produced it", "[pipeline-cache]")
+{
+    VkPhysicalDeviceProperties props {};
+    props.vendorID = 0x10DE;
+    props.deviceID = 0x1B80;
+    props.driverVersion = 0x5A0000;
+    for(uint8_t i=0; i<VK_UUID_SIZE; ++i) props.pipelineCacheUUID[i] = i;
+
+    const std::vector<char> data {'p','i','p','e','l','i','n','e','s'};
+    const auto file = wrap_pipeline_cache_data(props, data);
+    REQUIRE(file.size() > data.size());
+    REQUIRE(unwrap_pipeline_cache_data(props, file) == data);
+    REQUIRE(unwrap_pipeline_cache_data(props, wrap_pipeline_cache_data(props, {})).empty());
+
+    // Any difference in the device, the driver, or the shape of the file discards the data
+    auto other = props;
+    other.driverVersion += 1;
+    REQUIRE(unwrap_pipeline_cache_data(other, file).empty());
+    other = props;
+    other.deviceID += 1;
+    REQUIRE(unwrap_pipeline_cache_data(other, file).empty());
+    other = props;
+    other.vendorID += 1;
+    REQUIRE(unwrap_pipeline_cache_data(other, file).empty());
+    other = props;
+    other.pipelineCacheUUID[VK_UUID_SIZE-1] ^= 1;
+    REQUIRE(unwrap_pipeline_cache_data(other, file).empty());
+
+    auto bad_magic = file;
+    bad_magic[0] ^= 1;
+    REQUIRE(unwrap_pipeline_cache_data(props, bad_magic).empty());
+    REQUIRE(unwrap_pipeline_cache_data(props, {file.data(), file.size()-1}).empty());
+    REQUIRE(unwrap_pipeline_cache_data(props, {file.data(), 8}).empty());
+    auto extended = file;
+    extended.push_back(0);
+    REQUIRE(unwrap_pipeline_cache_data(props, extended).empty());
+}
+
+static std::vector<uint8_t> read_test_file(const char * filename)
+{
+    std::ifstream in {filename, std::ifstream::binary};
+    return {std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+}
+static void write_test_file(const char * filename, const std::vector<uint8_t> & bytes) { std::ofstream{filename, std::ofstream::binary}.write(reinterpret_cast<const char *>(bytes.data()), bytes.size()); }
+template<class T> T read_test_value(const std::vector<uint8_t> & bytes, size_t offset) { T value; memcpy(&value, bytes.data() + offset, sizeof(value)); return value; }
+
+TEST_CASE("packages round trip compressed and stored blobs", "[package]")
+{
+    std::mt19937 engine;
+    std::vector<uint8_t> repetitive(5000), random(3000), small {1,2,3};
+    for(size_t i=0; i<repetitive.size(); ++i) repetitive[i] = static_cast<uint8_t>(i % 7);
+    for(auto & b : random) b = static_cast<uint8_t>(engine());
+
+    package_writer writer;
+    writer.add_blob("assets/repetitive.bin", repetitive, true);
+    writer.add_blob("assets/random.bin", random, true); // Does not compress, so is stored
+    writer.add_blob("small.bin", small, false);
+    writer.add_blob("empty.bin", {}, true);
+    REQUIRE_THROWS_AS(writer.add_blob("small.bin", small, false), std::runtime_error);
+    writer.save("test-package.pak");
+
+    auto pkg = std::make_shared<package>("test-package.pak");
+    auto names = pkg->get_names();
+    std::sort(names.begin(), names.end());
+    REQUIRE((names == std::vector<std::string_view>{"assets/random.bin", "assets/repetitive.bin", "empty.bin", "small.bin"}));
+    REQUIRE(pkg->contains("small.bin"));
+    REQUIRE(!pkg->contains("assets"));
+    std::vector<uint8_t> storage;
+    auto blob = pkg->get_blob("assets/repetitive.bin", storage);
+    REQUIRE(std::vector<uint8_t>(blob.begin(), blob.end()) == repetitive);
+    REQUIRE(blob.data == storage.data());
+    blob = pkg->get_blob("assets/random.bin", storage);
+    REQUIRE(std::vector<uint8_t>(blob.begin(), blob.end()) == random);
+    blob = pkg->get_blob("small.bin", storage);
+    REQUIRE(std::vector<uint8_t>(blob.begin(), blob.end()) == small);
+    REQUIRE(pkg->get_blob("empty.bin", storage).size == 0);
+    REQUIRE_THROWS_AS(pkg->get_blob("missing.bin", storage), std::runtime_error);
+
+    // Every blob begins on a 64 byte boundary, and only the repetitive blob is stored compressed. The header holds an 8 byte magic, a version, an entry count
+    // and the offset of the table of contents, whose entries hold a name hash, the name offset, the blob offset, stored size and size, name length and compression.
+    const auto bytes = read_test_file("test-package.pak");
+    const auto entry_count = read_test_value<uint32_t>(bytes, 12);
+    const auto entries_offset = read_test_value<uint64_t>(bytes, 16);
+    REQUIRE(entry_count == 4);
+    size_t compressed_count = 0;
+    for(size_t i=0; i<entry_count; ++i)
+    {
+        const size_t entry = entries_offset + i*48;
+        REQUIRE(read_test_value<uint64_t>(bytes, entry + 16) % 64 == 0);
+        if(read_test_value<uint32_t>(bytes, entry + 44) == 0) continue;
+        ++compressed_count;
+        REQUIRE(read_test_value<uint64_t>(bytes, entry + 24) < read_test_value<uint64_t>(bytes, entry + 32));
+        REQUIRE(read_test_value<uint64_t>(bytes, entry + 32) == repetitive.size());
+    }
+    REQUIRE(compressed_count == 1);
+
+    // Truncated or corrupt headers and tables of contents are rejected when the package is opened
+    auto corrupt = [&](std::function<void(std::vector<uint8_t> &)> f) { auto b = bytes; f(b); write_test_file("test-package-corrupt.pak", b); };
+    corrupt([](auto & b) { b.resize(20); });
+    REQUIRE_THROWS_AS(package{"test-package-corrupt.pak"}, std::runtime_error);
+    corrupt([](auto & b) { b[0] ^= 1; });
+    REQUIRE_THROWS_AS(package{"test-package-corrupt.pak"}, std::runtime_error);
+    corrupt([](auto & b) { b[8] += 1; });
+    REQUIRE_THROWS_AS(package{"test-package-corrupt.pak"}, std::runtime_error);
+    corrupt([](auto & b) { b[12] = 200; });
+    REQUIRE_THROWS_AS(package{"test-package-corrupt.pak"}, std::runtime_error);
+    corrupt([&](auto & b) { b.resize(entries_offset + 48); });
+    REQUIRE_THROWS_AS(package{"test-package-corrupt.pak"}, std::runtime_error);
+    corrupt([&](auto & b) { b[entries_offset + 16 + 6] = 1; });
+    REQUIRE_THROWS_AS(package{"test-package-corrupt.pak"}, std::runtime_error);
+    corrupt([&](auto & b) { b[entries_offset + 44] = 9; });
+    REQUIRE_THROWS_AS(package{"test-package-corrupt.pak"}, std::runtime_error);
+    std::remove("test-package-corrupt.pak");
+
+    // Mounted packages are searched most recently mounted first, and are no longer searched once unmounted
+    package_writer override_writer;
+    const std::vector<uint8_t> nines(1000, 9);
+    override_writer.add_blob("small.bin", nines, true);
+    override_writer.save("test-package-override.pak");
+    auto override_pkg = std::make_shared<const package>("test-package-override.pak");
+    REQUIRE(!find_mounted_blob("small.bin"));
+    mount_package(pkg);
+    mount_package(override_pkg);
+    static_assert(!std::is_copy_constructible_v<mounted_blob>);
+    auto found = find_mounted_blob("small.bin");
+    REQUIRE(found);
+    REQUIRE(found->source == override_pkg);
+    REQUIRE(found->contents.data == found->storage.data());
+    auto moved = std::move(*found);
+    found.reset();
+    REQUIRE(std::vector<uint8_t>(moved.contents.begin(), moved.contents.end()) == nines);
+    REQUIRE(load_binary_file("assets/repetitive.bin") == repetitive);
+    unmount_package(override_pkg);
+    REQUIRE(find_mounted_blob("small.bin")->source == pkg);
+    unmount_package(pkg);
+    REQUIRE(!find_mounted_blob("small.bin"));
+    moved = {};
+    pkg.reset();
+    override_pkg.reset();
+    std::remove("test-package-override.pak");
+    std::remove("test-package.pak");
+}
+
+// Reference decoders for the block compressed formats, written from the format specifications rather than from the encoders
+static void decode_bc1_block(const uint8_t * in, bool four_color_only, uint8_t (& out)[16][4])
+{
+    const uint16_t c0 = in[0] | in[1] << 8, c1 = in[2] | in[3] << 8;
+    int palette[4][4];
+    for(int j=0; j<2; ++j)
+    {
+        const uint16_t c = j ? c1 : c0;
+        const int r = c >> 11, g = c >> 5 & 63, b = c & 31;
+        palette[j][0] = r << 3 | r >> 2; palette[j][1] = g << 2 | g >> 4; palette[j][2] = b << 3 | b >> 2; palette[j][3] = 255;
+    }
+    for(int c=0; c<3; ++c)
+    {
+        if(c0 > c1 || four_color_only) { palette[2][c] = (2*palette[0][c] + palette[1][c])/3; palette[3][c] = (palette[0][c] + 2*palette[1][c])/3; }
+        else { palette[2][c] = (palette[0][c] + palette[1][c])/2; palette[3][c] = 0; }
+    }
+    palette[2][3] = 255;
+    palette[3][3] = c0 > c1 || four_color_only ? 255 : 0;
+    const uint32_t indices = in[4] | in[5] << 8 | in[6] << 16 | uint32_t(in[7]) << 24;
+    for(int i=0; i<16; ++i) for(int c=0; c<4; ++c) out[i][c] = static_cast<uint8_t>(palette[indices >> i*2 & 3][c]);
+}
+static void decode_bc4_block(const uint8_t * in, uint8_t (& out)[16])
+{
+    int palette[8] {in[0], in[1]};
+    if(in[0] > in[1]) for(int i=2; i<8; ++i) palette[i] = ((8-i)*in[0] + (i-1)*in[1])/7;
+    else { for(int i=2; i<6; ++i) palette[i] = ((6-i)*in[0] + (i-1)*in[1])/5; palette[6] = 0; palette[7] = 255; }
+    uint64_t indices = 0;
+    for(int i=0; i<6; ++i) indices |= uint64_t(in[2+i]) << i*8;
+    for(int i=0; i<16; ++i) out[i] = static_cast<uint8_t>(palette[indices >> i*3 & 7]);
+}
+static void decode_bc7_mode6_block(const uint8_t * in, uint8_t (& out)[16][4])
+{
+    int position = 0;
+    auto read = [&](int bits) { uint32_t v = 0; for(int i=0; i<bits; ++i, ++position) v |= (in[position/8] >> position%8 & 1) << i; return v; };
+    REQUIRE(read(7) == 1 << 6);
+    int e[2][4];
+    for(int c=0; c<4; ++c) for(int j=0; j<2; ++j) e[j][c] = read(7) << 1;
+    for(int j=0; j<2; ++j) { const int p = read(1); for(int c=0; c<4; ++c) e[j][c] |= p; }
+    const int weights[16] {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+    for(int i=0; i<16; ++i)
+    {
+        const int index = read(i ? 4 : 3);
+        for(int c=0; c<4; ++c) out[i][c] = static_cast<uint8_t>(((64-weights[index])*e[0][c] + weights[index]*e[1][c] + 32) >> 6);
+    }
+}
+
+// Decodes every block of a compressed image back into R8G8B8A8, filling channels which the format does not store with 0 for color and 255 for alpha
+static std::vector<uint8_t> decode_test_image(const image & im)
+{
+    const int2 dims {im.get_width(), im.get_height()}, blocks {(dims.x+3)/4, (dims.y+3)/4};
+    const size_t block_size = compute_image_size({4,4}, im.get_format());
+    auto in = reinterpret_cast<const uint8_t *>(im.get_pixels());
+    std::vector<uint8_t> pixels(size_t(dims.x)*dims.y*4);
+    for(int by=0; by<blocks.y; ++by) for(int bx=0; bx<blocks.x; ++bx)
+    {
+        const uint8_t * block = in + (size_t(by)*blocks.x + bx)*block_size;
+        uint8_t texels[16][4] {}, values[16];
+        switch(im.get_format())
+        {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK: decode_bc1_block(block, false, texels); for(auto & t : texels) t[3] = 255; break;
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: decode_bc1_block(block, false, texels); break;
+        case VK_FORMAT_BC3_UNORM_BLOCK: decode_bc1_block(block+8, true, texels); decode_bc4_block(block, values); for(int i=0; i<16; ++i) texels[i][3] = values[i]; break;
+        case VK_FORMAT_BC4_UNORM_BLOCK: decode_bc4_block(block, values); for(int i=0; i<16; ++i) { texels[i][0] = values[i]; texels[i][3] = 255; } break;
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+            for(int c=0; c<2; ++c) { decode_bc4_block(block+c*8, values); for(int i=0; i<16; ++i) texels[i][c] = values[i]; }
+            for(auto & t : texels) t[3] = 255;
+            break;
+        case VK_FORMAT_BC7_UNORM_BLOCK: decode_bc7_mode6_block(block, texels); break;
+        default: FAIL("unexpected format");
+        }
+        for(int i=0; i<16; ++i)
+        {
+            const int x = bx*4 + i%4, y = by*4 + i/4;
+            if(x < dims.x && y < dims.y) memcpy(&pixels[(size_t(y)*dims.x + x)*4], texels[i], 4);
+        }
+    }
+    return pixels;
+}
+
+static image make_test_image(int2 dims, std::function<byte4(int x, int y)> f)
+{
+    image im {dims, VK_FORMAT_R8G8B8A8_UNORM};
+    for(int y=0; y<dims.y; ++y) for(int x=0; x<dims.x; ++x) reinterpret_cast<byte4 *>(im.get_pixels())[y*dims.x + x] = f(x, y);
+    return im;
+}
+
+static const uint8_t * get_test_bytes(const image & im) { return reinterpret_cast<const uint8_t *>(im.get_pixels()); }
+
+// Root mean square error of a single channel between an R8G8B8A8 image and decoded pixels
+static float get_channel_rmse(const image & source, const std::vector<uint8_t> & decoded, int channel)
+{
+    auto in = get_test_bytes(source);
+    double sum = 0;
+    for(size_t i=channel; i<decoded.size(); i+=4) sum += (in[i] - decoded[i]) * (in[i] - decoded[i]);
+    return static_cast<float>(std::sqrt(sum / (decoded.size()/4)));
+}
+
+TEST_CASE("compress_image encodes smooth images in every format within a small error", "[texture-cooker]")
+{
+    // Colors along a smooth gradient, with independent alpha and a little noise, in a size which is not a multiple of the block size
+    std::mt19937 engine;
+    const image source = make_test_image({22,13}, [&](int x, int y) { const int t = x*7 + y*5, n = static_cast<int>(engine() % 9) - 4; return byte4(std::clamp(20 + t + n, 0, 255), std::clamp(240 - t*4/5 + n, 0, 255), std::clamp(60 + t/2 + n, 0, 255), std::clamp(255 - x*y + n, 0, 255)); });
+
+    struct format_tolerance { VkFormat format; float rgb, alpha; int channels; };
+    for(auto [format, rgb, alpha, channels] : {format_tolerance{VK_FORMAT_BC1_RGB_UNORM_BLOCK, 8, 0, 3}, format_tolerance{VK_FORMAT_BC3_UNORM_BLOCK, 8, 4, 4}, format_tolerance{VK_FORMAT_BC4_UNORM_BLOCK, 4, 0, 1}, format_tolerance{VK_FORMAT_BC5_UNORM_BLOCK, 4, 0, 2}, format_tolerance{VK_FORMAT_BC7_UNORM_BLOCK, 5, 5, 4}})
+    {
+        const image compressed = compress_image(source, format);
+        REQUIRE(compressed.get_format() == format);
+        REQUIRE(compressed.get_width() == 22);
+        const auto decoded = decode_test_image(compressed);
+        for(int c=0; c<channels; ++c) REQUIRE(get_channel_rmse(source, decoded, c) < (c == 3 ? alpha : rgb));
+    }
+    REQUIRE_THROWS_AS(compress_image(source, VK_FORMAT_R8G8B8A8_UNORM), std::logic_error);
+    REQUIRE_THROWS_AS(compress_image(compress_image(source, VK_FORMAT_BC1_RGB_UNORM_BLOCK), VK_FORMAT_BC7_UNORM_BLOCK), std::logic_error);
+}
+
+TEST_CASE("BC1 uses three color mode for blocks with transparent pixels, and a single color for flat blocks", "[texture-cooker]")
+{
+    // Transparent pixels in a checkerboard, over a gradient
+    const image cutout = make_test_image({4,4}, [](int x, int y) { return byte4((x+y)*35, 220 - (x+y)*30, 40, (x+y)%2 ? 0 : 255); });
+    const image compressed = compress_image(cutout, VK_FORMAT_BC1_RGBA_UNORM_BLOCK);
+    auto block = get_test_bytes(compressed);
+    REQUIRE((block[0] | block[1] << 8) <= (block[2] | block[3] << 8));
+    const auto decoded = decode_test_image(compressed);
+    auto in = get_test_bytes(cutout);
+    for(int i=0; i<16; ++i)
+    {
+        REQUIRE(decoded[i*4+3] == in[i*4+3]);
+        if(in[i*4+3]) for(int c=0; c<3; ++c) REQUIRE(std::abs(decoded[i*4+c] - in[i*4+c]) < 40);
+    }
+
+    // The same block without transparency must stay in four color mode, even though it has no alpha to lose
+    const auto opaque = decode_test_image(compress_image(cutout, VK_FORMAT_BC1_RGB_UNORM_BLOCK));
+    for(int i=0; i<16; ++i) REQUIRE(opaque[i*4+3] == 255);
+
+    // A flat block quantizes both endpoints to the same color, which decoders treat as three color mode, so every index must select c0
+    for(auto format : {VK_FORMAT_BC1_RGB_UNORM_BLOCK, VK_FORMAT_BC1_RGBA_UNORM_BLOCK, VK_FORMAT_BC3_UNORM_BLOCK})
+    {
+        const image flat = make_test_image({4,4}, [](int, int) { return byte4(100, 150, 200, 255); });
+        const image flat_compressed = compress_image(flat, format);
+        auto color = get_test_bytes(flat_compressed) + (format == VK_FORMAT_BC3_UNORM_BLOCK ? 8 : 0);
+        REQUIRE((color[0] | color[1] << 8) == (color[2] | color[3] << 8));
+        const auto flat_decoded = decode_test_image(flat_compressed);
+        for(int i=0; i<16; ++i)
+        {
+            REQUIRE(flat_decoded[i*4+3] == 255);
+            for(int c=0; c<3; ++c) REQUIRE(std::abs(flat_decoded[i*4+c] - get_test_bytes(flat)[i*4+c]) <= 4);
+        }
+    }
+}
+
+TEST_CASE("BC4 uses six value mode to represent 0 and 255 exactly", "[texture-cooker]")
+{
+    const uint8_t values[16] {0, 255, 100, 110, 120, 130, 0, 255, 105, 115, 125, 0, 255, 100, 130, 118};
+    const image source = make_test_image({4,4}, [&](int x, int y) { return byte4(values[y*4+x], 0, 0, 255); });
+    const image compressed = compress_image(source, VK_FORMAT_BC4_UNORM_BLOCK);
+    auto block = get_test_bytes(compressed);
+    REQUIRE(block[0] <= block[1]);
+    const auto decoded = decode_test_image(compressed);
+    for(int i=0; i<16; ++i)
+    {
+        if(values[i] == 0 || values[i] == 255) REQUIRE(decoded[i*4] == values[i]);
+        else REQUIRE(std::abs(decoded[i*4] - values[i]) <= 4);
+    }
+
+    // A block which spans the whole range is better served by eight evenly spaced values
+    const image ramp = make_test_image({4,4}, [](int x, int y) { return byte4((y*4+x)*17, 0, 0, 255); });
+    const image ramp_compressed = compress_image(ramp, VK_FORMAT_BC4_UNORM_BLOCK);
+    REQUIRE(get_test_bytes(ramp_compressed)[0] > get_test_bytes(ramp_compressed)[1]);
+    REQUIRE(get_channel_rmse(ramp, decode_test_image(ramp_compressed), 0) < 12);
+}
+
+TEST_CASE("BC7 swaps endpoints so that the anchor index fits in three bits", "[texture-cooker]")
+{
+    // The first pixel of each block sits at opposite ends of the gradient, so one of the two must have its endpoints swapped
+    for(bool descending : {false, true})
+    {
+        const image source = make_test_image({4,4}, [&](int x, int y) { const int t = descending ? 15 - (y*4+x) : y*4+x; return byte4(t*16, 255 - t*12, 30 + t*8, 255 - t*4); });
+        const auto decoded = decode_test_image(compress_image(source, VK_FORMAT_BC7_UNORM_BLOCK));
+        for(int i=0; i<16; ++i) for(int c=0; c<4; ++c) REQUIRE(std::abs(decoded[i*4+c] - get_test_bytes(source)[i*4+c]) <= 8);
+    }
+}
+
+TEST_CASE("cooked textures round trip through KTX files in 2D, array and cube layouts", "[texture-cooker]")
+{
+    const image a = make_test_image({8,8}, [](int x, int y) { return byte4(x*32, y*32, 0, 255); });
+    const image b = make_test_image({8,8}, [](int x, int y) { return byte4(0, x*32, y*32, 255); });
+    const image wide = make_test_image({16,4}, [](int x, int y) { return byte4(x*16, y*64, 128, 255); });
+
+    struct texture_case { std::vector<const image *> layers; VkFormat format; bool is_cube; };
+    for(auto & t : {texture_case{{&wide}, VK_FORMAT_R8G8B8A8_UNORM, false}, texture_case{{&a, &b, &a}, VK_FORMAT_BC1_RGB_UNORM_BLOCK, false}, texture_case{{&a, &b, &a, &b, &a, &b}, VK_FORMAT_BC7_UNORM_BLOCK, true}})
+    {
+        const auto texture = cook_texture(t.layers, t.format, t.is_cube);
+        const auto & layout = texture.layout;
+        REQUIRE(layout.format == t.format);
+        REQUIRE(layout.layer_count == t.layers.size());
+        REQUIRE(layout.is_cube == t.is_cube);
+
+        // Levels halve down to 1x1, and each holds every layer, starting on a 16 byte boundary
+        const int2 dims {t.layers[0]->get_width(), t.layers[0]->get_height()};
+        REQUIRE(layout.levels.size() == (dims.x == 16 ? 5 : 4));
+        size_t offset = 0;
+        for(size_t i=0; i<layout.levels.size(); ++i)
+        {
+            auto & level = layout.levels[i];
+            REQUIRE(level.dims == int2(std::max(dims.x >> i, 1), std::max(dims.y >> i, 1)));
+            REQUIRE(level.layer_size == compute_image_size(level.dims, t.format));
+            REQUIRE(level.offset == offset);
+            REQUIRE(level.offset % 16 == 0);
+            offset = (level.offset + level.layer_size*layout.layer_count + 15) / 16 * 16;
+        }
+        REQUIRE(texture.contents.size() == layout.get_size());
+
+        // The base level holds each layer as given, or as compressed by compress_image(...)
+        for(size_t i=0; i<t.layers.size(); ++i)
+        {
+            const image expected = t.format == VK_FORMAT_R8G8B8A8_UNORM ? make_test_image(dims, [&](int x, int y) { return reinterpret_cast<const byte4 *>(t.layers[i]->get_pixels())[y*dims.x+x]; }) : compress_image(*t.layers[i], t.format);
+            REQUIRE(memcmp(texture.contents.data() + layout.levels[0].layer_size*i, expected.get_pixels(), layout.levels[0].layer_size) == 0);
+        }
+
+        save_ktx("test-texture.ktx", texture);
+        const auto loaded = load_ktx("test-texture.ktx");
+        REQUIRE(loaded.layout.format == layout.format);
+        REQUIRE(loaded.layout.layer_count == layout.layer_count);
+        REQUIRE(loaded.layout.is_cube == layout.is_cube);
+        REQUIRE(loaded.layout.levels.size() == layout.levels.size());
+        for(size_t i=0; i<layout.levels.size(); ++i)
+        {
+            REQUIRE(loaded.layout.levels[i].dims == layout.levels[i].dims);
+            REQUIRE(loaded.layout.levels[i].offset == layout.levels[i].offset);
+            REQUIRE(loaded.layout.levels[i].layer_size == layout.levels[i].layer_size);
+        }
+        REQUIRE(loaded.contents == texture.contents);
+
+        // Truncated files are rejected
+        auto bytes = read_test_file("test-texture.ktx");
+        bytes.resize(bytes.size() - 1);
+        write_test_file("test-texture.ktx", bytes);
+        REQUIRE_THROWS_AS(load_ktx("test-texture.ktx"), std::runtime_error);
+    }
+    std::remove("test-texture.ktx");
+
+    const image * mismatched[] {&a, &wide};
+    REQUIRE_THROWS_AS(cook_texture(mismatched, VK_FORMAT_R8G8B8A8_UNORM, false), std::runtime_error);
+    const image * too_few_faces[] {&a, &b, &a};
+    REQUIRE_THROWS_AS(cook_texture(too_few_faces, VK_FORMAT_R8G8B8A8_UNORM, true), std::runtime_error);
+}
+
+// Holds a single-threaded asset_loader busy until opened, so that the order of the loads queued behind it can be observed
+struct asset_loader_gate
+{
+    std::promise<void> started, opened;
+    std::shared_future<void> is_open {opened.get_future().share()};
+    asset_handle<int> block(asset_loader & loader)
+    {
+        auto handle = loader.submit(0, [this, f = is_open]() { started.set_value(); f.wait(); return -1; });
+        started.get_future().wait();
+        return handle;
+    }
+};
+
+TEST_CASE("asset_loader starts loads by priority, then in the order they were requested", "[asset-loader]")
+{
+    shader_compiler compiler;
+    asset_loader loader {compiler, 1};
+    asset_loader_gate gate;
+    auto blocker = gate.block(loader);
+
+    std::mutex mutex;
+    std::vector<int> order;
+    std::vector<asset_handle<int>> handles;
+    const int priorities[] {0, 5, 0, 5, -3, 10, 0};
+    for(int i=0; i<7; ++i) handles.push_back(loader.submit(priorities[i], [&, i]() { std::lock_guard<std::mutex> lock {mutex}; order.push_back(i); return i*i; }));
+    REQUIRE(!handles[0].is_ready());
+    gate.opened.set_value();
+
+    REQUIRE(blocker.get() == -1);
+    for(int i=0; i<7; ++i) REQUIRE(handles[i].get() == i*i);
+    REQUIRE((order == std::vector<int>{5, 1, 3, 0, 2, 6, 4}));
+}
+
+TEST_CASE("asset_loader reports cancelled and failed loads through get()", "[asset-loader]")
+{
+    shader_compiler compiler;
+    asset_loader loader {compiler, 1};
+    asset_loader_gate gate;
+    auto blocker = gate.block(loader);
+
+    bool cancelled_load_ran = false;
+    auto cancelled = loader.submit(0, [&]() { cancelled_load_ran = true; return 1; });
+    auto failed = loader.submit(0, []() -> int { throw std::runtime_error("load failed"); });
+    auto missing = loader.load_image("test-missing-image.png", false);
+    auto succeeded = loader.submit(0, []() { return 2; });
+    cancelled.cancel();
+    asset_handle<int>{}.cancel();
+    gate.opened.set_value();
+
+    REQUIRE_THROWS_AS(cancelled.get(), asset_load_cancelled);
+    REQUIRE(!cancelled_load_ran);
+    try { failed.get(); FAIL("expected an exception"); }
+    catch(const std::runtime_error & e) { REQUIRE(std::string(e.what()) == "load failed"); }
+    REQUIRE_THROWS_AS(missing.get(), std::runtime_error);
+    REQUIRE(succeeded.get() == 2);
+    REQUIRE(blocker.get() == -1);
+
+    // Cancelling a load which has already finished has no effect
+    auto finished = loader.submit(0, []() { return 3; });
+    finished.wait();
+    finished.cancel();
+    REQUIRE(finished.get() == 3);
+}
+
+TEST_CASE("asset_loader cancels pending loads on destruction, and waits for loads in progress", "[asset-loader]")
+{
+    shader_compiler compiler;
+    auto loader = std::make_unique<asset_loader>(compiler, 1);
+    asset_loader_gate gate;
+    auto in_progress = gate.block(*loader);
+    bool pending_load_ran = false;
+    auto pending = loader->submit(0, [&]() { pending_load_ran = true; return 8; });
+
+    // The destructor cancels pending loads straight away, but cannot return until the load in progress is allowed to finish
+    std::thread destroyer([&]() { loader.reset(); });
+    pending.wait();
+    const bool finished_early = in_progress.is_ready();
+    gate.opened.set_value();
+    destroyer.join();
+    REQUIRE(!finished_early);
+    REQUIRE_THROWS_AS(pending.get(), asset_load_cancelled);
+    REQUIRE(!pending_load_ran);
+    REQUIRE(in_progress.get() == -1);
+}
+
+TEST_CASE("save_binary_file replaces files whole, and reports failures", "[load]")
+{
+    const std::vector<uint8_t> first {1,2,3,4,5}, second {9,8};
+    save_binary_file("test-save.bin", first);
+    REQUIRE(load_binary_file("test-save.bin") == first);
+    save_binary_file("test-save.bin", second);
+    REQUIRE(load_binary_file("test-save.bin") == second);
+    save_binary_file("test-save.bin", {});
+    REQUIRE(load_binary_file("test-save.bin").empty());
+    std::remove("test-save.bin");
+    for(auto & entry : std::filesystem::directory_iterator(".")) REQUIRE(entry.path().extension() != ".tmp");
+
+    REQUIRE_THROWS_AS(save_binary_file("test-missing-directory/test-save.bin", first), std::runtime_error);
+}
@@ -0,0 +1,68 @@
+#include "asset-loader.h"
+#include <algorithm>
+
+asset_loader::asset_loader(shader_compiler & compiler, size_t thread_count) : compiler{compiler}
+{
+    for(size_t i=0; i<thread_count; ++i) workers.emplace_back([this]() { work(); });
+}
+
+asset_loader::~asset_loader()
+{
+    std::vector<task> abandoned;
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        stopping = true;
+        abandoned.swap(tasks);
+    }
+    tasks_available.notify_all();
+    for(auto & t : abandoned) t.run(true);
+    for(auto & w : workers) w.join();
+}
+
+void asset_loader::enqueue(int priority, std::function<void(bool cancelled)> run, std::shared_ptr<std::atomic<bool>> cancelled)
+{
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        if(stopping) throw std::logic_error("asset_loader is shutting down");
+        tasks.push_back({priority, next_sequence++, move(run), move(cancelled)});
+        std::push_heap(tasks.begin(), tasks.end());
+    }
+    tasks_available.notify_one();
+}
+
+void asset_loader::work()
+{
+    while(true)
+    {
+        task t;
+        {
+            std::unique_lock<std::mutex> lock {mutex};
+            tasks_available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if(tasks.empty()) return;
+            std::pop_heap(tasks.begin(), tasks.end());
+            t = std::move(tasks.back());
+            tasks.pop_back();
+        }
+        t.run(*t.cancelled);
+    }
+}
+
+asset_handle<image> asset_loader::load_image(const char * filename, bool is_linear, int priority)
+{
+    return submit(priority, [filename = std::string{filename}, is_linear]() { return ::load_image(filename.c_str(), is_linear); });
+}
+
+asset_handle<std::vector<mesh>> asset_loader::load_meshes_from_fbx(coord_system target, const char * filename, int priority, std::vector<mesh_optimization_stats> * stats)
+{
+    return submit(priority, [target, filename = std::string{filename}, stats]() { return ::load_meshes_from_fbx(target, filename.c_str(), stats); });
+}
+
+asset_handle<mesh> asset_loader::load_mesh_from_obj(coord_system target, const char * filename, int priority, mesh_optimization_stats * stats)
+{
+    return submit(priority, [target, filename = std::string{filename}, stats]() { return ::load_mesh_from_obj(target, filename.c_str(), stats); });
+}
+
+asset_handle<std::vector<uint32_t>> asset_loader::compile_glsl(VkShaderStageFlagBits stage, const char * filename, int priority)
+{
+    return submit(priority, [this, stage, filename = std::string{filename}]() { return compiler.compile_glsl(stage, filename.c_str()); });
+}
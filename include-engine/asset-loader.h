@@ -0,0 +1,79 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include "load.h"
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+// Thrown from asset_handle<T>::get() if the load was cancelled before it began
+struct asset_load_cancelled : std::runtime_error { asset_load_cancelled() : std::runtime_error("asset load cancelled") {} };
+
+// A handle to the result of an asynchronous load, which may be waited on, or cancelled if it has not yet started
+template<class T> class asset_handle
+{
+    std::future<T> result;
+    std::shared_ptr<std::atomic<bool>> cancelled;
+public:
+    asset_handle() {}
+    asset_handle(std::future<T> result, std::shared_ptr<std::atomic<bool>> cancelled) : result{move(result)}, cancelled{move(cancelled)} {}
+
+    bool is_ready() const { return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+    void wait() const { result.wait(); }
+    void cancel() { if(cancelled) *cancelled = true; } // Does nothing for a default constructed handle
+    T get() { return result.get(); } // Rethrows any exception raised by the load
+};
+
+// asset_loader decodes assets on a pool of worker threads. Higher priority loads are started first, and loads of equal priority are started in the order they were requested.
+class asset_loader
+{
+    struct task 
+    { 
+        int priority; 
+        uint64_t sequence; 
+        std::function<void(bool cancelled)> run; 
+        std::shared_ptr<std::atomic<bool>> cancelled; 
+        bool operator < (const task & r) const { return priority < r.priority || (priority == r.priority && sequence > r.sequence); }
+    };
+
+    std::mutex mutex;
+    std::condition_variable tasks_available;
+    std::vector<task> tasks; // Heap ordered by priority, then by sequence
+    uint64_t next_sequence {0};
+    bool stopping {false};
+    std::vector<std::thread> workers;
+
+    shader_compiler & compiler;
+
+    void enqueue(int priority, std::function<void(bool cancelled)> run, std::shared_ptr<std::atomic<bool>> cancelled);
+    void work();
+public:
+    // Shaders are compiled with the given compiler, usually the one owned by the renderer, which must outlive the loader
+    explicit asset_loader(shader_compiler & compiler, size_t thread_count = std::max(std::thread::hardware_concurrency(), 1u));
+    ~asset_loader(); // Loads which have not yet started are cancelled, loads in progress are waited on
+
+    template<class F> auto submit(int priority, F && load) -> asset_handle<decltype(load())>
+    {
+        using T = decltype(load());
+        auto promise = std::make_shared<std::promise<T>>();
+        auto cancelled = std::make_shared<std::atomic<bool>>(false);
+        asset_handle<T> handle {promise->get_future(), cancelled};
+        enqueue(priority, [promise, load = std::forward<F>(load)](bool cancelled) mutable
+        {
+            if(cancelled) promise->set_exception(std::make_exception_ptr(asset_load_cancelled{}));
+            else try { promise->set_value(load()); } catch(...) { promise->set_exception(std::current_exception()); }
+        }, cancelled);
+        return handle;
+    }
+
+    asset_handle<image> load_image(const char * filename, bool is_linear, int priority=0);
+    // If stats is given, it is filled in before the handle becomes ready, and must remain valid until then
+    asset_handle<std::vector<mesh>> load_meshes_from_fbx(coord_system target, const char * filename, int priority=0, std::vector<mesh_optimization_stats> * stats=nullptr);
+    asset_handle<mesh> load_mesh_from_obj(coord_system target, const char * filename, int priority=0, mesh_optimization_stats * stats=nullptr);
+    asset_handle<std::vector<uint32_t>> compile_glsl(VkShaderStageFlagBits stage, const char * filename, int priority=0);
+};
+
+#endif
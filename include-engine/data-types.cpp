@@ -19,6 +19,11 @@ size_t compute_image_size(int2 dims, VkFormat format)
     if(format <= VK_FORMAT_R32G32B32_SFLOAT) return product(dims)*12;
     if(format <= VK_FORMAT_R32G32B32A32_SFLOAT) return product(dims)*16;
     if(format <= VK_FORMAT_E5B9G9R9_UFLOAT_PACK32) return product(dims)*4;
+    if(format <= VK_FORMAT_D32_SFLOAT_S8_UINT) throw std::logic_error("unknown format");
+    if(format <= VK_FORMAT_BC1_RGBA_SRGB_BLOCK) return product((dims+3)/4)*8;
+    if(format <= VK_FORMAT_BC3_SRGB_BLOCK) return product((dims+3)/4)*16;
+    if(format <= VK_FORMAT_BC4_SNORM_BLOCK) return product((dims+3)/4)*8;
+    if(format <= VK_FORMAT_BC7_SRGB_BLOCK) return product((dims+3)/4)*16;
     throw std::logic_error("unknown format");
 }
 
@@ -30,6 +30,8 @@ template<class T> struct array_view
     const T * data;
     size_t size;
 
+    array_view() : data{}, size{} {}
+    array_view(const T * data, size_t size) : data{data}, size{size} {}
     template<size_t N> array_view(const T (& array)[N]) : data{array}, size{countof(array)} {}
     template<size_t N> array_view(const std::array<T,N> & array) : data{array.data()}, size{countof(array)} {}
     array_view(std::initializer_list<T> ilist) : data{ilist.begin()}, size{countof(ilist)} {}
@@ -61,6 +63,24 @@ public:
     byte * get_pixels() { return pixels.get(); }
 };
 
+// The arrangement of a texture whose mip levels were built ahead of time. The layers of each level are stored contiguously,
+// starting from the offset of that level, and every offset is aligned to a multiple of the size of a compressed block.
+struct texture_level { int2 dims; size_t offset, layer_size; };
+struct texture_layout
+{
+    VkFormat format {VK_FORMAT_UNDEFINED};
+    uint32_t layer_count {1};
+    bool is_cube {false};
+    std::vector<texture_level> levels;
+
+    size_t get_size() const { return levels.empty() ? 0 : levels.back().offset + levels.back().layer_size*layer_count; }
+};
+struct cooked_texture
+{
+    texture_layout layout;
+    std::vector<uint8_t> contents;
+};
+
 // A value type representing an abstract direction vector in 3D space, independent of any coordinate system
 enum class coord_axis { forward, back, left, right, up, down, north=forward, east=right, south=back, west=left };
 constexpr float dot(coord_axis a, coord_axis b)
@@ -214,7 +234,7 @@ template<class Transform> mesh transform(const Transform & t, mesh m)
 struct shader_info
 {
     struct type;
-    enum scalar_type { uint_, int_, float_, double_ };
+    enum scalar_type { uint_, int_, float_, double_, bool_ };
     struct matrix_layout { uint32_t stride; bool row_major; };
     struct structure_member { std::string name; std::unique_ptr<const type> type; std::optional<uint32_t> offset; };
     struct numeric { scalar_type scalar; uint32_t row_count, column_count; std::optional<matrix_layout> matrix_layout; };
@@ -223,10 +243,12 @@ struct shader_info
     struct structure { std::string name; std::vector<structure_member> members; };
     struct type { std::variant<sampler, numeric, array, structure> contents; };
     struct descriptor { uint32_t set, binding; std::string name; type type; };
+    struct specialization_constant { uint32_t id; std::string name; scalar_type type; uint64_t default_value; }; // default_value holds the bits of the default, zero extended
 
     VkShaderStageFlagBits stage;
     std::string name;
     std::vector<descriptor> descriptors;
+    std::vector<specialization_constant> specialization_constants; // Sorted by constant_id
 };
 
 #endif
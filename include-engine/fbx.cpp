@@ -3,323 +3,456 @@
 #include <sstream>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <thread>
+#include <algorithm>
+#include <charconv>
 #include <zlib.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
 
 namespace fbx
 {
     namespace ast
     {
-        ///////////////////////////////
-        // Binary file format reader //
-        ///////////////////////////////
-
-        template<class T> T read(std::istream & in, const char * desc)
+        void convert_elements(const double * in, float * out, size_t count)
         {
-            T value;
-            if(in.read(reinterpret_cast<char *>(&value), sizeof(T))) return value;
-            std::ostringstream ss;
-            ss << "failed to read " << desc;
-            throw std::runtime_error(ss.str());
+            size_t i = 0;
+        #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+            for(; i+4 <= count; i+=4)
+            {
+                const __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(in+i)), hi = _mm_cvtpd_ps(_mm_loadu_pd(in+i+2));
+                _mm_storeu_ps(out+i, _mm_movelh_ps(lo, hi));
+            }
+        #endif
+            for(; i<count; ++i) out[i] = static_cast<float>(in[i]);
         }
 
-        template<class T> T read_scalar(std::istream & in)
+        static_assert(std::is_trivially_destructible_v<property> && std::is_trivially_destructible_v<node>, "AST is allocated from an arena and must not require destruction");
+
+        template<class T> array_view<T> copy_to_arena(memory_arena & arena, const T * elements, size_t count)
         {
-            return read<T>(in, typeid(T).name());
+            T * copy = arena.allocate<T>(count);
+            if(count) memcpy(copy, elements, sizeof(T)*count);
+            return {copy, count};
         }
+        template<class T> array_view<T> copy_to_arena(memory_arena & arena, const std::vector<T> & elements) { return copy_to_arena(arena, elements.data(), elements.size()); }
+        std::string_view copy_to_arena(memory_arena & arena, std::string_view s) { return {copy_to_arena(arena, s.data(), s.size()).data, s.size()}; }
 
-        template<class T> std::vector<T> read_array(std::istream & in)
+        ///////////////////////////////
+        // Binary file format reader //
+        ///////////////////////////////
+
+        struct binary_reader
         {
-            const auto array_length = read<uint32_t>(in, "array_length");
-            const auto encoding = read<uint32_t>(in, "encoding");
-            const auto compressed_length = read<uint32_t>(in, "compressed_length");
+            const char * first, * it, * last;
+            memory_arena & arena;
+            std::vector<std::vector<node>> scratch; // Reusable buffers for accumulating the child nodes at each level of the tree
+            std::vector<document::deferred_entry> & deferred_arrays;
+            std::string_view node_name;             // Name of the node whose properties are currently being read
 
-            std::vector<T> elements(array_length);
-            if(encoding == 0)
-            {
-                if(!in.read(reinterpret_cast<char *>(elements.data()), sizeof(T)*elements.size())) throw std::runtime_error("failed to read array data");
-                return elements;
-            }
+            size_t tell() const { return it - first; }
 
-            if(encoding == 1)
+            const char * read_bytes(size_t length, const char * desc)
             {
-                std::vector<Byte> compressed(compressed_length);
-                if(!in.read(reinterpret_cast<char *>(compressed.data()), compressed.size())) throw std::runtime_error("failed to read compressed array data");
-            
-                z_stream strm {};
-                strm.next_in = compressed.data();
-                strm.avail_in = static_cast<uInt>(compressed.size());
-                strm.next_out = reinterpret_cast<Bytef *>(elements.data());
-                strm.avail_out = static_cast<uInt>(elements.size() * sizeof(T));
-                if(inflateInit(&strm) != Z_OK) throw std::runtime_error("inflateInit(...) failed");
-                if(inflate(&strm, Z_NO_FLUSH) == Z_STREAM_ERROR) throw std::runtime_error("inflate(...) failed");
-                if(inflateEnd(&strm) != Z_OK) throw std::runtime_error("inflateEnd(...) failed");
-                return elements;
+                if(static_cast<size_t>(last - it) < length)
+                {
+                    std::ostringstream ss;
+                    ss << "failed to read " << desc;
+                    throw std::runtime_error(ss.str());
+                }
+                const char * bytes = it;
+                it += length;
+                return bytes;
             }
 
-            throw std::runtime_error("unknown array encoding");
-        }
-
-        property read_property(std::istream & in)
-        {
-            const auto type = read<uint8_t>(in, "type");
-            if(type == 'S')
+            template<class T> T read(const char * desc)
             {
-                const auto length = read<uint32_t>(in, "length");
-                std::string string(length, ' ');
-                if(!in.read(&string[0], length)) throw std::runtime_error("failed to read string");
-                return {string};
+                T value;
+                memcpy(&value, read_bytes(sizeof(T), desc), sizeof(T));
+                return value;
             }
-            else if(type == 'R')
+
+            template<class T> T read_scalar()
             {
-                const auto length = read<uint32_t>(in, "length");
-                std::vector<uint8_t> raw(length);
-                if(!in.read(reinterpret_cast<char *>(raw.data()), length)) throw std::runtime_error("failed to read raw data");
-                return {raw};
+                return read<T>(typeid(T).name());
             }
-            else if(type == 'C') return {read_scalar<boolean>(in)};
-            else if(type == 'Y') return {read_scalar<int16_t>(in)};
-            else if(type == 'I') return {read_scalar<int32_t>(in)};
-            else if(type == 'L') return {read_scalar<int64_t>(in)};
-            else if(type == 'F') return {read_scalar<float>(in)};
-            else if(type == 'D') return {read_scalar<double>(in)};
-            else if(type == 'b') return {read_array<boolean>(in)};
-            else if(type == 'y') return {read_array<int16_t>(in)};
-            else if(type == 'i') return {read_array<int32_t>(in)};
-            else if(type == 'l') return {read_array<int64_t>(in)};
-            else if(type == 'f') return {read_array<float>(in)};
-            else if(type == 'd') return {read_array<double>(in)};
-            else 
+
+            template<class T> property read_array()
             {
-                std::ostringstream ss;
-                ss << "unknown property type '" << type << '\'';
-                throw std::runtime_error(ss.str());
-            }
-        }
+                const auto array_length = read<uint32_t>("array_length");
+                const auto encoding = read<uint32_t>("encoding");
+                const auto compressed_length = read<uint32_t>("compressed_length");
 
-        std::vector<node> read_node_list(std::istream & in);
+                if(encoding == 0)
+                {
+                    // Refer to the array contents in place, unless they are not suitably aligned for T
+                    const char * elements = read_bytes(sizeof(T)*array_length, "array data");
+                    if(reinterpret_cast<uintptr_t>(elements) % alignof(T) == 0) return {array_view<T>{reinterpret_cast<const T *>(elements), array_length}};
+                    return {copy_to_arena(arena, reinterpret_cast<const T *>(elements), array_length)};
+                }
 
-        std::optional<node> read_node(std::istream & in)
-        {
-            // Read node header
-            const auto end_offset           = read<uint32_t>(in, "end_offset");
-            const auto num_properties       = read<uint32_t>(in, "num_properties");
-            const auto property_list_len    = read<uint32_t>(in, "property_list_len");
-            const auto name_len             = read<uint8_t>(in, "name_len");
-
-            // If all header entries are zero, this is a null node (used to terminate lists of child nodes)
-            if(end_offset == 0 && num_properties == 0 && property_list_len == 0 && name_len == 0) return std::nullopt;
-
-            // Read name
-            node node;
-            node.name.resize(name_len);
-        
-            if(!in.read(&node.name[0], name_len)) throw std::runtime_error("failed to read name");
-       
-            // Read property list
-            const std::streamoff property_list_start = in.tellg();
-            for(uint32_t i=0; i<num_properties; ++i)
-            {
-                node.properties.push_back(read_property(in));
+                if(encoding == 1)
+                {
+                    // Reserve storage now, as the arena is not thread safe, but defer the actual inflation until the contents are needed
+                    const char * compressed = read_bytes(compressed_length, "compressed array data");
+                    T * elements = arena.allocate<T>(array_length);
+                    auto * deferred = new(arena.allocate<deferred_array>(1)) deferred_array(compressed, compressed_length, elements, sizeof(T)*array_length);
+                    deferred_arrays.push_back({node_name, deferred});
+                    return {array_view<T>{elements, array_length}, deferred};
+                }
+
+                throw std::runtime_error("unknown array encoding");
             }
-            if(static_cast<uint32_t>(in.tellg()) != property_list_start + property_list_len) throw std::runtime_error("malformed property list");   
 
-            // Read child nodes
-            if(static_cast<uint32_t>(in.tellg()) != end_offset)
+            property read_property()
             {
-                node.children = read_node_list(in);
-                if(static_cast<uint32_t>(in.tellg()) != end_offset) throw std::runtime_error("malformed children list");           
+                const auto type = read<uint8_t>("type");
+                if(type == 'S')
+                {
+                    const auto length = read<uint32_t>("length");
+                    return {std::string_view{read_bytes(length, "string"), length}};
+                }
+                else if(type == 'R')
+                {
+                    const auto length = read<uint32_t>("length");
+                    return {array_view<uint8_t>{reinterpret_cast<const uint8_t *>(read_bytes(length, "raw data")), length}};
+                }
+                else if(type == 'C') return {read_scalar<boolean>()};
+                else if(type == 'Y') return {read_scalar<int16_t>()};
+                else if(type == 'I') return {read_scalar<int32_t>()};
+                else if(type == 'L') return {read_scalar<int64_t>()};
+                else if(type == 'F') return {read_scalar<float>()};
+                else if(type == 'D') return {read_scalar<double>()};
+                else if(type == 'b') return read_array<boolean>();
+                else if(type == 'y') return read_array<int16_t>();
+                else if(type == 'i') return read_array<int32_t>();
+                else if(type == 'l') return read_array<int64_t>();
+                else if(type == 'f') return read_array<float>();
+                else if(type == 'd') return read_array<double>();
+                else 
+                {
+                    std::ostringstream ss;
+                    ss << "unknown property type '" << type << '\'';
+                    throw std::runtime_error(ss.str());
+                }
             }
 
-            return node;
-        }
+            std::optional<node> read_node(size_t depth)
+            {
+                // Read node header
+                const auto end_offset           = read<uint32_t>("end_offset");
+                const auto num_properties       = read<uint32_t>("num_properties");
+                const auto property_list_len    = read<uint32_t>("property_list_len");
+                const auto name_len             = read<uint8_t>("name_len");
+
+                // If all header entries are zero, this is a null node (used to terminate lists of child nodes)
+                if(end_offset == 0 && num_properties == 0 && property_list_len == 0 && name_len == 0) return std::nullopt;
+
+                // Read name
+                node node;
+                node.name = node_name = {read_bytes(name_len, "name"), name_len};
+
+                // Read property list, every property occupies at least one byte
+                if(num_properties > property_list_len) throw std::runtime_error("malformed property list");
+                const size_t property_list_start = tell();
+                auto * properties = arena.allocate<property>(num_properties);
+                for(uint32_t i=0; i<num_properties; ++i) new(properties + i) property(read_property());
+                node.properties = {properties, num_properties};
+                if(tell() != property_list_start + property_list_len) throw std::runtime_error("malformed property list");   
+
+                // Read child nodes
+                if(tell() != end_offset)
+                {
+                    node.children = read_node_list(depth + 1);
+                    if(tell() != end_offset) throw std::runtime_error("malformed children list");           
+                }
 
-        std::vector<node> read_node_list(std::istream & in)
-        {
-            std::vector<node> nodes;
-            while(true)
+                return node;
+            }
+
+            array_view<node> read_node_list(size_t depth)
             {
-                auto n = read_node(in);
-                if(n) nodes.push_back(*std::move(n));
-                else return nodes;
+                // NOTE: scratch may be resized by nested calls, so we must not hold a reference to scratch[depth] across them
+                if(scratch.size() <= depth) scratch.resize(depth + 1);
+                scratch[depth].clear();
+                while(true)
+                {
+                    auto n = read_node(depth);
+                    if(n) scratch[depth].push_back(*n);
+                    else return copy_to_arena(arena, scratch[depth]);
+                }
             }
-        }
+        };
 
         //////////////////////////////
         // ASCII file format reader //
         //////////////////////////////
 
-        template<class T> std::optional<T> parse_number(const std::string & s)
+        struct ascii_reader
         {
-            std::istringstream in(s);
-            T number;
-            if(!(in >> number)) return std::nullopt;
-            in.get();
-            if(!!in.good()) return std::nullopt;
-            return number;
-        }
+            const char * it, * last;
+            memory_arena & arena;
+            std::vector<std::vector<node>> scratch;             // Reusable buffers for accumulating the child nodes at each level of the tree
+            std::vector<std::vector<property>> property_scratch; // Reusable buffers for accumulating the properties at each level of the tree
+            std::vector<int64_t> integer_scratch;               // Reusable buffers for accumulating array contents before their element type is known
+            std::vector<double> real_scratch;
 
-        void skip_whitespace(std::istream & in)
-        {
-            while(true)
+            static bool is_space(char ch) { return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\v' || ch == '\f'; }
+            static bool is_delimiter(char ch) { return is_space(ch) || ch == ',' || ch == '{' || ch == '}'; }
+
+            bool at_end() const { return it == last; }
+            char peek() const { return it != last ? *it : '\0'; }
+
+            void skip_whitespace()
             {
-                if(!in.good()) return;
-                int ch = in.get();
-                if(isspace(ch)) continue;
-                if(ch == ';')
+                while(it != last)
                 {
-                    while(!!in.good() && ch != '\n') ch = in.get();
-                    continue;
+                    if(is_space(*it)) ++it;
+                    else if(*it == ';') while(it != last && *it != '\n') ++it;
+                    else return;
                 }
-                in.unget();
-                return;
             }
-        }
 
-        std::string parse_key(std::istream & in)
-        {
-            std::string s;
-            while(true)
+            bool consume(char ch)
             {
-                if(!in.good()) throw std::runtime_error("missing ':' after "+s);
-                int ch = in.get();
-                if(ch == ':') return s;
-                s += ch;
+                skip_whitespace();
+                if(peek() != ch) return false;
+                ++it;
+                return true;
             }
-        }
 
-        std::string parse_token(std::istream & in)
-        {
-            std::string s;
-            while(true)
+            std::string_view parse_key()
             {
-                int ch = in.get();
-                if(isspace(ch) || ch == ',') 
-                {
-                    in.unget();
-                    return s;
-                }
-                s.push_back(ch);
+                skip_whitespace();
+                const char * key = it;
+                while(it != last && *it != ':') ++it;
+                if(it == last) throw std::runtime_error("missing ':' after " + std::string(key, it));
+                return {key, static_cast<size_t>(it++ - key)};
             }
-        }
-
-        std::optional<property> parse_property(std::istream & in)
-        {
-            skip_whitespace(in);
-            int ch = in.get();
-
-            // Boolean
-            if(ch == 'F' && (isspace(in.peek()) || in.peek() == ',')) return property{boolean{0}};
-            if(ch == 'T' && (isspace(in.peek()) || in.peek() == ',')) return property{boolean{1}};
 
-            // Number
-            if(isdigit(ch) || ch == '-')
+            // Parses a number as an integer if it has no fractional part or exponent, or as a real number otherwise
+            template<class Integer, class Real> bool parse_number(Integer & integer, Real & real)
             {
-                in.unget();
-                auto s = parse_token(in);
-                if(auto n = parse_number<int64_t>(s)) return property{*n};
-                if(auto d = parse_number<double>(s)) return property{*d};
-                throw std::runtime_error("not a number: "+s);
+                auto r = std::from_chars(it, last, integer);
+                if(r.ec == std::errc{} && (r.ptr == last || (*r.ptr != '.' && *r.ptr != 'e' && *r.ptr != 'E'))) { it = r.ptr; return true; }
+                r = std::from_chars(it, last, real);
+                if(r.ec != std::errc{}) throw std::runtime_error("not a number: " + std::string(it, std::find_if(it, last, is_delimiter)));
+                it = r.ptr;
+                return false;
             }
 
-            // String
-            if(ch == '"')
+            property parse_array()
             {
-                std::string s;
-                while(true)
+                size_t length;
+                auto r = std::from_chars(it, last, length);
+                if(r.ec != std::errc{}) throw std::runtime_error("invalid array length");
+                it = r.ptr;
+                if(!consume('{') || parse_key() != "a") throw std::runtime_error("missing array contents");
+
+                // Accumulate integers until the first real number is encountered, at which point all prior elements are promoted
+                integer_scratch.clear();
+                real_scratch.clear();
+                bool integral = true;
+                skip_whitespace();
+                if(peek() != '}') while(true)
                 {
-                    ch = in.get();
-                    if(ch == '"') return property{s};
-                    s += ch;
+                    skip_whitespace();
+                    int64_t integer; double real;
+                    if(parse_number(integer, real))
+                    {
+                        if(integral) integer_scratch.push_back(integer);
+                        else real_scratch.push_back(static_cast<double>(integer));
+                    }
+                    else
+                    {
+                        if(integral) real_scratch.assign(integer_scratch.begin(), integer_scratch.end());
+                        integral = false;
+                        real_scratch.push_back(real);
+                    }
+                    if(consume(',')) continue;
+                    break;
+                }
+                if(!consume('}')) throw std::runtime_error("missing }");
+
+                // Produce the narrowest array type that the binary format would use to store these elements
+                const size_t count = integral ? integer_scratch.size() : real_scratch.size();
+                if(count != length) throw std::runtime_error("array length mismatch");
+                if(!integral) return {copy_to_arena(arena, real_scratch)};
+                if(std::all_of(integer_scratch.begin(), integer_scratch.end(), [](int64_t n) { return n == static_cast<int32_t>(n); }))
+                {
+                    auto * elements = arena.allocate<int32_t>(count);
+                    std::copy(integer_scratch.begin(), integer_scratch.end(), elements);
+                    return {array_view<int32_t>{elements, count}};
                 }
+                return {copy_to_arena(arena, integer_scratch)};
             }
 
-            // Array
-            if(ch == '*')
+            std::optional<property> parse_property()
             {
-                auto s = parse_token(in);
-                auto len = parse_number<size_t>(s);
-                if(!len) throw std::runtime_error("invalid array length: "+s);
-                skip_whitespace(in);
-                if(in.get() != '{') throw std::runtime_error("missing array contents");
-                skip_whitespace(in);
-                if(parse_key(in) != "a") throw std::runtime_error("missing array contents");
-                std::vector<double> contents(*len);
-                for(size_t i=0; i<contents.size(); ++i)
+                skip_whitespace();
+                if(at_end()) return std::nullopt;
+                const char ch = *it;
+
+                // Boolean
+                if((ch == 'T' || ch == 'F') && (it+1 == last || is_delimiter(it[1])))
                 {
-                    skip_whitespace(in);
-                    if(auto d = parse_number<double>(parse_token(in))) contents[i] = *d;
-                    else throw std::runtime_error("not a number: "+s);
-                    skip_whitespace(in);
-                    int ch = in.get();
-                    if(i+1 < len && ch != ',') throw std::runtime_error("missing ,");
-                    if(i+1 == len && ch != '}') throw std::runtime_error("missing }");            
+                    ++it;
+                    return property{boolean{static_cast<uint8_t>(ch == 'T')}};
                 }
-                return property{contents};
-            }
 
-            // Not a property
-            in.unget();
-            return std::nullopt;
-        }
+                // Number
+                if(isdigit(static_cast<unsigned char>(ch)) || ch == '-')
+                {
+                    int64_t integer; double real;
+                    if(parse_number(integer, real)) return property{integer};
+                    return property{real};
+                }
 
-        node parse_node(std::istream & in)
-        {
-            skip_whitespace(in);
-            node node;
-            node.name = parse_key(in);
-            while(true)
-            {
-                if(auto prop = parse_property(in))
+                // String, referred to in place
+                if(ch == '"')
                 {
-                    node.properties.push_back(*prop);
+                    const char * s = ++it;
+                    while(it != last && *it != '"') ++it;
+                    if(it == last) throw std::runtime_error("unterminated string");
+                    return property{std::string_view{s, static_cast<size_t>(it++ - s)}};
+                }
 
-                    skip_whitespace(in);
-                    int ch = in.get();
-                    if(ch == ',') continue;
-                    in.unget();
+                // Array
+                if(ch == '*')
+                {
+                    ++it;
+                    return parse_array();
                 }
-                break;
+
+                // Not a property
+                return std::nullopt;
             }
 
-            skip_whitespace(in);
-            int ch = in.get();
-            if(ch == '{')
+            node parse_node(size_t depth)
             {
+                node node;
+                node.name = parse_key();
+
+                // NOTE: scratch buffers may be resized by nested calls, so we must not hold references to them across those calls
+                if(property_scratch.size() <= depth) property_scratch.resize(depth + 1);
+                property_scratch[depth].clear();
+                while(auto prop = parse_property())
+                {
+                    property_scratch[depth].push_back(*prop);
+                    if(!consume(',')) break;
+                }
+                node.properties = copy_to_arena(arena, property_scratch[depth]);
+
+                if(consume('{')) node.children = parse_node_list(depth + 1, true);
+                return node;
+            }
+
+            array_view<node> parse_node_list(size_t depth, bool nested)
+            {
+                if(scratch.size() <= depth) scratch.resize(depth + 1);
+                scratch[depth].clear();
                 while(true)
                 {
-                    skip_whitespace(in);
-                    int ch = in.get();
-                    if(ch == '}') 
+                    skip_whitespace();
+                    if(nested && consume('}')) break;
+                    if(at_end())
                     {
+                        if(nested) throw std::runtime_error("missing }");
                         break;
                     }
-                    in.unget();
-                    node.children.push_back(parse_node(in));
+                    auto n = parse_node(depth);
+                    scratch[depth].push_back(n);
                 }
+                return copy_to_arena(arena, scratch[depth]);
             }
-            else in.unget();
-            return node;
-        }
-    
-        document load(std::istream & in)
+        };
+
+        void parse_document(document & doc, const char * first, const char * last)
         {
             // Try reading file as FBX binary
-            char header[23] {};
-            if(in.read(header, sizeof(header)) && strcmp("Kaydara FBX Binary  ", header) == 0)
+            const char header[] = "Kaydara FBX Binary  ";
+            if(last - first >= 27 && memcmp(first, header, sizeof(header)) == 0)
             {
-                return {read<uint32_t>(in, "version"), read_node_list(in)};
+                binary_reader reader {first, first + 23, last, doc.arena, {}, doc.deferred_arrays};
+                doc.version = reader.read<uint32_t>("version");
+                doc.nodes = reader.read_node_list(0);
+                return;
             }
 
             // Try reading file as FBX ascii
-            in.seekg(0);
+            ascii_reader reader {first, last, doc.arena};
+            doc.version = 0;
+            doc.nodes = reader.parse_node_list(0, false);
+        }
+
+        document load(const char * filename)
+        {
+            document doc {mapped_file{filename}};
+            parse_document(doc, doc.file.begin(), doc.file.end());
+            return doc;
+        }
+
+        document load(array_view<uint8_t> contents)
+        {
             document doc {};
-            while(true) 
+            parse_document(doc, reinterpret_cast<const char *>(contents.begin()), reinterpret_cast<const char *>(contents.end()));
+            return doc;
+        }
+
+        document load(std::istream & in)
+        {
+            // Read the entire stream into the arena, and parse it in place
+            document doc {};
+            in.seekg(0, std::istream::end);
+            const size_t length = static_cast<size_t>(in.tellg());
+            in.seekg(0);
+            char * contents = doc.arena.allocate<char>(length);
+            if(!in.read(contents, length)) throw std::runtime_error("failed to read stream");
+            parse_document(doc, contents, contents + length);
+            return doc;
+        }
+
+        //////////////////////////////////
+        // Deferred inflation of arrays //
+        //////////////////////////////////
+
+        void deferred_array::inflate_slow() const
+        {
+            // Exactly one thread claims the array and inflates it, any others wait for it to finish
+            uint32_t expected = compressed;
+            if(state.compare_exchange_strong(expected, inflating))
+            {
+                z_stream strm {};
+                strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(source));
+                strm.avail_in = source_length;
+                strm.next_out = reinterpret_cast<Bytef *>(target);
+                strm.avail_out = static_cast<uInt>(target_length);
+                // The stream must be well formed and fill the array exactly, or later reads would see partially inflated contents
+                const bool initialized = inflateInit(&strm) == Z_OK;
+                const bool inflated_all = initialized && ::inflate(&strm, Z_FINISH) == Z_STREAM_END && strm.total_out == target_length;
+                if(initialized) inflateEnd(&strm);
+                if(!inflated_all)
+                {
+                    state.store(failed, std::memory_order_release);
+                    throw std::runtime_error("inflate(...) failed");
+                }
+                state.store(inflated, std::memory_order_release);
+                return;
+            }
+            while((expected = state.load(std::memory_order_acquire)) == inflating) std::this_thread::yield();
+            if(expected == failed) throw std::runtime_error("inflate(...) failed");
+        }
+
+        void inflate_arrays(const document & doc, array_view<std::string_view> node_names)
+        {
+            std::vector<const deferred_array *> arrays;
+            for(auto & entry : doc.deferred_arrays)
             {
-                skip_whitespace(in);
-                if(!in.good()) break;
-                doc.nodes.push_back(parse_node(in));
+                if(std::find(node_names.begin(), node_names.end(), entry.node_name) != node_names.end()) arrays.push_back(entry.array);
             }
-            return doc;
+            parallel_for(arrays.size(), [&arrays](size_t i) { arrays[i]->inflate(); });
         }
     }
 
@@ -331,9 +464,9 @@ namespace fbx
     {
         std::ostream & out;
 
-        void operator() (const std::string & string) { out << '"' << string << '"'; }
+        void operator() (const std::string_view & string) { out << '"' << string << '"'; }
         template<class T> void operator() (const T & scalar) { out << scalar; }    
-        template<class T> void operator() (const std::vector<T> & array) { out << typeid(T).name() << '[' << array.size() << ']'; }
+        template<class T> void operator() (const array_view<T> & array) { out << typeid(T).name() << '[' << array.size << ']'; }
     };
 
     void print(std::ostream & out, int indent, const ast::node & node)
@@ -342,7 +475,7 @@ namespace fbx
         for(int i=0; i<indent; ++i) out << "  ";
         out << node.name;
         for(auto & prop : node.properties) out << ' ' << prop;
-        if(!node.children.empty())
+        if(node.children.size)
         {
             out << ':';
             for(auto & child : node.children) print(out, indent + 1, child);
@@ -352,12 +485,12 @@ namespace fbx
     template<class T> constexpr T rad_to_deg = static_cast<T>(57.295779513082320876798154814105);
     template<class T> constexpr T deg_to_rad = static_cast<T>(0.0174532925199432957692369076848);
 
-    const ast::node & find(const std::vector<ast::node> & nodes, std::string_view name)
+    const ast::node & find(array_view<ast::node> nodes, std::string_view name)
     {
         for(auto & n : nodes) if(n.name == name) return n;
         throw std::runtime_error("missing node " + std::string(name));
     }
-    const ast::node * find_maybe(const std::vector<ast::node> & nodes, std::string_view name)
+    const ast::node * find_maybe(array_view<ast::node> nodes, std::string_view name)
     {
         for(auto & n : nodes) if(n.name == name) return &n;
         return nullptr;
@@ -368,20 +501,21 @@ namespace fbx
         enum mapping_information_type { by_vertex, by_polygon_vertex, by_polygon, by_edge, all_same };
         enum reference_information_type { direct, index_to_direct };
 
-        const ast::property * array, * index_array = 0;
+        std::vector<float> values;
+        std::vector<size_t> indices;
         mapping_information_type mapping;
         reference_information_type reference;
 
         size_t get_value_index(size_t mapping_index) const
         {
             if(reference == direct) return mapping_index;
-            if(reference == index_to_direct) return index_array->get<size_t>(mapping_index);
+            if(reference == index_to_direct) return indices[mapping_index];
             throw std::logic_error("bad reference_information_type");
         }
     public:
         layer_info(const ast::node & node, std::string_view array_name, std::string_view index_array_name)
         {
-            array = &find(node.children, array_name).properties[0];
+            values = find(node.children, array_name).properties[0].get_elements<float>();
 
             auto mapping_type = find(node.children, "MappingInformationType").properties[0].get_string();
             if(mapping_type == "ByVertex" || mapping_type == "ByVertice") mapping = by_vertex;
@@ -389,16 +523,16 @@ namespace fbx
             else if(mapping_type == "ByPolygonVertex") mapping = by_polygon_vertex;
             else if(mapping_type == "ByEdge") mapping = by_edge;
             else if(mapping_type == "AllSame") mapping = all_same;
-            else throw std::runtime_error("unsupported MappingInformationType: " + mapping_type);
+            else throw std::runtime_error("unsupported MappingInformationType: " + std::string(mapping_type));
 
             auto reference_type = find(node.children, "ReferenceInformationType").properties[0].get_string();
             if(reference_type == "Direct") reference = direct;
             else if(reference_type == "IndexToDirect")
             {
                 reference = index_to_direct;
-                index_array = &find(node.children, index_array_name).properties[0];
+                indices = find(node.children, index_array_name).properties[0].get_elements<size_t>();
             }
-            else throw std::runtime_error("unsupported ReferenceInformationType: " + reference_type);
+            else throw std::runtime_error("unsupported ReferenceInformationType: " + std::string(reference_type));
         }
 
         size_t get_vertex_index(size_t geometric_vertex_id, size_t polygon_id, size_t polygon_vertex_id) const
@@ -415,7 +549,7 @@ namespace fbx
 
         template<class T, int M> void decode_attribute(linalg::vec<T,M> & attribute, size_t index) const
         {
-            for(int j=0; j<M; ++j) attribute[j] = array->get<T>(index*M+j);
+            for(int j=0; j<M; ++j) attribute[j] = static_cast<T>(values[index*M+j]);
         }
     };
 
@@ -441,7 +575,7 @@ namespace fbx
             for(auto & p : prop70.children)
             {
                 if(p.name != "P") continue;
-                auto & prop_name = p.properties[0].get_string();
+                auto prop_name = p.properties[0].get_string();
                 if(prop_name == "RotationOffset") rotation_offset = read_vector3d_property(p);
                 if(prop_name == "RotationPivot") rotation_pivot = read_vector3d_property(p);
                 if(prop_name == "ScalingOffset") scaling_offset = read_vector3d_property(p);
@@ -485,53 +619,107 @@ namespace fbx
         }
     };
 
+    // Object types, subtypes, and connection property names are interned when the scene is indexed, so that traversing the graph never compares strings
+    enum class object_type { other, geometry, model, deformer, animation_stack, animation_layer, animation_curve_node, animation_curve, count };
+    enum class object_subtype { other, mesh, limb_node, skin, cluster };
+    enum class connection_property { none, other, lcl_translation, lcl_rotation, lcl_scaling, d_x, d_y, d_z };
+
+    object_type intern_object_type(std::string_view name)
+    {
+        if(name == "Geometry") return object_type::geometry;
+        if(name == "Model") return object_type::model;
+        if(name == "Deformer") return object_type::deformer;
+        if(name == "AnimationStack") return object_type::animation_stack;
+        if(name == "AnimationLayer") return object_type::animation_layer;
+        if(name == "AnimationCurveNode") return object_type::animation_curve_node;
+        if(name == "AnimationCurve") return object_type::animation_curve;
+        return object_type::other;
+    }
+    object_subtype intern_object_subtype(std::string_view name)
+    {
+        if(name == "Mesh") return object_subtype::mesh;
+        if(name == "LimbNode") return object_subtype::limb_node;
+        if(name == "Skin") return object_subtype::skin;
+        if(name == "Cluster") return object_subtype::cluster;
+        return object_subtype::other;
+    }
+    connection_property intern_connection_property(std::string_view name)
+    {
+        if(name == "Lcl Translation") return connection_property::lcl_translation;
+        if(name == "Lcl Rotation") return connection_property::lcl_rotation;
+        if(name == "Lcl Scaling") return connection_property::lcl_scaling;
+        if(name == "d|X") return connection_property::d_x;
+        if(name == "d|Y") return connection_property::d_y;
+        if(name == "d|Z") return connection_property::d_z;
+        return connection_property::other;
+    }
+
     struct object
     {
-        struct connection { const object * obj; std::optional<std::string> prop; };
+        struct connection { const object * obj; connection_property prop; };
+        using connection_list = std::vector<connection>;
 
         const ast::node * node;
-        std::vector<connection> parents; // Objects which we were attached to via an OO or OP connection
-        std::vector<connection> children; // Objects which were attached to us via an OO or OP connection
-        
-        int64_t get_id() const { return node->properties[0].get<int64_t>(); }
-        const std::string & get_name() const { return node->properties[1].get_string(); }
-        const std::string & get_type() const { return node->name; }
-        const std::string & get_subtype() const { return node->properties[2].get_string(); }        
-
-        const object * get_first_parent(std::string_view type) const { for(auto & c : parents) if(c.obj->get_type() == type) return c.obj; return nullptr; }
-        const object * get_first_child(std::string_view type) const { for(auto & c : children) if(c.obj->get_type() == type) return c.obj; return nullptr; }
-        auto get_children(std::string_view type) const { std::vector<const object *> objects; for(auto & c : children) if(c.obj->get_type() == type) objects.push_back(c.obj); return objects; }
+        int64_t id;
+        object_type type;
+        object_subtype subtype;
+        connection_list parents[static_cast<size_t>(object_type::count)]; // Objects which we were attached to via an OO or OP connection, grouped by type
+        connection_list children[static_cast<size_t>(object_type::count)]; // Objects which were attached to us via an OO or OP connection, grouped by type
+
+        object(const ast::node & node) : node{&node}, id{node.properties.size > 0 ? node.properties[0].get<int64_t>() : 0}, type{intern_object_type(node.name)},
+            subtype{node.properties.size > 2 && node.properties[2].is_string() ? intern_object_subtype(node.properties[2].get_string()) : object_subtype::other} {}
+
+        std::string_view get_name() const { return node->properties[1].get_string(); }
+
+        const connection_list & get_parents(object_type type) const { return parents[static_cast<size_t>(type)]; }
+        const connection_list & get_children(object_type type) const { return children[static_cast<size_t>(type)]; }
+        const object * get_first_parent(object_type type) const { auto & list = get_parents(type); return list.empty() ? nullptr : list.front().obj; }
+        const object * get_first_child(object_type type) const { auto & list = get_children(type); return list.empty() ? nullptr : list.front().obj; }
     };
-    std::vector<object> index(const ast::document & doc)
+
+    struct object_graph
     {
-        // Obtain list of objects
         std::vector<object> objects;
-        for(auto & node : find(doc.nodes, "Objects").children) objects.push_back({&node});
+        std::vector<const object *> objects_by_type[static_cast<size_t>(object_type::count)];
+
+        const std::vector<const object *> & get_objects(object_type type) const { return objects_by_type[static_cast<size_t>(type)]; }
+    };
+
+    object_graph index(const ast::document & doc)
+    {
+        // Obtain list of objects, and index them by id and by type
+        object_graph graph;
+        auto & object_nodes = find(doc.nodes, "Objects").children;
+        graph.objects.reserve(object_nodes.size);
+        for(auto & node : object_nodes) graph.objects.emplace_back(node);
+
+        std::unordered_map<int64_t, object *> objects_by_id;
+        objects_by_id.reserve(graph.objects.size());
+        for(auto & obj : graph.objects)
+        {
+            objects_by_id.emplace(obj.id, &obj); // If an id is duplicated, the first object with that id wins
+            graph.objects_by_type[static_cast<size_t>(obj.type)].push_back(&obj);
+        }
 
         // Capture all connections between objects
-        auto find_object_by_id = [&objects](int64_t id) -> object * 
+        auto find_object_by_id = [&objects_by_id](int64_t id) -> object * 
         { 
-            for(auto & obj : objects) if(obj.get_id() == id) return &obj;
-            return nullptr;
+            auto it = objects_by_id.find(id);
+            return it != objects_by_id.end() ? it->second : nullptr;
         };
         for(auto & n : find(doc.nodes, "Connections").children)
         {
             auto * from = find_object_by_id(n.properties[1].get<int64_t>()), * to = find_object_by_id(n.properties[2].get<int64_t>());
             if(!from || !to) continue;
-            if(n.properties[0].get_string() == "OO")
-            {
-                to->children.push_back({from, std::nullopt});
-                from->parents.push_back({to, std::nullopt});
-            }
-            if(n.properties[0].get_string() == "OP")
-            {
-                to->children.push_back({from, n.properties[3].get_string()});
-                from->parents.push_back({to, n.properties[3].get_string()});
-            }
+            const auto kind = n.properties[0].get_string();
+            if(kind != "OO" && kind != "OP") continue;
+            const auto prop = kind == "OP" ? intern_connection_property(n.properties[3].get_string()) : connection_property::none;
+            to->children[static_cast<size_t>(from->type)].push_back({from, prop});
+            from->parents[static_cast<size_t>(to->type)].push_back({to, prop});
         }
 
-        // NOTE: We are relying on move semantics (or copy ellision) to ensure that the addresses of individual object structs do not change
-        return objects;
+        // NOTE: We are relying on move semantics to ensure that the addresses of individual object structs do not change
+        return graph;
     }
 
     void add_bone_weight(mesh::vertex & v, uint32_t index, float weight)
@@ -548,253 +736,261 @@ namespace fbx
         }
     }
 
-    std::vector<mesh> load_meshes(const ast::document & doc)
+    mesh load_mesh(const object_graph & graph, const object & obj)
     {
-        const auto objects = index(doc);
-              
-        // Obtain skeletal meshes
-        std::vector<mesh> meshes;
-        for(auto & obj : objects)
+        mesh geom;
+
+        // Obtain vertices
+        auto & vertices_node = find(obj.node->children, "Vertices");
+        if(vertices_node.properties.size != 1) throw std::runtime_error("malformed Vertices");
+        const auto positions = vertices_node.properties[0].get_elements<float>();
+        std::vector<mesh::vertex> geom_vertices;
+        geom_vertices.reserve(positions.size()/3);
+        for(size_t i=0; i+3<=positions.size(); i+=3) geom_vertices.push_back({{positions[i], positions[i+1], positions[i+2]}, {255,255,255}});
+
+        // Obtain bone weights and indices
+        auto * skin = obj.get_first_child(object_type::deformer);
+        if(skin && skin->subtype == object_subtype::skin)
         {
-            if(obj.get_type() != "Geometry") continue;            
-
-            mesh geom;
-
-            // Obtain vertices
-            auto & vertices_node = find(obj.node->children, "Vertices");
-            if(vertices_node.properties.size() != 1) throw std::runtime_error("malformed Vertices");
-            auto & vertices_array = vertices_node.properties[0];
-            std::vector<mesh::vertex> geom_vertices;
-            for(size_t i=0; i<vertices_array.size(); i+=3) geom_vertices.push_back({{vertices_array.get<float>(i), vertices_array.get<float>(i+1), vertices_array.get<float>(i+2)}, {255,255,255}});
-
-            // Obtain bone weights and indices
-            auto * skin = obj.get_first_child("Deformer");
-            if(skin && skin->get_subtype() == "Skin")
+            std::vector<const object *> bone_models;
+            for(auto & cluster : skin->get_children(object_type::deformer))
             {
-                std::vector<const object *> bone_models;
-                for(auto & cluster : skin->children)
+                if(cluster.obj->subtype != object_subtype::cluster) continue;
+                auto * model = cluster.obj->get_first_child(object_type::model);
+                if(!model) throw std::runtime_error("No Model affiliated with Cluster");
+
+                // Factor in bone weights for this bone
+                const auto indices = find(cluster.obj->node->children, "Indexes").properties[0].get_elements<size_t>();
+                const auto weights = find(cluster.obj->node->children, "Weights").properties[0].get_elements<float>();
+                if(indices.size() != weights.size()) throw std::runtime_error("Length of Indexes array does not match length of Weights array");
+                for(size_t i=0; i<indices.size(); ++i)
                 {
-                    if(cluster.obj->get_type() != "Deformer" || cluster.obj->get_subtype() != "Cluster") continue;
-                    auto * model = cluster.obj->get_first_child("Model");
-                    if(!model) throw std::runtime_error("No Model affiliated with Cluster");
-
-                    // Factor in bone weights for this bone
-                    const auto & indices = find(cluster.obj->node->children, "Indexes").properties[0];
-                    const auto & weights = find(cluster.obj->node->children, "Weights").properties[0];
-                    if(indices.size() != weights.size()) throw std::runtime_error("Length of Indexes array does not match length of Weights array");
-                    for(size_t i=0; i<indices.size(); ++i)
-                    {
-                        add_bone_weight(geom_vertices[indices.get<size_t>(i)], static_cast<uint32_t>(bone_models.size()), weights.get<float>(i));
-                    }
-
-                    // Obtain initial pose
-                    bone_models.push_back(model);
-                    model_transform m {*model->node};
-                    mesh::bone bone {model->get_name()};
-                    bone.initial_pose = m.get_keyframe();                    
-
-                    // Obtain model-to-bone matrix
-                    const auto & transform = find(cluster.obj->node->children, "Transform").properties[0];
-                    if(transform.size() != 16) throw std::runtime_error("Length of Transform array is not 16");
-                    for(int j=0; j<4; ++j) for(int i=0; i<4; ++i) bone.model_to_bone_matrix[j][i] = transform.get<float>(j*4+i);
-                    geom.bones.push_back(bone);
+                    add_bone_weight(geom_vertices[indices[i]], static_cast<uint32_t>(bone_models.size()), weights[i]);
                 }
 
-                // Make connections
-                for(size_t i=0; i<bone_models.size(); ++i)
+                // Obtain initial pose
+                bone_models.push_back(model);
+                model_transform m {*model->node};
+                mesh::bone bone {std::string{model->get_name()}};
+                bone.initial_pose = m.get_keyframe();                    
+
+                // Obtain model-to-bone matrix
+                const auto & transform = find(cluster.obj->node->children, "Transform").properties[0];
+                if(transform.size() != 16) throw std::runtime_error("Length of Transform array is not 16");
+                float transform_elements[16];
+                transform.get_elements(transform_elements, 16);
+                for(int j=0; j<4; ++j) for(int i=0; i<4; ++i) bone.model_to_bone_matrix[j][i] = transform_elements[j*4+i];
+                geom.bones.push_back(bone);
+            }
+
+            // Make connections
+            for(size_t i=0; i<bone_models.size(); ++i)
+            {
+                if(auto parent = bone_models[i]->get_first_parent(object_type::model))
                 {
-                    if(auto parent = bone_models[i]->get_first_parent("Model"))
+                    for(size_t j=0; j<bone_models.size(); ++j)
                     {
-                        for(size_t j=0; j<bone_models.size(); ++j)
+                        if(bone_models[j] == parent)
                         {
-                            if(bone_models[j] == parent)
-                            {
-                                geom.bones[i].parent_index = j;
-                                break;
-                            }
-                        }
-                        if(!geom.bones[i].parent_index) 
-                        {
-                            geom.bones[i].parent_index = bone_models.size();
-                            bone_models.push_back(parent);
-
-                            mesh::bone b;
-                            b.name = parent->get_name();
-                            model_transform m{*parent->node};
-                            b.initial_pose = m.get_keyframe();
-                            b.model_to_bone_matrix = {{1,0,0,0},{0,1,0,0},{0,0,1,0},{0,0,0,1}};
-                            geom.bones.push_back(b);
+                            geom.bones[i].parent_index = j;
+                            break;
                         }
                     }
+                    if(!geom.bones[i].parent_index) 
+                    {
+                        geom.bones[i].parent_index = bone_models.size();
+                        bone_models.push_back(parent);
+
+                        mesh::bone b;
+                        b.name = parent->get_name();
+                        model_transform m{*parent->node};
+                        b.initial_pose = m.get_keyframe();
+                        b.model_to_bone_matrix = {{1,0,0,0},{0,1,0,0},{0,0,1,0},{0,0,0,1}};
+                        geom.bones.push_back(b);
+                    }
                 }
+            }
 
-                // Get animations
-                for(auto & stack : objects)
+            // Get animations
+            for(auto * stack : graph.get_objects(object_type::animation_stack))
+            {
+                auto * layer = stack->get_first_child(object_type::animation_layer);
+                if(!layer) continue;
+
+                mesh::animation a;
+                a.name = stack->get_name();
+
+                // Generate transformation state for each bone
+                std::map<const object *, model_transform> model_transforms;
+                for(auto * model : bone_models) model_transforms[model] = model_transform(*model->node);
+
+                // Obtain all animation curves
+                struct curve_segment { int64_t key0, key1; float value0, value1; };
+                struct curve_state { float * target; std::vector<curve_segment> segments; size_t current; };
+                std::vector<curve_state> curves;
+                std::set<int64_t> keys;
+                for(auto & curve_node : layer->get_children(object_type::animation_curve_node))
                 {
-                    if(stack.get_type() != "AnimationStack") continue;
-                    auto * layer = stack.get_first_child("AnimationLayer");
-                    if(!layer) continue;
-
-                    mesh::animation a;
-                    a.name = stack.get_name();
-
-                    // Generate transformation state for each bone
-                    std::map<const object *, model_transform> model_transforms;
-                    for(auto * model : bone_models) model_transforms[model] = model_transform(*model->node);
-
-                    // Obtain all animation curves
-                    struct curve_segment { int64_t key0, key1; float value0, value1; };
-                    struct curve_state { float * target; std::vector<curve_segment> segments; size_t current; };
-                    std::vector<curve_state> curves;
-                    std::set<int64_t> keys;
-                    for(auto * curve_node : layer->get_children("AnimationCurveNode"))
+                    // Determine which property of a Model object this node is targeting
+                    float3 * model_property = nullptr;
+                    for(auto & p : curve_node.obj->get_parents(object_type::model))
                     {
-                        // Determine which property of a Model object this node is targeting
-                        float3 * model_property = nullptr;
-                        for(auto & p : curve_node->parents) if(p.obj->get_type() == "Model" && p.prop)
-                        {
-                            if(*p.prop == "Lcl Translation") model_property = &model_transforms[p.obj].translation;
-                            if(*p.prop == "Lcl Rotation") model_property = &model_transforms[p.obj].rotation;
-                            if(*p.prop == "Lcl Scaling") model_property = &model_transforms[p.obj].scaling;
-                        }
-                        if(!model_property) continue;
+                        if(p.prop == connection_property::lcl_translation) model_property = &model_transforms[p.obj].translation;
+                        if(p.prop == connection_property::lcl_rotation) model_property = &model_transforms[p.obj].rotation;
+                        if(p.prop == connection_property::lcl_scaling) model_property = &model_transforms[p.obj].scaling;
+                    }
+                    if(!model_property) continue;
 
-                        // For each AnimationCurve that is a child of this node
-                        for(auto & c : curve_node->children) if(c.obj->get_type() == "AnimationCurve" && c.prop)
+                    // For each AnimationCurve that is a child of this node
+                    for(auto & c : curve_node.obj->get_children(object_type::animation_curve))
+                    {
+                        // Determine which channel this curve is targeting
+                        curve_state cs {};
+                        if(c.prop == connection_property::d_x) cs.target = &model_property->x;
+                        if(c.prop == connection_property::d_y) cs.target = &model_property->y;
+                        if(c.prop == connection_property::d_z) cs.target = &model_property->z;
+                        if(!cs.target) continue;
+
+                        // Read the keyframes and aggregate the total keyframes in use in this stack
+                        const auto key_time = find(c.obj->node->children, "KeyTime").properties[0].get_elements<int64_t>();
+                        const auto key_value = find(c.obj->node->children, "KeyValueFloat").properties[0].get_elements<float>();
+                        if(key_time.size() != key_value.size()) throw std::runtime_error("Length of KeyTime array does not match length of KeyValueFloat array");
+                        if(key_time.size() == 0) throw std::runtime_error("KeyTime/KeyValueFloat arrays are empty");
+
+                        // Create curve segments
+                        keys.insert(key_time[0]);
+                        cs.segments.reserve(key_time.size()+1);
+                        cs.segments.push_back({std::numeric_limits<int64_t>::min(), key_time[0], key_value[0], key_value[0]});
+                        for(size_t i=1; i<key_time.size(); ++i) 
                         {
-                            // Determine which channel this curve is targeting
-                            curve_state cs {};
-                            if(*c.prop == "d|X") cs.target = &model_property->x;
-                            if(*c.prop == "d|Y") cs.target = &model_property->y;
-                            if(*c.prop == "d|Z") cs.target = &model_property->z;
-                            if(!cs.target) continue;
-
-                            // Read the keyframes and aggregate the total keyframes in use in this stack
-                            const auto & key_time = find(c.obj->node->children, "KeyTime").properties[0];
-                            const auto & key_value = find(c.obj->node->children, "KeyValueFloat").properties[0];
-                            if(key_time.size() != key_value.size()) throw std::runtime_error("Length of KeyTime array does not match length of KeyValueFloat array");
-                            if(key_time.size() == 0) throw std::runtime_error("KeyTime/KeyValueFloat arrays are empty");
-
-                            // Create curve segments
-                            keys.insert(key_time.get<int64_t>(0));
-                            cs.segments.push_back({std::numeric_limits<int64_t>::min(), key_time.get<int64_t>(0), key_value.get<float>(0), key_value.get<float>(0)});
-                            for(size_t i=1; i<key_time.size(); ++i) 
-                            {
-                                const int64_t key0 = key_time.get<int64_t>(i-1), key1 = key_time.get<int64_t>(i);
-                                keys.insert(key1);
-                                cs.segments.push_back({key0, key1, key_value.get<float>(i-1), key_value.get<float>(i)});
-                            }
-                            size_t last = key_time.size()-1;
-                            cs.segments.push_back({key_time.get<int64_t>(last), std::numeric_limits<int64_t>::max(), key_value.get<float>(last), key_value.get<float>(last)});
-                            curves.push_back(std::move(cs));
+                            keys.insert(key_time[i]);
+                            cs.segments.push_back({key_time[i-1], key_time[i], key_value[i-1], key_value[i]});
                         }
+                        size_t last = key_time.size()-1;
+                        cs.segments.push_back({key_time[last], std::numeric_limits<int64_t>::max(), key_value[last], key_value[last]});
+                        curves.push_back(std::move(cs));
                     }
+                }
 
-                    // Determine the state of each model at each keyframe
-                    for(auto key : keys)
-                    {   
-                        // Interpolate between keyframes
-                        for(auto & curve : curves)
+                // Determine the state of each model at each keyframe
+                for(auto key : keys)
+                {   
+                    // Interpolate between keyframes
+                    for(auto & curve : curves)
+                    {
+                        while(key > curve.segments[curve.current].key1) ++curve.current;
+                        const auto & seg = curve.segments[curve.current];
+                        if(seg.value0 == seg.value1) *curve.target = seg.value0;
+                        else 
                         {
-                            while(key > curve.segments[curve.current].key1) ++curve.current;
-                            const auto & seg = curve.segments[curve.current];
-                            if(seg.value0 == seg.value1) *curve.target = seg.value0;
-                            else 
-                            {
-                                // TODO: Apply nonlinear mappings
-                                float t = (float)(key - seg.key0)/(seg.key1 - seg.key0);
-                                *curve.target = seg.value0*(1-t) + seg.value1*t;
-                            }
+                            // TODO: Apply nonlinear mappings
+                            float t = (float)(key - seg.key0)/(seg.key1 - seg.key0);
+                            *curve.target = seg.value0*(1-t) + seg.value1*t;
                         }
-
-                        // Compute local matrices
-                        mesh::keyframe anim_kf {key};
-                        for(auto * model : bone_models) anim_kf.local_transforms.push_back({model_transforms[model].get_keyframe()});
-                        a.keyframes.push_back(anim_kf);
                     }
 
-                    geom.animations.push_back(a);
+                    // Compute local matrices
+                    mesh::keyframe anim_kf {key};
+                    for(auto * model : bone_models) anim_kf.local_transforms.push_back({model_transforms[model].get_keyframe()});
+                    a.keyframes.push_back(anim_kf);
                 }
+
+                geom.animations.push_back(a);
             }
-            else if(auto parent = obj.get_first_parent("Model"))
-            {
-                model_transform mt {*parent->node};
-                mesh::bone bone;
-                bone.name = parent->get_name();
-                bone.initial_pose = mt.get_keyframe();
-                bone.model_to_bone_matrix = {{1,0,0,0},{0,1,0,0},{0,0,1,0},{0,0,0,1}};
-                geom.bones.push_back(bone);
-            }
-            
-            const ast::property * material_list = nullptr;
-            if(auto * layer_material = find_maybe(obj.node->children, "LayerElementMaterial"))
-            {
-                auto mapping_information_type = find(layer_material->children, "MappingInformationType").properties[0].get_string();
-                auto reference_information_type = find(layer_material->children, "ReferenceInformationType").properties[0].get_string();
-                if(mapping_information_type != "ByPolygon" || reference_information_type != "IndexToDirect") throw std::runtime_error("Unsupported LayerElementMaterial mapping");
-                material_list = &find(layer_material->children, "Materials").properties[0];
-            }
-            size_t polygon_index = 0;
+        }
+        else if(auto parent = obj.get_first_parent(object_type::model))
+        {
+            model_transform mt {*parent->node};
+            mesh::bone bone;
+            bone.name = parent->get_name();
+            bone.initial_pose = mt.get_keyframe();
+            bone.model_to_bone_matrix = {{1,0,0,0},{0,1,0,0},{0,0,1,0},{0,0,0,1}};
+            geom.bones.push_back(bone);
+        }
+        
+        std::vector<size_t> material_list;
+        if(auto * layer_material = find_maybe(obj.node->children, "LayerElementMaterial"))
+        {
+            auto mapping_information_type = find(layer_material->children, "MappingInformationType").properties[0].get_string();
+            auto reference_information_type = find(layer_material->children, "ReferenceInformationType").properties[0].get_string();
+            if(mapping_information_type != "ByPolygon" || reference_information_type != "IndexToDirect") throw std::runtime_error("Unsupported LayerElementMaterial mapping");
+            material_list = find(layer_material->children, "Materials").properties[0].get_elements<size_t>();
+        }
+        size_t polygon_index = 0;
 
-            std::optional<layer_info> colors, normals, uvs;
-            if(auto * node = find_maybe(obj.node->children, "LayerElementColor")) colors = layer_info{*node, "Colors", "ColorIndex"};
-            if(auto * node = find_maybe(obj.node->children, "LayerElementNormal")) normals = layer_info{*node, "Normals", "NormalIndex"};
-            if(auto * node = find_maybe(obj.node->children, "LayerElementUV")) uvs = layer_info{*node, "UV", "UVIndex"};            
+        std::optional<layer_info> colors, normals, uvs;
+        if(auto * node = find_maybe(obj.node->children, "LayerElementColor")) colors = layer_info{*node, "Colors", "ColorIndex"};
+        if(auto * node = find_maybe(obj.node->children, "LayerElementNormal")) normals = layer_info{*node, "Normals", "NormalIndex"};
+        if(auto * node = find_maybe(obj.node->children, "LayerElementUV")) uvs = layer_info{*node, "UV", "UVIndex"};            
 
-            // Obtain polygons
-            auto & indices_node = find(obj.node->children, "PolygonVertexIndex");
-            if(indices_node.properties.size() != 1) throw std::runtime_error("malformed PolygonVertexIndex");
+        // Obtain polygons
+        auto & indices_node = find(obj.node->children, "PolygonVertexIndex");
+        if(indices_node.properties.size != 1) throw std::runtime_error("malformed PolygonVertexIndex");
 
-            size_t polygon_start = 0;
-            std::vector<std::vector<uint3>> material_triangles;
-            for(size_t j=0, n=indices_node.properties[0].size(); j<n; ++j)
+        const auto polygon_vertex_indices = indices_node.properties[0].get_elements<int32_t>();
+        geom.vertices.reserve(polygon_vertex_indices.size());
+
+        size_t polygon_start = 0;
+        std::vector<std::vector<uint3>> material_triangles;
+        for(size_t j=0, n=polygon_vertex_indices.size(); j<n; ++j)
+        {
+            auto i = polygon_vertex_indices[j];
+
+            // Detect end-of-polygon, indicated by a negative index
+            const bool end_of_polygon = i < 0;
+            if(end_of_polygon) i = ~i;
+            const size_t polygon_vertex_id = geom.vertices.size();
+
+            // Store a polygon vertex
+            auto vertex = geom_vertices[i];
+            if(colors) colors->decode_attribute(vertex.color, colors->get_vertex_index(i, polygon_index, polygon_vertex_id));
+            if(normals) normals->decode_attribute(vertex.normal, normals->get_vertex_index(i, polygon_index, polygon_vertex_id));
+            if(uvs) uvs->decode_attribute(vertex.texcoord, uvs->get_vertex_index(i, polygon_index, polygon_vertex_id));
+            geom.vertices.push_back(vertex);
+
+            // Generate triangles if necessary
+            if(end_of_polygon)
             {
-                auto i = indices_node.properties[0].get<int32_t>(j);
-
-                // Detect end-of-polygon, indicated by a negative index
-                const bool end_of_polygon = i < 0;
-                if(end_of_polygon) i = ~i;
-                const size_t polygon_vertex_id = geom.vertices.size();
-
-                // Store a polygon vertex
-                auto vertex = geom_vertices[i];
-                if(colors) colors->decode_attribute(vertex.color, colors->get_vertex_index(i, polygon_index, polygon_vertex_id));
-                if(normals) normals->decode_attribute(vertex.normal, normals->get_vertex_index(i, polygon_index, polygon_vertex_id));
-                if(uvs) uvs->decode_attribute(vertex.texcoord, uvs->get_vertex_index(i, polygon_index, polygon_vertex_id));
-                geom.vertices.push_back(vertex);
-
-                // Generate triangles if necessary
-                if(end_of_polygon)
-                {
-                    auto material_index = material_list ? material_list->get<size_t>(polygon_index) : 0;
-                    if(material_index >= material_triangles.size()) material_triangles.resize(material_index+1);
+                auto material_index = material_list.empty() ? 0 : material_list[polygon_index];
+                if(material_index >= material_triangles.size()) material_triangles.resize(material_index+1);
 
-                    for(size_t j=polygon_start+2; j<geom.vertices.size(); ++j)
-                    {
-                        material_triangles[material_index].push_back(uint3{linalg::vec<size_t,3>{polygon_start, j-1, j}});
-                    }
-                    ++polygon_index;
-                    polygon_start = geom.vertices.size();
+                for(size_t j=polygon_start+2; j<geom.vertices.size(); ++j)
+                {
+                    material_triangles[material_index].push_back(uint3{linalg::vec<size_t,3>{polygon_start, j-1, j}});
                 }
+                ++polygon_index;
+                polygon_start = geom.vertices.size();
             }
+        }
 
-            // Finalize vertices
-            for(auto & v : geom.vertices) 
-            {
-                v.color /= 255.0f;
-                v.texcoord.y = 1 - v.texcoord.y;
-                v.bone_weights /= sum(v.bone_weights);
-            }
-
-            for(auto & tris : material_triangles)
-            {
-                geom.materials.push_back({"", geom.triangles.size(), tris.size()});
-                geom.triangles.insert(end(geom.triangles), begin(tris), end(tris));
-            }
+        // Finalize vertices
+        for(auto & v : geom.vertices) 
+        {
+            v.color /= 255.0f;
+            v.texcoord.y = 1 - v.texcoord.y;
+            v.bone_weights /= sum(v.bone_weights);
+        }
 
-            meshes.push_back(geom);
+        for(auto & tris : material_triangles)
+        {
+            geom.materials.push_back({"", geom.triangles.size(), tris.size()});
+            geom.triangles.insert(end(geom.triangles), begin(tris), end(tris));
         }
-        
+
+        return geom;
+    }
+
+    std::vector<mesh> load_meshes(const ast::document & doc)
+    {
+        // Inflate all of the arrays we intend to read up front, in parallel
+        ast::inflate_arrays(doc, {"Vertices", "PolygonVertexIndex", "Colors", "ColorIndex", "Normals", "NormalIndex", "UV", "UVIndex", "Materials", "Indexes", "Weights", "Transform", "KeyTime", "KeyValueFloat"});
+
+        const auto graph = index(doc);
+              
+        // Obtain skeletal meshes, each of which depends only on the (now immutable) document and object graph
+        auto & geometries = graph.get_objects(object_type::geometry);
+        std::vector<mesh> meshes(geometries.size());
+        parallel_for(geometries.size(), [&](size_t i) { meshes[i] = load_mesh(graph, *geometries[i]); });
         return meshes;
     }
 }
@@ -803,9 +999,9 @@ struct fbx_property_printer
 {
     std::ostream & out;
 
-    void operator() (const std::string & string) { out << '"' << string << '"'; }
+    void operator() (const std::string_view & string) { out << '"' << string << '"'; }
     template<class T> void operator() (const T & scalar) { out << scalar; }    
-    template<class T> void operator() (const std::vector<T> & array) { out << typeid(T).name() << '[' << array.size() << ']'; }
+    template<class T> void operator() (const array_view<T> & array) { out << typeid(T).name() << '[' << array.size << ']'; }
 };
 void fbx::ast::property::print(std::ostream & out) const
 {
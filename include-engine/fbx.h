@@ -2,6 +2,10 @@
 #define FBX_H
 
 #include "data-types.h"
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
 
 namespace fbx
 {
@@ -14,6 +18,24 @@ namespace fbx
             explicit operator bool() const { return static_cast<bool>(byte & 1); } 
         };
 
+        // A compressed array whose contents are inflated into preallocated storage on first access, or ahead of time by inflate_arrays(...)
+        class deferred_array
+        {
+            enum : uint32_t { compressed, inflating, inflated, failed };
+            const char * source;
+            uint32_t source_length;
+            void * target;
+            size_t target_length;
+            mutable std::atomic<uint32_t> state {compressed};
+
+            void inflate_slow() const;
+        public:
+            deferred_array(const char * source, uint32_t source_length, void * target, size_t target_length) : source{source}, source_length{source_length}, target{target}, target_length{target_length} {}
+
+            void inflate() const { if(state.load(std::memory_order_acquire) != inflated) inflate_slow(); }
+        };
+
+        // Array and string properties refer either directly into the file contents or into the arena owned by the document
         using property_variant = std::variant
         <
             boolean,               // type 'C'
@@ -22,57 +44,95 @@ namespace fbx
             int64_t,               // type 'L'
             float,                 // type 'F'
             double,                // type 'D'
-            std::vector<boolean>,  // type 'b'
-            std::vector<int16_t>,  // type 'y'
-            std::vector<int32_t>,  // type 'i'
-            std::vector<int64_t>,  // type 'l'
-            std::vector<float>,    // type 'f'
-            std::vector<double>,   // type 'd'
-            std::string,           // type 'S'
-            std::vector<uint8_t>   // type 'R'
+            array_view<boolean>,   // type 'b'
+            array_view<int16_t>,   // type 'y'
+            array_view<int32_t>,   // type 'i'
+            array_view<int64_t>,   // type 'l'
+            array_view<float>,     // type 'f'
+            array_view<double>,    // type 'd'
+            std::string_view,      // type 'S'
+            array_view<uint8_t>    // type 'R'
         >;
 
+        // Bulk conversion of array contents from one element type to another
+        template<class T, class U> void convert_elements(const T * in, U * out, size_t count) { for(size_t i=0; i<count; ++i) out[i] = static_cast<U>(in[i]); }
+        template<class U> void convert_elements(const boolean * in, U * out, size_t count) { for(size_t i=0; i<count; ++i) out[i] = in[i] ? U{1} : U{0}; }
+        template<class T> void convert_elements(const T * in, T * out, size_t count) { if(count) memcpy(out, in, sizeof(T)*count); }
+        void convert_elements(const double * in, float * out, size_t count); // Vectorized where supported
+
         class property
         {
             property_variant contents;
+            const deferred_array * deferred;
 
             struct size_visitor
             {
-                template<class T> size_t operator() (const std::vector<T> & v) { return v.size(); }
+                template<class T> size_t operator() (const array_view<T> & v) { return v.size; }
                 size_t operator() (...) { return 1; }
             };
 
             template<class U> struct element_visitor
             {
                 size_t index;
-                template<class T> U operator() (const std::vector<T> & v) { return operator()(v[index]); }
+                template<class T> U operator() (const array_view<T> & v) { return operator()(v.data[index]); }
                 template<class T> U operator() (const T & n) { return static_cast<U>(n); }
-                U operator() (const std::string & s) { return {}; }
+                U operator() (const std::string_view &) { return {}; }
                 U operator() (const boolean & b) { return b ? U{1} : U{0}; }
             };
+
+            template<class U> struct array_visitor
+            {
+                U * elements;
+                size_t count;
+                template<class T> void operator() (const array_view<T> & v) { convert_elements(v.data, elements, count); }
+                template<class T> void operator() (const T & n) { elements[0] = static_cast<U>(n); }
+                void operator() (const std::string_view &) { std::fill_n(elements, count, U{}); }
+                void operator() (const boolean & b) { elements[0] = b ? U{1} : U{0}; }
+            };
         public:
-            property(property_variant && contents) : contents{move(contents)} {}
+            property(property_variant && contents, const deferred_array * deferred = nullptr) : contents{move(contents)}, deferred{deferred} {}
         
             size_t size() const { return std::visit(size_visitor{}, contents); }
-            template<class U> U get(size_t i=0) const { return std::visit(element_visitor<U>{i}, contents); }
-            const std::string & get_string() const { return std::get<std::string>(contents); }
+            template<class U> U get(size_t i=0) const { if(deferred) deferred->inflate(); return std::visit(element_visitor<U>{i}, contents); }
+            std::string_view get_string() const { return std::get<std::string_view>(contents); }
+            bool is_string() const { return std::holds_alternative<std::string_view>(contents); }
+
+            // Convert every element of this property into the caller's storage in a single pass
+            template<class U> void get_elements(U * elements, size_t count) const 
+            { 
+                if(count != size()) throw std::runtime_error("property size mismatch");
+                if(deferred) deferred->inflate(); 
+                std::visit(array_visitor<U>{elements, count}, contents); 
+            }
+            template<class U> std::vector<U> get_elements() const { std::vector<U> elements(size()); get_elements(elements.data(), elements.size()); return elements; }
             void print(std::ostream & out) const;
         };
 
+        // Nodes and properties are allocated from the document's arena, and are never individually destroyed
         struct node
         {
-            std::string name;
-            std::vector<property> properties;
-            std::vector<node> children;
+            std::string_view name;
+            array_view<property> properties;
+            array_view<node> children;
         };
 
         struct document
         {
+            struct deferred_entry { std::string_view node_name; const deferred_array * array; };
+
+            mapped_file file;                               // Contents of the file, when loaded directly from disk
+            memory_arena arena;                             // Storage for nodes, properties, and any array contents which could not be referenced in place
+            std::vector<deferred_entry> deferred_arrays;    // Every compressed array in the document, along with the name of the node it belongs to
             uint32_t version;
-            std::vector<node> nodes;
+            array_view<node> nodes;
         };
 
+        document load(const char * filename);
         document load(std::istream & in);
+        document load(array_view<uint8_t> contents); // The document refers into contents, which must outlive it
+
+        // Inflate, across all available threads, every compressed array belonging to a node with one of the given names
+        void inflate_arrays(const document & doc, array_view<std::string_view> node_names);
     }
 
     /////////////////////
@@ -0,0 +1,718 @@
+#include "image-ops.h"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_OPS_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__F16C__) || defined(__AVX2__)
+#define IMAGE_OPS_F16C
+#include <immintrin.h>
+#endif
+
+///////////////////
+// Pixel formats //
+///////////////////
+
+enum class channel_type { unorm8, srgb8, sfloat16, sfloat32 };
+struct pixel_format { VkFormat format; channel_type type; int channels; bool is_bgr; };
+static const pixel_format pixel_formats[]
+{
+    {VK_FORMAT_R8_UNORM,            channel_type::unorm8,   1, false},
+    {VK_FORMAT_R8_SRGB,             channel_type::srgb8,    1, false},
+    {VK_FORMAT_R8G8_UNORM,          channel_type::unorm8,   2, false},
+    {VK_FORMAT_R8G8_SRGB,           channel_type::srgb8,    2, false},
+    {VK_FORMAT_R8G8B8_UNORM,        channel_type::unorm8,   3, false},
+    {VK_FORMAT_R8G8B8_SRGB,         channel_type::srgb8,    3, false},
+    {VK_FORMAT_B8G8R8_UNORM,        channel_type::unorm8,   3, true},
+    {VK_FORMAT_B8G8R8_SRGB,         channel_type::srgb8,    3, true},
+    {VK_FORMAT_R8G8B8A8_UNORM,      channel_type::unorm8,   4, false},
+    {VK_FORMAT_R8G8B8A8_SRGB,       channel_type::srgb8,    4, false},
+    {VK_FORMAT_B8G8R8A8_UNORM,      channel_type::unorm8,   4, true},
+    {VK_FORMAT_B8G8R8A8_SRGB,       channel_type::srgb8,    4, true},
+    {VK_FORMAT_R16_SFLOAT,          channel_type::sfloat16, 1, false},
+    {VK_FORMAT_R16G16_SFLOAT,       channel_type::sfloat16, 2, false},
+    {VK_FORMAT_R16G16B16_SFLOAT,    channel_type::sfloat16, 3, false},
+    {VK_FORMAT_R16G16B16A16_SFLOAT, channel_type::sfloat16, 4, false},
+    {VK_FORMAT_R32_SFLOAT,          channel_type::sfloat32, 1, false},
+    {VK_FORMAT_R32G32_SFLOAT,       channel_type::sfloat32, 2, false},
+    {VK_FORMAT_R32G32B32_SFLOAT,    channel_type::sfloat32, 3, false},
+    {VK_FORMAT_R32G32B32A32_SFLOAT, channel_type::sfloat32, 4, false},
+};
+
+static const pixel_format & get_pixel_format(VkFormat format)
+{
+    for(auto & f : pixel_formats) if(f.format == format) return f;
+    throw std::logic_error("unsupported format for image operations");
+}
+
+static bool is_8bit(const pixel_format & f) { return f.type == channel_type::unorm8 || f.type == channel_type::srgb8; }
+static bool is_srgb_channel(const pixel_format & f, int channel) { return f.type == channel_type::srgb8 && channel < 3; }
+static int get_storage_index(const pixel_format & f, int channel) { return f.is_bgr && channel < 3 ? 2-channel : channel; }
+static size_t get_pixel_size(const pixel_format & f) { return f.channels * (f.type == channel_type::sfloat32 ? 4 : f.type == channel_type::sfloat16 ? 2 : 1); }
+static size_t get_row_size(const pixel_format & f, int width) { return get_pixel_size(f) * width; }
+
+////////////////////////
+// Scalar conversions //
+////////////////////////
+
+static float srgb_to_linear(float s) { return s <= 0.04045f ? s/12.92f : std::pow((s+0.055f)/1.055f, 2.4f); }
+static float linear_to_srgb(float l) { return l <= 0.0031308f ? l*12.92f : 1.055f*std::pow(l, 1/2.4f) - 0.055f; }
+static float saturate(float x) { return x > 0 ? (x < 1 ? x : 1) : 0; } // NaN saturates to zero
+static float decode_channel8(bool is_srgb, uint8_t v) { return is_srgb ? srgb_to_linear(v/255.0f) : v/255.0f; }
+static uint8_t encode_channel8(bool is_srgb, float x) { return static_cast<uint8_t>((is_srgb ? linear_to_srgb(saturate(x)) : saturate(x))*255 + 0.5f); }
+
+static float half_to_float(uint16_t h)
+{
+    const uint32_t sign = (h & 0x8000u) << 16, exponent = h >> 10 & 0x1F, mantissa = h & 0x3FF;
+    if(exponent == 0) return (sign ? -1.0f : 1.0f) * mantissa / (1 << 24); // Zero or subnormal
+    const uint32_t bits = sign | (exponent == 0x1F ? 0x7F800000 | mantissa << 13 : (exponent + 112) << 23 | mantissa << 13);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static uint16_t float_to_half(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    const uint32_t sign = bits >> 16 & 0x8000, magnitude = bits & 0x7FFFFFFF;
+    if(magnitude > 0x7F800000) return static_cast<uint16_t>(sign | 0x7E00); // NaN
+    if(magnitude >= 0x477FF000) return static_cast<uint16_t>(sign | 0x7C00); // Infinity, and values which round up to it
+    if(magnitude < 0x38800000) // Values which round to zero or a subnormal, and can be scaled exactly into the range of the mantissa
+    {
+        float m;
+        memcpy(&m, &magnitude, sizeof(m));
+        return static_cast<uint16_t>(sign | static_cast<uint32_t>(std::nearbyint(m * (1 << 24))));
+    }
+    // Rebias the exponent and round the mantissa to nearest even
+    return static_cast<uint16_t>(sign | (magnitude - 0x38000000 + 0xFFF + (magnitude >> 13 & 1)) >> 13);
+}
+
+static float4 decode_pixel(const pixel_format & f, const uint8_t * p)
+{
+    float4 v {0,0,0,1};
+    for(int c=0; c<f.channels; ++c)
+    {
+        const int i = get_storage_index(f, c);
+        switch(f.type)
+        {
+        case channel_type::unorm8: case channel_type::srgb8: v[c] = decode_channel8(is_srgb_channel(f, c), p[i]); break;
+        case channel_type::sfloat16: { uint16_t h; memcpy(&h, p + i*2, sizeof(h)); v[c] = half_to_float(h); break; }
+        case channel_type::sfloat32: memcpy(&v[c], p + i*4, sizeof(float)); break;
+        }
+    }
+    return v;
+}
+
+static void encode_pixel(const pixel_format & f, const float4 & v, uint8_t * p)
+{
+    for(int c=0; c<f.channels; ++c)
+    {
+        const int i = get_storage_index(f, c);
+        switch(f.type)
+        {
+        case channel_type::unorm8: case channel_type::srgb8: p[i] = encode_channel8(is_srgb_channel(f, c), v[c]); break;
+        case channel_type::sfloat16: { const uint16_t h = float_to_half(v[c]); memcpy(p + i*2, &h, sizeof(h)); break; }
+        case channel_type::sfloat32: memcpy(p + i*4, &v[c], sizeof(float)); break;
+        }
+    }
+}
+
+////////////////////////////
+// Vectorized row codecs //
+////////////////////////////
+
+// A minimal set of operations on four floats, which map onto SSE2 where it is available
+#ifdef IMAGE_OPS_SSE2
+typedef __m128 vec4;
+static vec4 load(const float4 & v) { return _mm_loadu_ps(&v.x); }
+static void store(float4 & v, vec4 r) { _mm_storeu_ps(&v.x, r); }
+static vec4 splat(float s) { return _mm_set1_ps(s); }
+static vec4 make_vec4(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+static vec4 add(vec4 a, vec4 b) { return _mm_add_ps(a, b); }
+static vec4 mul(vec4 a, vec4 b) { return _mm_mul_ps(a, b); }
+static vec4 saturate(vec4 v) { return _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1)); }
+static void round_to_int(vec4 v, int32_t (& r)[4]) { _mm_storeu_si128(reinterpret_cast<__m128i *>(r), _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)))); }
+#else
+typedef float4 vec4;
+static vec4 load(const float4 & v) { return v; }
+static void store(float4 & v, vec4 r) { v = r; }
+static vec4 splat(float s) { return vec4{s}; }
+static vec4 make_vec4(float x, float y, float z, float w) { return {x, y, z, w}; }
+static vec4 add(vec4 a, vec4 b) { return a + b; }
+static vec4 mul(vec4 a, vec4 b) { return a * b; }
+static vec4 saturate(vec4 v) { return {saturate(v.x), saturate(v.y), saturate(v.z), saturate(v.w)}; }
+static void round_to_int(vec4 v, int32_t (& r)[4]) { for(int i=0; i<4; ++i) r[i] = static_cast<int32_t>(v[i] + 0.5f); }
+#endif
+
+// Lookup tables for decoding 8 bit channels, and for encoding sRGB channels from linear values quantized to 16 bits, which is exact to well within one step of the output
+struct codec_tables
+{
+    float unorm8[256], srgb8[256];
+    uint8_t srgb_from_linear16[65536];
+
+    codec_tables()
+    {
+        for(int i=0; i<256; ++i)
+        {
+            unorm8[i] = decode_channel8(false, static_cast<uint8_t>(i));
+            srgb8[i] = decode_channel8(true, static_cast<uint8_t>(i));
+        }
+        for(int i=0; i<65536; ++i) srgb_from_linear16[i] = encode_channel8(true, i/65535.0f);
+    }
+};
+static const codec_tables & get_codec_tables() { static const codec_tables tables; return tables; }
+
+static void decode_row(const pixel_format & f, const uint8_t * in, float4 * out, int width)
+{
+    int x = 0;
+    switch(f.type)
+    {
+    case channel_type::unorm8: case channel_type::srgb8:
+    {
+#ifdef IMAGE_OPS_SSE2
+        if(f.type == channel_type::unorm8 && f.channels == 4)
+        {
+            // Widen sixteen bytes at a time into four pixels
+            const __m128i zero = _mm_setzero_si128();
+            const __m128 scale = _mm_set1_ps(1.0f/255);
+            for(; x+4<=width; x+=4)
+            {
+                const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + x*4));
+                const __m128i lo = _mm_unpacklo_epi8(px, zero), hi = _mm_unpackhi_epi8(px, zero);
+                const __m128i words[4] {_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero), _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+                for(int i=0; i<4; ++i)
+                {
+                    __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(words[i]), scale);
+                    if(f.is_bgr) v = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3,0,1,2));
+                    _mm_storeu_ps(&out[x+i].x, v);
+                }
+            }
+        }
+#endif
+        const auto & tables = get_codec_tables();
+        for(; x<width; ++x)
+        {
+            const uint8_t * p = in + x*f.channels;
+            float4 v {0,0,0,1};
+            for(int c=0; c<f.channels; ++c)
+            {
+                const float * table = is_srgb_channel(f, c) ? tables.srgb8 : tables.unorm8;
+                v[c] = table[p[get_storage_index(f, c)]];
+            }
+            out[x] = v;
+        }
+        break;
+    }
+    case channel_type::sfloat16:
+#ifdef IMAGE_OPS_F16C
+        if(f.channels == 4) for(; x<width; ++x) _mm_storeu_ps(&out[x].x, _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(in + x*8))));
+#endif
+        for(; x<width; ++x) out[x] = decode_pixel(f, in + x*get_pixel_size(f));
+        break;
+    case channel_type::sfloat32:
+        if(f.channels == 4) memcpy(&out[0].x, in, get_row_size(f, width));
+        else for(; x<width; ++x) out[x] = decode_pixel(f, in + x*get_pixel_size(f));
+        break;
+    }
+}
+
+static void encode_row(const pixel_format & f, const float4 * in, uint8_t * out, int width)
+{
+    int x = 0;
+    switch(f.type)
+    {
+    case channel_type::unorm8: case channel_type::srgb8:
+    {
+        const bool is_srgb = f.type == channel_type::srgb8;
+#ifdef IMAGE_OPS_SSE2
+        if(!is_srgb && f.channels == 4)
+        {
+            // Narrow four pixels at a time into sixteen bytes
+            for(; x+4<=width; x+=4)
+            {
+                __m128i q[4];
+                for(int i=0; i<4; ++i)
+                {
+                    __m128 v = _mm_loadu_ps(&in[x+i].x);
+                    if(f.is_bgr) v = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3,0,1,2));
+                    q[i] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(saturate(v), _mm_set1_ps(255)), _mm_set1_ps(0.5f)));
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x*4), _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3])));
+            }
+        }
+#endif
+        // sRGB channels are quantized to 16 bits and then encoded through a table
+        const auto & tables = get_codec_tables();
+        const vec4 scale = is_srgb ? make_vec4(65535, 65535, 65535, 255) : splat(255);
+        for(; x<width; ++x)
+        {
+            int32_t q[4];
+            round_to_int(mul(saturate(load(in[x])), scale), q);
+            if(is_srgb) for(int c=0; c<3; ++c) q[c] = tables.srgb_from_linear16[q[c]];
+            uint8_t * p = out + x*f.channels;
+            for(int c=0; c<f.channels; ++c) p[get_storage_index(f, c)] = static_cast<uint8_t>(q[c]);
+        }
+        break;
+    }
+    case channel_type::sfloat16:
+#ifdef IMAGE_OPS_F16C
+        if(f.channels == 4) for(; x<width; ++x) _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x*8), _mm_cvtps_ph(_mm_loadu_ps(&in[x].x), _MM_FROUND_TO_NEAREST_INT));
+#endif
+        for(; x<width; ++x) encode_pixel(f, in[x], out + x*get_pixel_size(f));
+        break;
+    case channel_type::sfloat32:
+        if(f.channels == 4) memcpy(out, &in[0].x, get_row_size(f, width));
+        else for(; x<width; ++x) encode_pixel(f, in[x], out + x*get_pixel_size(f));
+        break;
+    }
+}
+
+// Provides each thread with rows of scratch space, which are reused between calls
+static float4 * get_scratch_row(int index, int width)
+{
+    thread_local std::vector<float4> rows[2];
+    if(rows[index].size() < static_cast<size_t>(width)) rows[index].resize(width);
+    return rows[index].data();
+}
+
+// Decodes each row of an image, applies f(row, width) to it, and encodes the result into an image of the given format
+template<class F> static image transform_rows(const image & im, VkFormat format, F f)
+{
+    const auto & src = get_pixel_format(im.get_format()), & dst = get_pixel_format(format);
+    const int2 dims {im.get_width(), im.get_height()};
+    image result {dims, format};
+    auto in = reinterpret_cast<const uint8_t *>(im.get_pixels());
+    auto out = reinterpret_cast<uint8_t *>(result.get_pixels());
+    parallel_for(dims.y, [&](size_t y)
+    {
+        float4 * row = get_scratch_row(0, dims.x);
+        decode_row(src, in + y*get_row_size(src, dims.x), row, dims.x);
+        f(row, dims.x);
+        encode_row(dst, row, out + y*get_row_size(dst, dims.x), dims.x);
+    });
+    return result;
+}
+
+// Applies f(pixel) to each pixel of an image, one at a time, without any vectorization
+template<class F> static image transform_pixels(const image & im, VkFormat format, F f)
+{
+    const auto & src = get_pixel_format(im.get_format()), & dst = get_pixel_format(format);
+    const int2 dims {im.get_width(), im.get_height()};
+    image result {dims, format};
+    auto in = reinterpret_cast<const uint8_t *>(im.get_pixels());
+    auto out = reinterpret_cast<uint8_t *>(result.get_pixels());
+    for(size_t i=0, n=product(dims); i<n; ++i) encode_pixel(dst, f(decode_pixel(src, in + i*get_pixel_size(src))), out + i*get_pixel_size(dst));
+    return result;
+}
+
+///////////////////
+// convert_image //
+///////////////////
+
+image convert_image(const image & im, VkFormat format)
+{
+    const auto & src = get_pixel_format(im.get_format()), & dst = get_pixel_format(format);
+    if(!is_8bit(src) || !is_8bit(dst)) return transform_rows(im, format, [](float4 *, int) {});
+
+    // Conversions between 8 bit formats map each channel through a table of all 256 values, which gives exactly the same results as decoding and encoding it
+    uint8_t tables[4][256];
+    int sources[4] {};
+    for(int c=0; c<dst.channels; ++c)
+    {
+        if(c < src.channels)
+        {
+            sources[c] = get_storage_index(src, c);
+            for(int i=0; i<256; ++i) tables[c][i] = encode_channel8(is_srgb_channel(dst, c), decode_channel8(is_srgb_channel(src, c), static_cast<uint8_t>(i)));
+        }
+        else
+        {
+            sources[c] = 0;
+            std::fill_n(tables[c], 256, c == 3 ? 255 : 0);
+        }
+    }
+
+    const int2 dims {im.get_width(), im.get_height()};
+    image result {dims, format};
+    auto in = reinterpret_cast<const uint8_t *>(im.get_pixels());
+    auto out = reinterpret_cast<uint8_t *>(result.get_pixels());
+    parallel_for(dims.y, [&](size_t y)
+    {
+        const uint8_t * p = in + y*get_row_size(src, dims.x);
+        uint8_t * q = out + y*get_row_size(dst, dims.x);
+        for(int x=0; x<dims.x; ++x, p += src.channels, q += dst.channels)
+        {
+            for(int c=0; c<dst.channels; ++c) q[get_storage_index(dst, c)] = tables[c][p[sources[c]]];
+        }
+    });
+    return result;
+}
+
+image reference::convert_image(const image & im, VkFormat format)
+{
+    return transform_pixels(im, format, [](const float4 & v) { return v; });
+}
+
+//////////////////////
+// downsample_image //
+//////////////////////
+
+static int2 get_downsampled_dims(const image & im) { return {std::max(im.get_width()/2, 1), std::max(im.get_height()/2, 1)}; }
+
+// Returns the half-open range of source texels covered by the box filter for the given destination texel
+static int2 get_box_extent(int src_size, int dst_size, int i) { return {narrow(int64_t(i)*src_size/dst_size), narrow(int64_t(i+1)*src_size/dst_size)}; }
+
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for(int k=1; k<32; ++k) { term *= (x/(2*k)) * (x/(2*k)); sum += term; }
+    return sum;
+}
+
+// Computes the normalized weights of the source texels contributing to each destination texel, with source coordinates clamped to the edge of the image
+static std::vector<std::vector<std::pair<int,float>>> compute_kaiser_taps(int src_size, int dst_size)
+{
+    const double radius = 3, alpha = 4, scale = static_cast<double>(src_size)/dst_size, pi = 3.14159265358979323846;
+    std::vector<std::vector<std::pair<int,float>>> taps(dst_size);
+    for(int i=0; i<dst_size; ++i)
+    {
+        const double center = (i+0.5)*scale;
+        std::vector<std::pair<int,double>> weights;
+        double total = 0;
+        for(int j=static_cast<int>(std::floor(center - radius*scale)); j<=static_cast<int>(std::ceil(center + radius*scale)); ++j)
+        {
+            const double t = (j+0.5-center)/scale;
+            if(std::abs(t) >= radius) continue;
+            const double sinc = t == 0 ? 1 : std::sin(pi*t)/(pi*t), window = bessel_i0(alpha*std::sqrt(1-(t/radius)*(t/radius))) / bessel_i0(alpha);
+            weights.push_back({std::clamp(j, 0, src_size-1), sinc*window});
+            total += sinc*window;
+        }
+        for(auto [j, w] : weights) taps[i].push_back({j, static_cast<float>(w/total)});
+    }
+    return taps;
+}
+
+static image downsample_box(const image & im)
+{
+    const auto & f = get_pixel_format(im.get_format());
+    const int2 src_dims {im.get_width(), im.get_height()}, dims = get_downsampled_dims(im);
+    image result {dims, f.format};
+    auto in = reinterpret_cast<const uint8_t *>(im.get_pixels());
+    auto out = reinterpret_cast<uint8_t *>(result.get_pixels());
+    parallel_for(dims.y, [&](size_t y)
+    {
+        // Sum the covered source rows, then sum each box of columns, reusing the second row for the result
+        const int2 rows = get_box_extent(src_dims.y, dims.y, narrow(y));
+        float4 * sum = get_scratch_row(0, src_dims.x), * row = get_scratch_row(1, src_dims.x);
+        decode_row(f, in + rows.x*get_row_size(f, src_dims.x), sum, src_dims.x);
+        for(int sy=rows.x+1; sy<rows.y; ++sy)
+        {
+            decode_row(f, in + sy*get_row_size(f, src_dims.x), row, src_dims.x);
+            for(int x=0; x<src_dims.x; ++x) store(sum[x], add(load(sum[x]), load(row[x])));
+        }
+        for(int x=0; x<dims.x; ++x)
+        {
+            const int2 columns = get_box_extent(src_dims.x, dims.x, x);
+            vec4 total = load(sum[columns.x]);
+            for(int sx=columns.x+1; sx<columns.y; ++sx) total = add(total, load(sum[sx]));
+            store(row[x], mul(total, splat(1.0f / ((columns.y-columns.x)*(rows.y-rows.x)))));
+        }
+        encode_row(f, row, out + y*get_row_size(f, dims.x), dims.x);
+    });
+    return result;
+}
+
+static image downsample_kaiser(const image & im)
+{
+    const auto & f = get_pixel_format(im.get_format());
+    const int2 src_dims {im.get_width(), im.get_height()}, dims = get_downsampled_dims(im);
+    const auto x_taps = compute_kaiser_taps(src_dims.x, dims.x), y_taps = compute_kaiser_taps(src_dims.y, dims.y);
+    image result {dims, f.format};
+    auto in = reinterpret_cast<const uint8_t *>(im.get_pixels());
+    auto out = reinterpret_cast<uint8_t *>(result.get_pixels());
+
+    // Filter each source row horizontally, then filter the columns of the intermediate result vertically
+    std::vector<float4> filtered_rows(size_t(dims.x)*src_dims.y);
+    parallel_for(src_dims.y, [&](size_t y)
+    {
+        float4 * row = get_scratch_row(0, src_dims.x);
+        decode_row(f, in + y*get_row_size(f, src_dims.x), row, src_dims.x);
+        for(int x=0; x<dims.x; ++x)
+        {
+            vec4 total = splat(0);
+            for(auto [sx, w] : x_taps[x]) total = add(total, mul(load(row[sx]), splat(w)));
+            store(filtered_rows[y*dims.x + x], total);
+        }
+    });
+    parallel_for(dims.y, [&](size_t y)
+    {
+        float4 * row = get_scratch_row(0, dims.x);
+        std::fill_n(row, dims.x, float4{});
+        for(auto [sy, w] : y_taps[y])
+        {
+            const float4 * filtered_row = filtered_rows.data() + size_t(sy)*dims.x;
+            for(int x=0; x<dims.x; ++x) store(row[x], add(load(row[x]), mul(load(filtered_row[x]), splat(w))));
+        }
+        encode_row(f, row, out + y*get_row_size(f, dims.x), dims.x);
+    });
+    return result;
+}
+
+image downsample_image(const image & im, downsample_filter filter)
+{
+    switch(filter)
+    {
+    case downsample_filter::box: return downsample_box(im);
+    case downsample_filter::kaiser: return downsample_kaiser(im);
+    default: throw std::logic_error("unknown downsample filter");
+    }
+}
+
+image reference::downsample_image(const image & im, downsample_filter filter)
+{
+    const auto & f = get_pixel_format(im.get_format());
+    const int2 src_dims {im.get_width(), im.get_height()}, dims = get_downsampled_dims(im);
+    const auto x_taps = compute_kaiser_taps(src_dims.x, dims.x), y_taps = compute_kaiser_taps(src_dims.y, dims.y);
+    image result {dims, f.format};
+    auto in = reinterpret_cast<const uint8_t *>(im.get_pixels());
+    auto out = reinterpret_cast<uint8_t *>(result.get_pixels());
+    auto get_source = [&](int x, int y) { return decode_pixel(f, in + (size_t(y)*src_dims.x + x)*get_pixel_size(f)); };
+    for(int y=0; y<dims.y; ++y)
+    {
+        for(int x=0; x<dims.x; ++x)
+        {
+            float4 sum;
+            if(filter == downsample_filter::box)
+            {
+                const int2 columns = get_box_extent(src_dims.x, dims.x, x), rows = get_box_extent(src_dims.y, dims.y, y);
+                for(int sy=rows.x; sy<rows.y; ++sy) for(int sx=columns.x; sx<columns.y; ++sx) sum += get_source(sx, sy);
+                sum /= static_cast<float>((columns.y-columns.x)*(rows.y-rows.x));
+            }
+            else for(auto [sy, wy] : y_taps[y]) for(auto [sx, wx] : x_taps[x]) sum += get_source(sx, sy) * (wy*wx);
+            encode_pixel(f, sum, out + (size_t(y)*dims.x + x)*get_pixel_size(f));
+        }
+    }
+    return result;
+}
+
+///////////////////////
+// premultiply_alpha //
+///////////////////////
+
+image premultiply_alpha(const image & im)
+{
+    const auto & f = get_pixel_format(im.get_format());
+    if(f.type != channel_type::unorm8 || f.channels != 4)
+    {
+        return transform_rows(im, f.format, [](float4 * row, int width)
+        {
+            for(int x=0; x<width; ++x) store(row[x], mul(load(row[x]), make_vec4(row[x].w, row[x].w, row[x].w, 1)));
+        });
+    }
+
+    // UNORM channels are premultiplied as integers, using an exact rounding division by 255, which computes round(c*a/255) as (t + (t >> 8)) >> 8 with t = c*a + 128
+    const int2 dims {im.get_width(), im.get_height()};
+    image result {dims, f.format};
+    auto in = reinterpret_cast<const uint8_t *>(im.get_pixels());
+    auto out = reinterpret_cast<uint8_t *>(result.get_pixels());
+    parallel_for(dims.y, [&](size_t y)
+    {
+        const uint8_t * p = in + y*dims.x*4;
+        uint8_t * q = out + y*dims.x*4;
+        int x = 0;
+#ifdef IMAGE_OPS_SSE2
+        const __m128i zero = _mm_setzero_si128(), bias = _mm_set1_epi16(128), alpha_mask = _mm_setr_epi16(0,0,0,-1,0,0,0,-1), alpha_one = _mm_and_si128(alpha_mask, _mm_set1_epi16(255));
+        auto premultiply = [&](__m128i c) // Two pixels, widened to 16 bits per channel
+        {
+            __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(c, _MM_SHUFFLE(3,3,3,3)), _MM_SHUFFLE(3,3,3,3));
+            a = _mm_or_si128(_mm_andnot_si128(alpha_mask, a), alpha_one);
+            const __m128i t = _mm_add_epi16(_mm_mullo_epi16(c, a), bias);
+            return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+        };
+        for(; x+4<=dims.x; x+=4)
+        {
+            const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + x*4));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(q + x*4), _mm_packus_epi16(premultiply(_mm_unpacklo_epi8(px, zero)), premultiply(_mm_unpackhi_epi8(px, zero))));
+        }
+#endif
+        for(; x<dims.x; ++x)
+        {
+            for(int c=0; c<3; ++c)
+            {
+                const int t = p[x*4+c]*p[x*4+3] + 128;
+                q[x*4+c] = static_cast<uint8_t>((t + (t >> 8)) >> 8);
+            }
+            q[x*4+3] = p[x*4+3];
+        }
+    });
+    return result;
+}
+
+image reference::premultiply_alpha(const image & im)
+{
+    return transform_pixels(im, im.get_format(), [](const float4 & v) { return float4{v.x*v.w, v.y*v.w, v.z*v.w, v.w}; });
+}
+
+///////////////////
+// swizzle_image //
+///////////////////
+
+// Resolves the channel read by each channel of the result, with 4 and 5 standing for the constants zero and one
+static std::array<int,4> resolve_component_mapping(const VkComponentMapping & mapping)
+{
+    const VkComponentSwizzle swizzles[] {mapping.r, mapping.g, mapping.b, mapping.a};
+    std::array<int,4> sources;
+    for(int c=0; c<4; ++c)
+    {
+        switch(swizzles[c])
+        {
+        case VK_COMPONENT_SWIZZLE_IDENTITY: sources[c] = c; break;
+        case VK_COMPONENT_SWIZZLE_ZERO: sources[c] = 4; break;
+        case VK_COMPONENT_SWIZZLE_ONE: sources[c] = 5; break;
+        case VK_COMPONENT_SWIZZLE_R: sources[c] = 0; break;
+        case VK_COMPONENT_SWIZZLE_G: sources[c] = 1; break;
+        case VK_COMPONENT_SWIZZLE_B: sources[c] = 2; break;
+        case VK_COMPONENT_SWIZZLE_A: sources[c] = 3; break;
+        default: throw std::logic_error("invalid component swizzle");
+        }
+    }
+    return sources;
+}
+
+image swizzle_image(const image & im, const VkComponentMapping & mapping)
+{
+    const auto & f = get_pixel_format(im.get_format());
+    const auto sources = resolve_component_mapping(mapping);
+
+    // Four channel 8 bit images can be swizzled by moving bytes, provided no value moves between an sRGB color channel and the linear alpha channel
+    bool can_move_bytes = is_8bit(f) && f.channels == 4;
+    for(int c=0; c<4; ++c) if(f.type == channel_type::srgb8 && sources[c] < 4 && (sources[c] == 3) != (c == 3)) can_move_bytes = false;
+    if(!can_move_bytes)
+    {
+        return transform_rows(im, f.format, [&](float4 * row, int width)
+        {
+            for(int x=0; x<width; ++x)
+            {
+                const float values[6] {row[x].x, row[x].y, row[x].z, row[x].w, 0, 1};
+                row[x] = {values[sources[0]], values[sources[1]], values[sources[2]], values[sources[3]]};
+            }
+        });
+    }
+
+    // Each pixel is treated as a little-endian 32 bit word, with every channel of the result either shifted into place from the source or set to a constant
+    uint32_t constant = 0;
+    int shifts[4][2], moves = 0;
+    for(int c=0; c<4; ++c)
+    {
+        const int to = get_storage_index(f, c)*8;
+        if(sources[c] == 5) constant |= 0xFFu << to;
+        else if(sources[c] < 4) { shifts[moves][0] = get_storage_index(f, sources[c])*8; shifts[moves][1] = to; ++moves; }
+    }
+
+    const int2 dims {im.get_width(), im.get_height()};
+    image result {dims, f.format};
+    auto in = reinterpret_cast<const uint8_t *>(im.get_pixels());
+    auto out = reinterpret_cast<uint8_t *>(result.get_pixels());
+    parallel_for(dims.y, [&](size_t y)
+    {
+        const uint8_t * p = in + y*dims.x*4;
+        uint8_t * q = out + y*dims.x*4;
+        int x = 0;
+#ifdef IMAGE_OPS_SSE2
+        const __m128i mask = _mm_set1_epi32(0xFF);
+        for(; x+4<=dims.x; x+=4)
+        {
+            const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + x*4));
+            __m128i r = _mm_set1_epi32(static_cast<int>(constant));
+            for(int i=0; i<moves; ++i) r = _mm_or_si128(r, _mm_sll_epi32(_mm_and_si128(_mm_srl_epi32(px, _mm_cvtsi32_si128(shifts[i][0])), mask), _mm_cvtsi32_si128(shifts[i][1])));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(q + x*4), r);
+        }
+#endif
+        for(; x<dims.x; ++x)
+        {
+            uint32_t px, r = constant;
+            memcpy(&px, p + x*4, sizeof(px));
+            for(int i=0; i<moves; ++i) r |= (px >> shifts[i][0] & 0xFF) << shifts[i][1];
+            memcpy(q + x*4, &r, sizeof(r));
+        }
+    });
+    return result;
+}
+
+image reference::swizzle_image(const image & im, const VkComponentMapping & mapping)
+{
+    const auto sources = resolve_component_mapping(mapping);
+    return transform_pixels(im, im.get_format(), [&](const float4 & v)
+    {
+        const float values[6] {v.x, v.y, v.z, v.w, 0, 1};
+        return float4{values[sources[0]], values[sources[1]], values[sources[2]], values[sources[3]]};
+    });
+}
+
+////////////////////////////
+// renormalize_normal_map //
+////////////////////////////
+
+static const pixel_format & get_normal_map_format(const image & im)
+{
+    const auto & f = get_pixel_format(im.get_format());
+    if(f.type == channel_type::srgb8) throw std::logic_error("normal maps may not use sRGB formats");
+    if(f.channels < 2) throw std::logic_error("normal maps require at least two channels");
+    return f;
+}
+
+static float4 renormalize_normal(const float4 & v, int channels, bool is_unorm)
+{
+    float3 n = is_unorm ? float3{v.x, v.y, v.z}*2.0f - 1.0f : float3{v.x, v.y, v.z};
+    if(channels == 2)
+    {
+        const float length2 = n.x*n.x + n.y*n.y;
+        if(length2 > 1) n /= std::sqrt(length2);
+    }
+    else
+    {
+        const float length2 = dot(n, n);
+        n = length2 < 1e-12f ? float3{0,0,1} : n / std::sqrt(length2);
+    }
+    if(is_unorm) n = (n + 1.0f) / 2.0f;
+    return {n.x, n.y, channels == 2 ? v.z : n.z, v.w};
+}
+
+image renormalize_normal_map(const image & im)
+{
+    const auto & f = get_normal_map_format(im);
+    const bool is_unorm = f.type == channel_type::unorm8;
+    return transform_rows(im, f.format, [&](float4 * row, int width)
+    {
+#ifdef IMAGE_OPS_SSE2
+        const __m128 scale = _mm_set1_ps(is_unorm ? 2.0f : 1.0f), bias = _mm_set1_ps(is_unorm ? -1.0f : 0.0f);
+        const __m128 mask = _mm_castsi128_ps(f.channels == 2 ? _mm_setr_epi32(-1,-1,0,0) : _mm_setr_epi32(-1,-1,-1,0));
+        for(int x=0; x<width; ++x)
+        {
+            const __m128 v = _mm_loadu_ps(&row[x].x);
+            __m128 n = _mm_and_ps(_mm_add_ps(_mm_mul_ps(v, scale), bias), mask), length2 = _mm_mul_ps(n, n);
+            length2 = _mm_add_ps(length2, _mm_shuffle_ps(length2, length2, _MM_SHUFFLE(2,3,0,1)));
+            length2 = _mm_add_ps(length2, _mm_shuffle_ps(length2, length2, _MM_SHUFFLE(1,0,3,2)));
+            const float l2 = _mm_cvtss_f32(length2);
+            if(f.channels > 2 && l2 < 1e-12f) n = _mm_setr_ps(0,0,1,0);
+            else if(f.channels > 2 || l2 > 1) n = _mm_div_ps(n, _mm_sqrt_ps(length2));
+
+            // Map the normal back into the stored range, and keep the channels which are not part of it
+            n = _mm_div_ps(_mm_sub_ps(n, bias), scale);
+            _mm_storeu_ps(&row[x].x, _mm_or_ps(_mm_and_ps(mask, n), _mm_andnot_ps(mask, v)));
+        }
+#else
+        for(int x=0; x<width; ++x) row[x] = renormalize_normal(row[x], f.channels, is_unorm);
+#endif
+    });
+}
+
+image reference::renormalize_normal_map(const image & im)
+{
+    const auto & f = get_normal_map_format(im);
+    return transform_pixels(im, f.format, [&](const float4 & v) { return renormalize_normal(v, f.channels, f.type == channel_type::unorm8); });
+}
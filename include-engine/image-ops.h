@@ -0,0 +1,38 @@
+#ifndef IMAGE_OPS_H
+#define IMAGE_OPS_H
+
+#include "data-types.h"
+
+// Pure functions which transform the contents of images. They accept any format whose channels are 8 bit UNORM or SRGB, 16 bit SFLOAT or 32 bit SFLOAT, in R, RG, RGB,
+// BGR, RGBA or BGRA order. Pixels are processed in linear space, so the color channels of SRGB formats are decoded on the way in and encoded on the way out, and
+// channels missing from a format read as (0,0,0,1). Rows are spread across all available threads, and the inner loops use SSE2 where it is available.
+
+// Converting between the UNORM and SRGB variants of a format converts its color channels between linear and sRGB encoding
+image convert_image(const image & im, VkFormat format);
+
+// Halves both dimensions of an image, down to a minimum of one. The box filter spans either two or three source texels along dimensions of odd size. The Kaiser
+// filter is a windowed sinc spanning three destination texels either side of each texel, which preserves more detail at the cost of slight ringing.
+enum class downsample_filter { box, kaiser };
+image downsample_image(const image & im, downsample_filter filter);
+
+// Multiplies the color channels of an image by its alpha channel
+image premultiply_alpha(const image & im);
+
+// Rearranges the channels of an image, following the same rules as the component mapping of a VkImageView
+image swizzle_image(const image & im, const VkComponentMapping & mapping);
+
+// Rescales the normals stored in a normal map to unit length. UNORM channels map [0,1] onto [-1,1], while float channels store components directly. Two channel
+// normal maps only have their XY components clamped to the unit disc, as Z is expected to be reconstructed by the shader.
+image renormalize_normal_map(const image & im);
+
+// Straightforward scalar implementations of the functions above, which specify their intended behavior and are used to test them
+namespace reference
+{
+    image convert_image(const image & im, VkFormat format);
+    image downsample_image(const image & im, downsample_filter filter);
+    image premultiply_alpha(const image & im);
+    image swizzle_image(const image & im, const VkComponentMapping & mapping);
+    image renormalize_normal_map(const image & im);
+}
+
+#endif
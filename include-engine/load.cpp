@@ -1,12 +1,15 @@
 #include "load.h"
 #include "utility.h"
-#include <map>
+#include "package.h"
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <cstring>
+#include <thread>
 
 std::vector<uint8_t> load_binary_file(const char * filename)
 {
+    if(auto blob = find_mounted_blob(filename)) return {blob->contents.begin(), blob->contents.end()};
     FILE * f = fopen(filename, "rb");
     if(!f) throw std::runtime_error(std::string("failed to open ") + filename);
     fseek(f, 0, SEEK_END);
@@ -19,6 +22,7 @@ std::vector<uint8_t> load_binary_file(const char * filename)
 
 std::vector<char> load_text_file(const char * filename)
 {
+    if(auto blob = find_mounted_blob(filename)) return {blob->contents.begin(), blob->contents.end()};
     FILE * f = fopen(filename, "r");
     if(!f) throw std::runtime_error(std::string("failed to open ") + filename);
     fseek(f, 0, SEEK_END);
@@ -29,6 +33,49 @@ std::vector<char> load_text_file(const char * filename)
     return buffer;
 }
 
+void save_binary_file(const char * filename, array_view<uint8_t> contents)
+{
+    // The temporary file is named after the writing thread, as several threads may save the same file at once
+    const std::string temp_filename = filename + ('.' + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp");
+    FILE * f = fopen(temp_filename.c_str(), "wb");
+    if(!f) throw std::runtime_error(std::string("failed to open ") + temp_filename);
+    const size_t written = fwrite(contents.data, 1, contents.size, f);
+    if(fclose(f) != 0 || written != contents.size) { remove(temp_filename.c_str()); throw std::runtime_error(std::string("failed to write ") + temp_filename); }
+    remove(filename);
+    if(rename(temp_filename.c_str(), filename) != 0) { remove(temp_filename.c_str()); throw std::runtime_error(std::string("failed to replace ") + filename); }
+}
+
+// stb_image always allocates its own output, so its allocations are routed through these functions, which hand out the caller's
+// destination for the first allocation the size of the decoded image (plus the single byte of slack the JPEG decoder asks for).
+// Everything else is serviced by the C heap as usual.
+struct stbi_destination { void * pixels; size_t size, capacity; bool claimed; };
+static thread_local stbi_destination * stbi_dest;
+static void * stbi_malloc(size_t size)
+{
+    if(stbi_dest && !stbi_dest->claimed && (size == stbi_dest->size || size == stbi_dest->size + 1) && size <= stbi_dest->capacity)
+    {
+        stbi_dest->claimed = true;
+        return stbi_dest->pixels;
+    }
+    return malloc(size);
+}
+static void * stbi_realloc_sized(void * p, size_t old_size, size_t new_size)
+{
+    if(!stbi_dest || p != stbi_dest->pixels) return realloc(p, new_size);
+    if(new_size <= stbi_dest->capacity) return p;
+    void * q = malloc(new_size);
+    if(q) memcpy(q, p, std::min(old_size, new_size));
+    stbi_dest->claimed = false;
+    return q;
+}
+static void stbi_free(void * p)
+{
+    if(stbi_dest && p == stbi_dest->pixels) stbi_dest->claimed = false;
+    else free(p);
+}
+#define STBI_MALLOC(sz) stbi_malloc(sz)
+#define STBI_REALLOC_SIZED(p,oldsz,newsz) stbi_realloc_sized(p,oldsz,newsz)
+#define STBI_FREE(p) stbi_free(p)
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
@@ -42,11 +89,38 @@ image generate_single_color_image(const byte4 & color)
 image load_image(const char * filename, bool is_linear) 
 { 
     int2 dims;
-    auto p = stbi_load(filename, &dims.x, &dims.y, nullptr, 4);
+    auto blob = find_mounted_blob(filename);
+    auto p = blob ? stbi_load_from_memory(blob->contents.data, narrow(blob->contents.size), &dims.x, &dims.y, nullptr, 4) : stbi_load(filename, &dims.x, &dims.y, nullptr, 4);
     if(!p) throw std::runtime_error(std::string("failed to load ") + filename);
     return image{dims, is_linear ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R8G8B8A8_SRGB, std::unique_ptr<byte, std_free_deleter>(reinterpret_cast<byte *>(p))};
 }
 
+void load_image(const char * filename, bool is_linear, const std::function<void * (int2 dims, VkFormat format, size_t capacity)> & allocate_pixels)
+{
+    // Read the dimensions from the header, so that the destination can be allocated before decoding begins
+    auto blob = find_mounted_blob(filename);
+    std::unique_ptr<FILE, decltype(&fclose)> f {blob ? nullptr : fopen(filename, "rb"), &fclose};
+    if(!blob && !f) throw std::runtime_error(std::string("failed to open ") + filename);
+    int2 dims;
+    if(!(blob ? stbi_info_from_memory(blob->contents.data, narrow(blob->contents.size), &dims.x, &dims.y, nullptr) : stbi_info_from_file(f.get(), &dims.x, &dims.y, nullptr))) throw std::runtime_error(std::string("failed to load ") + filename);
+    const VkFormat format = is_linear ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R8G8B8A8_SRGB;
+    const size_t size = compute_image_size(dims, format), capacity = size + 1;
+    stbi_destination dest {allocate_pixels(dims, format, capacity), size, capacity, false};
+
+    // Decode, which will usually write directly into the destination, but otherwise fall back to copying the decoded pixels
+    int2 decoded_dims;
+    stbi_dest = &dest;
+    auto p = blob ? stbi_load_from_memory(blob->contents.data, narrow(blob->contents.size), &decoded_dims.x, &decoded_dims.y, nullptr, 4) : stbi_load_from_file(f.get(), &decoded_dims.x, &decoded_dims.y, nullptr, 4);
+    stbi_dest = nullptr;
+    if(!p) throw std::runtime_error(std::string("failed to load ") + filename);
+    if(p != dest.pixels)
+    {
+        if(decoded_dims == dims) memcpy(dest.pixels, p, dest.size);
+        stbi_image_free(p);
+    }
+    if(decoded_dims != dims) throw std::runtime_error(std::string("failed to load ") + filename);
+}
+
 mesh compute_tangent_basis(mesh && m)
 {
     for(auto & v : m.vertices) v.tangent = v.bitangent = {};
@@ -109,16 +183,18 @@ mesh invert_faces(mesh m)
 //////////////////////////
 
 #include "fbx.h"
+#include "mesh-ops.h"
 
-std::vector<mesh> load_meshes_from_fbx(coord_system target, const char * filename)
+std::vector<mesh> load_meshes_from_fbx(coord_system target, const char * filename, std::vector<mesh_optimization_stats> * stats)
 {
-    std::ifstream in(filename, std::ifstream::binary);
-    if(!in) throw std::runtime_error(std::string("unable to open ") + filename);
-    auto meshes = fbx::load_meshes(fbx::ast::load(in));
+    auto blob = find_mounted_blob(filename);
+    auto meshes = fbx::load_meshes(blob ? fbx::ast::load(blob->contents) : fbx::ast::load(filename));
 
     const coord_system fbx_coords {coord_axis::right, coord_axis::up, coord_axis::back};
     const auto xform = make_transform(fbx_coords, target);
-    for(auto & m : meshes) m = compute_tangent_basis(transform(xform, std::move(m)));
+    // FBX stores attributes per polygon corner, so vertices are welded before computing tangents, which are then shared by every corner of a vertex
+    if(stats) stats->resize(meshes.size());
+    for(size_t i=0; i<meshes.size(); ++i) meshes[i] = compute_tangent_basis(optimize_mesh(weld_vertices(transform(xform, std::move(meshes[i]))), 16, stats ? &(*stats)[i] : nullptr));
     return meshes;
 }
 
@@ -126,80 +202,347 @@ std::vector<mesh> load_meshes_from_fbx(coord_system target, const char * filenam
 // load_mesh_from_obj //
 ////////////////////////
 
-mesh load_mesh_from_obj(coord_system target, const char * filename)
+#include <charconv>
+#include <unordered_map>
+
+namespace obj
 {
-    mesh m;
-    std::map<std::string, uint32_t> vertex_map;
-    std::vector<float3> vertices;
+    // A single corner of a face, as 1-based indices into the position, texcoord and normal lists, with zero meaning absent
+    struct corner 
+    { 
+        int32_t v, vt, vn; 
+        bool operator == (const corner & r) const { return v == r.v && vt == r.vt && vn == r.vn; }
+    };
+    struct corner_hash { size_t operator() (const corner & c) const { return std::hash<uint64_t>{}((uint64_t(uint32_t(c.v)) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(uint32_t(c.vt)) << 21) ^ uint64_t(uint32_t(c.vn)) * 0xC2B2AE3D27D4EB4Full); } };
+
+    struct face { size_t first_corner, num_corners; };
+    struct material { std::string_view name; size_t first_face; };
+
+    // Everything parsed out of one contiguous range of lines, which can be produced independently of every other range
+    struct chunk
+    {
+        std::vector<float3> positions;
+        std::vector<float2> texcoords;
+        std::vector<float3> normals;
+        std::vector<corner> corners;
+        std::vector<face> faces;
+        std::vector<material> materials;
+    };
+
+    class line_parser
+    {
+        const char * it, * last;
+    public:
+        line_parser(const char * first, const char * last) : it{first}, last{last} {}
+
+        void skip_whitespace() { while(it != last && (*it == ' ' || *it == '\t' || *it == '\r')) ++it; }
+        bool at_end() { skip_whitespace(); return it == last; }
+
+        std::string_view parse_token()
+        {
+            skip_whitespace();
+            const char * token = it;
+            while(it != last && *it != ' ' && *it != '\t' && *it != '\r') ++it;
+            return {token, static_cast<size_t>(it - token)};
+        }
+
+        template<class T> T parse_number(const char * desc)
+        {
+            skip_whitespace();
+            if(it != last && *it == '+') ++it;
+            T number {};
+            auto r = std::from_chars(it, last, number);
+            if(r.ec != std::errc{}) throw std::runtime_error(std::string("malformed ") + desc);
+            it = r.ptr;
+            return number;
+        }
+
+        corner parse_corner()
+        {
+            // Accepts v, v/vt, v//vn, or v/vt/vn
+            corner c {parse_number<int32_t>("face"), 0, 0};
+            if(it == last || *it != '/') return c;
+            if(++it != last && *it != '/') c.vt = parse_number<int32_t>("face");
+            if(it == last || *it != '/') return c;
+            ++it;
+            c.vn = parse_number<int32_t>("face");
+            return c;
+        }
+    };
+
+    void parse_chunk(chunk & c, const char * first, const char * last)
+    {
+        while(first != last)
+        {
+            const char * eol = std::find(first, last, '\n');
+            line_parser line {first, eol};
+            first = eol == last ? last : eol + 1;
+
+            const auto token = line.parse_token();
+            if(token.empty() || token.front() == '#') continue;
+            if(token == "v")
+            {
+                const float x = line.parse_number<float>("vertex"), y = line.parse_number<float>("vertex"), z = line.parse_number<float>("vertex");
+                c.positions.push_back({x, y, z});
+            }
+            else if(token == "vt")
+            {
+                const float s = line.parse_number<float>("vertex texture coords"), t = line.parse_number<float>("vertex texture coords");
+                c.texcoords.push_back({s, 1-t});
+            }
+            else if(token == "vn")
+            {
+                const float x = line.parse_number<float>("vertex normal"), y = line.parse_number<float>("vertex normal"), z = line.parse_number<float>("vertex normal");
+                c.normals.push_back({x, y, z});
+            }
+            else if(token == "f")
+            {
+                face f {c.corners.size(), 0};
+                while(!line.at_end()) c.corners.push_back(line.parse_corner());
+                f.num_corners = c.corners.size() - f.first_corner;
+                c.faces.push_back(f);
+            }
+            else if(token == "usemtl") c.materials.push_back({line.parse_token(), c.faces.size()});
+        }
+    }
+}
+
+static mesh load_mesh_from_obj(coord_system target, const char * first, const char * last, mesh_optimization_stats * stats)
+{
+    // Split the file into chunks of whole lines and parse them in parallel
+    const size_t chunk_size = 256*1024;
+    std::vector<const char *> boundaries {first};
+    while(boundaries.back() != last)
+    {
+        const char * split = static_cast<size_t>(last - boundaries.back()) > chunk_size ? boundaries.back() + chunk_size : last;
+        split = std::find(split, last, '\n');
+        boundaries.push_back(split == last ? split : split + 1);
+    }
+    std::vector<obj::chunk> chunks(boundaries.size() - 1);
+    parallel_for(chunks.size(), [&](size_t i) { obj::parse_chunk(chunks[i], boundaries[i], boundaries[i+1]); });
+
+    // Concatenate vertex attributes, which are indexed across the whole file
+    std::vector<float3> positions, normals;
     std::vector<float2> texcoords;
-    std::vector<float3> normals;
-    auto find_vertex = [&](std::string && indices)
+    for(auto & c : chunks)
     {
-        auto it = vertex_map.find(indices);
+        positions.insert(positions.end(), c.positions.begin(), c.positions.end());
+        texcoords.insert(texcoords.end(), c.texcoords.begin(), c.texcoords.end());
+        normals.insert(normals.end(), c.normals.begin(), c.normals.end());
+    }
+
+    // Assemble faces in file order, creating one vertex per unique combination of indices
+    mesh m;
+    std::unordered_map<obj::corner, uint32_t, obj::corner_hash> vertex_map;
+    auto find_vertex = [&](const obj::corner & c)
+    {
+        auto it = vertex_map.find(c);
         if(it != vertex_map.end()) return it->second;
 
-        const auto index = vertex_map[indices] = static_cast<uint32_t>(m.vertices.size());
-        const bool no_texcoords = indices.find("//") != std::string::npos;
-        for(auto & ch : indices) if(ch == '/') ch = ' ';
-        int v {}, vt {}, vn {};
-        std::istringstream ss(indices);
-        ss >> v >> vt >> vn;
-        if(no_texcoords) std::swap(vt, vn);
+        if(c.v < 1 || c.v > static_cast<int64_t>(positions.size()) || c.vt < 0 || c.vt > static_cast<int64_t>(texcoords.size()) || c.vn < 0 || c.vn > static_cast<int64_t>(normals.size())) throw std::runtime_error("face index out of range");
         mesh::vertex vertex {};
-        if(v) vertex.position = vertices[v-1];
-        if(vt) vertex.texcoord = texcoords[vt-1];
-        if(vn) vertex.normal = normals[vn-1];
+        vertex.position = positions[c.v-1];
+        if(c.vt) vertex.texcoord = texcoords[c.vt-1];
+        if(c.vn) vertex.normal = normals[c.vn-1];
         vertex.color = {1,1,1};
+        const auto index = static_cast<uint32_t>(m.vertices.size());
         m.vertices.push_back(vertex);
+        vertex_map.emplace(c, index);
         return index;
     };
-
-    std::ifstream in(filename);
-    std::string line, token;
-    while(true)
+    std::vector<uint32_t> indices;
+    for(auto & c : chunks)
     {
-        if(!std::getline(in, line)) break;
-        if(line.empty() || line.front() == '#') continue;
-        std::istringstream ss(line);
-        if(!(ss >> token)) continue;
-        if(token == "v")
+        auto mat = c.materials.begin();
+        for(size_t i=0; i<=c.faces.size(); ++i)
         {
-            float3 vertex;
-            if(!(ss >> vertex.x >> vertex.y >> vertex.z)) throw std::runtime_error("malformed vertex");
-            vertices.push_back(vertex);
+            for(; mat != c.materials.end() && mat->first_face == i; ++mat)
+            {
+                if(!m.materials.empty()) m.materials.back().num_triangles = m.triangles.size() - m.materials.back().first_triangle;
+                m.materials.push_back({std::string{mat->name}, m.triangles.size(), 0});
+            }
+            if(i == c.faces.size()) break;
+
+            indices.clear();
+            for(size_t j=0; j<c.faces[i].num_corners; ++j) indices.push_back(find_vertex(c.corners[c.faces[i].first_corner + j]));
+            for(size_t j=2; j<indices.size(); ++j) m.triangles.push_back({indices[0], indices[j-1], indices[j]});
         }
-        else if(token == "vt")
+    }
+    if(!m.materials.empty()) m.materials.back().num_triangles = m.triangles.size() - m.materials.back().first_triangle;
+    const coord_system obj_coords {coord_axis::right, coord_axis::up, coord_axis::back};
+    return compute_tangent_basis(optimize_mesh(transform(make_transform(obj_coords, target), m), 16, stats));
+}
+
+mesh load_mesh_from_obj(coord_system target, const char * filename, mesh_optimization_stats * stats)
+{
+    if(auto blob = find_mounted_blob(filename)) return load_mesh_from_obj(target, reinterpret_cast<const char *>(blob->contents.begin()), reinterpret_cast<const char *>(blob->contents.end()), stats);
+    const mapped_file file {filename};
+    return load_mesh_from_obj(target, file.begin(), file.end(), stats);
+}
+
+////////////////
+// mesh_cache //
+////////////////
+
+// All offsets are relative to the start of the file, and all arrays begin on a 16 byte boundary. Vertices and keyframes are
+// stored exactly as they are laid out in memory, so a cache is tied to the vertex layout and byte order of the build which wrote it.
+struct mesh_cache_string { uint64_t offset, length; };
+struct mesh_cache_array { uint64_t offset, count; };
+struct mesh_cache_header
+{
+    char magic[8];
+    uint32_t version, vertex_size;
+    mesh_cache_array meshes;        // of mesh_cache_record
+};
+struct mesh_cache_record
+{
+    mesh_cache_array vertices;      // of mesh::vertex
+    mesh_cache_array triangles;     // of uint3
+    mesh_cache_array bones;         // of mesh_cache_bone
+    mesh_cache_array animations;    // of mesh_cache_animation
+    mesh_cache_array materials;     // of mesh_cache_material
+};
+struct mesh_cache_bone { mesh_cache_string name; int64_t parent_index; mesh::bone_keyframe initial_pose; float4x4 model_to_bone_matrix; };
+struct mesh_cache_animation { mesh_cache_string name; mesh_cache_array keys; mesh_cache_array local_transforms; }; // keys.count * bones.count local transforms
+struct mesh_cache_material { mesh_cache_string name; uint64_t first_triangle, num_triangles; };
+
+static const char mesh_cache_magic[8] {'I','E','M','E','S','H','\r','\n'};
+static const uint32_t mesh_cache_version = 1;
+
+class mesh_cache_writer
+{
+    std::vector<char> buffer;
+public:
+    template<class T> mesh_cache_array write(const T * elements, size_t count)
+    {
+        buffer.resize((buffer.size() + 15) & ~size_t(15));
+        const mesh_cache_array a {buffer.size(), count};
+        buffer.insert(buffer.end(), reinterpret_cast<const char *>(elements), reinterpret_cast<const char *>(elements + count));
+        return a;
+    }
+    template<class T> mesh_cache_array write(const std::vector<T> & elements) { return write(elements.data(), elements.size()); }
+    mesh_cache_string write(const std::string & s) { auto a = write(s.data(), s.size()); return {a.offset, a.count}; }
+    template<class T> void patch(const mesh_cache_array & a, const T * elements) { memcpy(buffer.data() + a.offset, elements, sizeof(T)*a.count); }
+
+    void save(const char * filename) const { save_binary_file(filename, {reinterpret_cast<const uint8_t *>(buffer.data()), buffer.size()}); }
+};
+
+void save_mesh_cache(const char * filename, array_view<mesh> meshes)
+{
+    // Reserve space for the header and mesh records, which are filled in once the offsets of their contents are known
+    mesh_cache_writer writer;
+    mesh_cache_header header {{}, mesh_cache_version, sizeof(mesh::vertex)};
+    memcpy(header.magic, mesh_cache_magic, sizeof(header.magic));
+    const auto header_location = writer.write(&header, 1);
+    header.meshes = writer.write(std::vector<mesh_cache_record>(meshes.size));
+
+    std::vector<mesh_cache_record> records;
+    for(auto & m : meshes)
+    {
+        std::vector<mesh_cache_bone> bones;
+        for(auto & b : m.bones) bones.push_back({writer.write(b.name), b.parent_index ? static_cast<int64_t>(*b.parent_index) : -1, b.initial_pose, b.model_to_bone_matrix});
+
+        std::vector<mesh_cache_animation> animations;
+        for(auto & a : m.animations)
         {
-            float2 texcoord;
-            if(!(ss >> texcoord.x >> texcoord.y)) throw std::runtime_error("malformed vertex texture coords");
-            texcoords.push_back({texcoord.x, 1-texcoord.y});
+            std::vector<int64_t> keys;
+            std::vector<mesh::bone_keyframe> local_transforms;
+            for(auto & k : a.keyframes)
+            {
+                if(k.local_transforms.size() != m.bones.size()) throw std::runtime_error("keyframe does not specify a transform for every bone");
+                keys.push_back(k.key);
+                local_transforms.insert(local_transforms.end(), k.local_transforms.begin(), k.local_transforms.end());
+            }
+            animations.push_back({writer.write(a.name), writer.write(keys), writer.write(local_transforms)});
         }
-        else if(token == "vn")
+
+        std::vector<mesh_cache_material> materials;
+        for(auto & mat : m.materials) materials.push_back({writer.write(mat.name), mat.first_triangle, mat.num_triangles});
+
+        records.push_back({writer.write(m.vertices), writer.write(m.triangles), writer.write(bones), writer.write(animations), writer.write(materials)});
+    }
+    writer.patch(header_location, &header);
+    writer.patch(header.meshes, records.data());
+    writer.save(filename);
+}
+
+mesh_cache::mesh_cache(const char * filename) : file{filename}
+{
+    if(file.get_size() < sizeof(mesh_cache_header)) throw std::runtime_error(std::string("not a mesh cache: ") + filename);
+    auto & header = *reinterpret_cast<const mesh_cache_header *>(file.begin());
+    if(memcmp(header.magic, mesh_cache_magic, sizeof(header.magic)) != 0) throw std::runtime_error(std::string("not a mesh cache: ") + filename);
+    if(header.version != mesh_cache_version || header.vertex_size != sizeof(mesh::vertex)) throw std::runtime_error(std::string("incompatible mesh cache: ") + filename);
+    records = get_array<mesh_cache_record>(header.meshes);
+
+    // Validate every array up front, so that the accessors below can refer into the file without further checks
+    for(auto & r : records)
+    {
+        get_array<mesh::vertex>(r.vertices);
+        for(auto & t : get_array<uint3>(r.triangles)) if(t.x >= r.vertices.count || t.y >= r.vertices.count || t.z >= r.vertices.count) throw std::runtime_error("mesh cache triangle index out of range");
+        for(auto & b : get_array<mesh_cache_bone>(r.bones))
         {
-            float3 normal;
-            if(!(ss >> normal.x >> normal.y >> normal.z)) throw std::runtime_error("malformed vertex normal");
-            normals.push_back(normal);
+            get_string(b.name);
+            if(b.parent_index >= static_cast<int64_t>(r.bones.count)) throw std::runtime_error("mesh cache bone parent out of range");
         }
-        else if(token == "f")
+        for(auto & a : get_array<mesh_cache_animation>(r.animations))
         {
-            std::vector<uint32_t> indices;
-            while(true)
-            {
-                if(ss >> token) indices.push_back(find_vertex(std::move(token)));
-                else break;
-            }
-            for(size_t i=2; i<indices.size(); ++i) m.triangles.push_back({indices[0], indices[i-1], indices[i]});
+            get_string(a.name);
+            get_array<int64_t>(a.keys);
+            if(get_array<mesh::bone_keyframe>(a.local_transforms).size != a.keys.count * r.bones.count) throw std::runtime_error("mesh cache animation is malformed");
         }
-        else if(token == "usemtl")
+        for(auto & m : get_array<mesh_cache_material>(r.materials))
         {
-            if(!m.materials.empty()) m.materials.back().num_triangles = m.triangles.size() - m.materials.back().first_triangle;
-            ss >> token;
-            m.materials.push_back({token, m.triangles.size(), 0});
+            get_string(m.name);
+            if(m.first_triangle > r.triangles.count || m.num_triangles > r.triangles.count - m.first_triangle) throw std::runtime_error("mesh cache material out of range");
         }
     }
-    if(!m.materials.empty()) m.materials.back().num_triangles = m.triangles.size() - m.materials.back().first_triangle;
-    const coord_system obj_coords {coord_axis::right, coord_axis::up, coord_axis::back};
-    return compute_tangent_basis(transform(make_transform(obj_coords, target), m));
+}
+
+template<class T> array_view<T> mesh_cache::get_array(const mesh_cache_array & a) const
+{
+    if(a.offset % alignof(T) || a.offset > file.get_size() || a.count > (file.get_size() - a.offset) / sizeof(T)) throw std::runtime_error("mesh cache array out of bounds");
+    return {reinterpret_cast<const T *>(file.begin() + a.offset), static_cast<size_t>(a.count)};
+}
+
+std::string_view mesh_cache::get_string(const mesh_cache_string & s) const
+{
+    auto a = get_array<char>({s.offset, s.length});
+    return {a.data, a.size};
+}
+
+array_view<mesh::vertex> mesh_cache::get_vertices(size_t index) const { return get_array<mesh::vertex>(records[index].vertices); }
+array_view<uint3> mesh_cache::get_triangles(size_t index) const { return get_array<uint3>(records[index].triangles); }
+
+mesh mesh_cache::get_mesh(size_t index) const
+{
+    auto & r = records[index];
+    mesh m;
+    const auto vertices = get_vertices(index);
+    const auto triangles = get_triangles(index);
+    m.vertices.assign(vertices.begin(), vertices.end());
+    m.triangles.assign(triangles.begin(), triangles.end());
+    for(auto & b : get_array<mesh_cache_bone>(r.bones))
+    {
+        m.bones.push_back({std::string{get_string(b.name)}, std::nullopt, b.initial_pose, b.model_to_bone_matrix});
+        if(b.parent_index >= 0) m.bones.back().parent_index = static_cast<size_t>(b.parent_index);
+    }
+    for(auto & a : get_array<mesh_cache_animation>(r.animations))
+    {
+        mesh::animation anim {std::string{get_string(a.name)}};
+        const auto keys = get_array<int64_t>(a.keys);
+        const auto local_transforms = get_array<mesh::bone_keyframe>(a.local_transforms);
+        for(size_t i=0; i<keys.size; ++i) anim.keyframes.push_back({keys[i], {local_transforms.begin() + i*r.bones.count, local_transforms.begin() + (i+1)*r.bones.count}});
+        m.animations.push_back(std::move(anim));
+    }
+    for(auto & mat : get_array<mesh_cache_material>(r.materials)) m.materials.push_back({std::string{get_string(mat.name)}, static_cast<size_t>(mat.first_triangle), static_cast<size_t>(mat.num_triangles)});
+    return m;
+}
+
+std::vector<mesh> mesh_cache::get_meshes() const
+{
+    std::vector<mesh> meshes;
+    for(size_t i=0; i<get_mesh_count(); ++i) meshes.push_back(get_mesh(i));
+    return meshes;
 }
 
 /////////////////
@@ -207,103 +550,194 @@ mesh load_mesh_from_obj(coord_system target, const char * filename)
 /////////////////
 
 #include <vulkan/spirv.hpp>
-struct spirv_module
+
+// Values attached to ids during parsing, grouped by id with a counting sort once parsing is complete, so that the values for any id form a contiguous range
+template<class T> class spirv_id_table
 {
-    struct type { spv::Op op; std::vector<uint32_t> contents; };
-    struct variable { uint32_t type; spv::StorageClass storage_class; };
-    struct constant { uint32_t type; std::vector<uint32_t> literals; };
-    struct entrypoint { spv::ExecutionModel execution_model; std::string name; std::vector<uint32_t> interfaces; };
-    struct metadata
+    std::vector<std::pair<uint32_t, T>> entries;
+    std::vector<uint32_t> offsets;
+    std::vector<T> values;
+public:
+    void add(uint32_t id, const T & value) { entries.push_back({id, value}); }
+    void build(uint32_t id_bound)
     {
-        std::string name;
-        std::map<spv::Decoration, std::vector<uint32_t>> decorations;
-        std::map<uint32_t, metadata> members;
-        bool has_decoration(spv::Decoration decoration) const { return decorations.find(decoration) != decorations.end(); }
-        std::optional<uint32_t> get_decoration(spv::Decoration decoration) const
-        {
-            auto it = decorations.find(decoration);
-            if(it == decorations.end() || it->second.size() != 1) return std::nullopt;
-            return it->second[0];
-        }
-    };
+        offsets.assign(size_t(id_bound)+1, 0);
+        for(auto & e : entries) ++offsets[e.first+1];
+        for(uint32_t i=0; i<id_bound; ++i) offsets[i+1] += offsets[i];
+        values.resize(entries.size());
+        std::vector<uint32_t> next {offsets.begin(), offsets.end()-1};
+        for(auto & e : entries) values[next[e.first]++] = e.second;
+        entries = {};
+    }
+    array_view<T> get(uint32_t id) const { return {values.data() + offsets[id], offsets[id+1] - offsets[id]}; }
+};
+
+// A view of a SPIR-V module, which refers directly to the words it was parsed from. Every id is below the bound given in the header, so all information about
+// ids lives in vectors indexed by id, with decorations and member names held in side tables.
+struct spirv_module
+{
+    static constexpr uint32_t no_member = ~0u;
+    struct definition { spv::Op op; uint32_t result_type; array_view<uint32_t> operands; }; // The instruction which produced an id, op is OpNop for unused ids
+    struct entrypoint { spv::ExecutionModel execution_model; uint32_t id; std::string_view name; array_view<uint32_t> interfaces; };
+    struct decoration { uint32_t member; spv::Decoration decoration; array_view<uint32_t> literals; };
+    struct member_name { uint32_t member; std::string_view name; };
+
+    uint32_t version_number, generator_id, id_bound, schema_id;
+    std::vector<definition> definitions;
+    std::vector<std::string_view> names;
+    spirv_id_table<decoration> decorations;
+    spirv_id_table<member_name> member_names;
+    std::vector<entrypoint> entrypoints;
 
-    uint32_t version_number, generator_id, schema_id;
-    std::map<uint32_t, type> types;
-    std::map<uint32_t, variable> variables;
-    std::map<uint32_t, constant> constants;
-    std::map<uint32_t, entrypoint> entrypoints;
-    std::map<uint32_t, metadata> metadatas;
+    static std::string_view read_string(const uint32_t * first, const uint32_t * last)
+    {
+        const char * s = reinterpret_cast<const char *>(first);
+        const size_t max_length = reinterpret_cast<const char *>(last) - s, length = strnlen(s, max_length);
+        if(length == max_length) throw std::runtime_error("missing null terminator");
+        return {s, length};
+    }
 
-    spirv_module() {}
     spirv_module(array_view<uint32_t> words)
     {
         if(words.size < 5) throw std::runtime_error("not SPIR-V");
         if(words[0] != 0x07230203) throw std::runtime_error("not SPIR-V");    
         version_number = words[1];
         generator_id = words[2];
+        id_bound = words[3];
         schema_id = words[4];
+
+        // Every id is defined by at least one word, though the remapper leaves ids sparse within a range of a few tens of thousands. Anything beyond
+        // that, or beyond the universal limit of the SPIR-V specification, is rejected before it is used to size any allocation.
+        if(id_bound > 0x3FFFFF || id_bound > words.size + 0x10000) throw std::runtime_error("SPIR-V id bound out of range");
+        definitions.resize(id_bound, {spv::OpNop});
+        names.resize(id_bound);
+
+        auto check_id = [this](uint32_t id) { if(id >= id_bound) throw std::runtime_error("SPIR-V id out of range"); return id; };
+        auto define = [&](uint32_t id, spv::Op op, uint32_t result_type, const uint32_t * first, const uint32_t * last)
+        {
+            auto & def = definitions[check_id(id)];
+            if(def.op != spv::OpNop) throw std::runtime_error("SPIR-V id defined twice");
+            def = {op, result_type, {first, static_cast<size_t>(last - first)}};
+        };
+
         const uint32_t * it = words.begin() + 5, * binary_end = words.end();
         while(it != binary_end)
         {
             auto op_code = static_cast<spv::Op>(*it & spv::OpCodeMask);
             const uint32_t op_code_length = *it >> 16;
             const uint32_t * op_code_end = it + op_code_length;
-            if(op_code_end > binary_end) throw std::runtime_error("incomplete opcode");
-            if(op_code >= spv::OpTypeVoid && op_code <= spv::OpTypeForwardPointer) types[it[1]] = {op_code, {it+2, op_code_end}};
-            switch(op_code)
+            if(op_code_length == 0 || op_code_end > binary_end) throw std::runtime_error("incomplete opcode");
+            if(op_code >= spv::OpTypeVoid && op_code < spv::OpTypeForwardPointer) // OpTypeForwardPointer names an id which is defined later by OpTypePointer
+            {
+                if(op_code_length < 2) throw std::runtime_error("incomplete opcode");
+                define(it[1], op_code, 0, it+2, op_code_end);
+            }
+            else switch(op_code)
             {
-            case spv::OpVariable: variables[it[2]] = {it[1], static_cast<spv::StorageClass>(it[3])}; break;
-            case spv::OpConstant: constants[it[2]] = {it[1], {it+3, op_code_end}}; break;
-            case spv::OpName: metadatas[it[1]].name = reinterpret_cast<const char *>(&it[2]); break;
-            case spv::OpMemberName: metadatas[it[1]].members[it[2]].name = reinterpret_cast<const char *>(&it[3]); break;
-            case spv::OpDecorate: metadatas[it[1]].decorations[static_cast<spv::Decoration>(it[2])].assign(it+3, op_code_end); break;
-            case spv::OpMemberDecorate: metadatas[it[1]].members[it[2]].decorations[static_cast<spv::Decoration>(it[3])].assign(it+4, op_code_end); break;
+            case spv::OpVariable: case spv::OpConstant: case spv::OpSpecConstantTrue: case spv::OpSpecConstantFalse: case spv::OpSpecConstant: 
+                if(op_code_length < 3) throw std::runtime_error("incomplete opcode");
+                define(it[2], op_code, it[1], it+3, op_code_end); 
+                break;
+            case spv::OpName: names[check_id(it[1])] = read_string(it+2, op_code_end); break;
+            case spv::OpMemberName: 
+                if(op_code_length < 3) throw std::runtime_error("incomplete opcode");
+                member_names.add(check_id(it[1]), {it[2], read_string(it+3, op_code_end)}); 
+                break;
+            case spv::OpDecorate: 
+                if(op_code_length < 3) throw std::runtime_error("incomplete opcode");
+                decorations.add(check_id(it[1]), {no_member, static_cast<spv::Decoration>(it[2]), {it+3, static_cast<size_t>(op_code_end - (it+3))}}); 
+                break;
+            case spv::OpMemberDecorate: 
+                if(op_code_length < 4) throw std::runtime_error("incomplete opcode");
+                decorations.add(check_id(it[1]), {it[2], static_cast<spv::Decoration>(it[3]), {it+4, static_cast<size_t>(op_code_end - (it+4))}}); 
+                break;
             case spv::OpEntryPoint:
-                auto & entrypoint = entrypoints[it[2]];
-                entrypoint.execution_model = static_cast<spv::ExecutionModel>(it[1]);
-                const char * s = reinterpret_cast<const char *>(it+3);
-                const size_t max_length = reinterpret_cast<const char *>(op_code_end) - s, length = strnlen(s, max_length);
-                if(length == max_length) throw std::runtime_error("missing null terminator");
-                entrypoint.name.assign(s, s+length);
-                entrypoint.interfaces.assign(it+3+(length+3)/4, op_code_end);
+            {
+                if(op_code_length < 4) throw std::runtime_error("incomplete opcode");
+                const auto name = read_string(it+3, op_code_end);
+                const uint32_t * interfaces = it+3+(name.size()+4)/4;
+                entrypoints.push_back({static_cast<spv::ExecutionModel>(it[1]), check_id(it[2]), name, {interfaces, static_cast<size_t>(op_code_end - interfaces)}});
+                break;
+            }
+            default: break;
             }
             it = op_code_end;
         }
+        decorations.build(id_bound);
+        member_names.build(id_bound);
+    }
+
+    const decoration * find_decoration(uint32_t id, uint32_t member, spv::Decoration decoration) const
+    {
+        for(auto & d : decorations.get(id)) if(d.member == member && d.decoration == decoration) return &d;
+        return nullptr;
+    }
+    bool has_decoration(uint32_t id, uint32_t member, spv::Decoration decoration) const { return find_decoration(id, member, decoration) != nullptr; }
+    std::optional<uint32_t> get_decoration(uint32_t id, uint32_t member, spv::Decoration decoration) const
+    {
+        auto d = find_decoration(id, member, decoration);
+        if(!d || d->literals.size != 1) return std::nullopt;
+        return d->literals[0];
+    }
+    std::string_view get_member_name(uint32_t id, uint32_t member) const
+    {
+        for(auto & m : member_names.get(id)) if(m.member == member) return m.name;
+        return {};
+    }
+
+    const definition & get_definition(uint32_t id, const char * expected) const
+    {
+        if(id >= id_bound || definitions[id].op == spv::OpNop) throw std::runtime_error(std::string("missing SPIR-V ") + expected);
+        return definitions[id];
+    }
+    const definition & get_type_definition(uint32_t id) const
+    {
+        auto & def = get_definition(id, "type");
+        if(def.op < spv::OpTypeVoid || def.op > spv::OpTypeForwardPointer) throw std::runtime_error("not a type");
+        return def;
+    }
+    // Returns operand i of the given instruction, after checking that it exists
+    static uint32_t get_operand(const definition & def, size_t i)
+    {
+        if(i >= def.operands.size) throw std::runtime_error("incomplete opcode");
+        return def.operands[narrow(i)];
     }
 
-    shader_info::numeric get_numeric_type(uint32_t id, std::optional<shader_info::matrix_layout> matrix_layout)
+    shader_info::numeric get_numeric_type(uint32_t id, std::optional<shader_info::matrix_layout> matrix_layout) const
     {
-        auto & type = types[id];
+        auto & type = get_type_definition(id);
         switch(type.op)
         {
+        case spv::OpTypeBool: return {shader_info::bool_, 1, 1, matrix_layout};
         case spv::OpTypeInt: 
-            if(type.contents[0] != 32) throw std::runtime_error("unsupported int width");
-            return {type.contents[1] ? shader_info::int_ : shader_info::uint_, 1, 1, matrix_layout};
+            if(get_operand(type, 0) != 32) throw std::runtime_error("unsupported int width");
+            return {get_operand(type, 1) ? shader_info::int_ : shader_info::uint_, 1, 1, matrix_layout};
         case spv::OpTypeFloat: 
-            if(type.contents[0] == 32) return {shader_info::float_, 1, 1, matrix_layout};
-            if(type.contents[0] == 64) return {shader_info::double_, 1, 1, matrix_layout};
+            if(get_operand(type, 0) == 32) return {shader_info::float_, 1, 1, matrix_layout};
+            if(get_operand(type, 0) == 64) return {shader_info::double_, 1, 1, matrix_layout};
             throw std::runtime_error("unsupported float width");
-        case spv::OpTypeVector: { auto t = get_numeric_type(type.contents[0], matrix_layout); t.row_count = type.contents[1]; return t; }
-        case spv::OpTypeMatrix: { auto t = get_numeric_type(type.contents[0], matrix_layout); t.column_count = type.contents[1]; return t; }
+        case spv::OpTypeVector: { auto t = get_numeric_type(get_operand(type, 0), matrix_layout); t.row_count = get_operand(type, 1); return t; }
+        case spv::OpTypeMatrix: { auto t = get_numeric_type(get_operand(type, 0), matrix_layout); t.column_count = get_operand(type, 1); return t; }
         default: throw std::runtime_error("not a numeric type");
         }
     }
-    uint32_t get_array_length(uint32_t constant_id)
+    uint32_t get_array_length(uint32_t constant_id) const
     {
-        auto & constant = constants[constant_id];
-        if(constant.literals.size() != 1) throw std::runtime_error("bad constant");
-        return constant.literals[0];
+        auto & constant = get_definition(constant_id, "constant");
+        if(constant.op != spv::OpConstant || constant.operands.size != 1) throw std::runtime_error("bad constant");
+        return constant.operands[0];
     }
-    shader_info::type get_type(uint32_t id, std::optional<shader_info::matrix_layout> matrix_layout)
+    shader_info::type get_type(uint32_t id, std::optional<shader_info::matrix_layout> matrix_layout) const
     {
-        auto & type = types[id]; auto & meta = metadatas[id];
-        if(type.op >= spv::OpTypeInt && type.op <= spv::OpTypeMatrix) return {get_numeric_type(id, matrix_layout)};
+        auto & type = get_type_definition(id);
+        if(type.op >= spv::OpTypeBool && type.op <= spv::OpTypeMatrix) return {get_numeric_type(id, matrix_layout)};
         if(type.op == spv::OpTypeImage) 
         {
-            auto n = get_numeric_type(type.contents[0], matrix_layout);
-            auto dim = static_cast<spv::Dim>(type.contents[1]);
-            bool shadow = type.contents[2] == 1, arrayed = type.contents[3] == 1, multisampled = type.contents[4] == 1;
-            auto sampled = type.contents[5]; // 0 - unknown, 1 - used with sampler, 2 - used without sampler (i.e. storage image)
+            if(type.operands.size < 6) throw std::runtime_error("incomplete opcode");
+            auto n = get_numeric_type(type.operands[0], matrix_layout);
+            auto dim = static_cast<spv::Dim>(type.operands[1]);
+            bool shadow = type.operands[2] == 1, arrayed = type.operands[3] == 1, multisampled = type.operands[4] == 1;
+            auto sampled = type.operands[5]; // 0 - unknown, 1 - used with sampler, 2 - used without sampler (i.e. storage image)
             switch(dim)
             {
             case spv::Dim1D: return {shader_info::sampler{n.scalar, arrayed ? VK_IMAGE_VIEW_TYPE_1D_ARRAY : VK_IMAGE_VIEW_TYPE_1D, multisampled, shadow}};
@@ -314,37 +748,38 @@ struct spirv_module
             default: throw std::runtime_error("unsupported image type"); // Buffer, SubpassData
             }
         }
-        if(type.op == spv::OpTypeSampledImage) return get_type(type.contents[0], matrix_layout);
-        if(type.op == spv::OpTypeArray) return {shader_info::array{std::make_unique<shader_info::type>(get_type(type.contents[0], matrix_layout)), get_array_length(type.contents[1]), meta.get_decoration(spv::DecorationArrayStride)}};
+        if(type.op == spv::OpTypeSampledImage) return get_type(get_operand(type, 0), matrix_layout);
+        if(type.op == spv::OpTypeArray) return {shader_info::array{std::make_unique<shader_info::type>(get_type(get_operand(type, 0), matrix_layout)), get_array_length(get_operand(type, 1)), get_decoration(id, no_member, spv::DecorationArrayStride)}};
         if(type.op == spv::OpTypeStruct)
         {
-            shader_info::structure s {meta.name};
-            // meta.has_decoration(spv::DecorationBlock) is true if this struct is used for VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER/VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
-            // meta.has_decoration(spv::DecorationBufferBlock) is true if this struct is used for VK_DESCRIPTOR_TYPE_STORAGE_BUFFER/VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC
-            for(size_t i=0; i<type.contents.size(); ++i)
+            shader_info::structure s {std::string{names[id]}};
+            // has_decoration(id, no_member, spv::DecorationBlock) is true if this struct is used for VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER/VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+            // has_decoration(id, no_member, spv::DecorationBufferBlock) is true if this struct is used for VK_DESCRIPTOR_TYPE_STORAGE_BUFFER/VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC
+            s.members.reserve(type.operands.size);
+            for(uint32_t i=0; i<type.operands.size; ++i)
             {
-                auto & member_meta = meta.members[narrow(i)];
                 std::optional<shader_info::matrix_layout> matrix_layout;
-                if(auto stride = member_meta.get_decoration(spv::DecorationMatrixStride)) matrix_layout = shader_info::matrix_layout{*stride, member_meta.has_decoration(spv::DecorationRowMajor)};
-                s.members.push_back({member_meta.name, std::make_unique<shader_info::type>(get_type(type.contents[i], matrix_layout)), member_meta.get_decoration(spv::DecorationOffset)});
+                if(auto stride = get_decoration(id, i, spv::DecorationMatrixStride)) matrix_layout = shader_info::matrix_layout{*stride, has_decoration(id, i, spv::DecorationRowMajor)};
+                s.members.push_back({std::string{get_member_name(id, i)}, std::make_unique<shader_info::type>(get_type(type.operands[i], matrix_layout)), get_decoration(id, i, spv::DecorationOffset)});
             }
             return {std::move(s)};
         }
         throw std::runtime_error("unsupported type");
     }
-    shader_info::type get_pointee_type(uint32_t id)
+    shader_info::type get_pointee_type(uint32_t id) const
     {
-        if(types[id].op != spv::OpTypePointer) throw std::runtime_error("not a pointer type");
-        return get_type(types[id].contents[1], std::nullopt);
+        auto & type = get_type_definition(id);
+        if(type.op != spv::OpTypePointer) throw std::runtime_error("not a pointer type");
+        return get_type(get_operand(type, 1), std::nullopt);
     }
 };
 
 shader_info load_shader_info_from_spirv(array_view<uint32_t> words)
 {
     // Analyze SPIR-V
-    spirv_module mod(words);
+    const spirv_module mod(words);
     if(mod.entrypoints.size() != 1) throw std::runtime_error("SPIR-V module should have exactly one entrypoint");
-    auto & entrypoint = mod.entrypoints.begin()->second;
+    auto & entrypoint = mod.entrypoints[0];
 
     // Determine shader stage
     shader_info info {};
@@ -360,15 +795,31 @@ shader_info load_shader_info_from_spirv(array_view<uint32_t> words)
     }
     info.name = entrypoint.name;
 
-    // Harvest descriptors
-    for(auto & v : mod.variables)
+    // Harvest descriptors, visiting variables in order of id
+    for(uint32_t id=0; id<mod.id_bound; ++id)
     {
-        auto & meta = mod.metadatas[v.first];
-        auto set = meta.get_decoration(spv::DecorationDescriptorSet);
-        auto binding = meta.get_decoration(spv::DecorationBinding);
-        if(set && binding) info.descriptors.push_back({*set, *binding, meta.name, mod.get_pointee_type(v.second.type)});
+        auto & def = mod.definitions[id];
+        if(def.op != spv::OpVariable) continue;
+        auto set = mod.get_decoration(id, spirv_module::no_member, spv::DecorationDescriptorSet);
+        auto binding = mod.get_decoration(id, spirv_module::no_member, spv::DecorationBinding);
+        if(set && binding) info.descriptors.push_back({*set, *binding, std::string{mod.names[id]}, mod.get_pointee_type(def.result_type)});
     }
     std::sort(begin(info.descriptors), end(info.descriptors), [](const shader_info::descriptor & a, const shader_info::descriptor & b) { return std::tie(a.set, a.binding) < std::tie(b.set, b.binding); });
+
+    // Harvest scalar specialization constants, composites and constants computed by OpSpecConstantOp cannot be specialized directly
+    for(uint32_t id=0; id<mod.id_bound; ++id)
+    {
+        auto & def = mod.definitions[id];
+        if(def.op != spv::OpSpecConstantTrue && def.op != spv::OpSpecConstantFalse && def.op != spv::OpSpecConstant) continue;
+        auto spec_id = mod.get_decoration(id, spirv_module::no_member, spv::DecorationSpecId);
+        if(!spec_id) continue;
+        auto type = mod.get_numeric_type(def.result_type, std::nullopt);
+        if(type.row_count != 1 || type.column_count != 1) throw std::runtime_error("specialization constant is not a scalar");
+        uint64_t default_value = def.op == spv::OpSpecConstantTrue;
+        if(def.op == spv::OpSpecConstant) for(size_t i=0; i<def.operands.size && i<2; ++i) default_value |= uint64_t(def.operands[narrow(i)]) << (32*i);
+        info.specialization_constants.push_back({*spec_id, std::string{mod.names[id]}, type.scalar, default_value});
+    }
+    std::sort(begin(info.specialization_constants), end(info.specialization_constants), [](const shader_info::specialization_constant & a, const shader_info::specialization_constant & b) { return a.id < b.id; });
     return info;
 }
 
@@ -379,66 +830,352 @@ shader_info load_shader_info_from_spirv(array_view<uint32_t> words)
 #include "../3rdparty/glslang/glslang/Public/ShaderLang.h"
 #include "../3rdparty/glslang/StandAlone/ResourceLimits.h"
 #include "../3rdparty/glslang/SPIRV/GlslangToSpv.h"
+#include "../3rdparty/glslang/SPIRV/SPVRemapper.h"
+#include "../3rdparty/glslang/SPIRV/doc.h"
+#include <filesystem>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+static uint64_t hash_bytes(uint64_t hash, const void * data, size_t size)
+{
+    // 64-bit FNV-1a
+    for(auto p = reinterpret_cast<const uint8_t *>(data), end = p + size; p != end; ++p) hash = (hash ^ *p) * 0x100000001b3;
+    return hash;
+}
+static const uint64_t fnv_offset_basis = 0xcbf29ce484222325;
 
-struct shader_compiler_impl : glslang::TShader::Includer
+// Cache entries are named after the hash of the stage, filename, source text and compiler options. They record the content hash of every file
+// included during compilation, and are only used if all of those files are unchanged. The SPIR-V is followed by the shader_info reflected from 
+// it, as remapped SPIR-V no longer contains the names needed to reflect it again.
+struct spirv_cache_header
 {
-    struct result_text
+    char magic[8];
+    uint32_t version, dependency_count;
+    uint64_t key, word_count, info_size;
+};
+struct spirv_cache_dependency { uint64_t content_hash, name_length; }; // Followed by the name, padded to a multiple of 8 bytes
+
+static const char spirv_cache_magic[8] {'I','E','S','P','I','R','V','\n'};
+static const uint32_t spirv_cache_version = 2;
+
+// Strips debug information, removes dead functions, variables and types, and renumbers ids based on the contents of the module. MAP_NAMES is left out, as
+// it numbers ids by hashing their debug names, which would keep shaders that differ only in names from compiling to identical modules.
+static const uint32_t spirv_remap_options = spv::spirvbin_t::STRIP | spv::spirvbin_t::DCE_ALL | spv::spirvbin_t::MAP_TYPES | spv::spirvbin_t::MAP_FUNCS;
+
+// shader_info is serialized as a flat sequence of fields, with each string and array prefixed by its length, and each type prefixed by the index of its alternative
+struct shader_info_writer
+{
+    std::vector<char> & buffer;
+
+    void write(const void * data, size_t size) { buffer.insert(buffer.end(), reinterpret_cast<const char *>(data), reinterpret_cast<const char *>(data) + size); }
+    void write(uint32_t value) { write(&value, sizeof(value)); }
+    void write(uint64_t value) { write(&value, sizeof(value)); }
+    void write_count(size_t count) { const uint32_t value = narrow(count); write(value); }
+    void write(const std::string & s) { write_count(s.size()); write(s.data(), s.size()); }
+    void write(const std::optional<uint32_t> & value) { write(uint32_t(value.has_value())); if(value) write(*value); }
+    void write(const shader_info::type & type)
     {
-        std::vector<char> text;
-        IncludeResult result;
-        result_text(const std::string & header_name) : text{load_text_file(header_name.c_str())}, result{header_name, text.data(), text.size(), nullptr} {}
-    };
-    std::vector<std::unique_ptr<result_text>> results;
+        write_count(type.contents.index());
+        if(auto s = std::get_if<shader_info::sampler>(&type.contents)) for(uint32_t value : {uint32_t(s->channel), uint32_t(s->view_type), uint32_t(s->multisampled), uint32_t(s->shadow)}) write(value);
+        if(auto n = std::get_if<shader_info::numeric>(&type.contents))
+        {
+            for(uint32_t value : {uint32_t(n->scalar), n->row_count, n->column_count, uint32_t(n->matrix_layout.has_value())}) write(value);
+            if(n->matrix_layout) for(uint32_t value : {n->matrix_layout->stride, uint32_t(n->matrix_layout->row_major)}) write(value);
+        }
+        if(auto a = std::get_if<shader_info::array>(&type.contents))
+        {
+            write(*a->element);
+            write(a->length);
+            write(a->stride);
+        }
+        if(auto s = std::get_if<shader_info::structure>(&type.contents))
+        {
+            write(s->name);
+            write_count(s->members.size());
+            for(auto & m : s->members)
+            {
+                write(m.name);
+                write(*m.type);
+                write(m.offset);
+            }
+        }
+    }
+    void write(const shader_info & info)
+    {
+        write(uint32_t(info.stage));
+        write(info.name);
+        write_count(info.descriptors.size());
+        for(auto & d : info.descriptors)
+        {
+            write(d.set);
+            write(d.binding);
+            write(d.name);
+            write(d.type);
+        }
+        write_count(info.specialization_constants.size());
+        for(auto & c : info.specialization_constants)
+        {
+            write(c.id);
+            write(c.name);
+            write(uint32_t(c.type));
+            write(c.default_value);
+        }
+    }
+};
 
-    IncludeResult * get_header(const std::string & name)
+// Throws std::runtime_error if the serialized data is truncated or malformed
+struct shader_info_reader
+{
+    const char * it, * end;
+
+    void read(void * data, size_t size) { if(size > static_cast<size_t>(end - it)) throw std::runtime_error("truncated shader info"); memcpy(data, it, size); it += size; }
+    uint32_t read_uint32() { uint32_t value; read(&value, sizeof(value)); return value; }
+    uint64_t read_uint64() { uint64_t value; read(&value, sizeof(value)); return value; }
+    uint32_t read_enum(uint32_t count) { const uint32_t value = read_uint32(); if(value >= count) throw std::runtime_error("malformed shader info"); return value; }
+    uint32_t read_count() { const uint32_t count = read_uint32(); if(count > static_cast<size_t>(end - it)) throw std::runtime_error("truncated shader info"); return count; } // Every element occupies at least one byte
+    std::string read_string() { const uint32_t size = read_count(); std::string s {it, it + size}; it += size; return s; }
+    std::optional<uint32_t> read_optional() { if(read_enum(2)) return read_uint32(); return std::nullopt; }
+    std::unique_ptr<const shader_info::type> read_type_ptr() { return std::make_unique<const shader_info::type>(read_type()); }
+    shader_info::type read_type()
     {
-        // Return previously loaded include file
-        for(auto & r : results)
+        switch(read_enum(std::variant_size_v<decltype(shader_info::type::contents)>))
+        {
+        case 0:
         {
-            if(r->result.headerName == name)
+            shader_info::sampler s {};
+            s.channel = static_cast<shader_info::scalar_type>(read_enum(shader_info::bool_+1));
+            s.view_type = static_cast<VkImageViewType>(read_uint32());
+            s.multisampled = read_enum(2) != 0;
+            s.shadow = read_enum(2) != 0;
+            return {s};
+        }
+        case 1:
+        {
+            shader_info::numeric n {};
+            n.scalar = static_cast<shader_info::scalar_type>(read_enum(shader_info::bool_+1));
+            n.row_count = read_uint32();
+            n.column_count = read_uint32();
+            if(read_enum(2))
+            {
+                const uint32_t stride = read_uint32();
+                n.matrix_layout = shader_info::matrix_layout{stride, read_enum(2) != 0};
+            }
+            return {n};
+        }
+        case 2:
+        {
+            shader_info::array a;
+            a.element = read_type_ptr();
+            a.length = read_uint32();
+            a.stride = read_optional();
+            return {std::move(a)};
+        }
+        default:
+        {
+            shader_info::structure s;
+            s.name = read_string();
+            s.members.resize(read_count());
+            for(auto & m : s.members)
             {
-                return &r->result;
+                m.name = read_string();
+                m.type = read_type_ptr();
+                m.offset = read_optional();
             }
+            return {std::move(s)};
+        }
         }
+    }
+    shader_info read_info()
+    {
+        shader_info info;
+        info.stage = static_cast<VkShaderStageFlagBits>(read_uint32());
+        info.name = read_string();
+        info.descriptors.resize(read_count());
+        for(auto & d : info.descriptors)
+        {
+            d.set = read_uint32();
+            d.binding = read_uint32();
+            d.name = read_string();
+            d.type = read_type();
+        }
+        info.specialization_constants.resize(read_count());
+        for(auto & c : info.specialization_constants)
+        {
+            c.id = read_uint32();
+            c.name = read_string();
+            c.type = static_cast<shader_info::scalar_type>(read_enum(shader_info::bool_+1));
+            c.default_value = read_uint64();
+        }
+        return info;
+    }
+};
+
+// Any change to the arguments passed to glslang must be reflected here, as these options form part of every cache key
+static const int glsl_default_version = 450;
+static const EProfile glsl_default_profile = ENoProfile;
+static const EShMessages glsl_parse_messages = static_cast<EShMessages>(EShMsgSpvRules|EShMsgVulkanRules), glsl_link_messages = EShMsgVulkanRules;
+
+struct shader_compiler_impl
+{
+    struct include_file { std::string name; std::vector<char> text; uint64_t content_hash; };
+    std::mutex include_mutex;
+    std::unordered_map<std::string, std::unique_ptr<const include_file>> include_files; // Entries are never removed, so pointers to them remain valid
 
-        // Otherwise attempt to load
-        try
+    std::string cache_directory; // Empty if caching is disabled
+    bool remap_spirv = false;
+    std::atomic<size_t> hits {0}, misses {0}, stale {0}, stores {0};
+
+    // Include files are loaded at most once, and shared by every compilation. May be called from any thread.
+    const include_file * get_include_file(const std::string & name)
+    {
         {
-            results.push_back(std::make_unique<result_text>(name));
-            return &results.back()->result;
+            std::lock_guard<std::mutex> lock {include_mutex};
+            auto it = include_files.find(name);
+            if(it != include_files.end()) return it->second.get();
         }
-        catch(const std::runtime_error &)
+
+        // Load the file without holding the lock. If another thread loaded the same file in the meantime, its copy is kept.
+        std::unique_ptr<include_file> file;
+        try 
+        { 
+            auto text = load_text_file(name.c_str());
+            const uint64_t content_hash = hash_bytes(fnv_offset_basis, text.data(), text.size());
+            file = std::make_unique<include_file>(include_file{name, std::move(text), content_hash});
+        }
+        catch(const std::runtime_error &) { return nullptr; }
+        std::lock_guard<std::mutex> lock {include_mutex};
+        auto & entry = include_files[name];
+        if(!entry) entry = std::move(file);
+        return entry.get();
+    }
+
+    uint64_t get_cache_key(VkShaderStageFlagBits stage, const char * filename, const std::string & preamble, const std::vector<char> & source) const
+    {
+        uint64_t key = hash_bytes(fnv_offset_basis, &spirv_cache_version, sizeof(spirv_cache_version));
+        key = hash_bytes(key, &glslang::DefaultTBuiltInResource, sizeof(glslang::DefaultTBuiltInResource));
+        for(int option : {glsl_default_version, static_cast<int>(glsl_default_profile), static_cast<int>(glsl_parse_messages), static_cast<int>(glsl_link_messages), static_cast<int>(stage), remap_spirv ? static_cast<int>(spirv_remap_options) : 0}) key = hash_bytes(key, &option, sizeof(option));
+        key = hash_bytes(key, filename, strlen(filename)+1);
+        key = hash_bytes(key, preamble.c_str(), preamble.size()+1);
+        return hash_bytes(key, source.data(), source.size());
+    }
+    std::string get_cache_filename(uint64_t key) const
+    {
+        char name[24];
+        snprintf(name, sizeof(name), "%016llx.spv", static_cast<unsigned long long>(key));
+        return cache_directory + '/' + name;
+    }
+
+    std::optional<shader_compile_result> load_cached_spirv(uint64_t key)
+    {
+        mapped_file file;
+        try { file = mapped_file{get_cache_filename(key).c_str()}; }
+        catch(const std::runtime_error &) { ++misses; return std::nullopt; }
+        if(auto result = read_cache_entry(key, file.begin(), file.end()))
+        {
+            ++hits;
+            return result;
+        }
+
+        // Malformed or outdated entries are replaced once the shader has been compiled
+        ++stale;
+        ++misses;
+        return std::nullopt;
+    }
+    std::optional<shader_compile_result> read_cache_entry(uint64_t key, const char * it, const char * end)
+    {
+        auto read = [&](void * data, size_t size) { if(size > static_cast<size_t>(end - it)) return false; memcpy(data, it, size); it += size; return true; };
+        spirv_cache_header header;
+        if(!read(&header, sizeof(header)) || memcmp(header.magic, spirv_cache_magic, sizeof(header.magic)) != 0 || header.version != spirv_cache_version || header.key != key) return std::nullopt;
+        for(uint32_t i=0; i<header.dependency_count; ++i)
+        {
+            spirv_cache_dependency dependency;
+            if(!read(&dependency, sizeof(dependency))) return std::nullopt;
+            const uint64_t padded_length = (dependency.name_length + 7) & ~uint64_t(7);
+            if(padded_length < dependency.name_length || padded_length > static_cast<size_t>(end - it)) return std::nullopt;
+            auto file = get_include_file({it, it + dependency.name_length});
+            if(!file || file->content_hash != dependency.content_hash) return std::nullopt;
+            it += padded_length;
+        }
+        const size_t remaining = static_cast<size_t>(end - it);
+        if(header.word_count == 0 || header.word_count > remaining / sizeof(uint32_t) || header.info_size != remaining - header.word_count * sizeof(uint32_t)) return std::nullopt;
+        shader_compile_result result {std::vector<uint32_t>(header.word_count)};
+        read(result.spirv.data(), result.spirv.size() * sizeof(uint32_t));
+        shader_info_reader reader {it, end};
+        try { result.info = reader.read_info(); }
+        catch(const std::runtime_error &) { return std::nullopt; }
+        if(reader.it != end) return std::nullopt;
+        return result;
+    }
+
+    void store_cached_spirv(uint64_t key, array_view<const include_file *> dependencies, const shader_compile_result & result)
+    {
+        std::vector<char> info;
+        shader_info_writer{info}.write(result.info);
+
+        std::vector<uint8_t> buffer;
+        auto write = [&buffer](const void * data, size_t size) { buffer.insert(buffer.end(), reinterpret_cast<const uint8_t *>(data), reinterpret_cast<const uint8_t *>(data) + size); };
+        spirv_cache_header header {{}, spirv_cache_version, narrow(dependencies.size), key, result.spirv.size(), info.size()};
+        memcpy(header.magic, spirv_cache_magic, sizeof(header.magic));
+        write(&header, sizeof(header));
+        for(auto d : dependencies)
         {
-            return nullptr; 
+            const spirv_cache_dependency dependency {d->content_hash, d->name.size()};
+            write(&dependency, sizeof(dependency));
+            write(d->name.data(), d->name.size());
+            buffer.resize((buffer.size() + 7) & ~size_t(7));
         }
+        write(result.spirv.data(), result.spirv.size() * sizeof(uint32_t));
+        write(info.data(), info.size());
+
+        // Failure to store an entry is not an error, the shader will simply be compiled again next time
+        try { save_binary_file(get_cache_filename(key).c_str(), buffer); }
+        catch(const std::runtime_error &) { return; }
+        ++stores;
     }
 
+    shader_compile_result compile(VkShaderStageFlagBits stage, const char * filename, array_view<std::string> defines);
+};
+
+// Resolves the #include directives of a single compilation, and records every file they refer to
+struct shader_includer : glslang::TShader::Includer
+{
+    shader_compiler_impl & impl;
+    std::vector<const shader_compiler_impl::include_file *> dependencies;
+
+    shader_includer(shader_compiler_impl & impl) : impl{impl} {}
+
     // Implement glslang::TShader::Includer
     IncludeResult * includeSystem(const char * header_name, const char * includer_name, size_t inclusion_depth) override { return nullptr; }
     IncludeResult * includeLocal(const char * header_name, const char * includer_name, size_t inclusion_depth) override 
     { 
         std::string path {includer_name};
         size_t off = path.rfind('/');
-        if(off != std::string::npos) path.resize(off+1);
-        return get_header(path + header_name);
+        path.resize(off == std::string::npos ? 0 : off+1);
+        auto file = impl.get_include_file(path + header_name);
+        if(!file) return nullptr;
+        if(std::find(dependencies.begin(), dependencies.end(), file) == dependencies.end()) dependencies.push_back(file);
+        return new IncludeResult{file->name, file->text.data(), file->text.size(), nullptr};
     }
-    void releaseInclude(IncludeResult * result) override {}
+    void releaseInclude(IncludeResult * result) override { delete result; }
 };
 
-shader_compiler::shader_compiler()
+shader_compile_result shader_compiler_impl::compile(VkShaderStageFlagBits stage, const char * filename, array_view<std::string> defines)
 {
-    glslang::InitializeProcess();
-    impl = std::make_unique<shader_compiler_impl>();
-}
+    std::string preamble;
+    for(auto & d : defines)
+    {
+        const size_t eq = d.find('=');
+        preamble += "#define " + (eq == std::string::npos ? d + " 1" : d.substr(0, eq) + ' ' + d.substr(eq+1)) + '\n';
+    }
 
-shader_compiler::~shader_compiler()
-{
-    impl.reset();
-    glslang::FinalizeProcess();
-}
+    auto buffer = load_text_file(filename);
+    const uint64_t key = get_cache_key(stage, filename, preamble, buffer);
+    if(!cache_directory.empty())
+    {
+        if(auto result = load_cached_spirv(key)) return std::move(*result);
+    }
 
-std::vector<uint32_t> shader_compiler::compile_glsl(VkShaderStageFlagBits stage, const char * filename)
-{    
     glslang::TShader shader([stage]()
     {
         switch(stage)
@@ -453,24 +1190,200 @@ std::vector<uint32_t> shader_compiler::compile_glsl(VkShaderStageFlagBits stage,
         }
     }());    
 
-    auto buffer = load_text_file(filename);
     const char * s = buffer.data();
     int l = static_cast<int>(buffer.size());
     shader.setStringsWithLengthsAndNames(&s, &l, &filename, 1);
+    shader.setPreamble(preamble.c_str());
 
-    if(!shader.parse(&glslang::DefaultTBuiltInResource, 450, ENoProfile, false, false, static_cast<EShMessages>(EShMsgSpvRules|EShMsgVulkanRules), *impl))
+    shader_includer includer {*this};
+    if(!shader.parse(&glslang::DefaultTBuiltInResource, glsl_default_version, glsl_default_profile, false, false, glsl_parse_messages, includer))
     {
-        throw std::runtime_error(std::string("GLSL compile failure: ") + shader.getInfoLog());
+        return {{}, std::string("GLSL compile failure: ") + shader.getInfoLog()};
     }
     
     glslang::TProgram program;
     program.addShader(&shader);
-    if(!program.link(EShMsgVulkanRules))
+    if(!program.link(glsl_link_messages))
     {
-        throw std::runtime_error(std::string("GLSL link failure: ") + program.getInfoLog());
+        return {{}, std::string("GLSL link failure: ") + program.getInfoLog()};
     }
 
-    std::vector<uint32_t> spirv;
-    glslang::GlslangToSpv(*program.getIntermediate(shader.getStage()), spirv, nullptr);
-    return spirv;
-}
\ No newline at end of file
+    shader_compile_result result {{}, std::string(shader.getInfoLog()) + program.getInfoLog()};
+    glslang::GlslangToSpv(*program.getIntermediate(shader.getStage()), result.spirv, nullptr);
+
+    // Reflect the module while it still has its debug names, as remapping strips them
+    result.info = load_shader_info_from_spirv(result.spirv);
+    if(remap_spirv) spv::spirvbin_t{}.remap(result.spirv, spirv_remap_options);
+
+    if(!cache_directory.empty()) store_cached_spirv(key, includer.dependencies, result);
+    return result;
+}
+
+// glslang::FinalizeProcess() frees state shared by every compiler, so it must only be called once the last shader_compiler is destroyed
+static std::mutex glslang_process_mutex;
+static size_t glslang_process_count = 0;
+
+shader_compiler::shader_compiler(const char * cache_directory, bool remap_spirv)
+{
+    impl = std::make_unique<shader_compiler_impl>();
+    if(remap_spirv)
+    {
+        // The remapper reports errors through a global handler, which exits the process by default. Its opcode tables are built on first use, which is
+        // not thread-safe, so build them here rather than during a concurrent compilation.
+        spv::spirvbin_t::registerErrorHandler([](const std::string & message) { throw std::runtime_error("SPIR-V remap failure: " + message); });
+        spv::Parameterize();
+        impl->remap_spirv = true;
+    }
+    if(cache_directory)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(cache_directory, ec);
+        if(ec) throw std::runtime_error(std::string("failed to create shader cache directory ") + cache_directory);
+        impl->cache_directory = cache_directory;
+    }
+
+    // Done last, so that a constructor which throws leaves the count untouched
+    std::lock_guard<std::mutex> lock {glslang_process_mutex};
+    if(glslang_process_count++ == 0) glslang::InitializeProcess();
+}
+
+shader_compiler::~shader_compiler()
+{
+    impl.reset();
+    std::lock_guard<std::mutex> lock {glslang_process_mutex};
+    if(--glslang_process_count == 0) glslang::FinalizeProcess();
+}
+
+shader_cache_stats shader_compiler::get_cache_stats() const
+{
+    return {impl->hits, impl->misses, impl->stale, impl->stores};
+}
+
+std::vector<uint32_t> shader_compiler::compile_glsl(VkShaderStageFlagBits stage, const char * filename)
+{    
+    auto result = impl->compile(stage, filename, {});
+    if(result.spirv.empty()) throw std::runtime_error(result.diagnostics);
+    return std::move(result.spirv);
+}
+
+std::vector<shader_compile_result> shader_compiler::compile_glsl(array_view<shader_compile_request> requests)
+{
+    std::vector<shader_compile_result> results(requests.size);
+    parallel_for(requests.size, [&](size_t i)
+    {
+        auto & request = requests[narrow(i)];
+        try { results[i] = impl->compile(request.stage, request.filename, request.defines); }
+        catch(const std::runtime_error & e) { results[i] = {{}, e.what()}; }
+    });
+    return results;
+}
+
+std::vector<std::vector<std::string>> enumerate_shader_permutations(array_view<std::vector<std::string>> axes)
+{
+    std::vector<std::vector<std::string>> permutations {{}};
+    for(auto & axis : axes)
+    {
+        if(axis.empty()) throw std::logic_error("shader keyword axis must contain at least one keyword");
+        std::vector<std::vector<std::string>> expanded;
+        expanded.reserve(permutations.size() * axis.size());
+        for(auto & p : permutations) for(auto & keyword : axis)
+        {
+            expanded.push_back(p);
+            if(!keyword.empty()) expanded.back().push_back(keyword);
+        }
+        permutations.swap(expanded);
+    }
+    return permutations;
+}
+
+static std::vector<std::string> get_canonical_keywords(array_view<std::string> keywords)
+{
+    std::vector<std::string> sorted;
+    for(auto & k : keywords) if(!k.empty()) sorted.push_back(k);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    return sorted;
+}
+
+std::string get_shader_permutation_key(array_view<std::string> keywords)
+{
+    std::string key;
+    for(auto & k : get_canonical_keywords(keywords)) key += (key.empty() ? "" : " ") + k;
+    return key;
+}
+
+std::optional<size_t> shader_permutation_set::find(array_view<std::string> keywords) const
+{
+    auto it = std::find(keys.begin(), keys.end(), get_shader_permutation_key(keywords));
+    if(it == keys.end()) return std::nullopt;
+    return it - keys.begin();
+}
+
+shader_permutation_set shader_compiler::compile_glsl_permutations(VkShaderStageFlagBits stage, const char * filename, array_view<std::vector<std::string>> permutations)
+{
+    // Compile each distinct permutation once, with its keywords in canonical order so that it always produces the same cache key
+    shader_permutation_set set;
+    std::vector<shader_compile_request> requests;
+    for(auto & p : permutations)
+    {
+        auto key = get_shader_permutation_key(p);
+        if(std::find(set.keys.begin(), set.keys.end(), key) != set.keys.end()) continue;
+        requests.push_back({stage, filename, get_canonical_keywords(p)});
+        set.keys.push_back(std::move(key));
+    }
+    auto results = compile_glsl(requests);
+
+    std::string errors;
+    for(size_t i=0; i<results.size(); ++i) if(results[i].spirv.empty()) errors += std::string(filename) + " [" + set.keys[i] + "]: " + results[i].diagnostics + "\n";
+    if(!errors.empty()) throw std::runtime_error(errors);
+
+    // Permutations whose keywords did not affect the compiled code share a single module
+    std::unordered_map<uint64_t, std::vector<size_t>> modules_by_hash;
+    for(auto & r : results)
+    {
+        auto & candidates = modules_by_hash[hash_bytes(fnv_offset_basis, r.spirv.data(), r.spirv.size() * sizeof(uint32_t))];
+        auto it = std::find_if(candidates.begin(), candidates.end(), [&](size_t m) { return set.modules[m] == r.spirv; });
+        set.infos.push_back(std::move(r.info));
+        if(it != candidates.end()) set.module_indices.push_back(*it);
+        else
+        {
+            candidates.push_back(set.modules.size());
+            set.module_indices.push_back(set.modules.size());
+            set.modules.push_back(std::move(r.spirv));
+        }
+    }
+    return set;
+}
+
+/////////////////////////
+// pipeline cache data //
+/////////////////////////
+
+struct pipeline_cache_header
+{
+    char magic[8];
+    uint32_t vendor_id, device_id, driver_version, data_size;
+    uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+};
+static const char pipeline_cache_magic[8] {'I','E','P','C','A','C','H','\n'};
+
+std::vector<char> wrap_pipeline_cache_data(const VkPhysicalDeviceProperties & props, array_view<char> data)
+{
+    pipeline_cache_header header {{}, props.vendorID, props.deviceID, props.driverVersion, narrow(data.size)};
+    memcpy(header.magic, pipeline_cache_magic, sizeof(header.magic));
+    memcpy(header.pipeline_cache_uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+    std::vector<char> buffer(reinterpret_cast<const char *>(&header), reinterpret_cast<const char *>(&header + 1));
+    buffer.insert(buffer.end(), data.begin(), data.end());
+    return buffer;
+}
+
+std::vector<char> unwrap_pipeline_cache_data(const VkPhysicalDeviceProperties & props, array_view<char> file)
+{
+    pipeline_cache_header header;
+    if(file.size < sizeof(header)) return {};
+    memcpy(&header, file.data, sizeof(header));
+    if(memcmp(header.magic, pipeline_cache_magic, sizeof(header.magic)) != 0 || memcmp(header.pipeline_cache_uuid, props.pipelineCacheUUID, VK_UUID_SIZE) != 0) return {};
+    if(header.vendor_id != props.vendorID || header.device_id != props.deviceID || header.driver_version != props.driverVersion) return {};
+    if(header.data_size != file.size - sizeof(header)) return {};
+    return {file.begin() + sizeof(header), file.end()};
+}
@@ -5,26 +5,97 @@
 
 std::vector<uint8_t> load_binary_file(const char * filename);
 std::vector<char> load_text_file(const char * filename);
+// Writes to a temporary file which is then moved into place, so that an interrupted write never leaves behind a truncated file. Throws on failure.
+void save_binary_file(const char * filename, array_view<uint8_t> contents);
 
 image generate_single_color_image(const byte4 & color);
 image load_image(const char * filename, bool is_linear);
+// Decodes directly into memory provided by the caller, which must hold at least capacity bytes, slightly more than compute_image_size(dims, format)
+void load_image(const char * filename, bool is_linear, const std::function<void * (int2 dims, VkFormat format, size_t capacity)> & allocate_pixels);
 
 mesh generate_fullscreen_quad();
 mesh generate_box_mesh(const float3 & bmin, const float3 & bmax);
 mesh apply_vertex_color(mesh m, const float3 & color);
 mesh invert_faces(mesh m);
-std::vector<mesh> load_meshes_from_fbx(coord_system target, const char * filename);
-mesh load_mesh_from_obj(coord_system target, const char * filename);
+// Loaded meshes are optimized with optimize_mesh(...), and if stats is given, it receives the vertex cache statistics of each mesh before and after
+struct mesh_optimization_stats; // Defined in mesh-ops.h
+std::vector<mesh> load_meshes_from_fbx(coord_system target, const char * filename, std::vector<mesh_optimization_stats> * stats = nullptr);
+mesh load_mesh_from_obj(coord_system target, const char * filename, mesh_optimization_stats * stats = nullptr);
+
+// Meshes can be saved to a compact binary cache, which is later mapped into memory and referred to in place, with no parsing or tangent generation
+void save_mesh_cache(const char * filename, array_view<mesh> meshes);
+class mesh_cache
+{
+    mapped_file file;
+    array_view<struct mesh_cache_record> records;
+
+    template<class T> array_view<T> get_array(const struct mesh_cache_array & a) const;
+    std::string_view get_string(const struct mesh_cache_string & s) const;
+public:
+    explicit mesh_cache(const char * filename);
+
+    size_t get_mesh_count() const { return records.size; }
+    array_view<mesh::vertex> get_vertices(size_t index) const;
+    array_view<uint3> get_triangles(size_t index) const;
+    mesh get_mesh(size_t index) const;
+    std::vector<mesh> get_meshes() const;
+};
 shader_info load_shader_info_from_spirv(array_view<uint32_t> words);
 
+struct shader_cache_stats 
+{ 
+    size_t hits, misses;    // Lookups which did and did not find a usable entry
+    size_t stale;           // Misses which found an entry that was malformed, or built from sources which have since changed
+    size_t stores;          // Entries written after compiling a shader
+};
+
+// Each define is either a symbol, which is defined as 1, or of the form SYMBOL=VALUE
+struct shader_compile_request { VkShaderStageFlagBits stage; const char * filename; std::vector<std::string> defines; };
+struct shader_compile_result 
+{ 
+    std::vector<uint32_t> spirv;    // Empty if compilation failed
+    std::string diagnostics;        // Errors if compilation failed, otherwise any warnings
+    shader_info info;               // Reflected before the SPIR-V is remapped, so it keeps the names of descriptors, types and specialization constants
+};
+
+// Permutations of a shader are compiled from a single source file, with a set of keywords defined as preprocessor symbols. Each axis lists mutually exclusive
+// keywords, and each permutation takes one keyword from every axis. An empty keyword defines nothing, so an axis of {"", "SKINNED"} toggles a single feature.
+std::vector<std::vector<std::string>> enumerate_shader_permutations(array_view<std::vector<std::string>> axes);
+// Identifies the permutation which defines the given keywords: the distinct non-empty keywords in sorted order, separated by spaces
+std::string get_shader_permutation_key(array_view<std::string> keywords);
+
+struct shader_permutation_set
+{
+    std::vector<std::string> keys;                  // Permutation key of each distinct permutation, in the order they were requested
+    std::vector<size_t> module_indices;             // Index within modules of the SPIR-V compiled for each permutation
+    std::vector<shader_info> infos;                 // Reflection of each permutation, which may differ in names even where permutations share a module
+    std::vector<std::vector<uint32_t>> modules;     // Distinct SPIR-V modules, permutations which compile to identical SPIR-V share a module
+
+    std::optional<size_t> find(array_view<std::string> keywords) const; // Returns the index within keys of the permutation defining the given keywords
+};
+
+// All member functions of shader_compiler may be called from any thread. Files included by shaders are loaded once and shared between compilations.
 class shader_compiler
 {
     std::unique_ptr<struct shader_compiler_impl> impl;
 public:
-    shader_compiler();
+    // If a cache directory is given, compiled SPIR-V is stored there, keyed by a hash of the stage, the source, every included file and the compiler options.
+    // If remap_spirv is set, compiled SPIR-V is stripped of debug information and has its ids canonicalized, so that shaders which differ only in names or
+    // in the order of their declarations compile to identical modules.
+    explicit shader_compiler(const char * cache_directory = nullptr, bool remap_spirv = false);
     ~shader_compiler();
 
     std::vector<uint32_t> compile_glsl(VkShaderStageFlagBits stage, const char * filename);
+    // Compiles a batch of shaders concurrently, returning their results in the order they were requested. Failures are reported per shader rather than thrown.
+    std::vector<shader_compile_result> compile_glsl(array_view<shader_compile_request> requests);
+    // Compiles the given permutations concurrently, and throws the diagnostics of every permutation that failed to compile
+    shader_permutation_set compile_glsl_permutations(VkShaderStageFlagBits stage, const char * filename, array_view<std::vector<std::string>> permutations);
+    shader_cache_stats get_cache_stats() const;
 };
 
+// Pipeline cache files wrap the data returned by vkGetPipelineCacheData(...) in a description of the device and driver which produced it. Drivers are meant
+// to reject data from other devices, but not all of them do so reliably, so unwrapping returns nothing unless the file is well formed and all of these match.
+std::vector<char> wrap_pipeline_cache_data(const VkPhysicalDeviceProperties & props, array_view<char> data);
+std::vector<char> unwrap_pipeline_cache_data(const VkPhysicalDeviceProperties & props, array_view<char> file);
+
 #endif
@@ -0,0 +1,773 @@
+#include "mesh-ops.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_set>
+#include <unordered_map>
+
+static uint64_t hash_bytes(const void * data, size_t size)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    for(auto p = reinterpret_cast<const uint8_t *>(data), end = p + size; p != end; ++p) hash = (hash ^ *p) * 0x100000001b3;
+    return hash;
+}
+
+// Replaces the indices of every triangle, dropping triangles which refer to the same vertex more than once, and shrinks material ranges to match
+static void remap_triangles(mesh & m, array_view<uint32_t> remap)
+{
+    std::vector<size_t> kept_before(m.triangles.size()+1);
+    std::vector<uint3> triangles;
+    triangles.reserve(m.triangles.size());
+    for(size_t i=0; i<m.triangles.size(); ++i)
+    {
+        kept_before[i] = triangles.size();
+        const uint3 t {remap[m.triangles[i].x], remap[m.triangles[i].y], remap[m.triangles[i].z]};
+        if(t.x != t.y && t.y != t.z && t.z != t.x) triangles.push_back(t);
+    }
+    kept_before.back() = triangles.size();
+    m.triangles.swap(triangles);
+
+    for(auto & mat : m.materials)
+    {
+        const size_t first = kept_before[mat.first_triangle];
+        mat.num_triangles = kept_before[mat.first_triangle + mat.num_triangles] - first;
+        mat.first_triangle = first;
+    }
+}
+
+// Returns the ranges of triangles which may be reordered independently, one per material, or a single range if the mesh has no materials
+static std::vector<mesh::material> get_triangle_ranges(const mesh & m)
+{
+    if(m.materials.empty()) return {{"", 0, m.triangles.size()}};
+    return m.materials;
+}
+
+// Emulates a FIFO cache by recording the time at which each vertex entered it. A vertex is in the cache if fewer than cache_size vertices have entered since.
+struct vertex_cache
+{
+    std::vector<uint32_t> timestamps;
+    uint32_t cache_size, time;
+
+    vertex_cache(size_t vertex_count, uint32_t cache_size) : timestamps(vertex_count), cache_size{cache_size}, time{cache_size+1} {}
+
+    bool contains(uint32_t v) const { return time - timestamps[v] <= cache_size; }
+    int add(uint32_t v) { if(contains(v)) return 0; timestamps[v] = time++; return 1; }
+    int add(const uint3 & t) { return add(t.x) + add(t.y) + add(t.z); }
+    void clear() { time += cache_size+1; }
+};
+
+///////////////////
+// weld_vertices //
+///////////////////
+
+mesh weld_vertices(mesh m, float epsilon)
+{
+    // Vertices are compared by the bits of their attributes, which requires that mesh::vertex contains no padding. Adding zero folds -0.0f into 0.0f.
+    static_assert(sizeof(mesh::vertex) == 25*4, "mesh::vertex must not contain padding");
+    auto snap = [epsilon](float x) { return (epsilon > 0 ? std::round(x / epsilon) * epsilon : x) + 0.0f; };
+    auto get_key = [&](mesh::vertex v)
+    {
+        for(auto * a : {&v.position, &v.color, &v.normal, &v.tangent, &v.bitangent}) *a = {snap(a->x), snap(a->y), snap(a->z)};
+        v.texcoord = {snap(v.texcoord.x), snap(v.texcoord.y)};
+        v.bone_weights = {snap(v.bone_weights.x), snap(v.bone_weights.y), snap(v.bone_weights.z), snap(v.bone_weights.w)};
+        return v;
+    };
+
+    // Open addressing hash table of indices into keys, kept at most half full
+    size_t table_size = 16;
+    while(table_size < m.vertices.size() * 2) table_size *= 2;
+    std::vector<uint32_t> table(table_size, ~0u), remap(m.vertices.size());
+    std::vector<mesh::vertex> keys, vertices;
+    for(size_t i=0; i<m.vertices.size(); ++i)
+    {
+        const auto key = get_key(m.vertices[i]);
+        for(size_t slot = hash_bytes(&key, sizeof(key)) & (table_size-1); ; slot = (slot+1) & (table_size-1))
+        {
+            if(table[slot] == ~0u)
+            {
+                table[slot] = remap[i] = narrow(vertices.size());
+                keys.push_back(key);
+                vertices.push_back(m.vertices[i]);
+                break;
+            }
+            if(memcmp(&keys[table[slot]], &key, sizeof(key)) == 0)
+            {
+                remap[i] = table[slot];
+                break;
+            }
+        }
+    }
+
+    m.vertices.swap(vertices);
+    remap_triangles(m, remap);
+    return m;
+}
+
+//////////////////////////
+// analyze_vertex_cache //
+//////////////////////////
+
+vertex_cache_stats analyze_vertex_cache(const mesh & m, uint32_t cache_size)
+{
+    vertex_cache cache {m.vertices.size(), cache_size};
+    std::vector<bool> referenced(m.vertices.size());
+    size_t transformed = 0, referenced_count = 0;
+    for(auto & t : m.triangles)
+    {
+        transformed += cache.add(t);
+        for(auto v : t) if(!referenced[v]) { referenced[v] = true; ++referenced_count; }
+    }
+    return {m.triangles.empty() ? 0 : float(transformed) / m.triangles.size(), referenced_count == 0 ? 0 : float(transformed) / referenced_count};
+}
+
+///////////////////////////
+// optimize_vertex_cache //
+///////////////////////////
+
+static void tipsify(array_view<uint3> triangles, size_t vertex_count, uint32_t cache_size, uint3 * out)
+{
+    // Build lists of the triangles adjacent to each vertex
+    std::vector<uint32_t> live(vertex_count), offsets(vertex_count+1), adjacency(triangles.size*3);
+    for(auto & t : triangles) for(auto v : t) ++live[v];
+    for(size_t v=0; v<vertex_count; ++v) offsets[v+1] = offsets[v] + live[v];
+    std::vector<uint32_t> cursors(offsets.begin(), offsets.end()-1);
+    for(size_t i=0; i<triangles.size; ++i) for(auto v : triangles[narrow(i)]) adjacency[cursors[v]++] = narrow(i);
+
+    vertex_cache cache {vertex_count, cache_size};
+    std::vector<bool> emitted(triangles.size);
+    std::vector<uint32_t> dead_ends, candidates;
+    uint32_t next_vertex = 0; // Scans forward through the vertices when the dead end stack runs dry
+    for(int64_t fan = triangles.size ? triangles[0].x : -1; fan >= 0; )
+    {
+        // Emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for(uint32_t i=offsets[fan]; i<offsets[fan+1]; ++i)
+        {
+            const uint32_t t = adjacency[i];
+            if(emitted[t]) continue;
+            emitted[t] = true;
+            *out++ = triangles[t];
+            for(auto v : triangles[t])
+            {
+                dead_ends.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                cache.add(v);
+            }
+        }
+
+        // Prefer the candidate which entered the cache earliest, provided that fanning around it will not push it out of the cache
+        fan = -1;
+        int64_t best_priority = -1;
+        for(auto v : candidates)
+        {
+            if(live[v] == 0) continue;
+            int64_t priority = 0;
+            const int64_t age = cache.time - cache.timestamps[v];
+            if(age + 2*live[v] <= cache_size) priority = age;
+            if(priority > best_priority) { best_priority = priority; fan = v; }
+        }
+        if(fan >= 0) continue;
+
+        // Otherwise fall back to the most recently referenced vertex with triangles remaining, or failing that, the next such vertex in index order
+        while(!dead_ends.empty() && fan < 0)
+        {
+            const uint32_t v = dead_ends.back();
+            dead_ends.pop_back();
+            if(live[v] > 0) fan = v;
+        }
+        for(; next_vertex < vertex_count && fan < 0; ++next_vertex) if(live[next_vertex] > 0) fan = next_vertex;
+    }
+}
+
+mesh optimize_vertex_cache(mesh m, uint32_t cache_size)
+{
+    auto triangles = m.triangles; // Triangles outside of any material keep their place
+    for(auto & r : get_triangle_ranges(m)) tipsify({m.triangles.data() + r.first_triangle, r.num_triangles}, m.vertices.size(), cache_size, triangles.data() + r.first_triangle);
+    m.triangles.swap(triangles);
+    return m;
+}
+
+///////////////////////
+// optimize_overdraw //
+///////////////////////
+
+// Returns the index of the first triangle of each cluster within the given range
+static std::vector<size_t> find_clusters(array_view<uint3> triangles, vertex_cache & cache, float threshold)
+{
+    // Triangles whose vertices all miss the cache usually begin a new patch of the mesh, and form hard boundaries
+    std::vector<size_t> hard_boundaries, clusters;
+    cache.clear();
+    for(size_t i=0; i<triangles.size; ++i) if(cache.add(triangles[narrow(i)]) == 3 || i == 0) hard_boundaries.push_back(i);
+    hard_boundaries.push_back(triangles.size);
+
+    // Within each of these, start a new cluster as soon as the current one reaches the ACMR of the whole patch, scaled by threshold. As the cache is cleared at 
+    // the start of every cluster, the trailing cluster usually falls short of this target, and is merged with the cluster before it.
+    for(size_t i=0; i+1<hard_boundaries.size(); ++i)
+    {
+        const size_t begin = hard_boundaries[i], end = hard_boundaries[i+1];
+        cache.clear();
+        int misses = 0;
+        for(size_t j=begin; j<end; ++j) misses += cache.add(triangles[narrow(j)]);
+        const float target = threshold * misses / (end - begin);
+
+        const size_t first_cluster = clusters.size();
+        clusters.push_back(begin);
+        cache.clear();
+        misses = 0;
+        for(size_t j=begin; j<end; ++j)
+        {
+            misses += cache.add(triangles[narrow(j)]);
+            if(misses <= target * (j + 1 - clusters.back()))
+            {
+                clusters.push_back(j+1);
+                cache.clear();
+                misses = 0;
+            }
+        }
+        if(clusters.back() == end || clusters.size() > first_cluster+1) clusters.pop_back();
+    }
+    return clusters;
+}
+
+mesh optimize_overdraw(mesh m, float threshold, uint32_t cache_size)
+{
+    float3 mesh_centroid;
+    for(auto & v : m.vertices) mesh_centroid += v.position;
+    if(!m.vertices.empty()) mesh_centroid /= float(m.vertices.size());
+
+    vertex_cache cache {m.vertices.size(), cache_size};
+    auto triangles = m.triangles;
+    for(auto & r : get_triangle_ranges(m))
+    {
+        const array_view<uint3> range {m.triangles.data() + r.first_triangle, r.num_triangles};
+        auto clusters = find_clusters(range, cache, threshold);
+        clusters.push_back(range.size);
+
+        // Clusters whose area weighted normal points away from the center of the mesh are likely to occlude the rest of it, so should be drawn first
+        struct cluster { size_t begin, end; float sort_key; };
+        std::vector<cluster> sorted;
+        for(size_t i=0; i+1<clusters.size(); ++i)
+        {
+            float3 centroid, normal;
+            float area = 0;
+            for(size_t j=clusters[i]; j<clusters[i+1]; ++j)
+            {
+                const auto & t = range[narrow(j)];
+                const float3 p0 = m.vertices[t.x].position, p1 = m.vertices[t.y].position, p2 = m.vertices[t.z].position, n = cross(p1 - p0, p2 - p0);
+                centroid += (p0 + p1 + p2) * (length(n) / 3);
+                normal += n;
+                area += length(n);
+            }
+            if(area > 0) centroid /= area;
+            const float normal_length = length(normal);
+            sorted.push_back({clusters[i], clusters[i+1], normal_length > 0 ? dot(centroid - mesh_centroid, normal / normal_length) : 0});
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [](const cluster & a, const cluster & b) { return a.sort_key > b.sort_key; });
+
+        auto out = triangles.begin() + r.first_triangle;
+        for(auto & c : sorted) out = std::copy(range.begin() + c.begin, range.begin() + c.end, out);
+    }
+    m.triangles.swap(triangles);
+    return m;
+}
+
+///////////////////////////
+// optimize_vertex_fetch //
+///////////////////////////
+
+mesh optimize_vertex_fetch(mesh m)
+{
+    std::vector<uint32_t> remap(m.vertices.size(), ~0u);
+    std::vector<mesh::vertex> vertices;
+    vertices.reserve(m.vertices.size());
+    for(auto & t : m.triangles) for(auto v : t) if(remap[v] == ~0u)
+    {
+        remap[v] = narrow(vertices.size());
+        vertices.push_back(m.vertices[v]);
+    }
+    for(size_t v=0; v<m.vertices.size(); ++v) if(remap[v] == ~0u)
+    {
+        remap[v] = narrow(vertices.size());
+        vertices.push_back(m.vertices[v]);
+    }
+    m.vertices.swap(vertices);
+    for(auto & t : m.triangles) for(auto & v : t) v = remap[v];
+    return m;
+}
+
+mesh optimize_mesh(mesh m, uint32_t cache_size, mesh_optimization_stats * stats)
+{
+    if(stats) stats->before = analyze_vertex_cache(m, cache_size);
+    m = optimize_vertex_fetch(optimize_overdraw(optimize_vertex_cache(std::move(m), cache_size), 1.05f, cache_size));
+    if(stats) stats->after = analyze_vertex_cache(m, cache_size);
+    return m;
+}
+
+////////////////////
+// build_meshlets //
+////////////////////
+
+// Ritter's bounding sphere, which starts from the most distant pair of axis extremes and grows to enclose any vertex outside it
+static void compute_bounding_sphere(const mesh & m, array_view<uint32_t> vertices, float3 & center, float & radius)
+{
+    uint32_t min_index[3], max_index[3];
+    for(int j=0; j<3; ++j) min_index[j] = max_index[j] = vertices[0];
+    for(auto v : vertices) for(int j=0; j<3; ++j)
+    {
+        if(m.vertices[v].position[j] < m.vertices[min_index[j]].position[j]) min_index[j] = v;
+        if(m.vertices[v].position[j] > m.vertices[max_index[j]].position[j]) max_index[j] = v;
+    }
+    int axis = 0;
+    for(int j=1; j<3; ++j) if(distance2(m.vertices[min_index[j]].position, m.vertices[max_index[j]].position) > distance2(m.vertices[min_index[axis]].position, m.vertices[max_index[axis]].position)) axis = j;
+    center = (m.vertices[min_index[axis]].position + m.vertices[max_index[axis]].position) / 2.0f;
+    radius = distance(m.vertices[min_index[axis]].position, center);
+    for(auto v : vertices)
+    {
+        const float d = distance(m.vertices[v].position, center);
+        if(d <= radius) continue;
+        const float new_radius = (radius + d) / 2;
+        center += (m.vertices[v].position - center) * ((new_radius - radius) / d);
+        radius = new_radius;
+    }
+}
+
+// Finds the average direction of the triangle normals and the sine of the widest angle between it and any of them, ignoring degenerate triangles
+static void compute_normal_cone(const mesh & m, size_t first_triangle, size_t num_triangles, float3 & axis, float & cutoff)
+{
+    std::vector<float3> normals;
+    for(size_t i=first_triangle; i<first_triangle+num_triangles; ++i)
+    {
+        auto & t = m.triangles[i];
+        const float3 n = cross(m.vertices[t.y].position - m.vertices[t.x].position, m.vertices[t.z].position - m.vertices[t.x].position);
+        const float len = length(n);
+        if(len > 0) normals.push_back(n / len);
+    }
+    float3 sum;
+    for(auto & n : normals) sum += n;
+    const float len = length(sum);
+    axis = len > 0 ? sum / len : float3{0,0,1};
+    float min_dot = len > 0 ? 1.0f : -1.0f;
+    for(auto & n : normals) min_dot = std::min(min_dot, dot(n, axis));
+    cutoff = min_dot > 0 ? std::sqrt(1 - min_dot*min_dot) : 1;
+}
+
+// Gives every vertex the index of the first vertex at the same position, so that triangles on either side of a seam are still considered adjacent
+static std::vector<uint32_t> get_position_ids(const mesh & m)
+{
+    std::vector<uint32_t> order(m.vertices.size()), ids(m.vertices.size());
+    for(uint32_t i=0; i<order.size(); ++i) order[i] = i;
+    auto less = [&m](uint32_t a, uint32_t b) { auto & p = m.vertices[a].position, & q = m.vertices[b].position; return std::tie(p.x, p.y, p.z, a) < std::tie(q.x, q.y, q.z, b); };
+    std::sort(order.begin(), order.end(), less);
+    for(size_t i=0; i<order.size(); ++i) ids[order[i]] = i > 0 && m.vertices[order[i]].position == m.vertices[order[i-1]].position ? ids[order[i-1]] : order[i];
+    return ids;
+}
+
+// Lists the triangles which touch each position, from adjacency[offsets[p]] up to adjacency[offsets[p+1]] for the position with id p
+static void get_position_adjacency(array_view<uint32_t> position_ids, const std::vector<uint3> & triangles, std::vector<uint32_t> & offsets, std::vector<uint32_t> & adjacency)
+{
+    offsets.assign(position_ids.size+1, 0);
+    adjacency.resize(triangles.size()*3);
+    for(auto & t : triangles) for(auto v : t) ++offsets[position_ids[v]+1];
+    for(size_t p=0; p<position_ids.size; ++p) offsets[p+1] += offsets[p];
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end()-1);
+    for(uint32_t i=0; i<triangles.size(); ++i) for(auto v : triangles[i]) adjacency[fill[position_ids[v]]++] = i;
+}
+
+std::vector<meshlet> build_meshlets(mesh & m, uint32_t max_vertices, uint32_t max_triangles)
+{
+    if(max_vertices < 3 || max_triangles < 1) throw std::logic_error("meshlets must be able to hold at least one triangle");
+
+    // Find the triangles which touch each position
+    const auto position_ids = get_position_ids(m);
+    std::vector<uint32_t> adjacency_offsets, adjacency;
+    get_position_adjacency(position_ids, m.triangles, adjacency_offsets, adjacency);
+
+    auto get_centroid = [&m](const uint3 & t) { return (m.vertices[t.x].position + m.vertices[t.y].position + m.vertices[t.z].position) / 3.0f; };
+    std::vector<bool> emitted(m.triangles.size());
+    std::vector<uint32_t> last_meshlet(m.vertices.size(), ~0u), vertices, candidates;
+    std::vector<uint3> triangles = m.triangles;
+    std::vector<std::vector<uint32_t>> vertex_lists;
+    std::vector<meshlet> meshlets;
+    const auto ranges = get_triangle_ranges(m);
+    for(size_t i=0; i<ranges.size(); ++i)
+    {
+        const size_t range_end = ranges[i].first_triangle + ranges[i].num_triangles;
+        auto in_range = [&](uint32_t t) { return t >= ranges[i].first_triangle && t < range_end; };
+        size_t next = ranges[i].first_triangle;
+        for(size_t seed=ranges[i].first_triangle; seed<range_end; ++seed)
+        {
+            if(emitted[seed]) continue;
+
+            // Grow a meshlet from the first remaining triangle, preferring adjacent triangles which add the fewest vertices, then the closest to its centroid
+            const uint32_t id = narrow(meshlets.size());
+            meshlet ml {i, next, 0};
+            float3 centroid_sum;
+            candidates = {narrow(seed)};
+            while(ml.num_triangles < max_triangles)
+            {
+                uint32_t best = ~0u, best_new_vertices = 4;
+                float best_distance = 0;
+                const float3 centroid = ml.num_triangles ? centroid_sum / float(ml.num_triangles) : get_centroid(m.triangles[seed]);
+                for(auto t : candidates)
+                {
+                    if(emitted[t]) continue;
+                    uint32_t new_vertices = 0;
+                    for(auto v : m.triangles[t]) if(last_meshlet[v] != id) ++new_vertices;
+                    if(vertices.size() + new_vertices > max_vertices) continue;
+                    const float d = distance2(get_centroid(m.triangles[t]), centroid);
+                    if(new_vertices < best_new_vertices || (new_vertices == best_new_vertices && d < best_distance)) std::tie(best, best_new_vertices, best_distance) = std::tie(t, new_vertices, d);
+                }
+                if(best == ~0u) break;
+
+                emitted[best] = true;
+                triangles[next++] = m.triangles[best];
+                ++ml.num_triangles;
+                centroid_sum += get_centroid(m.triangles[best]);
+                for(auto v : m.triangles[best])
+                {
+                    if(last_meshlet[v] != id) { last_meshlet[v] = id; vertices.push_back(v); }
+                    for(auto j=adjacency_offsets[position_ids[v]]; j<adjacency_offsets[position_ids[v]+1]; ++j) if(!emitted[adjacency[j]] && in_range(adjacency[j])) candidates.push_back(adjacency[j]);
+                }
+                candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](uint32_t t) { return emitted[t]; }), candidates.end());
+            }
+            meshlets.push_back(ml);
+            vertex_lists.push_back(std::move(vertices));
+            vertices.clear();
+        }
+    }
+
+    // Each material now holds its meshlets consecutively, so their bounds can be computed from the reordered triangles
+    m.triangles.swap(triangles);
+    for(size_t i=0; i<meshlets.size(); ++i)
+    {
+        compute_bounding_sphere(m, vertex_lists[i], meshlets[i].center, meshlets[i].radius);
+        compute_normal_cone(m, meshlets[i].first_triangle, meshlets[i].num_triangles, meshlets[i].cone_axis, meshlets[i].cone_cutoff);
+    }
+    return meshlets;
+}
+
+bool is_meshlet_culled(const meshlet & m, const float4x4 & model_view_proj_matrix, const float3 & model_eye_position)
+{
+    // Test the bounding sphere against the planes -w <= x <= w, -w <= y <= w and 0 <= z <= w of clip space
+    const float4 x = model_view_proj_matrix.row(0), y = model_view_proj_matrix.row(1), z = model_view_proj_matrix.row(2), w = model_view_proj_matrix.row(3);
+    for(auto & plane : {w+x, w-x, w+y, w-y, z, w-z})
+    {
+        if(dot(plane.xyz(), m.center) + plane.w < -m.radius * length(plane.xyz())) return true;
+    }
+
+    // Every triangle faces away from every point in the sphere if the eye lies far enough behind the normal cone
+    const float3 view = m.center - model_eye_position;
+    return dot(view, m.cone_axis) >= m.cone_cutoff * length(view) + m.radius;
+}
+
+///////////////////
+// generate_lods //
+///////////////////
+
+bounding_sphere get_bounding_sphere(const mesh & m)
+{
+    if(m.vertices.empty()) return {};
+    std::vector<uint32_t> vertices(m.vertices.size());
+    for(uint32_t i=0; i<vertices.size(); ++i) vertices[i] = i;
+    bounding_sphere sphere;
+    compute_bounding_sphere(m, vertices, sphere.center, sphere.radius);
+    return sphere;
+}
+
+// The error of a point p is dot(p', q*p') / weight, with p' = {p,1}, which is the weighted mean of its squared distances to every plane added to q
+struct quadric { double4x4 q; double weight; };
+static void add_plane(quadric & q, const float3 & normal, const float3 & point, double weight)
+{
+    const double4 plane {normal.x, normal.y, normal.z, -dot(normal, point)};
+    q.q = q.q + outerprod(plane, plane) * weight;
+    q.weight += weight;
+}
+static double get_error(const quadric & q, const float3 & p)
+{
+    const double4 pp {p.x, p.y, p.z, 1};
+    return q.weight > 0 ? std::max(dot(pp, q.q*pp), 0.0) / q.weight : 0;
+}
+
+static uint64_t get_edge_key(uint32_t a, uint32_t b) { return uint64_t(a) << 32 | b; }
+
+// Texcoords and skin weights must not change across the surface where a collapse moves vertices, though normals may
+static bool has_same_surface_attributes(const mesh::vertex & a, const mesh::vertex & b) { return a.texcoord == b.texcoord && a.bone_indices == b.bone_indices && a.bone_weights == b.bone_weights; }
+
+// Collapses edges of the given triangles until no more than target_count triangles remain, or no further collapse is allowed. Each collapse moves every
+// vertex at one position onto a vertex at a neighbouring position, either one which shares a triangle with it, or failing that, the one chosen for another
+// vertex with the same texcoords and skin weights. This lets hard edges collapse, but UV seams only move along themselves. Positions on an open border only
+// move along it. Returns the square root of the largest error of any collapse.
+static float simplify_triangles(const mesh & m, array_view<uint32_t> position_ids, const std::vector<bool> & is_locked, std::vector<uint3> & triangles, size_t target_count)
+{
+    auto get_position = [&](uint32_t v) -> const float3 & { return m.vertices[v].position; };
+
+    // Accumulate the plane of every triangle at each of its positions, weighted by area, along with planes perpendicular to every border and UV seam
+    std::unordered_map<uint64_t, uint64_t> edges; // From the positions at either end of an edge to its vertices
+    for(auto & t : triangles) for(int i=0; i<3; ++i) edges[get_edge_key(position_ids[t[i]], position_ids[t[(i+1)%3]])] = get_edge_key(t[i], t[(i+1)%3]);
+    std::vector<quadric> quadrics(m.vertices.size());
+    for(auto & t : triangles)
+    {
+        const float3 n = cross(get_position(t.y) - get_position(t.x), get_position(t.z) - get_position(t.x));
+        const float area = length(n) / 2;
+        if(!(area > 0)) continue;
+        for(auto v : t) add_plane(quadrics[position_ids[v]], n / (area*2), get_position(t.x), area);
+        for(int i=0; i<3; ++i)
+        {
+            const uint32_t a = t[i], b = t[(i+1)%3];
+            auto it = edges.find(get_edge_key(position_ids[b], position_ids[a]));
+            if(it != edges.end() && has_same_surface_attributes(m.vertices[a], m.vertices[it->second & 0xFFFFFFFF]) && has_same_surface_attributes(m.vertices[b], m.vertices[it->second >> 32])) continue;
+            const float3 edge_normal = cross(get_position(b) - get_position(a), n);
+            if(!(length(edge_normal) > 0)) continue;
+            for(auto v : {a, b}) add_plane(quadrics[position_ids[v]], normalize(edge_normal), get_position(a), distance2(get_position(a), get_position(b)));
+        }
+    }
+
+    struct collapse { uint32_t from, to; double error; };
+    std::vector<collapse> collapses;
+    std::vector<std::pair<uint32_t, uint32_t>> moves;
+    std::vector<uint32_t> adjacency_offsets, adjacency, remap(m.vertices.size()), next(m.vertices.size()), prev(m.vertices.size()), open_out(m.vertices.size()), open_in(m.vertices.size());
+    std::vector<bool> touched(m.vertices.size());
+    std::unordered_set<uint64_t> position_edges;
+    double max_error = 0;
+    while(triangles.size() > target_count)
+    {
+        // Find the triangles at each position, and the open borders through it
+        get_position_adjacency(position_ids, triangles, adjacency_offsets, adjacency);
+
+        position_edges.clear();
+        for(auto & t : triangles) for(int i=0; i<3; ++i) position_edges.insert(get_edge_key(position_ids[t[i]], position_ids[t[(i+1)%3]]));
+        open_out.assign(m.vertices.size(), 0);
+        open_in.assign(m.vertices.size(), 0);
+        for(auto & t : triangles) for(int i=0; i<3; ++i)
+        {
+            const uint32_t a = position_ids[t[i]], b = position_ids[t[(i+1)%3]];
+            if(position_edges.count(get_edge_key(b, a))) continue;
+            next[a] = b;
+            prev[b] = a;
+            ++open_out[a];
+            ++open_in[b];
+        }
+
+        // Consider collapsing every position onto each of its neighbours, unless it is locked, or lies on anything but a single border
+        collapses.clear();
+        for(auto & t : triangles) for(int i=0; i<3; ++i) for(auto [from, to] : {std::pair{t[i], t[(i+1)%3]}, std::pair{t[(i+1)%3], t[i]}})
+        {
+            const uint32_t p = position_ids[from], q = position_ids[to];
+            if(p == q || is_locked[p] || open_out[p] != open_in[p] || open_out[p] > 1) continue;
+            if(open_out[p] == 1 && next[p] != q && prev[p] != q) continue;
+            collapses.push_back({p, q, get_error(quadrics[p], get_position(to))});
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const collapse & a, const collapse & b) { return a.error < b.error; });
+
+        // Apply the cheapest collapses which do not touch the same triangles, stopping once they should remove enough triangles
+        for(uint32_t v=0; v<remap.size(); ++v) remap[v] = v;
+        touched.assign(m.vertices.size(), false);
+        const size_t max_collapses = (triangles.size() - target_count) / 2 + 1;
+        size_t collapse_count = 0;
+        for(auto & c : collapses)
+        {
+            if(collapse_count == max_collapses) break;
+            if(touched[c.from] || touched[c.to]) continue;
+
+            // Every vertex at the old position must find a vertex at the new position to move to
+            moves.clear();
+            for(auto j=adjacency_offsets[c.from]; j<adjacency_offsets[c.from+1]; ++j)
+            {
+                auto & t = triangles[adjacency[j]];
+                uint32_t from = ~0u, to = ~0u;
+                for(auto v : t) { if(position_ids[v] == c.from) from = v; if(position_ids[v] == c.to) to = v; }
+                if(std::none_of(moves.begin(), moves.end(), [from](const std::pair<uint32_t, uint32_t> & move) { return move.first == from; })) moves.push_back({from, to});
+                else if(to != ~0u) for(auto & move : moves) if(move.first == from && move.second == ~0u) move.second = to;
+            }
+            for(auto & move : moves) if(move.second == ~0u) for(auto & other : moves) if(other.second != ~0u && has_same_surface_attributes(m.vertices[move.first], m.vertices[other.first])) move.second = other.second;
+            if(std::any_of(moves.begin(), moves.end(), [](const std::pair<uint32_t, uint32_t> & move) { return move.second == ~0u; })) continue;
+
+            // No remaining triangle may flip or become much steeper
+            bool flips = false;
+            for(auto j=adjacency_offsets[c.from]; j<adjacency_offsets[c.from+1] && !flips; ++j)
+            {
+                auto & t = triangles[adjacency[j]];
+                if(position_ids[t.x] == c.to || position_ids[t.y] == c.to || position_ids[t.z] == c.to) continue;
+                float3 p[3], q[3];
+                for(int k=0; k<3; ++k)
+                {
+                    p[k] = get_position(t[k]);
+                    q[k] = position_ids[t[k]] == c.from ? get_position(moves[0].second) : p[k];
+                }
+                const float3 old_normal = cross(p[1]-p[0], p[2]-p[0]), new_normal = cross(q[1]-q[0], q[2]-q[0]);
+                flips = !(dot(old_normal, new_normal) > 0.25f * length(old_normal) * length(new_normal));
+            }
+            if(flips) continue;
+
+            for(auto & move : moves) remap[move.first] = move.second;
+            quadrics[c.to].q = quadrics[c.to].q + quadrics[c.from].q;
+            quadrics[c.to].weight += quadrics[c.from].weight;
+            max_error = std::max(max_error, c.error);
+            for(auto j=adjacency_offsets[c.from]; j<adjacency_offsets[c.from+1]; ++j) for(auto v : triangles[adjacency[j]]) touched[position_ids[v]] = true;
+            ++collapse_count;
+        }
+        if(collapse_count == 0) break;
+
+        // Remove the triangles which have collapsed
+        size_t kept = 0;
+        for(auto & t : triangles)
+        {
+            const uint3 r {remap[t.x], remap[t.y], remap[t.z]};
+            if(position_ids[r.x] != position_ids[r.y] && position_ids[r.y] != position_ids[r.z] && position_ids[r.z] != position_ids[r.x]) triangles[kept++] = r;
+        }
+        triangles.resize(kept);
+    }
+    return static_cast<float>(std::sqrt(max_error));
+}
+
+std::vector<mesh_lod> generate_lods(mesh & m, size_t lod_count, float reduction)
+{
+    if(!(reduction > 0 && reduction < 1)) throw std::logic_error("reduction must lie between zero and one");
+
+    // Positions used by more than one material must not move, or cracks could open between them
+    const auto position_ids = get_position_ids(m);
+    const auto ranges = get_triangle_ranges(m);
+    std::vector<uint32_t> owners(m.vertices.size(), ~0u);
+    for(uint32_t i=0; i<ranges.size(); ++i) for(size_t j=ranges[i].first_triangle; j<ranges[i].first_triangle+ranges[i].num_triangles; ++j) for(auto v : m.triangles[j])
+    {
+        auto & owner = owners[position_ids[v]];
+        owner = owner == ~0u || owner == i ? i : ~1u;
+    }
+
+    // Simplify each level from the one before it, so that error accumulates down the chain
+    std::vector<std::vector<uint3>> triangles(ranges.size());
+    std::vector<float> errors(ranges.size());
+    for(size_t i=0; i<ranges.size(); ++i) triangles[i].assign(m.triangles.begin() + ranges[i].first_triangle, m.triangles.begin() + ranges[i].first_triangle + ranges[i].num_triangles);
+    std::vector<mesh_lod> lods;
+    for(size_t level=1; level<=lod_count; ++level)
+    {
+        auto next_triangles = triangles;
+        auto next_errors = errors;
+        size_t count = 0, next_count = 0;
+        for(uint32_t i=0; i<ranges.size(); ++i)
+        {
+            std::vector<bool> is_locked(m.vertices.size());
+            for(size_t p=0; p<owners.size(); ++p) is_locked[p] = owners[p] != i;
+            next_errors[i] += simplify_triangles(m, position_ids, is_locked, next_triangles[i], static_cast<size_t>(ranges[i].num_triangles * std::pow(reduction, level)));
+            count += triangles[i].size();
+            next_count += next_triangles[i].size();
+        }
+        if(next_count > count * (1 + reduction) / 2) break;
+
+        mesh_lod lod {{}, 0};
+        for(size_t i=0; i<ranges.size(); ++i)
+        {
+            lod.materials.push_back({ranges[i].name, m.triangles.size(), next_triangles[i].size()});
+            lod.error = std::max(lod.error, next_errors[i]);
+            m.triangles.insert(m.triangles.end(), next_triangles[i].begin(), next_triangles[i].end());
+        }
+        lods.push_back(lod);
+        triangles.swap(next_triangles);
+        errors.swap(next_errors);
+    }
+
+    // Record the range of the full detail triangles, so that later passes over a mesh without materials leave the appended levels alone
+    if(m.materials.empty() && !lods.empty()) m.materials = ranges;
+    return lods;
+}
+
+///////////////////
+// pack_vertices //
+///////////////////
+
+static float saturate(float x) { return x > 0 ? (x < 1 ? x : 1) : 0; } // NaN saturates to zero
+static uint8_t to_unorm8(float x) { return static_cast<uint8_t>(saturate(x)*255 + 0.5f); }
+static uint16_t to_unorm16(float x) { return static_cast<uint16_t>(saturate(x)*65535 + 0.5f); }
+static int8_t to_snorm8(float x) { return static_cast<int8_t>(std::round(std::clamp(x, -1.0f, 1.0f)*127)); }
+static int16_t to_snorm16(float x) { return static_cast<int16_t>(std::round(std::clamp(x, -1.0f, 1.0f)*32767)); }
+
+static uint16_t float_to_half(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    const uint32_t sign = bits >> 16 & 0x8000, magnitude = bits & 0x7FFFFFFF;
+    if(magnitude > 0x7F800000) return static_cast<uint16_t>(sign | 0x7E00); // NaN
+    if(magnitude >= 0x477FF000) return static_cast<uint16_t>(sign | 0x7C00); // Infinity, and values which round up to it
+    if(magnitude < 0x38800000) // Values which round to zero or a subnormal, and can be scaled exactly into the range of the mantissa
+    {
+        float m;
+        memcpy(&m, &magnitude, sizeof(m));
+        return static_cast<uint16_t>(sign | static_cast<uint32_t>(std::nearbyint(m * (1 << 24))));
+    }
+    // Rebias the exponent and round the mantissa to nearest even
+    return static_cast<uint16_t>(sign | (magnitude - 0x38000000 + 0xFFF + (magnitude >> 13 & 1)) >> 13);
+}
+
+// Projects a direction onto the octahedron |x|+|y|+|z| = 1 and folds the lower half over the upper half. Zero vectors encode as +Z.
+static float2 encode_octahedral(const float3 & v)
+{
+    const float length = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    if(!(length > 0)) return {0,0};
+    const float2 p = float2{v.x, v.y} / length;
+    if(v.z >= 0) return p;
+    return {(1 - std::abs(p.y)) * (p.x < 0 ? -1 : 1), (1 - std::abs(p.x)) * (p.y < 0 ? -1 : 1)};
+}
+
+// Quantizes bone weights to unorm8s which sum to exactly 255, by giving the rounding error to the largest weight
+static byte4 quantize_bone_weights(const float4 & weights)
+{
+    float4 w = max(weights, float4{0,0,0,0});
+    const float sum = w.x + w.y + w.z + w.w;
+    if(!(sum > 0)) return {255,0,0,0};
+    int4 q;
+    for(int i=0; i<4; ++i) q[i] = static_cast<int>(std::round(w[i] / sum * 255));
+    q[argmax(q)] += 255 - (q.x + q.y + q.z + q.w);
+    return byte4{q};
+}
+
+uint32_t get_packed_vertex_size(const vertex_packing & packing)
+{
+    return 24 + (packing.color ? 4 : 0) + (packing.skinning ? 8 : 0);
+}
+
+std::vector<VkVertexInputAttributeDescription> get_packed_vertex_attributes(const vertex_packing & packing, uint32_t binding)
+{
+    std::vector<VkVertexInputAttributeDescription> attributes {{0, binding, VK_FORMAT_R32G32B32_SFLOAT, 0}};
+    uint32_t offset = 12;
+    auto add = [&](uint32_t location, VkFormat format) { attributes.push_back({location, binding, format, offset}); offset += 4; };
+    if(packing.color) add(1, VK_FORMAT_R8G8B8A8_UNORM);
+    add(2, VK_FORMAT_R16G16_SNORM);
+    add(3, packing.unorm_texcoords ? VK_FORMAT_R16G16_UNORM : VK_FORMAT_R16G16_SFLOAT);
+    add(4, VK_FORMAT_R8G8B8A8_SNORM);
+    if(packing.skinning)
+    {
+        add(6, VK_FORMAT_R8G8B8A8_UINT);
+        add(7, VK_FORMAT_R8G8B8A8_UNORM);
+    }
+    return attributes;
+}
+
+std::vector<uint8_t> pack_vertices(array_view<mesh::vertex> vertices, const vertex_packing & packing)
+{
+    std::vector<uint8_t> data(vertices.size * get_packed_vertex_size(packing));
+    uint8_t * out = data.data();
+    auto write = [&out](const auto & value) { memcpy(out, &value, sizeof(value)); out += sizeof(value); };
+    for(auto & v : vertices)
+    {
+        write(v.position);
+        if(packing.color) write(byte4{to_unorm8(v.color.x), to_unorm8(v.color.y), to_unorm8(v.color.z), 255});
+
+        const float2 n = encode_octahedral(v.normal), t = encode_octahedral(v.tangent);
+        write(short2{to_snorm16(n.x), to_snorm16(n.y)});
+        if(packing.unorm_texcoords) write(ushort2{to_unorm16(v.texcoord.x), to_unorm16(v.texcoord.y)});
+        else write(ushort2{float_to_half(v.texcoord.x), float_to_half(v.texcoord.y)});
+        write(linalg::vec<int8_t,4>{to_snorm8(t.x), to_snorm8(t.y), 0, static_cast<int8_t>(dot(cross(v.normal, v.tangent), v.bitangent) < 0 ? -127 : 127)});
+
+        if(packing.skinning)
+        {
+            if(v.bone_indices.x > 255 || v.bone_indices.y > 255 || v.bone_indices.z > 255 || v.bone_indices.w > 255) throw std::runtime_error("bone index does not fit in packed vertex");
+            write(byte4{v.bone_indices});
+            write(quantize_bone_weights(v.bone_weights));
+        }
+    }
+    return data;
+}
@@ -0,0 +1,66 @@
+#ifndef MESH_OPS_H
+#define MESH_OPS_H
+
+#include "data-types.h"
+
+// Pure functions which transform the contents of meshes. Functions which reorder or remove triangles keep every material's triangles within the range
+// recorded for that material, adjusting first_triangle and num_triangles to match.
+
+// Merges vertices whose attributes are identical, and removes any triangles which refer to the same vertex more than once. Each group of merged vertices
+// takes the place and attributes of its first vertex. If epsilon is nonzero, every float attribute is rounded to the nearest multiple of epsilon before
+// vertices are compared, so that vertices which differ only by small errors are merged as well.
+mesh weld_vertices(mesh m, float epsilon = 0);
+
+// Simulates a FIFO post-transform vertex cache of the given size. ACMR is the average number of vertices transformed per triangle, from 3 down to about 0.5
+// for large regular meshes. ATVR is the average number of times each referenced vertex is transformed, which is 1 for an ideal ordering.
+struct vertex_cache_stats { float acmr, atvr; };
+vertex_cache_stats analyze_vertex_cache(const mesh & m, uint32_t cache_size = 16);
+
+// Reorders the triangles of each material with Tipsify (Sander, Nehab and Barczak 2007), so that vertices tend to be reused while they are still in a
+// post-transform cache of the given size. Meshes without materials are treated as a single material.
+mesh optimize_vertex_cache(mesh m, uint32_t cache_size = 16);
+// Splits the triangles of each material into clusters, at every point where the vertex cache starts over and wherever else this keeps the ACMR of each
+// cluster within threshold times its original value, then sorts the clusters so that outward facing ones are drawn first, to reduce overdraw.
+mesh optimize_overdraw(mesh m, float threshold = 1.05f, uint32_t cache_size = 16);
+// Reorders vertices in the order that triangles first refer to them, so that vertex fetches walk through memory. Unreferenced vertices are moved to the end.
+mesh optimize_vertex_fetch(mesh m);
+// Applies optimize_vertex_cache(...), optimize_overdraw(...) and optimize_vertex_fetch(...) in that order. If stats is given, it receives the result of
+// analyze_vertex_cache(...) for the mesh before and after optimization.
+struct mesh_optimization_stats { vertex_cache_stats before, after; };
+mesh optimize_mesh(mesh m, uint32_t cache_size = 16, mesh_optimization_stats * stats = nullptr);
+
+// A range of consecutive triangles within one material, small enough to be culled as a unit. The sphere bounds every vertex of the meshlet, and every
+// triangle normal lies within cone_cutoff of cone_axis, measured as the sine of the largest angle between them. A cone_cutoff of 1 means the meshlet is
+// never backfacing.
+struct meshlet { size_t material, first_triangle, num_triangles; float3 center; float radius; float3 cone_axis; float cone_cutoff; };
+// Groups the triangles of each material into meshlets of at most max_vertices distinct vertices and max_triangles triangles, growing each one across
+// adjacent triangles so that it stays compact. Unlike the functions above, this reorders the triangles of m in place, so that each meshlet is a range.
+std::vector<meshlet> build_meshlets(mesh & m, uint32_t max_vertices = 64, uint32_t max_triangles = 124);
+// Returns true if a meshlet lies entirely outside the view frustum of a zero to one depth projection, or if every one of its triangles faces away from
+// the eye. Both the matrix and the eye position must be given in the space of the mesh, which may have been scaled uniformly but not otherwise.
+bool is_meshlet_culled(const meshlet & m, const float4x4 & model_view_proj_matrix, const float3 & model_eye_position);
+
+// Returns a sphere which bounds every vertex of m. It is found with Ritter's method, and so may be a few percent larger than the smallest such sphere.
+struct bounding_sphere { float3 center; float radius; };
+bounding_sphere get_bounding_sphere(const mesh & m);
+
+// A simplified version of every material of a mesh, referring to the same vertices. Error estimates the largest distance between its surface and that of
+// the full detail mesh, from the quadric error of every edge collapse made so far.
+struct mesh_lod { std::vector<mesh::material> materials; float error; };
+// Simplifies each material of m by repeatedly collapsing the edge whose quadric error is lowest, moving one vertex onto another, so that every remaining
+// vertex keeps its texcoords and skin weights. Vertices on UV seams and open borders only move along them, and vertices shared with other materials never
+// move. Level i keeps about reduction^i of the original triangles, which are appended to m.triangles. Stops early if a level would remove too few triangles.
+// If m has no materials and any level is generated, a single material covering the original triangles is added to it.
+std::vector<mesh_lod> generate_lods(mesh & m, size_t lod_count = 3, float reduction = 0.5f);
+
+// Describes a compact vertex layout which keeps the attribute locations of mesh::vertex. Positions stay as 32-bit floats, normals are octahedral encoded
+// in two snorm16s, tangents are octahedral encoded in two snorm8s with the sign of the bitangent in w, and texcoords are halfs, or unorm16s clamped to
+// [0,1] if unorm_texcoords is set. Colors are stored as unorm8s and bone indices and weights as uint8s and unorm8s, but only if requested. There is no
+// bitangent attribute, shaders should use cross(normal, tangent) * tangent.w instead. Static layouts take 24 bytes and skinned layouts 32, plus 4 for color.
+struct vertex_packing { bool color, skinning, unorm_texcoords; };
+uint32_t get_packed_vertex_size(const vertex_packing & packing);
+std::vector<VkVertexInputAttributeDescription> get_packed_vertex_attributes(const vertex_packing & packing, uint32_t binding = 0);
+// Bone weights are renormalized so that they sum to exactly one after quantization. Throws if a bone index does not fit in eight bits.
+std::vector<uint8_t> pack_vertices(array_view<mesh::vertex> vertices, const vertex_packing & packing);
+
+#endif
@@ -0,0 +1,181 @@
+#include "package.h"
+#include "load.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <zlib.h>
+
+// All offsets are relative to the start of the file. Blobs begin on a 64 byte boundary, and are followed by the table of contents and then the names.
+struct package_header
+{
+    char magic[8];
+    uint32_t version, entry_count;
+    uint64_t entries_offset;
+};
+struct package_entry
+{
+    uint64_t name_hash;
+    uint64_t name_offset;
+    uint64_t offset, stored_size, size;
+    uint32_t name_length, compression;
+};
+enum : uint32_t { package_compression_none, package_compression_zlib };
+
+static const char package_magic[8] {'I','E','P','A','C','K','\r','\n'};
+static const uint32_t package_version = 1;
+static const size_t package_blob_alignment = 64;
+
+static uint64_t hash_name(std::string_view name)
+{
+    // 64-bit FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    for(char ch : name) hash = (hash ^ static_cast<uint8_t>(ch)) * 0x100000001b3;
+    return hash;
+}
+
+////////////////////
+// package_writer //
+////////////////////
+
+void package_writer::add_blob(std::string_view name, std::vector<uint8_t> contents, bool compress)
+{
+    for(auto & b : blobs) if(b.name == name) throw std::runtime_error("duplicate blob name: " + std::string(name));
+    blobs.push_back({std::string{name}, move(contents), compress});
+}
+
+void package_writer::add_file(const char * filename, bool compress)
+{
+    add_blob(filename, load_binary_file(filename), compress);
+}
+
+void package_writer::save(const char * filename) const
+{
+    // Compress blobs in parallel, keeping the compressed form only if it is actually smaller
+    std::vector<std::vector<uint8_t>> compressed(blobs.size());
+    parallel_for(blobs.size(), [&](size_t i)
+    {
+        if(!blobs[i].compress || blobs[i].contents.empty()) return;
+        uLongf length = compressBound(static_cast<uLong>(blobs[i].contents.size()));
+        compressed[i].resize(length);
+        if(compress2(compressed[i].data(), &length, blobs[i].contents.data(), static_cast<uLong>(blobs[i].contents.size()), Z_BEST_COMPRESSION) != Z_OK) throw std::runtime_error("compress2(...) failed");
+        if(length < blobs[i].contents.size()) compressed[i].resize(length);
+        else compressed[i].clear();
+    });
+
+    // Lay out blobs, then the table of contents, then the names
+    std::vector<uint8_t> buffer(sizeof(package_header));
+    std::vector<package_entry> entries;
+    for(size_t i=0; i<blobs.size(); ++i)
+    {
+        buffer.resize((buffer.size() + package_blob_alignment - 1) & ~(package_blob_alignment - 1));
+        const auto & stored = compressed[i].empty() ? blobs[i].contents : compressed[i];
+        entries.push_back({hash_name(blobs[i].name), 0, buffer.size(), stored.size(), blobs[i].contents.size(), narrow(blobs[i].name.size()), compressed[i].empty() ? package_compression_none : package_compression_zlib});
+        buffer.insert(buffer.end(), stored.begin(), stored.end());
+    }
+    buffer.resize((buffer.size() + package_blob_alignment - 1) & ~(package_blob_alignment - 1));
+    const size_t entries_offset = buffer.size();
+    buffer.resize(entries_offset + sizeof(package_entry) * entries.size());
+    for(size_t i=0; i<blobs.size(); ++i)
+    {
+        entries[i].name_offset = buffer.size();
+        buffer.insert(buffer.end(), blobs[i].name.begin(), blobs[i].name.end());
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const package_entry & a, const package_entry & b) { return a.name_hash < b.name_hash; });
+    if(!entries.empty()) memcpy(buffer.data() + entries_offset, entries.data(), sizeof(package_entry) * entries.size());
+
+    package_header header {{}, package_version, narrow(entries.size()), entries_offset};
+    memcpy(header.magic, package_magic, sizeof(header.magic));
+    memcpy(buffer.data(), &header, sizeof(header));
+
+    save_binary_file(filename, buffer);
+}
+
+/////////////
+// package //
+/////////////
+
+package::package(const char * filename) : file{filename}
+{
+    const size_t size = file.get_size();
+    if(size < sizeof(package_header)) throw std::runtime_error(std::string("not a package: ") + filename);
+    auto & header = *reinterpret_cast<const package_header *>(file.begin());
+    if(memcmp(header.magic, package_magic, sizeof(header.magic)) != 0) throw std::runtime_error(std::string("not a package: ") + filename);
+    if(header.version != package_version) throw std::runtime_error(std::string("incompatible package: ") + filename);
+    if(header.entries_offset % alignof(package_entry) || header.entries_offset > size || header.entry_count > (size - header.entries_offset) / sizeof(package_entry)) throw std::runtime_error(std::string("malformed package: ") + filename);
+    entries = {reinterpret_cast<const package_entry *>(file.begin() + header.entries_offset), header.entry_count};
+
+    // Validate every entry up front, so that lookups can refer into the file without further checks
+    for(auto & e : entries)
+    {
+        if(e.offset > size || e.stored_size > size - e.offset || e.name_offset > size || e.name_length > size - e.name_offset) throw std::runtime_error(std::string("malformed package: ") + filename);
+        if(e.compression == package_compression_none && e.stored_size != e.size) throw std::runtime_error(std::string("malformed package: ") + filename);
+        if(e.compression != package_compression_none && e.compression != package_compression_zlib) throw std::runtime_error(std::string("unsupported compression in package: ") + filename);
+    }
+}
+
+std::string_view package::get_name(const package_entry & entry) const
+{
+    return {file.begin() + entry.name_offset, entry.name_length};
+}
+
+const package_entry * package::find_entry(std::string_view name) const
+{
+    const uint64_t hash = hash_name(name);
+    auto it = std::lower_bound(entries.begin(), entries.end(), hash, [](const package_entry & e, uint64_t hash) { return e.name_hash < hash; });
+    for(; it != entries.end() && it->name_hash == hash; ++it) if(get_name(*it) == name) return it;
+    return nullptr;
+}
+
+std::vector<std::string_view> package::get_names() const
+{
+    std::vector<std::string_view> names;
+    for(auto & e : entries) names.push_back(get_name(e));
+    return names;
+}
+
+array_view<uint8_t> package::get_blob(std::string_view name, std::vector<uint8_t> & storage) const
+{
+    auto * entry = find_entry(name);
+    if(!entry) throw std::runtime_error("blob not found in package: " + std::string(name));
+    const auto * stored = reinterpret_cast<const uint8_t *>(file.begin() + entry->offset);
+    if(entry->compression == package_compression_none) return {stored, static_cast<size_t>(entry->size)};
+
+    storage.resize(static_cast<size_t>(entry->size));
+    uLongf length = static_cast<uLongf>(storage.size());
+    if(uncompress(storage.data(), &length, stored, static_cast<uLong>(entry->stored_size)) != Z_OK || length != storage.size()) throw std::runtime_error("failed to inflate blob: " + std::string(name));
+    return {storage.data(), storage.size()};
+}
+
+//////////////////////
+// mounted packages //
+//////////////////////
+
+static std::mutex mounted_packages_mutex;
+static std::vector<std::shared_ptr<const package>> mounted_packages;
+
+void mount_package(std::shared_ptr<const package> pkg)
+{
+    std::lock_guard<std::mutex> lock {mounted_packages_mutex};
+    mounted_packages.push_back(move(pkg));
+}
+
+void unmount_package(const std::shared_ptr<const package> & pkg)
+{
+    std::lock_guard<std::mutex> lock {mounted_packages_mutex};
+    mounted_packages.erase(std::remove(mounted_packages.begin(), mounted_packages.end(), pkg), mounted_packages.end());
+}
+
+std::optional<mounted_blob> find_mounted_blob(std::string_view name)
+{
+    std::shared_ptr<const package> source;
+    {
+        std::lock_guard<std::mutex> lock {mounted_packages_mutex};
+        for(auto it = mounted_packages.rbegin(); it != mounted_packages.rend(); ++it) if((*it)->contains(name)) { source = *it; break; }
+    }
+    if(!source) return std::nullopt;
+
+    mounted_blob blob;
+    blob.source = source;
+    blob.contents = source->get_blob(name, blob.storage);
+    return blob;
+}
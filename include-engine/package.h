@@ -0,0 +1,54 @@
+#ifndef PACKAGE_H
+#define PACKAGE_H
+
+#include "data-types.h"
+
+// package_writer gathers a collection of named blobs at runtime, and writes them out as a single package file
+class package_writer
+{
+    struct blob { std::string name; std::vector<uint8_t> contents; bool compress; };
+    std::vector<blob> blobs;
+public:
+    void add_blob(std::string_view name, std::vector<uint8_t> contents, bool compress);
+    void add_file(const char * filename, bool compress);
+    void save(const char * filename) const;
+};
+
+// package is a read-only view of a package file, mapped into memory, whose blobs can be looked up by name
+class package
+{
+    mapped_file file;
+    array_view<struct package_entry> entries; // Sorted by hash of name
+
+    const package_entry * find_entry(std::string_view name) const;
+    std::string_view get_name(const package_entry & entry) const;
+public:
+    explicit package(const char * filename);
+
+    bool contains(std::string_view name) const { return find_entry(name) != nullptr; }
+    std::vector<std::string_view> get_names() const;
+
+    // Uncompressed blobs are referred to in place, compressed blobs are inflated into the caller's storage
+    array_view<uint8_t> get_blob(std::string_view name, std::vector<uint8_t> & storage) const;
+};
+
+// Mounted packages are searched, most recently mounted first, by the asset loading functions in load.h before they fall back to the filesystem
+void mount_package(std::shared_ptr<const package> pkg);
+void unmount_package(const std::shared_ptr<const package> & pkg);
+
+// Move-only, as contents may refer into storage, which moving preserves but copying would not
+struct mounted_blob
+{
+    std::shared_ptr<const package> source;  // Keeps the package mapped for as long as contents may refer into it
+    std::vector<uint8_t> storage;           // Holds the contents of compressed blobs
+    array_view<uint8_t> contents;
+
+    mounted_blob() = default;
+    mounted_blob(mounted_blob &&) = default;
+    mounted_blob(const mounted_blob &) = delete;
+    mounted_blob & operator = (mounted_blob &&) = default;
+    mounted_blob & operator = (const mounted_blob &) = delete;
+};
+std::optional<mounted_blob> find_mounted_blob(std::string_view name);
+
+#endif
@@ -1,7 +1,10 @@
 #include "renderer.h"
+#include "load.h"
+#include "texture-cooker.h"
 #include "utility.h"
 #include <stdexcept>
 #include <algorithm>
+#include <cstdio>
 
 struct physical_device_selection
 {
@@ -22,16 +25,22 @@ struct context
     physical_device_selection selection {};
     VkDevice device {};
     VkQueue queue {};
+    VkPhysicalDeviceProperties device_props {};
     VkPhysicalDeviceMemoryProperties mem_props {};
 
+    VkPipelineCache pipeline_cache {};
+    std::string pipeline_cache_filename; // Empty if the pipeline cache is not persistent
+
     VkBuffer staging_buffer {};
     VkDeviceMemory staging_memory {};
     void * mapped_staging_memory {};
     VkCommandPool staging_pool {};
 
-    context(std::function<void(const char *)> debug_callback);
+    context(std::function<void(const char *)> debug_callback, const char * pipeline_cache_filename);
     ~context();
 
+    bool save_pipeline_cache() const;
+
     uint32_t select_memory_type(const VkMemoryRequirements & reqs, VkMemoryPropertyFlags props) const;
     VkDeviceMemory allocate(const VkMemoryRequirements & reqs, VkMemoryPropertyFlags props);
 
@@ -163,7 +172,15 @@ physical_device_selection select_physical_device(VkInstance instance, const std:
 // context //
 /////////////
 
-context::context(std::function<void(const char *)> debug_callback) : debug_callback{debug_callback}
+static std::vector<char> load_pipeline_cache_data(const char * filename, const VkPhysicalDeviceProperties & props)
+{
+    mapped_file file;
+    try { file = mapped_file{filename}; }
+    catch(const std::runtime_error &) { return {}; }
+    return unwrap_pipeline_cache_data(props, {file.begin(), file.get_size()});
+}
+
+context::context(std::function<void(const char *)> debug_callback, const char * pipeline_cache_filename) : debug_callback{debug_callback}, pipeline_cache_filename{pipeline_cache_filename ? pipeline_cache_filename : ""}
 {
     if(glfwInit() == GLFW_FALSE) throw std::runtime_error("glfwInit() failed");
     uint32_t extension_count = 0;
@@ -191,11 +208,20 @@ context::context(std::function<void(const char *)> debug_callback) : debug_callb
     selection = select_physical_device(instance, device_extensions);
     const float queue_priorities[] {1.0f};
     const VkDeviceQueueCreateInfo queue_infos[] {{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO, nullptr, {}, selection.queue_family, narrow(countof(queue_priorities)), queue_priorities}};
-    const VkDeviceCreateInfo device_info {VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO, nullptr, {}, narrow(countof(queue_infos)), queue_infos, narrow(countof(layers)), layers, narrow(countof(device_extensions)), device_extensions.data()};
+    VkPhysicalDeviceFeatures supported_features, enabled_features {};
+    vkGetPhysicalDeviceFeatures(selection.physical_device, &supported_features);
+    enabled_features.textureCompressionBC = supported_features.textureCompressionBC; // Required for textures cooked into BC formats
+    const VkDeviceCreateInfo device_info {VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO, nullptr, {}, narrow(countof(queue_infos)), queue_infos, narrow(countof(layers)), layers, narrow(countof(device_extensions)), device_extensions.data(), &enabled_features};
     check(vkCreateDevice(selection.physical_device, &device_info, nullptr, &device));
     vkGetDeviceQueue(device, selection.queue_family, 0, &queue);
+    vkGetPhysicalDeviceProperties(selection.physical_device, &device_props);
     vkGetPhysicalDeviceMemoryProperties(selection.physical_device, &mem_props);
 
+    // Set up pipeline cache, starting from the contents of the cache file if it was written by the same device and driver
+    const auto initial_data = pipeline_cache_filename ? load_pipeline_cache_data(pipeline_cache_filename, device_props) : std::vector<char>{};
+    const VkPipelineCacheCreateInfo pipeline_cache_info {VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO, nullptr, 0, initial_data.size(), initial_data.data()};
+    check(vkCreatePipelineCache(device, &pipeline_cache_info, nullptr, &pipeline_cache));
+
     // Set up staging buffer
     VkBufferCreateInfo buffer_info {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
     buffer_info.size = 16*1024*1024;
@@ -224,11 +250,28 @@ context::~context()
     vkUnmapMemory(device, staging_memory);
     vkFreeMemory(device, staging_memory, nullptr);
 
+    save_pipeline_cache();
+    vkDestroyPipelineCache(device, pipeline_cache, nullptr);
+
     vkDestroyDevice(device, nullptr);
     vkDestroyDebugReportCallbackEXT(instance, callback, nullptr);
     vkDestroyInstance(instance, nullptr);
 }
 
+bool context::save_pipeline_cache() const
+{
+    if(pipeline_cache_filename.empty()) return false;
+    size_t size = 0;
+    if(vkGetPipelineCacheData(device, pipeline_cache, &size, nullptr) != VK_SUCCESS) return false;
+    std::vector<char> data(size);
+    if(vkGetPipelineCacheData(device, pipeline_cache, &size, data.data()) != VK_SUCCESS) return false;
+    data.resize(size);
+    const auto buffer = wrap_pipeline_cache_data(device_props, data);
+    try { save_binary_file(pipeline_cache_filename.c_str(), {reinterpret_cast<const uint8_t *>(buffer.data()), buffer.size()}); }
+    catch(const std::runtime_error &) { return false; }
+    return true;
+}
+
 uint32_t context::select_memory_type(const VkMemoryRequirements & reqs, VkMemoryPropertyFlags props) const
 {
     for(uint32_t i=0; i<mem_props.memoryTypeCount; ++i)
@@ -457,14 +500,45 @@ render_target::~render_target()
 
 void transition_layout(VkCommandBuffer command_buffer, VkImage image, uint32_t mip_level, uint32_t array_layer, VkImageLayout old_layout, VkImageLayout new_layout);
 
-texture::texture(std::shared_ptr<context> ctx, VkFormat format, VkExtent3D extent, array_view<const void *> layer_data, VkImageViewType view_type) : ctx{ctx}
+staging_buffer::staging_buffer(std::shared_ptr<context> ctx, VkDeviceSize size) : ctx{ctx}, size{size}
+{
+    VkBufferCreateInfo buffer_info {VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    buffer_info.size = size;
+    buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    check(vkCreateBuffer(ctx->device, &buffer_info, nullptr, &buffer));
+
+    // Prefer cached memory where available, as some decoders read back the rows they have already written
+    VkMemoryRequirements mem_reqs;
+    vkGetBufferMemoryRequirements(ctx->device, buffer, &mem_reqs);
+    const VkMemoryPropertyFlags host_memory = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    try { device_memory = ctx->allocate(mem_reqs, host_memory | VK_MEMORY_PROPERTY_HOST_CACHED_BIT); }
+    catch(const std::runtime_error &) { device_memory = ctx->allocate(mem_reqs, host_memory); }
+    vkBindBufferMemory(ctx->device, buffer, device_memory, 0);
+    check(vkMapMemory(ctx->device, device_memory, 0, size, 0, &mapped_memory));
+}
+
+staging_buffer::~staging_buffer()
+{
+    vkDestroyBuffer(ctx->device, buffer, nullptr);
+    vkUnmapMemory(ctx->device, device_memory);
+    vkFreeMemory(ctx->device, device_memory, nullptr);
+}
+
+static uint32_t get_full_mip_count(VkExtent3D extent)
+{
+    return 1+static_cast<uint32_t>(std::ceil(std::log2(std::max({extent.width, extent.height, extent.depth}))));
+}
+
+texture::texture(std::shared_ptr<context> ctx, VkFormat format, VkExtent3D extent, uint32_t mip_levels, uint32_t layer_count, VkImageViewType view_type) : ctx{ctx}, mip_levels{mip_levels}
 {
     VkImageCreateInfo image_info {VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
+    if(view_type == VK_IMAGE_VIEW_TYPE_CUBE) image_info.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
     image_info.imageType = extent.depth > 1 ? VK_IMAGE_TYPE_3D : extent.height > 1 ? VK_IMAGE_TYPE_2D : VK_IMAGE_TYPE_1D;
     image_info.format = format;
     image_info.extent = extent;
-    image_info.mipLevels = 1+static_cast<uint32_t>(std::ceil(std::log2(std::max({extent.width, extent.height, extent.depth}))));
-    image_info.arrayLayers = layer_data.size;
+    image_info.mipLevels = mip_levels;
+    image_info.arrayLayers = layer_count;
     image_info.samples = VK_SAMPLE_COUNT_1_BIT;
     image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
     image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
@@ -476,49 +550,6 @@ texture::texture(std::shared_ptr<context> ctx, VkFormat format, VkExtent3D exten
     vkGetImageMemoryRequirements(ctx->device, image, &mem_reqs);
     device_memory = ctx->allocate(mem_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
     vkBindImageMemory(ctx->device, image, device_memory, 0);
-    
-    for(size_t layer=0; layer<layer_data.size; ++layer) 
-    {
-        // Write initial data for this layer into the staging area
-        memcpy(ctx->mapped_staging_memory, layer_data[layer], compute_image_size({narrow(extent.width), narrow(extent.height)}, format));
-
-        VkImageSubresourceLayers layers {};
-        layers.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        layers.baseArrayLayer = layer;
-        layers.layerCount = 1;
-
-        // Copy image contents from staging buffer into mip level zero
-        auto cmd = ctx->begin_transient();
-        transition_layout(cmd, image, 0, layer, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-        VkBufferImageCopy copy_region {};
-        copy_region.imageSubresource = layers;
-        copy_region.imageExtent = extent;
-        vkCmdCopyBufferToImage(cmd, ctx->staging_buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
-
-        // Generate mip levels using blits
-        VkOffset3D dims {narrow(extent.width), narrow(extent.height), narrow(extent.depth)};
-        for(uint32_t i=1; i<image_info.mipLevels; ++i)
-        {
-            VkImageBlit blit {};
-            blit.srcSubresource = layers;
-            blit.srcSubresource.mipLevel = i-1;
-            blit.srcOffsets[1] = dims;
-
-            dims.x = std::max(dims.x/2,1);
-            dims.y = std::max(dims.y/2,1);
-            dims.z = std::max(dims.z/2,1);
-            blit.dstSubresource = layers;
-            blit.dstSubresource.mipLevel = i;
-            blit.dstOffsets[1] = dims;
-
-            transition_layout(cmd, image, i-1, layer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-            transition_layout(cmd, image, i, layer, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-            vkCmdBlitImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
-            transition_layout(cmd, image, i-1, layer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        }
-        transition_layout(cmd, image, image_info.mipLevels-1, layer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-        ctx->end_transient(cmd);
-    }
 
     VkImageViewCreateInfo image_view_info {VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
     image_view_info.image = image;
@@ -526,12 +557,96 @@ texture::texture(std::shared_ptr<context> ctx, VkFormat format, VkExtent3D exten
     image_view_info.format = format;
     image_view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     image_view_info.subresourceRange.baseMipLevel = 0;
-    image_view_info.subresourceRange.levelCount = image_info.mipLevels;
+    image_view_info.subresourceRange.levelCount = mip_levels;
     image_view_info.subresourceRange.baseArrayLayer = 0;
-    image_view_info.subresourceRange.layerCount = layer_data.size;
+    image_view_info.subresourceRange.layerCount = layer_count;
     check(vkCreateImageView(ctx->device, &image_view_info, nullptr, &image_view));
 }
 
+void texture::upload_layer(VkCommandBuffer cmd, VkBuffer source, VkExtent3D extent, uint32_t layer)
+{
+    VkImageSubresourceLayers layers {};
+    layers.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    layers.baseArrayLayer = layer;
+    layers.layerCount = 1;
+
+    // Copy image contents from staging buffer into mip level zero
+    transition_layout(cmd, image, 0, layer, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    VkBufferImageCopy copy_region {};
+    copy_region.imageSubresource = layers;
+    copy_region.imageExtent = extent;
+    vkCmdCopyBufferToImage(cmd, source, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
+
+    // Generate mip levels using blits
+    VkOffset3D dims {narrow(extent.width), narrow(extent.height), narrow(extent.depth)};
+    for(uint32_t i=1; i<mip_levels; ++i)
+    {
+        VkImageBlit blit {};
+        blit.srcSubresource = layers;
+        blit.srcSubresource.mipLevel = i-1;
+        blit.srcOffsets[1] = dims;
+
+        dims.x = std::max(dims.x/2,1);
+        dims.y = std::max(dims.y/2,1);
+        dims.z = std::max(dims.z/2,1);
+        blit.dstSubresource = layers;
+        blit.dstSubresource.mipLevel = i;
+        blit.dstOffsets[1] = dims;
+
+        transition_layout(cmd, image, i-1, layer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+        transition_layout(cmd, image, i, layer, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        vkCmdBlitImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+        transition_layout(cmd, image, i-1, layer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+    transition_layout(cmd, image, mip_levels-1, layer, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+}
+
+texture::texture(std::shared_ptr<context> ctx, VkFormat format, VkExtent3D extent, array_view<const void *> layer_data, VkImageViewType view_type) : texture{ctx, format, extent, get_full_mip_count(extent), narrow(layer_data.size), view_type}
+{
+    for(size_t layer=0; layer<layer_data.size; ++layer) 
+    {
+        // Write initial data for this layer into the shared staging area
+        memcpy(ctx->mapped_staging_memory, layer_data[layer], compute_image_size({narrow(extent.width), narrow(extent.height)}, format));
+
+        auto cmd = ctx->begin_transient();
+        upload_layer(cmd, ctx->staging_buffer, extent, narrow(layer));
+        ctx->end_transient(cmd);
+    }
+}
+
+texture::texture(std::shared_ptr<context> ctx, VkFormat format, VkExtent3D extent, array_view<const staging_buffer *> layer_data, VkImageViewType view_type) : texture{ctx, format, extent, get_full_mip_count(extent), narrow(layer_data.size), view_type}
+{
+    // Every layer already resides in its own staging buffer, so all of them can be uploaded in a single submission
+    const size_t layer_size = compute_image_size({narrow(extent.width), narrow(extent.height)}, format);
+    for(auto * layer : layer_data) if(layer->get_size() < layer_size) throw std::logic_error("staging buffer too small for texture layer");
+    auto cmd = ctx->begin_transient();
+    for(size_t layer=0; layer<layer_data.size; ++layer) upload_layer(cmd, *layer_data[layer], extent, narrow(layer));
+    ctx->end_transient(cmd);
+}
+
+texture::texture(std::shared_ptr<context> ctx, const texture_layout & layout, const staging_buffer & contents, VkImageViewType view_type) : 
+    texture{ctx, layout.format, VkExtent3D{narrow(layout.levels[0].dims.x), narrow(layout.levels[0].dims.y), 1}, narrow(layout.levels.size()), layout.layer_count, view_type}
+{
+    if(contents.get_size() < layout.get_size()) throw std::logic_error("staging buffer too small for texture");
+
+    // Every level of every layer was built ahead of time, so the whole texture can be uploaded with a single copy
+    std::vector<VkBufferImageCopy> regions;
+    for(uint32_t i=0; i<mip_levels; ++i)
+    {
+        VkBufferImageCopy region {};
+        region.bufferOffset = layout.levels[i].offset;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, i, 0, layout.layer_count};
+        region.imageExtent = {narrow(layout.levels[i].dims.x), narrow(layout.levels[i].dims.y), 1};
+        regions.push_back(region);
+    }
+    const VkImageSubresourceRange range {VK_IMAGE_ASPECT_COLOR_BIT, 0, mip_levels, 0, layout.layer_count};
+    auto cmd = ctx->begin_transient();
+    transition_layout(cmd, image, range, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    vkCmdCopyBufferToImage(cmd, contents, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, narrow(regions.size()), regions.data());
+    transition_layout(cmd, image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    ctx->end_transient(cmd);
+}
+
 texture::~texture()
 {
     vkDestroyImageView(ctx->device, image_view, nullptr);
@@ -711,6 +826,11 @@ VkDescriptorSet transient_resource_pool::allocate_descriptor_set(VkDescriptorSet
 ////////////////////////////
 
 void transition_layout(VkCommandBuffer command_buffer, VkImage image, uint32_t mip_level, uint32_t array_layer, VkImageLayout old_layout, VkImageLayout new_layout)
+{
+    transition_layout(command_buffer, image, {VK_IMAGE_ASPECT_COLOR_BIT, mip_level, 1, array_layer, 1}, old_layout, new_layout);
+}
+
+void transition_layout(VkCommandBuffer command_buffer, VkImage image, const VkImageSubresourceRange & range, VkImageLayout old_layout, VkImageLayout new_layout)
 {
     VkPipelineStageFlags src_stage_mask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
     VkPipelineStageFlags dst_stage_mask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
@@ -720,11 +840,7 @@ void transition_layout(VkCommandBuffer command_buffer, VkImage image, uint32_t m
     barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.image = image;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = mip_level;
-    barrier.subresourceRange.levelCount = 1;
-    barrier.subresourceRange.baseArrayLayer = array_layer;
-    barrier.subresourceRange.layerCount = 1;
+    barrier.subresourceRange = range;
     switch(old_layout)
     {
     case VK_IMAGE_LAYOUT_UNDEFINED: break; // No need to wait for anything, contents can be discarded
@@ -748,7 +864,7 @@ void transition_layout(VkCommandBuffer command_buffer, VkImage image, uint32_t m
 }
 
 
-VkPipeline make_pipeline(VkDevice device, const render_pass & render_pass, VkPipelineLayout layout, VkPipelineVertexInputStateCreateInfo vertex_input_state, array_view<VkPipelineShaderStageCreateInfo> stages, bool depth_write, bool depth_test, VkBlendFactor src_factor, VkBlendFactor dst_factor)
+VkPipeline make_pipeline(VkDevice device, VkPipelineCache cache, const render_pass & render_pass, VkPipelineLayout layout, VkPipelineVertexInputStateCreateInfo vertex_input_state, array_view<VkPipelineShaderStageCreateInfo> stages, bool depth_write, bool depth_test, VkBlendFactor src_factor, VkBlendFactor dst_factor)
 {
     VkPipelineInputAssemblyStateCreateInfo inputAssembly {VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO};
     inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
@@ -833,7 +949,7 @@ VkPipeline make_pipeline(VkDevice device, const render_pass & render_pass, VkPip
     pipelineInfo.basePipelineIndex = -1; // Optional
 
     VkPipeline pipeline;
-    check(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline));
+    check(vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &pipeline));
     return pipeline;
 }
 
@@ -907,17 +1023,27 @@ VkPipelineVertexInputStateCreateInfo vertex_format::get_vertex_input_state() con
 // shader //
 ////////////
 
-shader::shader(std::shared_ptr<context> ctx, array_view<uint32_t> words) : ctx{ctx}, info{load_shader_info_from_spirv(words)}
+shader_module::shader_module(std::shared_ptr<context> ctx, array_view<uint32_t> words) : ctx{ctx}
 {
     VkShaderModuleCreateInfo create_info {VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
     create_info.codeSize = words.size * sizeof(uint32_t);
     create_info.pCode = words.data;
-    check(vkCreateShaderModule(ctx->device, &create_info, nullptr, &module));
+    check(vkCreateShaderModule(ctx->device, &create_info, nullptr, &handle));
+}
+
+shader_module::~shader_module()
+{
+    vkDestroyShaderModule(ctx->device, handle, nullptr);
 }
 
-shader::~shader()
+shader::shader(std::shared_ptr<const shader_module> module, shader_info info) : module{std::move(module)}, info{std::move(info)} {}
+
+shader::shader(std::shared_ptr<context> ctx, array_view<uint32_t> words) : shader{std::make_shared<shader_module>(ctx, words), load_shader_info_from_spirv(words)} {}
+
+std::shared_ptr<shader> shader_permutations::get(array_view<std::string> keywords) const
 {
-    vkDestroyShaderModule(ctx->device, module, nullptr);
+    if(auto index = set.find(keywords)) return shaders[*index];
+    throw std::logic_error("shader permutation was not compiled: " + get_shader_permutation_key(keywords));
 }
 
 /////////////
@@ -1027,17 +1153,64 @@ VkDescriptorSetLayoutBinding get_descriptor_set_layout_binding(uint32_t binding,
     return {binding, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, stage_flags};
 }
 
-scene_material::scene_material(std::shared_ptr<context> ctx, std::shared_ptr<scene_contract> contract, std::shared_ptr<vertex_format> format, array_view<std::shared_ptr<shader>> stages, bool depth_write, bool depth_test, VkBlendFactor src_factor, VkBlendFactor dst_factor) : 
+// Specialization data is laid out as one 64-bit slot per constant, of which the leading four bytes are used by 32-bit types
+struct stage_specialization
+{
+    std::vector<VkSpecializationMapEntry> entries;
+    std::vector<uint64_t> data;
+    VkSpecializationInfo info; // Refers to entries and data, and is filled in once the specialization has reached its final location
+};
+
+static stage_specialization get_stage_specialization(const shader & s, array_view<specialization_value> values, std::vector<bool> & values_used)
+{
+    stage_specialization spec {};
+    for(auto & c : s.get_specialization_constants())
+    {
+        auto it = std::find_if(values.begin(), values.end(), [&c](const specialization_value & v) { return v.name == c.name; });
+        if(it == values.end()) continue;
+        values_used[it - values.begin()] = true;
+
+        uint64_t bits = 0;
+        switch(c.type)
+        {
+        case shader_info::bool_: bits = it->value != 0 ? VK_TRUE : VK_FALSE; break;
+        case shader_info::uint_: bits = static_cast<uint32_t>(it->value); break;
+        case shader_info::int_: { const auto v = static_cast<int32_t>(it->value); memcpy(&bits, &v, sizeof(v)); break; }
+        case shader_info::float_: { const auto v = static_cast<float>(it->value); memcpy(&bits, &v, sizeof(v)); break; }
+        case shader_info::double_: memcpy(&bits, &it->value, sizeof(it->value)); break;
+        default: throw std::logic_error("unsupported specialization constant type");
+        }
+        spec.entries.push_back({c.id, narrow(spec.data.size() * sizeof(uint64_t)), c.type == shader_info::double_ ? sizeof(double) : sizeof(uint32_t)});
+        spec.data.push_back(bits);
+    }
+    return spec;
+}
+
+scene_material::scene_material(std::shared_ptr<context> ctx, std::shared_ptr<scene_contract> contract, std::shared_ptr<vertex_format> format, array_view<std::shared_ptr<shader>> stages, bool depth_write, bool depth_test, VkBlendFactor src_factor, VkBlendFactor dst_factor, array_view<specialization_value> specialization) : 
     ctx{ctx}, contract{contract}
 {
+    // Resolve specialization values against the constants declared by each stage
+    std::vector<stage_specialization> specializations;
+    std::vector<bool> values_used(specialization.size);
+    for(auto & s : stages) specializations.push_back(get_stage_specialization(*s, specialization, values_used));
+    for(size_t i=0; i<specialization.size; ++i) if(!values_used[i]) throw std::runtime_error("no stage declares specialization constant " + specialization[narrow(i)].name);
+
     // Determine the full set of per object descriptors across all stages
     std::vector<VkDescriptorSetLayoutBinding> per_object_bindings;
     std::vector<VkPipelineShaderStageCreateInfo> shader_stages, shader_stages_no_frag;
     const uint32_t per_object_descriptor_set_index = narrow(contract->get_shared_layouts().size());
-    for(auto & s : stages) 
+    for(size_t i=0; i<stages.size; ++i)
     {
-        shader_stages.push_back(s->get_shader_stage());
-        if(s->get_shader_stage().stage != VK_SHADER_STAGE_FRAGMENT_BIT) shader_stages_no_frag.push_back(s->get_shader_stage());
+        auto & s = stages[narrow(i)];
+        auto stage = s->get_shader_stage();
+        auto & spec = specializations[i];
+        if(!spec.entries.empty())
+        {
+            spec.info = {narrow(spec.entries.size()), spec.entries.data(), spec.data.size() * sizeof(uint64_t), spec.data.data()};
+            stage.pSpecializationInfo = &spec.info;
+        }
+        shader_stages.push_back(stage);
+        if(stage.stage != VK_SHADER_STAGE_FRAGMENT_BIT) shader_stages_no_frag.push_back(stage);
         for(auto & descriptor : s->get_descriptors())
         {
             if(descriptor.set != per_object_descriptor_set_index) continue;
@@ -1063,7 +1236,7 @@ scene_material::scene_material(std::shared_ptr<context> ctx, std::shared_ptr<sce
     pipeline_layout = ctx->create_pipeline_layout(set_layouts);
     for(auto & p : contract->render_passes)
     {
-        pipelines.push_back(make_pipeline(ctx->device, *p, pipeline_layout, format->get_vertex_input_state(), p->has_color_attachments() ? shader_stages : shader_stages_no_frag, depth_write, depth_test, src_factor, dst_factor));
+        pipelines.push_back(make_pipeline(ctx->device, ctx->pipeline_cache, *p, pipeline_layout, format->get_vertex_input_state(), p->has_color_attachments() ? shader_stages : shader_stages_no_frag, depth_write, depth_test, src_factor, dst_factor));
     }
 }
     
@@ -1091,6 +1264,27 @@ void scene_descriptor_set::write_combined_image_sampler(uint32_t binding, uint32
     vkWriteDescriptorCombinedImageSamplerInfo(device, set, binding, array_element, {sampler.get_vk_handle(), image_view, image_layout});
 }
 
+//////////////
+// gfx_mesh //
+//////////////
+
+const std::vector<mesh::material> & gfx_mesh::select_lod(const float4x4 & view_proj_matrix, const float4x4 & model_matrix, float max_screen_error) const
+{
+    // Find the distance to the nearest point of the bounds along the view direction, and how far the projection scales a distance at unit depth
+    const float scale = length(model_matrix[0].xyz()), depth = dot(view_proj_matrix.row(3), float4{transform_point(model_matrix, bounds.center), 1}) - bounds.radius*scale;
+    if(depth <= 0) return m.materials;
+    const float screen_scale = scale * length(view_proj_matrix.row(1).xyz()) / (2*depth);
+
+    // Errors only grow with each level, so pick the last level which is still accurate enough
+    const std::vector<mesh::material> * materials = &m.materials;
+    for(auto & lod : lods)
+    {
+        if(lod.error * screen_scale > max_screen_error) break;
+        materials = &lod.materials;
+    }
+    return *materials;
+}
+
 ///////////////
 // draw_list //
 ///////////////
@@ -1152,6 +1346,66 @@ void draw_list::draw(const scene_descriptor_set & descriptors, const gfx_mesh &
     draw(descriptors, mesh, {}, 0);
 }
 
+void draw_list::draw(const scene_descriptor_set & descriptors, const gfx_mesh & mesh, std::vector<size_t> mtls, const float4x4 & view_proj_matrix, const float4x4 & model_matrix, const float3 & eye_position, float max_screen_error)
+{
+    if(&descriptors.get_material().get_contract() != &contract) fail_fast();
+    if(&mesh.select_lod(view_proj_matrix, model_matrix, max_screen_error) != &mesh.m.materials) return draw(descriptors, mesh, mtls, view_proj_matrix, model_matrix, max_screen_error);
+    if(mesh.meshlets.empty()) return draw(descriptors, mesh, mtls);
+
+    draw_item item {&descriptors.get_material(), descriptors.get_descriptor_set()};
+    item.vertex_buffer_count = 1;
+    item.vertex_buffers[0] = *mesh.vertex_buffer;
+    item.vertex_buffer_offsets[0] = 0;
+    item.index_buffer = *mesh.index_buffer;
+    item.index_buffer_offset = 0;
+    item.index_count = 0;
+    item.instance_count = 1;
+
+    const float4x4 model_view_proj_matrix = view_proj_matrix * model_matrix;
+    const float3 model_eye_position = transform_point(inverse(model_matrix), eye_position);
+    for(auto & ml : mesh.meshlets)
+    {
+        if(std::find(mtls.begin(), mtls.end(), ml.material) == mtls.end() || is_meshlet_culled(ml, model_view_proj_matrix, model_eye_position)) continue;
+        const uint32_t first_index = narrow(ml.first_triangle*3), index_count = narrow(ml.num_triangles*3);
+        if(item.index_count && item.first_index + item.index_count == first_index) item.index_count += index_count;
+        else
+        {
+            if(item.index_count) items.push_back(item);
+            item.first_index = first_index;
+            item.index_count = index_count;
+        }
+    }
+    if(item.index_count) items.push_back(item);
+}
+
+void draw_list::draw(const scene_descriptor_set & descriptors, const gfx_mesh & mesh, std::vector<size_t> mtls, const float4x4 & view_proj_matrix, const float4x4 & model_matrix, float max_screen_error)
+{
+    if(&descriptors.get_material().get_contract() != &contract) fail_fast();
+
+    draw_item item {&descriptors.get_material(), descriptors.get_descriptor_set()};
+    item.vertex_buffer_count = 1;
+    item.vertex_buffers[0] = *mesh.vertex_buffer;
+    item.vertex_buffer_offsets[0] = 0;
+    item.index_buffer = *mesh.index_buffer;
+    item.index_buffer_offset = 0;
+    item.instance_count = 1;
+    auto & materials = mesh.select_lod(view_proj_matrix, model_matrix, max_screen_error);
+    for(auto mtl : mtls)
+    {
+        if(!materials[mtl].num_triangles) continue;
+        item.first_index = narrow(materials[mtl].first_triangle*3);
+        item.index_count = narrow(materials[mtl].num_triangles*3);
+        items.push_back(item);
+    }
+}
+
+void draw_list::draw(const scene_descriptor_set & descriptors, const gfx_mesh & mesh, const float4x4 & view_proj_matrix, const float4x4 & model_matrix, float max_screen_error)
+{
+    std::vector<size_t> mtls;
+    for(size_t i=0; i<mesh.m.materials.size(); ++i) mtls.push_back(i);
+    draw(descriptors, mesh, mtls, view_proj_matrix, model_matrix, max_screen_error);
+}
+
 void draw_list::write_commands(VkCommandBuffer cmd, const render_pass & render_pass, array_view<scene_descriptor_set> shared_descriptors) const
 {
     // Validate and bind shared descriptor sets
@@ -1184,11 +1438,17 @@ void draw_list::write_commands(VkCommandBuffer cmd, const render_pass & render_p
 // renderer //
 //////////////
 
-renderer::renderer(std::function<void(const char *)> debug_callback) : ctx{std::make_shared<context>(debug_callback)} 
+renderer::renderer(std::function<void(const char *)> debug_callback, const char * shader_cache_directory, bool remap_spirv, const char * pipeline_cache_filename) : 
+    ctx{std::make_shared<context>(debug_callback, pipeline_cache_filename)}, compiler{shader_cache_directory, remap_spirv}
 {
 
 }
 
+bool renderer::save_pipeline_cache()
+{
+    return ctx->save_pipeline_cache();
+}
+
 void renderer::wait_until_device_idle()
 {
     vkDeviceWaitIdle(ctx->device);
@@ -1216,6 +1476,62 @@ std::shared_ptr<texture> renderer::create_texture_cube(const image & posx, const
     return std::make_shared<texture>(ctx, format, VkExtent3D{side_length,side_length,1}, array_view<const void *>{posx.get_pixels(), negx.get_pixels(), posy.get_pixels(), negy.get_pixels(), posz.get_pixels(), negz.get_pixels()}, VK_IMAGE_VIEW_TYPE_CUBE);
 }
 
+staged_image renderer::load_staged_image(const char * filename, bool is_linear)
+{
+    staged_image im {};
+    load_image(filename, is_linear, [&](int2 dims, VkFormat format, size_t capacity)
+    {
+        im = {dims, format, std::make_shared<staging_buffer>(ctx, capacity)};
+        return im.pixels->get_mapped_memory();
+    });
+    return im;
+}
+
+std::shared_ptr<texture> renderer::create_texture_2d(const staged_image & contents)
+{
+    return std::make_shared<texture>(ctx, contents.format, VkExtent3D{narrow(contents.dims.x),narrow(contents.dims.y),1}, array_view<const staging_buffer *>{contents.pixels.get()}, VK_IMAGE_VIEW_TYPE_2D);
+}
+
+std::shared_ptr<texture> renderer::create_texture_cube(const staged_image & posx, const staged_image & negx, const staged_image & posy, const staged_image & negy, const staged_image & posz, const staged_image & negz)
+{
+    const VkFormat format = posx.format; const int side_length = posx.dims.x;
+    for(auto * face : {&posx, &negx, &posy, &negy, &posz, &negz}) if(face->format != format || face->dims != int2{side_length, side_length}) throw std::runtime_error("bad texture for cubemap");
+    return std::make_shared<texture>(ctx, format, VkExtent3D{narrow(side_length),narrow(side_length),1}, array_view<const staging_buffer *>{posx.pixels.get(), negx.pixels.get(), posy.pixels.get(), negy.pixels.get(), posz.pixels.get(), negz.pixels.get()}, VK_IMAGE_VIEW_TYPE_CUBE);
+}
+
+staged_texture renderer::load_staged_texture(const char * filename)
+{
+    staged_texture tex;
+    tex.layout = load_ktx(filename, [&](const texture_layout & layout, size_t size)
+    {
+        tex.contents = std::make_shared<staging_buffer>(ctx, size);
+        return tex.contents->get_mapped_memory();
+    });
+    return tex;
+}
+
+std::shared_ptr<texture> renderer::create_texture(const staged_texture & contents)
+{
+    const auto & layout = contents.layout;
+    if(layout.levels.empty() || !contents.contents) throw std::logic_error("empty texture");
+    if(layout.is_cube && layout.layer_count != 6) throw std::runtime_error("bad texture for cubemap");
+
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(ctx->selection.physical_device, layout.format, &props);
+    if(!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) throw std::runtime_error("texture format not supported by device");
+
+    const VkImageViewType view_type = layout.is_cube ? VK_IMAGE_VIEW_TYPE_CUBE : layout.layer_count > 1 ? VK_IMAGE_VIEW_TYPE_2D_ARRAY : VK_IMAGE_VIEW_TYPE_2D;
+    return std::make_shared<texture>(ctx, layout, *contents.contents, view_type);
+}
+
+std::shared_ptr<texture> renderer::create_texture(const cooked_texture & contents)
+{
+    if(contents.contents.size() < contents.layout.get_size()) throw std::logic_error("texture contents do not match layout");
+    staged_texture staged {contents.layout, std::make_shared<staging_buffer>(ctx, contents.layout.get_size())};
+    memcpy(staged.contents->get_mapped_memory(), contents.contents.data(), contents.layout.get_size());
+    return create_texture(staged);
+}
+
 std::shared_ptr<render_pass> renderer::create_render_pass(array_view<VkAttachmentDescription> color_attachments, std::optional<VkAttachmentDescription> depth_attachment, bool invert_faces)
 {
     return std::make_shared<render_pass>(ctx, color_attachments, depth_attachment, invert_faces);
@@ -1226,9 +1542,44 @@ std::shared_ptr<framebuffer> renderer::create_framebuffer(std::shared_ptr<const
     return std::make_shared<framebuffer>(ctx, pass, attachments, dims);
 }
 
+std::shared_ptr<const shader_module> renderer::get_shader_module(const std::vector<uint32_t> & words)
+{
+    auto & entry = shader_modules[words];
+    if(auto module = entry.lock()) return module;
+    auto module = std::make_shared<const shader_module>(ctx, words);
+    entry = module;
+
+    // Forget modules which have since been destroyed
+    for(auto it = shader_modules.begin(); it != shader_modules.end(); ) it = it->second.expired() ? shader_modules.erase(it) : std::next(it);
+    return module;
+}
+
 std::shared_ptr<shader> renderer::create_shader(VkShaderStageFlagBits stage, const char * filename)
 {
-    return std::make_shared<shader>(ctx, compiler.compile_glsl(stage, filename));
+    return create_shaders({{stage, filename, {}}})[0];
+}
+
+shader_permutations renderer::create_shader_permutations(VkShaderStageFlagBits stage, const char * filename, array_view<std::vector<std::string>> axes)
+{
+    shader_permutations permutations {compiler.compile_glsl_permutations(stage, filename, enumerate_shader_permutations(axes))};
+    std::vector<std::shared_ptr<const shader_module>> modules;
+    for(auto & m : permutations.set.modules) modules.push_back(get_shader_module(m));
+    for(size_t i=0; i<permutations.set.keys.size(); ++i) permutations.shaders.push_back(std::make_shared<shader>(modules[permutations.set.module_indices[i]], std::move(permutations.set.infos[i])));
+    permutations.set.modules.clear();
+    permutations.set.infos.clear();
+    return permutations;
+}
+
+std::vector<std::shared_ptr<shader>> renderer::create_shaders(array_view<shader_compile_request> requests)
+{
+    auto results = compiler.compile_glsl(requests);
+    std::string errors;
+    for(size_t i=0; i<results.size(); ++i) if(results[i].spirv.empty()) errors += std::string(requests[narrow(i)].filename) + ": " + results[i].diagnostics + "\n";
+    if(!errors.empty()) throw std::runtime_error(errors);
+
+    std::vector<std::shared_ptr<shader>> shaders;
+    for(auto & r : results) shaders.push_back(std::make_shared<shader>(get_shader_module(r.spirv), std::move(r.info)));
+    return shaders;
 }
 
 std::shared_ptr<vertex_format> renderer::create_vertex_format(array_view<VkVertexInputBindingDescription> bindings, array_view<VkVertexInputAttributeDescription> attributes)
@@ -1236,12 +1587,17 @@ std::shared_ptr<vertex_format> renderer::create_vertex_format(array_view<VkVerte
     return std::make_shared<vertex_format>(bindings, attributes);
 }
 
+std::shared_ptr<vertex_format> renderer::create_vertex_format(const vertex_packing & packing)
+{
+    return create_vertex_format({{0, get_packed_vertex_size(packing), VK_VERTEX_INPUT_RATE_VERTEX}}, get_packed_vertex_attributes(packing));
+}
+
 std::shared_ptr<scene_contract> renderer::create_contract(array_view<std::shared_ptr<const render_pass>> render_passes, array_view<array_view<VkDescriptorSetLayoutBinding>> shared_descriptor_sets)
 {
     return std::make_shared<scene_contract>(ctx, render_passes, shared_descriptor_sets);
 }
 
-std::shared_ptr<scene_material> renderer::create_material(std::shared_ptr<scene_contract> contract, std::shared_ptr<vertex_format> format, array_view<std::shared_ptr<shader>> stages, bool depth_write, bool depth_test, VkBlendFactor src_factor, VkBlendFactor dst_factor)
+std::shared_ptr<scene_material> renderer::create_material(std::shared_ptr<scene_contract> contract, std::shared_ptr<vertex_format> format, array_view<std::shared_ptr<shader>> stages, bool depth_write, bool depth_test, VkBlendFactor src_factor, VkBlendFactor dst_factor, array_view<specialization_value> specialization)
 {
-    return std::make_shared<scene_material>(ctx, contract, format, stages, depth_write, depth_test, src_factor, dst_factor);
+    return std::make_shared<scene_material>(ctx, contract, format, stages, depth_write, depth_test, src_factor, dst_factor, specialization);
 }
\ No newline at end of file
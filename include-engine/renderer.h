@@ -53,14 +53,52 @@ public:
 
 inline render_target make_depth_buffer(std::shared_ptr<context> ctx, uint2 dims) { return {ctx, dims, VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT}; }
 
+// A dedicated host visible buffer which the CPU can write into directly, and from which the GPU can copy into textures
+class staging_buffer
+{
+    std::shared_ptr<context> ctx;
+    VkBuffer buffer;
+    VkDeviceMemory device_memory;
+    void * mapped_memory;
+    VkDeviceSize size;
+public:
+    staging_buffer(std::shared_ptr<context> ctx, VkDeviceSize size);
+    ~staging_buffer();
+
+    VkDeviceSize get_size() const { return size; }
+    void * get_mapped_memory() const { return mapped_memory; }
+    operator VkBuffer () const { return buffer; }
+};
+
+// An image which has been decoded directly into a staging buffer, ready to be copied into a texture
+struct staged_image
+{
+    int2 dims;
+    VkFormat format;
+    std::shared_ptr<staging_buffer> pixels;
+};
+
+// A texture whose levels have been read directly into a staging buffer, ready to be copied into a texture
+struct staged_texture
+{
+    texture_layout layout;
+    std::shared_ptr<staging_buffer> contents;
+};
+
 class texture
 {
     std::shared_ptr<context> ctx;
     VkImage image;
     VkImageView image_view;
     VkDeviceMemory device_memory;
+    uint32_t mip_levels;
+
+    texture(std::shared_ptr<context> ctx, VkFormat format, VkExtent3D extent, uint32_t mip_levels, uint32_t layer_count, VkImageViewType view_type);
+    void upload_layer(VkCommandBuffer cmd, VkBuffer source, VkExtent3D extent, uint32_t layer);
 public:
     texture(std::shared_ptr<context> ctx, VkFormat format, VkExtent3D extent, array_view<const void *> layer_data, VkImageViewType view_type);
+    texture(std::shared_ptr<context> ctx, VkFormat format, VkExtent3D extent, array_view<const staging_buffer *> layer_data, VkImageViewType view_type);
+    texture(std::shared_ptr<context> ctx, const texture_layout & layout, const staging_buffer & contents, VkImageViewType view_type);
     ~texture();
 
     VkImage get_image() { return image; }
@@ -141,6 +179,7 @@ public:
 
 // Other utility functions
 void transition_layout(VkCommandBuffer command_buffer, VkImage image, uint32_t mip_level, uint32_t array_layer, VkImageLayout old_layout, VkImageLayout new_layout);
+void transition_layout(VkCommandBuffer command_buffer, VkImage image, const VkImageSubresourceRange & range, VkImageLayout old_layout, VkImageLayout new_layout);
 
 // Convenience wrappers around Vulkan calls
 void vkUpdateDescriptorSets(VkDevice device, array_view<VkWriteDescriptorSet> descriptorWrites, array_view<VkCopyDescriptorSet> descriptorCopies);
@@ -154,7 +193,8 @@ void vkCmdSetViewport(VkCommandBuffer commandBuffer, VkRect2D viewport);
 void vkCmdSetScissor(VkCommandBuffer commandBuffer, VkRect2D scissor);
 void vkCmdBeginRenderPass(VkCommandBuffer cmd, VkRenderPass renderPass, VkFramebuffer framebuffer, VkRect2D renderArea, array_view<VkClearValue> clearValues);
 
-#include "load.h"   // For shader_compiler
+#include "load.h"       // For shader_compiler
+#include "mesh-ops.h"   // For vertex_packing
 #include <map>
 
 class vertex_format
@@ -169,20 +209,28 @@ public:
     array_view<VkVertexInputAttributeDescription> get_attributes() const { return attributes; }
 };
 
+// Optional work done when constructing a gfx_mesh from a mesh. Meshlets are needed to cull with draw_list::draw(..., eye_position), and lod_count simplified
+// versions of the mesh are generated with generate_lods(...), for draw_list to choose between based on the projected size of the mesh.
+struct gfx_mesh_options { bool meshlets; size_t lod_count; };
+
 struct gfx_mesh
 {
+    mesh m;
+    std::vector<mesh_lod> lods;     // Simplified versions of m, whose triangles follow the full detail triangles in the index buffer
+    std::vector<meshlet> meshlets;  // Empty unless requested by gfx_mesh_options, in which case the full detail triangles of m are ordered by meshlet
+    bounding_sphere bounds;
     std::unique_ptr<static_buffer> vertex_buffer;
     std::unique_ptr<static_buffer> index_buffer;
     uint32_t index_count;
-    mesh m;
 
     gfx_mesh(std::unique_ptr<static_buffer> vertex_buffer, std::unique_ptr<static_buffer> index_buffer, uint32_t index_count)
-        : vertex_buffer{move(vertex_buffer)}, index_buffer{move(index_buffer)}, index_count{index_count}
+        : bounds{}, vertex_buffer{move(vertex_buffer)}, index_buffer{move(index_buffer)}, index_count{index_count}
     {
         m.materials.push_back({"", 0, index_count/3});
     }
 
     template<class V> gfx_mesh(std::shared_ptr<context> ctx, const std::vector<V> & vertices, const std::vector<uint3> & triangles) :
+        bounds{},
         vertex_buffer{std::make_unique<static_buffer>(ctx, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertices.size() * sizeof(V), vertices.data())},
         index_buffer{std::make_unique<static_buffer>(ctx, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, triangles.size() * sizeof(uint3), triangles.data())},
         index_count{narrow(triangles.size() * 3)}
@@ -190,26 +238,70 @@ struct gfx_mesh
         m.materials.push_back({"", 0, triangles.size()});
     }
 
-    gfx_mesh(std::shared_ptr<context> ctx, const mesh & m) :
-        vertex_buffer{std::make_unique<static_buffer>(ctx, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m.vertices.size() * sizeof(mesh::vertex), m.vertices.data())},
-        index_buffer{std::make_unique<static_buffer>(ctx, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m.triangles.size() * sizeof(uint3), m.triangles.data())},
-        index_count{static_cast<uint32_t>(m.triangles.size() * 3)}, m{m}
+    gfx_mesh(std::shared_ptr<context> ctx, const mesh & source, const gfx_mesh_options & options = {}) : m{source}, bounds{get_bounding_sphere(source)}
+    {
+        prepare(options);
+        vertex_buffer = std::make_unique<static_buffer>(ctx, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m.vertices.size() * sizeof(mesh::vertex), m.vertices.data());
+        index_buffer = std::make_unique<static_buffer>(ctx, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m.triangles.size() * sizeof(uint3), m.triangles.data());
+    }
+
+    // Uploads the vertices of source in the given packed layout, which must match the vertex_format of any material used to draw this mesh
+    gfx_mesh(std::shared_ptr<context> ctx, const mesh & source, const vertex_packing & packing, const gfx_mesh_options & options = {}) : m{source}, bounds{get_bounding_sphere(source)}
     {
-        
+        prepare(options);
+        vertex_buffer = std::make_unique<static_buffer>(ctx, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m.vertices.size() * get_packed_vertex_size(packing), pack_vertices(m.vertices, packing).data());
+        index_buffer = std::make_unique<static_buffer>(ctx, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m.triangles.size() * sizeof(uint3), m.triangles.data());
     }
+
+    // Builds meshlets before generating levels of detail, as build_meshlets(...) reorders every triangle of m while the levels are appended after the
+    // full detail triangles, which are the only ones counted by index_count
+    void prepare(const gfx_mesh_options & options)
+    {
+        if(options.meshlets) meshlets = build_meshlets(m);
+        index_count = narrow(m.triangles.size() * 3);
+        lods = generate_lods(m, options.lod_count);
+    }
+
+    // Returns the materials of the coarsest version of this mesh whose error, as a fraction of the height of the viewport, is at most max_screen_error when
+    // drawn with the given matrices. Returns the materials of m if there are no simplified versions or the bounds reach behind the eye.
+    const std::vector<mesh::material> & select_lod(const float4x4 & view_proj_matrix, const float4x4 & model_matrix, float max_screen_error) const;
 };
 
-class shader
+// A VkShaderModule may be shared by any number of shaders whose SPIR-V is identical
+class shader_module
 {
     std::shared_ptr<context> ctx;
-    VkShaderModule module;
+    VkShaderModule handle;
+public:
+    shader_module(std::shared_ptr<context> ctx, array_view<uint32_t> words);
+    ~shader_module();
+
+    VkShaderModule get_vk_handle() const { return handle; }
+};
+
+class shader
+{
+    std::shared_ptr<const shader_module> module;
     shader_info info;
 public:
+    shader(std::shared_ptr<const shader_module> module, shader_info info);
     shader(std::shared_ptr<context> ctx, array_view<uint32_t> words);
-    ~shader();
 
-    VkPipelineShaderStageCreateInfo get_shader_stage() const { return {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0, info.stage, module, info.name.c_str()}; }
+    VkPipelineShaderStageCreateInfo get_shader_stage() const { return {VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0, info.stage, module->get_vk_handle(), info.name.c_str()}; }
     const std::vector<shader_info::descriptor> & get_descriptors() const { return info.descriptors; }
+    const std::vector<shader_info::specialization_constant> & get_specialization_constants() const { return info.specialization_constants; }
+};
+
+// Overrides the value of a specialization constant, identified by the name it is declared with in GLSL. The value is converted to the declared type of the constant.
+struct specialization_value { std::string name; double value; };
+
+// Permutations of a single shader, identified by the keywords they define. Permutations which compile to identical SPIR-V share a shader module.
+struct shader_permutations
+{
+    shader_permutation_set set; // SPIR-V modules and reflection are released once shaders have been created from them
+    std::vector<std::shared_ptr<shader>> shaders; // One for each permutation in set.keys
+
+    std::shared_ptr<shader> get(array_view<std::string> keywords) const;
 };
 
 class sampler
@@ -287,7 +379,7 @@ class scene_material
     VkPipelineLayout pipeline_layout;
     std::vector<VkPipeline> pipelines;
 public:
-    scene_material(std::shared_ptr<context> ctx, std::shared_ptr<scene_contract> contract, std::shared_ptr<vertex_format> format, array_view<std::shared_ptr<shader>> stages, bool depth_write, bool depth_test, VkBlendFactor src_factor, VkBlendFactor dst_factor);
+    scene_material(std::shared_ptr<context> ctx, std::shared_ptr<scene_contract> contract, std::shared_ptr<vertex_format> format, array_view<std::shared_ptr<shader>> stages, bool depth_write, bool depth_test, VkBlendFactor src_factor, VkBlendFactor dst_factor, array_view<specialization_value> specialization);
     ~scene_material();
 
     const scene_contract & get_contract() const { return *contract; }
@@ -302,23 +394,50 @@ public:
     std::shared_ptr<context> ctx;
 private:
     shader_compiler compiler;
+    std::map<std::vector<uint32_t>, std::weak_ptr<const shader_module>> shader_modules; // Keyed by SPIR-V, so that identical shaders share a module
+
+    std::shared_ptr<const shader_module> get_shader_module(const std::vector<uint32_t> & words);
 public:
-    renderer(std::function<void(const char *)> debug_callback);
+    // If shader_cache_directory is given, compiled shaders are cached there and reused on later runs. If remap_spirv is set, shaders are stripped
+    // of debug information and have their ids canonicalized, see shader_compiler in load.h. If pipeline_cache_filename is given, the pipeline cache
+    // used by every material is loaded from that file, provided it was written by the same device and driver, and saved back to it on shutdown.
+    renderer(std::function<void(const char *)> debug_callback, const char * shader_cache_directory = nullptr, bool remap_spirv = false, const char * pipeline_cache_filename = nullptr);
 
     void wait_until_device_idle();
+    // Writes the pipeline cache to disk ahead of shutdown. Returns false if no cache file was given, or if it could not be written.
+    bool save_pipeline_cache();
     VkFormat get_swapchain_surface_format() const;
 
     std::shared_ptr<texture> create_texture_2d(uint32_t width, uint32_t height, VkFormat format, const void * initial_data);
     std::shared_ptr<texture> create_texture_2d(const image & contents) { return create_texture_2d(contents.get_width(), contents.get_height(), contents.get_format(), contents.get_pixels()); }
     std::shared_ptr<texture> create_texture_cube(const image & posx, const image & negx, const image & posy, const image & negy, const image & posz, const image & negz);
 
+    // Images decoded directly into staging memory avoid an extra copy of their pixels. load_staged_image(...) may be called from any thread.
+    staged_image load_staged_image(const char * filename, bool is_linear);
+    std::shared_ptr<texture> create_texture_2d(const staged_image & contents);
+    std::shared_ptr<texture> create_texture_cube(const staged_image & posx, const staged_image & negx, const staged_image & posy, const staged_image & negy, const staged_image & posz, const staged_image & negz);
+
+    // Cooked textures supply every mip level up front, and are uploaded with a single copy. load_staged_texture(...) may be called from any thread.
+    staged_texture load_staged_texture(const char * filename);
+    std::shared_ptr<texture> create_texture(const staged_texture & contents);
+    std::shared_ptr<texture> create_texture(const cooked_texture & contents);
+
     std::shared_ptr<render_pass> create_render_pass(array_view<VkAttachmentDescription> color_attachments, std::optional<VkAttachmentDescription> depth_attachment, bool invert_faces=false);
     std::shared_ptr<framebuffer> create_framebuffer(std::shared_ptr<const render_pass> render_pass, array_view<VkImageView> attachments, uint2 dims);
 
     std::shared_ptr<shader> create_shader(VkShaderStageFlagBits stage, const char * filename);
+    // Compiles all shaders concurrently. If any fail to compile, the diagnostics of every failure are thrown together.
+    std::vector<std::shared_ptr<shader>> create_shaders(array_view<shader_compile_request> requests);
+    // Compiles every combination of keywords from the given axes concurrently, see enumerate_shader_permutations(...) in load.h
+    shader_permutations create_shader_permutations(VkShaderStageFlagBits stage, const char * filename, array_view<std::vector<std::string>> axes);
+    shader_cache_stats get_shader_cache_stats() const { return compiler.get_cache_stats(); }
+    // The compiler used by create_shader(...) and friends, which may be shared with other threads, such as those of an asset_loader
+    shader_compiler & get_shader_compiler() { return compiler; }
     std::shared_ptr<vertex_format> create_vertex_format(array_view<VkVertexInputBindingDescription> bindings, array_view<VkVertexInputAttributeDescription> attributes);
+    std::shared_ptr<vertex_format> create_vertex_format(const vertex_packing & packing);
     std::shared_ptr<scene_contract> create_contract(array_view<std::shared_ptr<const render_pass>> render_passes, array_view<array_view<VkDescriptorSetLayoutBinding>> shared_descriptor_sets);
-    std::shared_ptr<scene_material> create_material(std::shared_ptr<scene_contract> contract, std::shared_ptr<vertex_format> format, array_view<std::shared_ptr<shader>> stages, bool depth_write, bool depth_test, VkBlendFactor src_factor, VkBlendFactor dst_factor);
+    // Specialization values apply to every stage which declares a constant of the same name. Constants which are not given a value keep their default.
+    std::shared_ptr<scene_material> create_material(std::shared_ptr<scene_contract> contract, std::shared_ptr<vertex_format> format, array_view<std::shared_ptr<shader>> stages, bool depth_write, bool depth_test, VkBlendFactor src_factor, VkBlendFactor dst_factor, array_view<specialization_value> specialization = {});
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -391,6 +510,13 @@ struct draw_list
     void draw(const scene_descriptor_set & descriptors, const gfx_mesh & mesh, VkDescriptorBufferInfo instances, size_t instance_stride);
     void draw(const scene_descriptor_set & descriptors, const gfx_mesh & mesh, std::vector<size_t> mtls);
     void draw(const scene_descriptor_set & descriptors, const gfx_mesh & mesh);
+    // Draws only the meshlets of the given materials which are not culled by is_meshlet_culled(...), merging adjacent ones into a single draw. Assumes that
+    // back faces are culled, and that model_matrix scales uniformly if at all.
+    // Level of detail is chosen with gfx_mesh::select_lod(...). Meshlets are only culled when drawing at full detail.
+    void draw(const scene_descriptor_set & descriptors, const gfx_mesh & mesh, std::vector<size_t> mtls, const float4x4 & view_proj_matrix, const float4x4 & model_matrix, const float3 & eye_position, float max_screen_error = 1.0f/1024);
+    // Draws the given materials at the level of detail chosen by gfx_mesh::select_lod(...), without culling, so that the same list may be drawn from other views
+    void draw(const scene_descriptor_set & descriptors, const gfx_mesh & mesh, std::vector<size_t> mtls, const float4x4 & view_proj_matrix, const float4x4 & model_matrix, float max_screen_error = 1.0f/1024);
+    void draw(const scene_descriptor_set & descriptors, const gfx_mesh & mesh, const float4x4 & view_proj_matrix, const float4x4 & model_matrix, float max_screen_error = 1.0f/1024);
     void write_commands(VkCommandBuffer cmd, const render_pass & render_pass, array_view<scene_descriptor_set> shared_descriptors) const;
 };
 
@@ -0,0 +1,556 @@
+#include "texture-cooker.h"
+#include "package.h"
+#include "load.h"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+
+static bool is_rgba8(VkFormat format) { return format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB; }
+
+///////////////////
+// generate_mips //
+///////////////////
+
+std::vector<image> generate_mips(const image & base, downsample_filter filter)
+{
+    std::vector<image> mips;
+    for(const image * level = &base; level->get_width() > 1 || level->get_height() > 1; level = &mips.back()) mips.push_back(downsample_image(*level, filter));
+    return mips;
+}
+
+////////////////////
+// compress_image //
+////////////////////
+
+namespace bc
+{
+    // Sums of squared differences between pixels, taken over the first n channels
+    template<int N> float distance2(const float (& a)[4], const float (& b)[4]) { float d=0; for(int c=0; c<N; ++c) d += (a[c]-b[c])*(a[c]-b[c]); return d; }
+
+    // Returns the direction along which the given points vary the most, found by power iteration on their covariance matrix, or zero if they do not vary
+    template<int N> void principal_axis(const float (* points)[4], int count, const float (& mean)[4], float (& axis)[4])
+    {
+        float cov[4][4] {};
+        for(int i=0; i<count; ++i) for(int j=0; j<N; ++j) for(int k=0; k<N; ++k) cov[j][k] += (points[i][j]-mean[j]) * (points[i][k]-mean[k]);
+
+        int start = 0;
+        for(int j=1; j<N; ++j) if(cov[j][j] > cov[start][start]) start = j;
+        std::fill_n(axis, 4, 0.0f);
+        if(cov[start][start] < 1e-4f) return;
+        for(int j=0; j<N; ++j) axis[j] = cov[start][j];
+        for(int iteration=0; iteration<8; ++iteration)
+        {
+            float next[4] {}, length2 = 0;
+            for(int j=0; j<N; ++j) { for(int k=0; k<N; ++k) next[j] += cov[j][k]*axis[k]; length2 += next[j]*next[j]; }
+            if(length2 < 1e-12f) return;
+            for(int j=0; j<N; ++j) axis[j] = next[j] / std::sqrt(length2);
+        }
+    }
+
+    // Produces endpoints at the extremes of the projection of the points onto their principal axis
+    template<int N> void fit_endpoints(const float (* points)[4], int count, float (& e0)[4], float (& e1)[4])
+    {
+        float mean[4] {}, axis[4];
+        for(int i=0; i<count; ++i) for(int c=0; c<N; ++c) mean[c] += points[i][c] / count;
+        principal_axis<N>(points, count, mean, axis);
+
+        float t_min = 0, t_max = 0;
+        for(int i=0; i<count; ++i)
+        {
+            float t = 0;
+            for(int c=0; c<N; ++c) t += (points[i][c]-mean[c]) * axis[c];
+            t_min = std::min(t_min, t);
+            t_max = std::max(t_max, t);
+        }
+        for(int c=0; c<4; ++c)
+        {
+            e0[c] = std::clamp(mean[c] + axis[c]*t_min, 0.0f, 255.0f);
+            e1[c] = std::clamp(mean[c] + axis[c]*t_max, 0.0f, 255.0f);
+        }
+    }
+
+    // Finds the endpoints which minimize the squared error of points reconstructed as e0*(1-w) + e1*w, returning false if the weights are degenerate
+    template<int N> bool solve_endpoints(const float (* points)[4], const float * weights, int count, float (& e0)[4], float (& e1)[4])
+    {
+        float aa=0, ab=0, bb=0, ax[4] {}, bx[4] {};
+        for(int i=0; i<count; ++i)
+        {
+            const float a = 1-weights[i], b = weights[i];
+            aa += a*a; ab += a*b; bb += b*b;
+            for(int c=0; c<N; ++c) { ax[c] += a*points[i][c]; bx[c] += b*points[i][c]; }
+        }
+        const float det = aa*bb - ab*ab;
+        if(std::abs(det) < 1e-6f) return false;
+        for(int c=0; c<N; ++c)
+        {
+            e0[c] = std::clamp((bb*ax[c] - ab*bx[c]) / det, 0.0f, 255.0f);
+            e1[c] = std::clamp((aa*bx[c] - ab*ax[c]) / det, 0.0f, 255.0f);
+        }
+        return true;
+    }
+
+    // Writes values of arbitrary width into a little-endian bit stream, which must initially be zeroed
+    struct bit_writer
+    {
+        uint8_t * bytes;
+        int position;
+        void write(uint32_t value, int bits) { for(int i=0; i<bits; ++i, ++position) if(value >> i & 1) bytes[position/8] |= 1 << position%8; }
+    };
+
+    ///////////////////////////////
+    // BC1 color (and BC3 color) //
+    ///////////////////////////////
+
+    uint16_t pack_565(const float (& c)[4])
+    {
+        auto quantize = [](float v, int max) { return static_cast<uint16_t>(std::clamp(static_cast<int>(v*max/255 + 0.5f), 0, max)); };
+        return quantize(c[0],31) << 11 | quantize(c[1],63) << 5 | quantize(c[2],31);
+    }
+    void unpack_565(uint16_t v, float (& c)[4])
+    {
+        const int r = v >> 11, g = v >> 5 & 63, b = v & 31;
+        c[0] = static_cast<float>(r << 3 | r >> 2);
+        c[1] = static_cast<float>(g << 2 | g >> 4);
+        c[2] = static_cast<float>(b << 3 | b >> 2);
+        c[3] = 0;
+    }
+
+    struct color_encoding { uint16_t c0, c1; uint8_t indices[16]; float error; };
+
+    // Chooses the nearest palette entry for every opaque pixel. In three color mode, transparent pixels use index 3.
+    color_encoding evaluate_bc1(const float (& pixels)[16][4], const bool (& transparent)[16], bool three_color, uint16_t c0, uint16_t c1)
+    {
+        color_encoding enc {c0, c1, {}, 0};
+        float palette[4][4];
+        unpack_565(c0, palette[0]);
+        unpack_565(c1, palette[1]);
+        for(int c=0; c<3; ++c)
+        {
+            palette[2][c] = three_color ? (palette[0][c] + palette[1][c])/2 : (palette[0][c]*2 + palette[1][c])/3;
+            palette[3][c] = three_color ? 0 : (palette[0][c] + palette[1][c]*2)/3;
+        }
+        const int entries = three_color ? 3 : 4;
+        for(int i=0; i<16; ++i)
+        {
+            if(transparent[i]) { enc.indices[i] = 3; continue; }
+            float best = distance2<3>(pixels[i], palette[0]);
+            for(int j=1; j<entries; ++j)
+            {
+                const float d = distance2<3>(pixels[i], palette[j]);
+                if(d < best) { best = d; enc.indices[i] = static_cast<uint8_t>(j); }
+            }
+            enc.error += best;
+        }
+        return enc;
+    }
+
+    void encode_bc1_color(const uint8_t (& block)[16][4], bool allow_transparency, uint8_t * out)
+    {
+        float pixels[16][4], opaque[16][4];
+        bool transparent[16];
+        int opaque_count = 0;
+        for(int i=0; i<16; ++i)
+        {
+            for(int c=0; c<4; ++c) pixels[i][c] = block[i][c];
+            transparent[i] = allow_transparency && block[i][3] < 128;
+            if(!transparent[i]) std::copy_n(pixels[i], 4, opaque[opaque_count++]);
+        }
+
+        // Blocks with transparent pixels must use three color mode, in which the endpoints are ordered c0 <= c1
+        const bool three_color = opaque_count < 16;
+        color_encoding best {0, 0, {3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3}, 0};
+        if(opaque_count > 0)
+        {
+            float e0[4], e1[4];
+            fit_endpoints<3>(opaque, opaque_count, e0, e1);
+            best = evaluate_bc1(pixels, transparent, three_color, pack_565(e1), pack_565(e0));
+
+            // Refine the endpoints by least squares, given the indices chosen so far
+            for(int iteration=0; iteration<2; ++iteration)
+            {
+                const float weights_4[4] {0, 1, 1.0f/3, 2.0f/3}, weights_3[3] {0, 1, 0.5f};
+                float weights[16];
+                for(int i=0, j=0; i<16; ++i) if(!transparent[i]) weights[j++] = (three_color ? weights_3 : weights_4)[best.indices[i]];
+                if(!solve_endpoints<3>(opaque, weights, opaque_count, e0, e1)) break;
+                const auto enc = evaluate_bc1(pixels, transparent, three_color, pack_565(e0), pack_565(e1));
+                if(enc.error >= best.error) break;
+                best = enc;
+            }
+        }
+
+        // Order the endpoints to select the intended mode, remapping indices to match
+        if(three_color ? best.c0 > best.c1 : best.c0 < best.c1)
+        {
+            std::swap(best.c0, best.c1);
+            for(auto & index : best.indices) index = three_color ? (index < 2 ? index ^ 1 : index) : index ^ 1;
+        }
+        if(!three_color && best.c0 == best.c1) std::fill_n(best.indices, 16, 0);
+
+        uint32_t indices = 0;
+        for(int i=0; i<16; ++i) indices |= best.indices[i] << i*2;
+        out[0] = best.c0 & 0xFF; out[1] = best.c0 >> 8;
+        out[2] = best.c1 & 0xFF; out[3] = best.c1 >> 8;
+        for(int i=0; i<4; ++i) out[4+i] = indices >> i*8 & 0xFF;
+    }
+
+    /////////////////////////////////
+    // BC4 channel (and BC3 alpha) //
+    /////////////////////////////////
+
+    struct channel_encoding { uint8_t a0, a1; uint8_t indices[16]; float error; };
+
+    channel_encoding evaluate_bc4(const uint8_t (& values)[16], uint8_t a0, uint8_t a1)
+    {
+        channel_encoding enc {a0, a1, {}, 0};
+        float palette[8] {float(a0), float(a1)};
+        if(a0 > a1) for(int i=2; i<8; ++i) palette[i] = ((8-i)*palette[0] + (i-1)*palette[1])/7;
+        else { for(int i=2; i<6; ++i) palette[i] = ((6-i)*palette[0] + (i-1)*palette[1])/5; palette[6] = 0; palette[7] = 255; }
+        for(int i=0; i<16; ++i)
+        {
+            float best = std::abs(values[i] - palette[0]);
+            for(int j=1; j<8; ++j)
+            {
+                const float d = std::abs(values[i] - palette[j]);
+                if(d < best) { best = d; enc.indices[i] = static_cast<uint8_t>(j); }
+            }
+            enc.error += best*best;
+        }
+        return enc;
+    }
+
+    // Tries both the eight value mode spanning the whole block, and the six value mode which represents 0 and 255 exactly
+    void encode_bc4(const uint8_t (& values)[16], uint8_t * out)
+    {
+        uint8_t lo = 255, hi = 0, inner_lo = 255, inner_hi = 0;
+        for(auto v : values)
+        {
+            lo = std::min(lo, v); hi = std::max(hi, v);
+            if(v != 0 && v != 255) { inner_lo = std::min(inner_lo, v); inner_hi = std::max(inner_hi, v); }
+        }
+        auto best = evaluate_bc4(values, hi, lo);
+        if(hi == lo) std::fill_n(best.indices, 16, 0);
+        else if(inner_lo <= inner_hi)
+        {
+            const auto enc = evaluate_bc4(values, inner_lo, inner_hi);
+            if(enc.error < best.error) best = enc;
+        }
+
+        uint64_t indices = 0;
+        for(int i=0; i<16; ++i) indices |= uint64_t(best.indices[i]) << i*3;
+        out[0] = best.a0; out[1] = best.a1;
+        for(int i=0; i<6; ++i) out[2+i] = indices >> i*8 & 0xFF;
+    }
+
+    ////////////////
+    // BC7 mode 6 //
+    ////////////////
+
+    const int bc7_weights[16] {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    struct bc7_encoding { int e0[4], e1[4], p0, p1; uint8_t indices[16]; float error; };
+
+    // Quantizes both endpoints to seven bits plus the given shared low bits, and chooses the nearest of the sixteen interpolated colors for each pixel
+    bc7_encoding evaluate_bc7(const float (& pixels)[16][4], const float (& e0)[4], const float (& e1)[4], int p0, int p1)
+    {
+        bc7_encoding enc {{}, {}, p0, p1, {}, 0};
+        float palette[16][4];
+        for(int c=0; c<4; ++c)
+        {
+            enc.e0[c] = std::clamp(static_cast<int>((e0[c]-p0)/2 + 0.5f), 0, 127);
+            enc.e1[c] = std::clamp(static_cast<int>((e1[c]-p1)/2 + 0.5f), 0, 127);
+            const int v0 = enc.e0[c]*2 + p0, v1 = enc.e1[c]*2 + p1;
+            for(int j=0; j<16; ++j) palette[j][c] = static_cast<float>(((64-bc7_weights[j])*v0 + bc7_weights[j]*v1 + 32) >> 6);
+        }
+
+        // Estimate each index by projecting onto the line between the endpoints, then settle on the best of its neighbors
+        float dir[4], dir2 = 0;
+        for(int c=0; c<4; ++c) { dir[c] = palette[15][c] - palette[0][c]; dir2 += dir[c]*dir[c]; }
+        for(int i=0; i<16; ++i)
+        {
+            float t = 0;
+            for(int c=0; c<4; ++c) t += (pixels[i][c] - palette[0][c]) * dir[c];
+            const int guess = dir2 > 0 ? std::clamp(static_cast<int>(t/dir2*15 + 0.5f), 0, 15) : 0;
+            float best = distance2<4>(pixels[i], palette[guess]);
+            enc.indices[i] = static_cast<uint8_t>(guess);
+            for(int j : {guess-1, guess+1})
+            {
+                if(j < 0 || j > 15) continue;
+                const float d = distance2<4>(pixels[i], palette[j]);
+                if(d < best) { best = d; enc.indices[i] = static_cast<uint8_t>(j); }
+            }
+            enc.error += best;
+        }
+        return enc;
+    }
+
+    bc7_encoding evaluate_bc7(const float (& pixels)[16][4], const float (& e0)[4], const float (& e1)[4])
+    {
+        auto best = evaluate_bc7(pixels, e0, e1, 0, 0);
+        for(auto [p0, p1] : {std::pair{0,1}, std::pair{1,0}, std::pair{1,1}})
+        {
+            const auto enc = evaluate_bc7(pixels, e0, e1, p0, p1);
+            if(enc.error < best.error) best = enc;
+        }
+        return best;
+    }
+
+    // Mode 6 stores a single pair of RGBA endpoints with four bit indices, which suits both opaque and translucent content
+    void encode_bc7(const uint8_t (& block)[16][4], uint8_t * out)
+    {
+        float pixels[16][4], e0[4], e1[4];
+        for(int i=0; i<16; ++i) for(int c=0; c<4; ++c) pixels[i][c] = block[i][c];
+        fit_endpoints<4>(pixels, 16, e0, e1);
+        auto best = evaluate_bc7(pixels, e0, e1);
+        for(int iteration=0; iteration<2; ++iteration)
+        {
+            float weights[16];
+            for(int i=0; i<16; ++i) weights[i] = bc7_weights[best.indices[i]] / 64.0f;
+            if(!solve_endpoints<4>(pixels, weights, 16, e0, e1)) break;
+            const auto enc = evaluate_bc7(pixels, e0, e1);
+            if(enc.error >= best.error) break;
+            best = enc;
+        }
+
+        // The high bit of the first index is implied to be zero, which can be arranged by swapping the endpoints
+        if(best.indices[0] >= 8)
+        {
+            std::swap(best.e0, best.e1);
+            std::swap(best.p0, best.p1);
+            for(auto & index : best.indices) index = 15 - index;
+        }
+
+        std::fill_n(out, 16, 0);
+        bit_writer writer {out, 0};
+        writer.write(1 << 6, 7);
+        for(int c=0; c<4; ++c) { writer.write(best.e0[c], 7); writer.write(best.e1[c], 7); }
+        writer.write(best.p0, 1);
+        writer.write(best.p1, 1);
+        writer.write(best.indices[0], 3);
+        for(int i=1; i<16; ++i) writer.write(best.indices[i], 4);
+    }
+}
+
+image compress_image(const image & im, VkFormat format)
+{
+    if(!is_rgba8(im.get_format())) throw std::logic_error("compress_image(...) requires an R8G8B8A8 image");
+    const int2 dims {im.get_width(), im.get_height()}, blocks {(dims.x+3)/4, (dims.y+3)/4};
+    const size_t block_size = compute_image_size({4,4}, format);
+
+    std::function<void(const uint8_t (&)[16][4], uint8_t *)> encode_block;
+    switch(format)
+    {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK: case VK_FORMAT_BC1_RGB_SRGB_BLOCK: encode_block = [](auto & block, uint8_t * out) { bc::encode_bc1_color(block, false, out); }; break;
+    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: encode_block = [](auto & block, uint8_t * out) { bc::encode_bc1_color(block, true, out); }; break;
+    case VK_FORMAT_BC3_UNORM_BLOCK: case VK_FORMAT_BC3_SRGB_BLOCK: encode_block = [](auto & block, uint8_t * out)
+    {
+        uint8_t alpha[16];
+        for(int i=0; i<16; ++i) alpha[i] = block[i][3];
+        bc::encode_bc4(alpha, out);
+        bc::encode_bc1_color(block, false, out+8);
+    }; break;
+    case VK_FORMAT_BC4_UNORM_BLOCK: case VK_FORMAT_BC5_UNORM_BLOCK: encode_block = [format](auto & block, uint8_t * out)
+    {
+        for(int c=0; c<(format == VK_FORMAT_BC5_UNORM_BLOCK ? 2 : 1); ++c)
+        {
+            uint8_t values[16];
+            for(int i=0; i<16; ++i) values[i] = block[i][c];
+            bc::encode_bc4(values, out+c*8);
+        }
+    }; break;
+    case VK_FORMAT_BC7_UNORM_BLOCK: case VK_FORMAT_BC7_SRGB_BLOCK: encode_block = bc::encode_bc7; break;
+    default: throw std::logic_error("unsupported format for compression");
+    }
+
+    image result {dims, format};
+    auto in = reinterpret_cast<const uint8_t *>(im.get_pixels());
+    auto out = reinterpret_cast<uint8_t *>(result.get_pixels());
+    parallel_for(blocks.y, [&](size_t by)
+    {
+        for(int bx=0; bx<blocks.x; ++bx)
+        {
+            // Blocks which overhang the edge of the image replicate its last row and column
+            uint8_t block[16][4];
+            for(int i=0; i<16; ++i)
+            {
+                const int x = std::min(bx*4 + i%4, dims.x-1), y = std::min(static_cast<int>(by)*4 + i/4, dims.y-1);
+                memcpy(block[i], in + (size_t(y)*dims.x + x)*4, 4);
+            }
+            encode_block(block, out + (by*blocks.x + bx)*block_size);
+        }
+    });
+    return result;
+}
+
+//////////////////
+// cook_texture //
+//////////////////
+
+static const size_t texture_level_alignment = 16;
+
+static texture_layout make_texture_layout(VkFormat format, int2 dims, uint32_t level_count, uint32_t layer_count, bool is_cube)
+{
+    texture_layout layout {format, layer_count, is_cube};
+    size_t offset = 0;
+    for(uint32_t i=0; i<level_count; ++i)
+    {
+        const size_t layer_size = compute_image_size(dims, format);
+        layout.levels.push_back({dims, offset, layer_size});
+        offset += (layer_size*layer_count + texture_level_alignment-1) / texture_level_alignment * texture_level_alignment;
+        dims = {std::max(dims.x/2,1), std::max(dims.y/2,1)};
+    }
+    return layout;
+}
+
+cooked_texture cook_texture(array_view<const image *> layers, VkFormat format, bool is_cube)
+{
+    if(layers.size == 0) throw std::logic_error("cook_texture(...) requires at least one layer");
+    const int2 dims {layers[0]->get_width(), layers[0]->get_height()};
+    for(auto * layer : layers)
+    {
+        if(!is_rgba8(layer->get_format())) throw std::logic_error("cook_texture(...) requires R8G8B8A8 layers");
+        if(layer->get_width() != dims.x || layer->get_height() != dims.y || layer->get_format() != layers[0]->get_format()) throw std::runtime_error("texture layers do not match");
+    }
+    if(is_cube && (layers.size != 6 || dims.x != dims.y)) throw std::runtime_error("bad texture for cubemap");
+
+    uint32_t level_count = 1;
+    for(int n = std::max<int>(dims.x, dims.y); n > 1; n /= 2) ++level_count;
+    cooked_texture texture {make_texture_layout(format, dims, level_count, narrow(layers.size), is_cube)};
+    texture.contents.resize(texture.layout.get_size());
+    for(size_t i=0; i<layers.size; ++i)
+    {
+        const auto mips = generate_mips(*layers[i]);
+        for(size_t j=0; j<level_count; ++j)
+        {
+            const image & level = j ? mips[j-1] : *layers[i];
+            const auto & info = texture.layout.levels[j];
+            if(is_rgba8(format)) memcpy(texture.contents.data() + info.offset + info.layer_size*i, level.get_pixels(), info.layer_size);
+            else memcpy(texture.contents.data() + info.offset + info.layer_size*i, compress_image(level, format).get_pixels(), info.layer_size);
+        }
+    }
+    return texture;
+}
+
+/////////
+// KTX //
+/////////
+
+struct ktx_header
+{
+    uint8_t identifier[12];
+    uint32_t endianness;
+    uint32_t gl_type, gl_type_size, gl_format, gl_internal_format, gl_base_internal_format;
+    uint32_t pixel_width, pixel_height, pixel_depth;
+    uint32_t number_of_array_elements, number_of_faces, number_of_mipmap_levels;
+    uint32_t bytes_of_key_value_data;
+};
+
+// The OpenGL enums which identify each format we can store
+struct ktx_format { VkFormat format; uint32_t gl_type, gl_format, gl_internal_format, gl_base_internal_format; };
+static const ktx_format ktx_formats[]
+{
+    {VK_FORMAT_R8G8B8A8_UNORM,       0x1401, 0x1908, 0x8058, 0x1908}, // GL_UNSIGNED_BYTE, GL_RGBA, GL_RGBA8
+    {VK_FORMAT_R8G8B8A8_SRGB,        0x1401, 0x1908, 0x8C43, 0x1908}, // GL_UNSIGNED_BYTE, GL_RGBA, GL_SRGB8_ALPHA8
+    {VK_FORMAT_BC1_RGB_UNORM_BLOCK,  0, 0, 0x83F0, 0x1907},           // GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    {VK_FORMAT_BC1_RGB_SRGB_BLOCK,   0, 0, 0x8C4C, 0x1907},           // GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+    {VK_FORMAT_BC1_RGBA_UNORM_BLOCK, 0, 0, 0x83F1, 0x1908},           // GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+    {VK_FORMAT_BC1_RGBA_SRGB_BLOCK,  0, 0, 0x8C4D, 0x1908},           // GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+    {VK_FORMAT_BC3_UNORM_BLOCK,      0, 0, 0x83F3, 0x1908},           // GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    {VK_FORMAT_BC3_SRGB_BLOCK,       0, 0, 0x8C4F, 0x1908},           // GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+    {VK_FORMAT_BC4_UNORM_BLOCK,      0, 0, 0x8DBB, 0x1903},           // GL_COMPRESSED_RED_RGTC1
+    {VK_FORMAT_BC5_UNORM_BLOCK,      0, 0, 0x8DBD, 0x8227},           // GL_COMPRESSED_RG_RGTC2
+    {VK_FORMAT_BC7_UNORM_BLOCK,      0, 0, 0x8E8C, 0x1908},           // GL_COMPRESSED_RGBA_BPTC_UNORM
+    {VK_FORMAT_BC7_SRGB_BLOCK,       0, 0, 0x8E8D, 0x1908},           // GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+};
+
+static const uint8_t ktx_identifier[12] {0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'};
+static const uint32_t ktx_endianness = 0x04030201;
+
+// Non-array cubemaps record the size of a single face for each level, everything else records the size of every layer
+static size_t get_ktx_image_size(const texture_layout & layout, const texture_level & level) { return level.layer_size * (layout.is_cube ? 1 : layout.layer_count); }
+
+void save_ktx(const char * filename, const cooked_texture & texture)
+{
+    const auto & layout = texture.layout;
+    auto it = std::find_if(std::begin(ktx_formats), std::end(ktx_formats), [&](const ktx_format & f) { return f.format == layout.format; });
+    if(it == std::end(ktx_formats) || layout.levels.empty()) throw std::logic_error("unsupported texture for KTX");
+    if(texture.contents.size() < layout.get_size()) throw std::logic_error("texture contents do not match layout");
+
+    ktx_header header {};
+    memcpy(header.identifier, ktx_identifier, sizeof(ktx_identifier));
+    header.endianness = ktx_endianness;
+    header.gl_type = it->gl_type;
+    header.gl_type_size = 1;
+    header.gl_format = it->gl_format;
+    header.gl_internal_format = it->gl_internal_format;
+    header.gl_base_internal_format = it->gl_base_internal_format;
+    header.pixel_width = layout.levels[0].dims.x;
+    header.pixel_height = layout.levels[0].dims.y;
+    header.number_of_array_elements = layout.is_cube || layout.layer_count == 1 ? 0 : layout.layer_count;
+    header.number_of_faces = layout.is_cube ? 6 : 1;
+    header.number_of_mipmap_levels = narrow(layout.levels.size());
+
+    // Every supported format has layers whose size is a multiple of four bytes, so no padding is ever required
+    std::vector<uint8_t> buffer(sizeof(header));
+    memcpy(buffer.data(), &header, sizeof(header));
+    for(auto & level : layout.levels)
+    {
+        const uint32_t image_size = narrow(get_ktx_image_size(layout, level));
+        buffer.insert(buffer.end(), reinterpret_cast<const uint8_t *>(&image_size), reinterpret_cast<const uint8_t *>(&image_size + 1));
+        buffer.insert(buffer.end(), texture.contents.begin() + level.offset, texture.contents.begin() + level.offset + level.layer_size*layout.layer_count);
+    }
+
+    save_binary_file(filename, buffer);
+}
+
+static texture_layout load_ktx(const char * filename, array_view<uint8_t> contents, const std::function<void * (const texture_layout & layout, size_t size)> & allocate_contents)
+{
+    const uint8_t * it = contents.begin(), * last = contents.end();
+    auto read = [&](void * data, size_t size)
+    {
+        if(static_cast<size_t>(last - it) < size) throw std::runtime_error(std::string("truncated KTX file: ") + filename);
+        memcpy(data, it, size);
+        it += size;
+    };
+
+    ktx_header header;
+    read(&header, sizeof(header));
+    if(memcmp(header.identifier, ktx_identifier, sizeof(ktx_identifier)) != 0) throw std::runtime_error(std::string("not a KTX file: ") + filename);
+    if(header.endianness != ktx_endianness) throw std::runtime_error(std::string("unsupported KTX endianness: ") + filename);
+    auto format = std::find_if(std::begin(ktx_formats), std::end(ktx_formats), [&](const ktx_format & f) { return f.gl_internal_format == header.gl_internal_format && f.gl_type == header.gl_type; });
+    if(format == std::end(ktx_formats)) throw std::runtime_error(std::string("unsupported KTX format: ") + filename);
+    if(header.pixel_depth > 1 || (header.number_of_faces != 1 && header.number_of_faces != 6) || (header.number_of_faces == 6 && header.number_of_array_elements != 0)) throw std::runtime_error(std::string("unsupported KTX texture type: ") + filename);
+    if(header.pixel_width == 0 || header.pixel_height == 0) throw std::runtime_error(std::string("unsupported KTX dimensions: ") + filename);
+    if(static_cast<size_t>(last - it) < header.bytes_of_key_value_data) throw std::runtime_error(std::string("truncated KTX file: ") + filename);
+    it += header.bytes_of_key_value_data;
+
+    const uint32_t layer_count = std::max(header.number_of_array_elements, 1u) * header.number_of_faces;
+    const auto layout = make_texture_layout(format->format, {narrow(header.pixel_width), narrow(header.pixel_height)}, std::max(header.number_of_mipmap_levels, 1u), layer_count, header.number_of_faces == 6);
+    auto data = reinterpret_cast<uint8_t *>(allocate_contents(layout, layout.get_size()));
+    for(auto & level : layout.levels)
+    {
+        uint32_t image_size;
+        read(&image_size, sizeof(image_size));
+        if(image_size != get_ktx_image_size(layout, level)) throw std::runtime_error(std::string("bad KTX image size: ") + filename);
+        read(data + level.offset, level.layer_size*layout.layer_count);
+    }
+    return layout;
+}
+
+texture_layout load_ktx(const char * filename, const std::function<void * (const texture_layout & layout, size_t size)> & allocate_contents)
+{
+    if(auto blob = find_mounted_blob(filename)) return load_ktx(filename, blob->contents, allocate_contents);
+    const mapped_file file {filename};
+    return load_ktx(filename, {reinterpret_cast<const uint8_t *>(file.begin()), file.get_size()}, allocate_contents);
+}
+
+cooked_texture load_ktx(const char * filename)
+{
+    cooked_texture texture;
+    texture.layout = load_ktx(filename, [&](const texture_layout &, size_t size)
+    {
+        texture.contents.resize(size);
+        return texture.contents.data();
+    });
+    return texture;
+}
@@ -0,0 +1,22 @@
+#ifndef TEXTURE_COOKER_H
+#define TEXTURE_COOKER_H
+
+#include "image-ops.h"
+
+// Builds every mip level below the given image by repeatedly downsampling it. The color channels of sRGB images are filtered in linear space.
+std::vector<image> generate_mips(const image & base, downsample_filter filter=downsample_filter::box);
+
+// Encodes an R8G8B8A8 image into one of the BC1, BC3, BC4, BC5 or BC7 formats, spreading the blocks across all available threads.
+// BC4 and BC5 store only the red and red/green channels respectively, and are intended for masks and normal maps.
+image compress_image(const image & im, VkFormat format);
+
+// Builds the full mip chain for each layer and encodes every level into the given format, which may also be the uncompressed format of the layers
+cooked_texture cook_texture(array_view<const image *> layers, VkFormat format, bool is_cube);
+
+// Cooked textures are stored as KTX 1.1 files, which may also be read from mounted packages
+void save_ktx(const char * filename, const cooked_texture & texture);
+cooked_texture load_ktx(const char * filename);
+// Reads every level directly into memory provided by the caller, which must hold at least size bytes
+texture_layout load_ktx(const char * filename, const std::function<void * (const texture_layout & layout, size_t size)> & allocate_contents);
+
+#endif
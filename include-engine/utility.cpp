@@ -12,4 +12,207 @@ void fail_fast()
     if(IsDebuggerPresent()) DebugBreak();
     std::cerr << "fail_fast() called." << std::endl;
     std::exit(EXIT_FAILURE);
-}
\ No newline at end of file
+}
+
+/////////////////
+// mapped_file //
+/////////////////
+
+#include <string>
+#include <stdexcept>
+
+#ifdef _WIN32
+mapped_file::mapped_file(const char * filename)
+{
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE) throw std::runtime_error(std::string("failed to open ") + filename);
+    LARGE_INTEGER file_size {};
+    if(!GetFileSizeEx(file, &file_size)) { CloseHandle(file); throw std::runtime_error(std::string("failed to query size of ") + filename); }
+    if(file_size.QuadPart == 0) { CloseHandle(file); return; } // Zero-length files cannot be mapped, but are trivially empty
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if(!mapping) throw std::runtime_error(std::string("failed to map ") + filename);
+    data = reinterpret_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    CloseHandle(mapping); // The view keeps the mapping alive
+    if(!data) throw std::runtime_error(std::string("failed to map ") + filename);
+    size = static_cast<size_t>(file_size.QuadPart);
+}
+
+mapped_file::~mapped_file()
+{
+    if(data) UnmapViewOfFile(data);
+}
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+mapped_file::mapped_file(const char * filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) throw std::runtime_error(std::string("failed to open ") + filename);
+    struct stat st {};
+    if(fstat(fd, &st) != 0) { close(fd); throw std::runtime_error(std::string("failed to query size of ") + filename); }
+    if(st.st_size == 0) { close(fd); return; } // Zero-length files cannot be mapped, but are trivially empty
+
+    void * p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file alive
+    if(p == MAP_FAILED) throw std::runtime_error(std::string("failed to map ") + filename);
+    madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    data = reinterpret_cast<const char *>(p);
+    size = static_cast<size_t>(st.st_size);
+}
+
+mapped_file::~mapped_file()
+{
+    if(data) munmap(const_cast<char *>(data), size);
+}
+#endif
+
+//////////////////
+// memory_arena //
+//////////////////
+
+void * memory_arena::allocate(size_t size, size_t alignment)
+{
+    // Allocations which would waste a significant portion of a block are given a dedicated block of their own
+    if(size + alignment > block_size/4)
+    {
+        blocks.push_back(std::unique_ptr<char[]>(new char[size + alignment]));
+        void * p = blocks.back().get();
+        size_t space = size + alignment;
+        return std::align(alignment, size, p, space);
+    }
+
+    // Otherwise carve the allocation out of the current block, starting a new one if necessary
+    void * p = next;
+    if(!p || !std::align(alignment, size, p, remaining))
+    {
+        blocks.push_back(std::unique_ptr<char[]>(new char[block_size]));
+        p = blocks.back().get();
+        remaining = block_size;
+        std::align(alignment, size, p, remaining);
+    }
+    next = reinterpret_cast<char *>(p) + size;
+    remaining -= size;
+    return p;
+}
+
+//////////////////
+// parallel_for //
+//////////////////
+
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+// A call to parallel_for(...), whose indices are claimed by the calling thread and by any pool workers which join it
+struct parallel_job
+{
+    const std::function<void(size_t)> & f;
+    const size_t count;
+    size_t helpers_wanted, helpers_joined {0}, helpers_active {0}; // Guarded by the pool's mutex
+    std::atomic<size_t> next {0};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    parallel_job(const std::function<void(size_t)> & f, size_t count, size_t helpers_wanted) : f{f}, count{count}, helpers_wanted{helpers_wanted} {}
+
+    void run()
+    {
+        for(size_t i=next++; i<count; i=next++)
+        {
+            try { f(i); }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lock {error_mutex};
+                if(!error) error = std::current_exception();
+                next = count;
+            }
+        }
+    }
+};
+
+// Calls made from a pool worker, or from within f on the thread that called parallel_for(...), run inline rather than waiting on the pool
+static thread_local bool is_in_parallel_for = false;
+
+// One worker per hardware thread besides the caller, started on first use and shared by every call to parallel_for(...)
+class parallel_pool
+{
+    std::mutex mutex;
+    std::condition_variable jobs_available, helpers_done;
+    std::deque<parallel_job *> jobs;
+    bool stopping {false};
+    std::vector<std::thread> workers;
+
+    void work()
+    {
+        is_in_parallel_for = true;
+        std::unique_lock<std::mutex> lock {mutex};
+        while(true)
+        {
+            jobs_available.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if(stopping) return;
+            parallel_job & job = *jobs.front();
+            if(++job.helpers_joined == job.helpers_wanted) jobs.pop_front();
+            ++job.helpers_active;
+            lock.unlock();
+            job.run();
+            lock.lock();
+            if(--job.helpers_active == 0) helpers_done.notify_all();
+        }
+    }
+public:
+    parallel_pool() { for(size_t i=1; i<std::thread::hardware_concurrency(); ++i) workers.emplace_back([this]() { work(); }); }
+    ~parallel_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock {mutex};
+            stopping = true;
+        }
+        jobs_available.notify_all();
+        for(auto & w : workers) w.join();
+    }
+
+    size_t get_worker_count() const { return workers.size(); }
+
+    void run(parallel_job & job)
+    {
+        {
+            std::lock_guard<std::mutex> lock {mutex};
+            jobs.push_back(&job);
+        }
+        if(job.helpers_wanted == 1) jobs_available.notify_one();
+        else jobs_available.notify_all();
+
+        is_in_parallel_for = true;
+        job.run();
+        is_in_parallel_for = false;
+
+        // Stop further workers from joining, then wait for those which did to finish their last index
+        std::unique_lock<std::mutex> lock {mutex};
+        auto it = std::find(jobs.begin(), jobs.end(), &job);
+        if(it != jobs.end()) jobs.erase(it);
+        helpers_done.wait(lock, [&job]() { return job.helpers_active == 0; });
+    }
+};
+
+void parallel_for(size_t count, const std::function<void(size_t)> & f)
+{
+    static parallel_pool pool;
+    const size_t helpers = std::min(pool.get_worker_count(), count ? count-1 : 0);
+    if(is_in_parallel_for || helpers == 0)
+    {
+        for(size_t i=0; i<count; ++i) f(i);
+        return;
+    }
+
+    parallel_job job {f, count, helpers};
+    pool.run(job);
+    if(job.error) std::rethrow_exception(job.error);
+}
@@ -1,6 +1,11 @@
 #ifndef UTILITY_H
 #define UTILITY_H
 
+#include <cstddef>      // For size_t
+#include <memory>       // For std::unique_ptr<T>
+#include <vector>       // For std::vector<T>
+#include <functional>   // For std::function<T>
+
 [[noreturn]] void fail_fast();
 
 template<class T> struct narrower
@@ -19,4 +24,42 @@ template<class T> narrower<T> narrow(const T & value)
     return {value}; 
 }
 
+// A read-only view of the contents of a file, mapped directly into the address space of this process
+class mapped_file
+{
+    const char * data {};
+    size_t size {};
+public:
+    mapped_file() {}
+    explicit mapped_file(const char * filename);
+    mapped_file(mapped_file && r) : data{r.data}, size{r.size} { r.data = nullptr; r.size = 0; }
+    mapped_file & operator = (mapped_file && r) { std::swap(data, r.data); std::swap(size, r.size); return *this; }
+    ~mapped_file();
+
+    const char * begin() const { return data; }
+    const char * end() const { return data + size; }
+    size_t get_size() const { return size; }
+};
+
+// Hands out memory from a small number of large blocks, all of which are released together when the arena is destroyed.
+// Destructors are never run for objects placed in the arena, so it should only be used for trivially destructible types.
+class memory_arena
+{
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char * next {};
+    size_t remaining {};
+    size_t block_size {1024*1024};
+public:
+    memory_arena() {}
+    explicit memory_arena(size_t block_size) : block_size{block_size} {}
+
+    void * allocate(size_t size, size_t alignment);
+    template<class T> T * allocate(size_t count) { return reinterpret_cast<T *>(allocate(sizeof(T)*count, alignof(T))); }
+};
+
+// Invokes f(i) for every i in [0,count), distributing the calls between the calling thread and a persistent pool of one worker per additional hardware
+// thread, shared by every caller. Nested calls, made from within f, run inline. If any call throws, the remaining calls are abandoned and the first
+// exception is rethrown on the calling thread.
+void parallel_for(size_t count, const std::function<void(size_t)> & f);
+
 #endif